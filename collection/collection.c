@@ -20,11 +20,14 @@
 */
 
 #include "config.h"
+#include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "trace.h"
 
 /* The collection should use the real structures */
@@ -38,6 +41,12 @@
 #define COLLECTION_ACTION_DEL        2
 #define COLLECTION_ACTION_UPDATE     3
 #define COLLECTION_ACTION_GET        4
+#define COLLECTION_ACTION_FIND_WRITE 5
+
+/* Actions that change the collection the item was found in */
+#define COL_WRITE_ACTION(a) (((a) == COLLECTION_ACTION_DEL) || \
+                             ((a) == COLLECTION_ACTION_UPDATE) || \
+                             ((a) == COLLECTION_ACTION_FIND_WRITE))
 
 
 /* Special internal error code to indicate that collection search was interrupted */
@@ -55,6 +64,28 @@
     #error "Platform cannot support 64-bit constant integers"
 #endif
 
+/* Add one character to the case insensitive hash.
+ * Only ASCII letters are folded and the other characters
+ * are mixed in the way toupper() returned them in the "C" locale,
+ * so the hash values do not change but no locale lookup
+ * is done per character.
+ */
+static inline uint64_t col_hash_char(uint64_t hash, char c)
+{
+    int folded = (unsigned char)c;
+    unsigned offset = (unsigned)(folded - 'a');
+
+    /* Clear the lower case bit of the letters without branching.
+     * The top bit is set only if the offset is between 0 and 25.
+     */
+    folded ^= ((~offset & (offset - 26)) >> 26) & 0x20;
+
+    /* Character that is equal to EOF is returned as is */
+    if (c == EOF) folded = EOF;
+
+    return (hash ^ folded) * FNV1a_prime;
+}
+
 /* Struct used for passing parameter for update operation */
 struct update_property {
         int type;
@@ -70,6 +101,8 @@ struct path_data {
     char *name;
     int length;
     struct path_data *previous_path;
+    struct collection_item *ref;
+    struct collection_item *owner;
 };
 
 /* Structure to keep data needed to
@@ -105,6 +138,16 @@ static int col_act_traverse_handler(struct collection_item *head,
                                     void *custom_data,
                                     int *stop);
 
+/* Action on the found item */
+struct find_name;
+static int col_act_on_item(struct collection_item *head,
+                           struct collection_item *previous,
+                           struct collection_item *current,
+                           struct find_name *traverse_data,
+                           col_item_fn user_item_handler,
+                           void *custom_data,
+                           int *stop);
+
 /* Traverse handler to find parent of the item */
 static int col_parent_traverse_handler(struct collection_item *head,
                                        struct collection_item *previous,
@@ -143,6 +186,24 @@ static int col_get_subcollection(const char *property,
 /* Function to destroy collection */
 void col_destroy_collection(struct collection_item *ci);
 
+/* Function to copy collection */
+static int col_copy_collection_int(struct collection_item **collection_copy,
+                                   struct collection_item *collection_to_copy,
+                                   const char *name_to_use,
+                                   int copy_mode,
+                                   col_copy_cb copy_cb,
+                                   void *ext_data,
+                                   struct col_arena *arena,
+                                   unsigned flags);
+
+/* Functions to copy shared sub collections before they change */
+static int col_unshare_path(struct path_data *path,
+                            struct collection_item **collection);
+static struct collection_item *col_find_same_item(struct collection_item *from,
+                                                  struct collection_item *to,
+                                                  struct collection_item *item);
+static int col_unshare_tree(struct collection_item *collection);
+
 /******************** SUPPLEMENTARY FUNCTIONS ****************************/
 /* BASIC OPERATIONS */
 
@@ -168,6 +229,30 @@ static int col_validate_property(const char *property)
 }
 
 
+/* Release the storage of the property name */
+static void col_free_property(struct collection_item *item)
+{
+    /* Arena memory is released only with the whole arena */
+    if (item->flags & COL_ITEM_INTERN_PROPERTY)
+        col_intern_release(item->property);
+    else if (!(item->flags & (COL_ITEM_ARENA_PROPERTY |
+                              COL_ITEM_INLINE_PROPERTY)))
+        free(item->property);
+    item->flags &= ~(COL_ITEM_ARENA_PROPERTY |
+                     COL_ITEM_INLINE_PROPERTY |
+                     COL_ITEM_INTERN_PROPERTY);
+    item->property = NULL;
+}
+
+/* Release the storage of the item data */
+static void col_free_data(struct collection_item *item)
+{
+    if (!(item->flags & (COL_ITEM_ARENA_DATA | COL_ITEM_INLINE_DATA)))
+        free(item->data);
+    item->flags &= ~(COL_ITEM_ARENA_DATA | COL_ITEM_INLINE_DATA);
+    item->data = NULL;
+}
+
 /* Function that cleans the item with callback */
 void col_delete_item_with_cb(struct collection_item *item,
                              col_item_cleanup_fn cb,
@@ -190,6 +275,12 @@ void col_delete_item_with_cb(struct collection_item *item,
         col_destroy_collection_with_cb(other_collection, cb, custom_data);
     }
 
+    /* Header owns the lookup index */
+    if ((item->type == COL_TYPE_COLLECTION) && (item->data != NULL)) {
+        col_index_free((struct collection_header *)item->data);
+        col_position_free((struct collection_header *)item->data);
+    }
+
     /* Call the callback */
     if (cb) cb(item->property,
                item->property_len,
@@ -201,10 +292,10 @@ void col_delete_item_with_cb(struct collection_item *item,
     TRACE_INFO_STRING("Deleting property:", item->property);
     TRACE_INFO_NUMBER("Type:", item->type);
 
-    if (item->property != NULL) free(item->property);
-    if (item->data != NULL) free(item->data);
+    col_free_property(item);
+    col_free_data(item);
 
-    free(item);
+    if (!(item->flags & COL_ITEM_ARENA)) free(item);
 
     TRACE_FLOW_STRING("col_delete_item","Exit.");
 }
@@ -221,11 +312,27 @@ void col_delete_item(struct collection_item *item)
 
 
 
-/* A generic function to allocate a property item */
-int col_allocate_item(struct collection_item **ci, const char *property,
-                      const void *item_data, int length, int type)
+/* A generic function to allocate a property item.
+ * If arena is not NULL the item is allocated from the arena.
+ * If intern is not 0 the item uses interned property name.
+ */
+static int col_allocate_item_int(struct collection_item **ci,
+                                 struct col_arena *arena,
+                                 int intern,
+                                 const char *property,
+                                 const void *item_data,
+                                 int length,
+                                 int type)
 {
     struct collection_item *item = NULL;
+    size_t item_size;
+    size_t property_size;
+    size_t inline_size;
+    unsigned flags;
+    char *block;
+    char *interned = NULL;
+    uint64_t phash = 0;
+    int property_len = 0;
 
     TRACE_FLOW_STRING("col_allocate_item", "Entry point.");
     TRACE_INFO_NUMBER("Will be using type:", type);
@@ -241,41 +348,126 @@ int col_allocate_item(struct collection_item **ci, const char *property,
         return EINVAL;
     }
 
-    /* Allocate memory for the structure */
-    item = (struct collection_item *)malloc(sizeof(struct collection_item));
-    if (item == NULL)  {
-        TRACE_ERROR_STRING("col_allocate_item", "Malloc failed.");
-        return ENOMEM;
+    /* Interned name is shared and already hashed */
+    if (intern) {
+        interned = col_intern_name(property, &phash, &property_len);
+        if (interned == NULL) {
+            TRACE_ERROR_STRING("col_allocate_item", "Failed to intern property.");
+            return ENOMEM;
+        }
+    }
+    else phash = col_make_hash(property, 0, &property_len);
+
+    /* Short property and data are stored inside the item */
+    property_size = property_len + 1;
+    inline_size = 0;
+    flags = interned ? COL_ITEM_INTERN_PROPERTY : 0;
+    if ((!interned) && (property_size <= COL_ITEM_INLINE_SIZE)) {
+        flags |= COL_ITEM_INLINE_PROPERTY;
+        inline_size = COL_ARENA_ALIGN(property_size);
     }
+    if (inline_size + length <= COL_ITEM_INLINE_SIZE)
+        flags |= COL_ITEM_INLINE_DATA;
+
+    if (arena) {
+        /* Item and the parts that do not fit into it are carved as one block */
+        item_size = COL_ARENA_ALIGN(sizeof(struct collection_item));
+        if (!(flags & (COL_ITEM_INLINE_PROPERTY | COL_ITEM_INTERN_PROPERTY))) {
+            flags |= COL_ITEM_ARENA_PROPERTY;
+            item_size += COL_ARENA_ALIGN(property_size);
+        }
+        if (!(flags & COL_ITEM_INLINE_DATA)) {
+            flags |= COL_ITEM_ARENA_DATA;
+            item_size += length;
+        }
 
-    /* After we initialize members we can use delete_item() in case of error */
-    item->next = NULL;
-    item->property = NULL;
-    item->data = NULL;
-    TRACE_INFO_NUMBER("About to set type to:", type);
-    item->type = type;
+        item = (struct collection_item *)col_arena_alloc(arena, item_size);
+        if (item == NULL)  {
+            TRACE_ERROR_STRING("col_allocate_item", "Arena allocation failed.");
+            if (interned) col_intern_release(interned);
+            return ENOMEM;
+        }
 
-    /* Copy property */
-    item->property = strdup(property);
-    if (item->property == NULL) {
-        TRACE_ERROR_STRING("col_allocate_item", "Failed to dup property.");
-        col_delete_item(item);
-        return ENOMEM;
+        item->next = NULL;
+        item->index_header = NULL;
+        item->flags = flags | COL_ITEM_ARENA;
+        TRACE_INFO_NUMBER("About to set type to:", type);
+        item->type = type;
+
+        block = (char *)item + COL_ARENA_ALIGN(sizeof(struct collection_item));
+        if (interned) item->property = interned;
+        else {
+            if (flags & COL_ITEM_INLINE_PROPERTY)
+                item->property = item->space.buf;
+            else {
+                item->property = block;
+                block += COL_ARENA_ALIGN(property_size);
+            }
+            memcpy(item->property, property, property_size);
+        }
+
+        if (flags & COL_ITEM_INLINE_DATA)
+            item->data = item->space.buf + inline_size;
+        else item->data = block;
+    }
+    else {
+        /* Allocate memory for the structure */
+        item = (struct collection_item *)malloc(sizeof(struct collection_item));
+        if (item == NULL)  {
+            TRACE_ERROR_STRING("col_allocate_item", "Malloc failed.");
+            if (interned) col_intern_release(interned);
+            return ENOMEM;
+        }
+
+        /* After we initialize members we can use delete_item() in case of error */
+        item->next = NULL;
+        item->index_header = NULL;
+        item->flags = 0;
+        item->property = NULL;
+        item->data = NULL;
+        TRACE_INFO_NUMBER("About to set type to:", type);
+        item->type = type;
+
+        /* Copy property */
+        if (interned) {
+            item->flags |= COL_ITEM_INTERN_PROPERTY;
+            item->property = interned;
+        }
+        else if (flags & COL_ITEM_INLINE_PROPERTY) {
+            item->flags |= COL_ITEM_INLINE_PROPERTY;
+            item->property = item->space.buf;
+            memcpy(item->property, property, property_size);
+        }
+        else {
+            item->property = strdup(property);
+            if (item->property == NULL) {
+                TRACE_ERROR_STRING("col_allocate_item", "Failed to dup property.");
+                col_delete_item(item);
+                return ENOMEM;
+            }
+        }
+
+        /* Deal with data */
+        if (flags & COL_ITEM_INLINE_DATA) {
+            item->flags |= COL_ITEM_INLINE_DATA;
+            item->data = item->space.buf + inline_size;
+        }
+        else {
+            item->data = malloc(length);
+            if (item->data == NULL) {
+                TRACE_ERROR_STRING("col_allocate_item", "Failed to dup data.");
+                col_delete_item(item);
+                return ENOMEM;
+            }
+        }
     }
 
-    item->phash = col_make_hash(property, 0, &(item->property_len));
+    item->phash = phash;
+    item->property_len = property_len;
     TRACE_INFO_NUMBER("Item hash", item->phash);
     TRACE_INFO_NUMBER("Item property length", item->property_len);
     TRACE_INFO_NUMBER("Item property strlen", strlen(item->property));
 
-    /* Deal with data */
-    item->data = malloc(length);
-    if (item->data == NULL) {
-        TRACE_ERROR_STRING("col_allocate_item", "Failed to dup data.");
-        col_delete_item(item);
-        return ENOMEM;
-    }
-
     memcpy(item->data, item_data, length);
     item->length = length;
 
@@ -291,10 +483,131 @@ int col_allocate_item(struct collection_item **ci, const char *property,
     return EOK;
 }
 
+/* Allocate a property item that does not belong to any arena */
+int col_allocate_item(struct collection_item **ci, const char *property,
+                      const void *item_data, int length, int type)
+{
+    return col_allocate_item_int(ci, NULL, 0, property, item_data, length, type);
+}
+
+/* Move item out of the arena.
+ * The parts of the item that are not in the arena are
+ * taken over by the detached item.
+ */
+static int col_detach_item(struct collection_item *item,
+                           struct collection_item **detached)
+{
+    struct collection_item *copy = NULL;
+
+    TRACE_FLOW_STRING("col_detach_item", "Entry point.");
+
+    if (!(item->flags & (COL_ITEM_ARENA |
+                         COL_ITEM_ARENA_PROPERTY |
+                         COL_ITEM_ARENA_DATA))) {
+        *detached = item;
+        TRACE_FLOW_STRING("col_detach_item", "Item is not in arena.");
+        return EOK;
+    }
+
+    copy = (struct collection_item *)malloc(sizeof(struct collection_item));
+    if (copy == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate item", ENOMEM);
+        return ENOMEM;
+    }
+
+    *copy = *item;
+    copy->next = NULL;
+    copy->index_header = NULL;
+    copy->flags = item->flags & (COL_ITEM_INLINE_PROPERTY |
+                                 COL_ITEM_INLINE_DATA |
+                                 COL_ITEM_INTERN_PROPERTY);
+
+    /* Inline parts are copied with the item */
+    if (item->flags & COL_ITEM_INLINE_PROPERTY)
+        copy->property = copy->space.buf + (item->property - item->space.buf);
+    if (item->flags & COL_ITEM_INLINE_DATA)
+        copy->data = copy->space.buf + ((char *)item->data - item->space.buf);
+
+    if (item->flags & COL_ITEM_ARENA_PROPERTY) {
+        copy->property = strdup(item->property);
+        if (copy->property == NULL) {
+            TRACE_ERROR_NUMBER("Failed to dup property", ENOMEM);
+            free(copy);
+            return ENOMEM;
+        }
+    }
+
+    if (item->flags & COL_ITEM_ARENA_DATA) {
+        copy->data = malloc(item->length);
+        if (copy->data == NULL) {
+            TRACE_ERROR_NUMBER("Failed to dup data", ENOMEM);
+            if (item->flags & COL_ITEM_ARENA_PROPERTY) free(copy->property);
+            free(copy);
+            return ENOMEM;
+        }
+        memcpy(copy->data, item->data, item->length);
+    }
+
+    *detached = copy;
+
+    TRACE_FLOW_STRING("col_detach_item", "Exit.");
+    return EOK;
+}
+
+/* Get the arena the items of the collection are allocated from */
+static struct col_arena *col_get_arena(struct collection_item *collection)
+{
+    if ((collection == NULL) || (collection->type != COL_TYPE_COLLECTION))
+        return NULL;
+
+    return ((struct collection_header *)collection->data)->arena;
+}
+
+/* Get the flags the collection was created with */
+static unsigned col_get_flags(struct collection_item *collection)
+{
+    if ((collection == NULL) || (collection->type != COL_TYPE_COLLECTION))
+        return 0;
+
+    return ((struct collection_header *)collection->data)->flags &
+           ~COL_HEADER_FROZEN;
+}
+
+/* Lock the thread-safe collection for reading or writing.
+ * Other collections are not locked.
+ */
+static int col_lock(struct collection_item *collection, int write)
+{
+    struct collection_header *header;
+
+    if ((collection == NULL) || (collection->type != COL_TYPE_COLLECTION))
+        return EOK;
+
+    header = (struct collection_header *)collection->data;
+
+    /* Frozen collection can't be changed */
+    if ((write) && (header->flags & COL_HEADER_FROZEN)) {
+        TRACE_ERROR_STRING("Collection is frozen", collection->property);
+        return EPERM;
+    }
+
+    return col_lock_acquire(header->lock, write);
+}
+
+/* Unlock the collection locked by col_lock() */
+static void col_unlock(struct collection_item *collection)
+{
+    if ((collection == NULL) || (collection->type != COL_TYPE_COLLECTION))
+        return;
+
+    col_lock_release(((struct collection_header *)collection->data)->lock);
+}
+
 /* Structure used to find things in collection */
 struct property_search {
     const char *property;
     uint64_t hash;
+    const void *fold;
     struct collection_item *parent;
     int index;
     int count;
@@ -303,6 +616,7 @@ struct property_search {
     int type;
     int interrupt;
     int exact;
+    unsigned scanned;
 };
 
 /* Find the parent of the item with given name */
@@ -320,6 +634,7 @@ static int col_find_property_sub(struct collection_item *collection,
     int i = 0;
     unsigned depth = 0;
     struct collection_item *sub = NULL;
+    struct col_index *index = NULL;
     int error = EOK;
 
     TRACE_FLOW_ENTRY();
@@ -336,14 +651,17 @@ static int col_find_property_sub(struct collection_item *collection,
     ps.type = type;
     ps.interrupt = interrupt;
     ps.exact = exact;
+    ps.scanned = 0;
 
     /* Create hash of the string to search */
     while(refprop[i] != 0) {
-        ps.hash = ps.hash ^ toupper(refprop[i]);
-        ps.hash *= FNV1a_prime;
+        ps.hash = col_hash_char(ps.hash, refprop[i]);
         i++;
     }
 
+    /* Interned names are compared by their class */
+    ps.fold = col_intern_class(refprop, ps.hash);
+
     /* Add item to collection */
     if (subcollection == NULL) {
         sub = collection;
@@ -371,12 +689,40 @@ static int col_find_property_sub(struct collection_item *collection,
 
     }
 
+    COL_STAT_ADD(sub, lookups, 1);
+
+    /* Use index if the collection is big enough.
+     * The walk starts with the header so if the header
+     * matches the walk has to be done the usual way.
+     */
+    index = col_index_get(sub);
+    if ((index) &&
+        ((ps.hash != sub->phash) ||
+         ((use_type) && (!(type & sub->type))) ||
+         (!col_intern_match(sub, refprop, ps.fold)))) {
+        if (col_index_find(index, ps.hash, refprop, ps.fold,
+                           use_type ? type : COL_TYPE_ANY, 0,
+                           parent) == NULL) {
+            COL_STAT_ADD(sub, hash_misses, 1);
+            TRACE_FLOW_STRING("col_find_property", "Exit - item NOT indexed");
+            return 0;
+        }
+        COL_STAT_ADD(sub, hash_hits, 1);
+        if (idx == 0) {
+            TRACE_FLOW_STRING("col_find_property", "Exit - item indexed");
+            return 1;
+        }
+        *parent = NULL;
+    }
+
     /* We do not care about error here */
     (void)col_walk_items(sub, COL_TRAVERSE_ONELEVEL,
                          col_parent_traverse_handler,
                          (void *)parent, NULL, (void *)&ps,
                          &depth);
 
+    COL_STAT_ADD(sub, items_scanned, ps.scanned);
+
     if (*parent) {
         /* Item is found in the collection */
         TRACE_FLOW_STRING("col_find_property", "Exit - item found");
@@ -417,13 +763,13 @@ static int col_find_property(struct collection_item *collection,
 
 
 /* Find a duplicate item */
-int col_get_dup_item(struct collection_item *ci,
-                     const char *subcollection,
-                     const char *property_to_find,
-                     int type,
-                     int idx,
-                     int exact,
-                     struct collection_item **item)
+static int col_get_dup_item_int(struct collection_item *ci,
+                                const char *subcollection,
+                                const char *property_to_find,
+                                int type,
+                                int idx,
+                                int exact,
+                                struct collection_item **item)
 {
     int error = EOK;
     struct collection_item *parent = NULL;
@@ -470,18 +816,65 @@ int col_get_dup_item(struct collection_item *ci,
     return error;
 }
 
+/* Find a duplicate item holding the lock */
+int col_get_dup_item(struct collection_item *ci,
+                     const char *subcollection,
+                     const char *property_to_find,
+                     int type,
+                     int idx,
+                     int exact,
+                     struct collection_item **item)
+{
+    int error;
+
+    error = col_lock(ci, 0);
+    if (error) return error;
+
+    error = col_get_dup_item_int(ci,
+                                 subcollection,
+                                 property_to_find,
+                                 type,
+                                 idx,
+                                 exact,
+                                 item);
+
+    col_unlock(ci);
+
+    return error;
+}
+
+/* Count the item added to the collection */
+static void col_stat_insert(struct collection_item *collection,
+                            struct collection_item *item)
+{
+    unsigned long bytes = sizeof(struct collection_item);
+
+    /* Header of the new collection is not counted */
+    if (collection == item) return;
+
+    if (!(item->flags & (COL_ITEM_INLINE_PROPERTY | COL_ITEM_INTERN_PROPERTY)))
+        bytes += item->property_len + 1;
+    if (!(item->flags & COL_ITEM_INLINE_DATA))
+        bytes += item->length;
+
+    COL_STAT_ADD(collection, inserts, 1);
+    COL_STAT_ADD(collection, bytes_allocated, bytes);
+}
+
 /* Insert item into the current collection */
-int col_insert_item_into_current(struct collection_item *collection,
-                                 struct collection_item *item,
-                                 int disposition,
-                                 const char *refprop,
-                                 int idx,
-                                 unsigned flags)
+static int col_insert_item_into_current_int(struct collection_item *collection,
+                                            struct collection_item *item,
+                                            int disposition,
+                                            const char *refprop,
+                                            int idx,
+                                            unsigned flags)
 {
     struct collection_header *header = NULL;
     struct collection_item *parent = NULL;
     struct collection_item *current = NULL;
+    struct collection_item *prev = NULL;
     int refindex = 0;
+    int position = -1;
 
     TRACE_FLOW_STRING("col_insert_item_into_current", "Entry point");
 
@@ -519,6 +912,9 @@ int col_insert_item_into_current(struct collection_item *collection,
 
     header = (struct collection_header *)collection->data;
 
+    if (flags != COL_INSERT_NOCHECK)
+        COL_STAT_ADD(collection, duplicate_checks, 1);
+
     /* Check flags first */
     switch(flags) {
     case COL_INSERT_NOCHECK:    /* No check - good just fall through */
@@ -527,10 +923,16 @@ int col_insert_item_into_current(struct collection_item *collection,
     case COL_INSERT_DUPOVER:    /* Find item and overwrite - ignore disposition */
                                 if (col_find_property(collection, item->property, 0, 0, 0, &parent)) {
                                     current = parent->next;
+                                    col_index_remove(collection, parent, current);
+                                    col_position_remove(collection, parent, current, -1);
                                     item->next = current->next;
                                     parent->next = item;
                                     if (header->last == current) header->last = item;
+                                    col_index_add(collection, parent, item);
+                                    col_position_add(collection, parent, item, -1);
                                     col_delete_item(current);
+                                    COL_STAT_ADD(collection, deletes, 1);
+                                    col_stat_insert(collection, item);
                                     /* Deleted one added another - count stays the same! */
                                     TRACE_FLOW_STRING("col_insert_item_into_current", "Dup overwrite exit");
                                     return EOK;
@@ -541,10 +943,16 @@ int col_insert_item_into_current(struct collection_item *collection,
     case COL_INSERT_DUPOVERT:   /* Find item by name and type and overwrite - ignore disposition */
                                 if (col_find_property(collection, item->property, 0, 1, item->type, &parent)) {
                                     current = parent->next;
+                                    col_index_remove(collection, parent, current);
+                                    col_position_remove(collection, parent, current, -1);
                                     item->next = current->next;
                                     parent->next = item;
                                     if (header->last == current) header->last = item;
+                                    col_index_add(collection, parent, item);
+                                    col_position_add(collection, parent, item, -1);
                                     col_delete_item(current);
+                                    COL_STAT_ADD(collection, deletes, 1);
+                                    col_stat_insert(collection, item);
                                     /* Deleted one added another - count stays the same! */
                                     TRACE_FLOW_STRING("col_insert_item_into_current", "Dup overwrite exit");
                                     return EOK;
@@ -569,9 +977,12 @@ int col_insert_item_into_current(struct collection_item *collection,
     case COL_INSERT_DUPMOVE:    /* Find item and delete */
                                 if (col_find_property(collection, item->property, 0, 0, 0, &parent)) {
                                     current = parent->next;
+                                    col_index_remove(collection, parent, current);
+                                    col_position_remove(collection, parent, current, -1);
                                     parent->next = current->next;
                                     if (header->last == current) header->last = parent;
                                     col_delete_item(current);
+                                    COL_STAT_ADD(collection, deletes, 1);
                                     header->count--;
                                 }
                                 /* Now add item according to the disposition */
@@ -583,9 +994,12 @@ int col_insert_item_into_current(struct collection_item *collection,
                                 if (col_find_property(collection, item->property, 0, 1, item->type, &parent)) {
                                     TRACE_INFO_LNUMBER("Current:", parent->next);
                                     current = parent->next;
+                                    col_index_remove(collection, parent, current);
+                                    col_position_remove(collection, parent, current, -1);
                                     parent->next = current->next;
                                     if (header->last == current) header->last = parent;
                                     col_delete_item(current);
+                                    COL_STAT_ADD(collection, deletes, 1);
                                     header->count--;
                                 }
                                 /* Now add item according to the disposition */
@@ -599,13 +1013,17 @@ int col_insert_item_into_current(struct collection_item *collection,
 
     switch (disposition) {
     case COL_DSP_END:       /* Link new item to the last item in the list if there any */
-                            if (header->count != 0) header->last->next = item;
+                            if (header->count != 0) {
+                                prev = header->last;
+                                header->last->next = item;
+                            }
                             /* Make sure we save a new last element */
                             header->last = item;
                             header->count++;
                             break;
 
     case COL_DSP_FRONT:     /* Same as above if there is header only */
+                            prev = collection;
                             if (header->count == 1) {
                                 header->last->next = item;
                                 header->last = item;
@@ -627,6 +1045,7 @@ int col_insert_item_into_current(struct collection_item *collection,
                             if (col_find_property(collection, refprop, 0, 0, 0, &parent)) {
                                 item->next = parent->next;
                                 parent->next = item;
+                                prev = parent;
                                 header->count++;
                             }
                             else {
@@ -644,6 +1063,7 @@ int col_insert_item_into_current(struct collection_item *collection,
                             /* We need to find property */
                             if (col_find_property(collection, refprop, 0, 0, 0, &parent)) {
                                 parent = parent->next;
+                                prev = parent;
                                 if (parent->next) {
                                     /* It is not the last item */
                                     item->next = parent->next;
@@ -664,6 +1084,7 @@ int col_insert_item_into_current(struct collection_item *collection,
 
     case COL_DSP_INDEX:     if(idx == 0) {
                                 /* Same is first */
+                                prev = collection;
                                 if (header->count == 1) {
                                     header->last->next = item;
                                     header->last = item;
@@ -675,20 +1096,26 @@ int col_insert_item_into_current(struct collection_item *collection,
                             }
                             else if(idx >= header->count - 1) {
                                 /* In this case add to the end */
+                                prev = header->last;
                                 header->last->next = item;
                                 /* Make sure we save a new last element */
                                 header->last = item;
                             }
                             else {
                                 /* In the middle */
-                                parent = collection;
-                                /* Move to the right position counting */
-                                while (idx > 0) {
-                                    idx--;
-                                    if (parent->next) parent = parent->next;
+                                position = idx;
+                                parent = col_position_prev(collection, idx);
+                                if (parent == NULL) {
+                                    parent = collection;
+                                    /* Move to the right position counting */
+                                    while (idx > 0) {
+                                        idx--;
+                                        if (parent->next) parent = parent->next;
+                                    }
                                 }
                                 item->next = parent->next;
                                 parent->next = item;
+                                prev = parent;
                             }
                             header->count++;
                             break;
@@ -717,6 +1144,7 @@ int col_insert_item_into_current(struct collection_item *collection,
                                                       &parent)) {
                                 item->next = parent->next;
                                 parent->next = item;
+                                prev = parent;
                                 header->count++;
                                 if(header->last == parent) header->last = item;
                             }
@@ -732,6 +1160,13 @@ int col_insert_item_into_current(struct collection_item *collection,
 
     }
 
+    /* Keep the lookup index in sync */
+    if (prev) {
+        col_index_add(collection, prev, item);
+        col_position_add(collection, prev, item, position);
+    }
+
+    col_stat_insert(collection, item);
 
     TRACE_INFO_STRING("Collection:", collection->property);
     TRACE_INFO_STRING("Just added item is:", item->property);
@@ -742,20 +1177,49 @@ int col_insert_item_into_current(struct collection_item *collection,
     return EOK;
 }
 
+/* Insert item into the current collection holding the lock */
+int col_insert_item_into_current(struct collection_item *collection,
+                                 struct collection_item *item,
+                                 int disposition,
+                                 const char *refprop,
+                                 int idx,
+                                 unsigned flags)
+{
+    int error;
+
+    error = col_lock(collection, 1);
+    if (error) return error;
+
+    error = col_insert_item_into_current_int(collection,
+                                             item,
+                                             disposition,
+                                             refprop,
+                                             idx,
+                                             flags);
+
+    col_unlock(collection);
+
+    return error;
+}
+
 /* Extract item from the current collection */
-int col_extract_item_from_current(struct collection_item *collection,
-                                  int disposition,
-                                  const char *refprop,
-                                  int idx,
-                                  int type,
-                                  struct collection_item **ret_ref)
+static int col_extract_item_from_current_int(struct collection_item *collection,
+                                             int disposition,
+                                             const char *refprop,
+                                             int idx,
+                                             int type,
+                                             struct collection_item **ret_ref)
 {
     struct collection_header *header = NULL;
     struct collection_item *parent = NULL;
     struct collection_item *current = NULL;
     struct collection_item *found = NULL;
+    struct collection_item *prev = NULL;
+    struct collection_item *detached = NULL;
     int refindex = 0;
     int use_type = 0;
+    int position = -1;
+    int error = EOK;
 
     TRACE_FLOW_STRING("col_extract_item_from_current", "Entry point");
 
@@ -777,20 +1241,26 @@ int col_extract_item_from_current(struct collection_item *collection,
 
     switch (disposition) {
     case COL_DSP_END:       /* Extract last item in the list. */
-                            parent = collection;
-                            current = collection->next;
-                            while (current->next != NULL) {
-                                parent = current;
-                                current = current->next;
+                            parent = col_position_prev(collection,
+                                                       header->count - 2);
+                            if (parent == NULL) {
+                                parent = collection;
+                                current = collection->next;
+                                while (current->next != NULL) {
+                                    parent = current;
+                                    current = current->next;
+                                }
                             }
                             *ret_ref = parent->next;
                             parent->next = NULL;
+                            prev = parent;
                             /* Special case - one data element */
                             if (header->count == 2) header->last = collection;
                             else header->last = parent;
                             break;
 
     case COL_DSP_FRONT:     /* Extract first item in the list */
+                            prev = collection;
                             *ret_ref = collection->next;
                             collection->next = (*ret_ref)->next;
                             /* Special case - one data element */
@@ -821,6 +1291,7 @@ int col_extract_item_from_current(struct collection_item *collection,
                                 }
                                 *ret_ref = current;
                                 parent->next = current->next;
+                                prev = parent;
 
                             }
                             else {
@@ -841,6 +1312,7 @@ int col_extract_item_from_current(struct collection_item *collection,
                                 if (current->next) {
                                     *ret_ref = current->next;
                                     current->next = (*ret_ref)->next;
+                                    prev = current;
                                     /* If we removed the last element adjust header */
                                     if(current->next == NULL) header->last = current;
                                 }
@@ -856,6 +1328,7 @@ int col_extract_item_from_current(struct collection_item *collection,
                             break;
 
     case COL_DSP_INDEX:     if (idx == 0) {
+                                prev = collection;
                                 *ret_ref = collection->next;
                                 collection->next = (*ret_ref)->next;
                                 /* Special case - one data element */
@@ -869,17 +1342,22 @@ int col_extract_item_from_current(struct collection_item *collection,
                                 return ENOENT;
                             }
                             else {
-                                /* Loop till the element with right index */
-                                refindex = 0;
-                                parent = collection;
-                                current = collection->next;
-                                while (refindex < idx) {
-                                    parent = current;
-                                    current = current->next;
-                                    refindex++;
+                                position = idx;
+                                parent = col_position_prev(collection, idx);
+                                if (parent == NULL) {
+                                    /* Loop till the element with right index */
+                                    refindex = 0;
+                                    parent = collection;
+                                    current = collection->next;
+                                    while (refindex < idx) {
+                                        parent = current;
+                                        current = current->next;
+                                        refindex++;
+                                    }
                                 }
                                 *ret_ref = parent->next;
                                 parent->next = (*ret_ref)->next;
+                                prev = parent;
                                 /* If we removed the last element adjust header */
                                 if (parent->next == NULL) header->last = parent;
                             }
@@ -909,6 +1387,7 @@ int col_extract_item_from_current(struct collection_item *collection,
                                                       &parent)) {
                                 *ret_ref = parent->next;
                                 parent->next = (*ret_ref)->next;
+                                prev = parent;
                                 /* If we removed the last element adjust header */
                                 if(parent->next == NULL) header->last = parent;
                             }
@@ -924,10 +1403,31 @@ int col_extract_item_from_current(struct collection_item *collection,
 
     }
 
+    /* Extracted item belongs to the caller and can outlive
+     * the arena of the collection so it is moved to the heap.
+     */
+    error = col_detach_item(*ret_ref, &detached);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to detach item", error);
+        /* Put the item back */
+        (*ret_ref)->next = prev->next;
+        prev->next = *ret_ref;
+        if ((*ret_ref)->next == NULL) header->last = *ret_ref;
+        *ret_ref = NULL;
+        return error;
+    }
+
+    /* Keep the lookup index in sync */
+    col_index_remove(collection, prev, *ret_ref);
+    col_position_remove(collection, prev, *ret_ref, position);
 
     /* Clear item and reduce count */
     (*ret_ref)->next = NULL;
     header->count--;
+    COL_STAT_ADD(collection, deletes, 1);
+
+    /* The memory of the item in the arena is just abandoned */
+    *ret_ref = detached;
 
     TRACE_INFO_STRING("Collection:", (*ret_ref)->property);
     TRACE_INFO_NUMBER("Item type.", (*ret_ref)->type);
@@ -937,14 +1437,39 @@ int col_extract_item_from_current(struct collection_item *collection,
     return EOK;
 }
 
+/* Extract item from the current collection holding the lock */
+int col_extract_item_from_current(struct collection_item *collection,
+                                  int disposition,
+                                  const char *refprop,
+                                  int idx,
+                                  int type,
+                                  struct collection_item **ret_ref)
+{
+    int error;
+
+    error = col_lock(collection, 1);
+    if (error) return error;
+
+    error = col_extract_item_from_current_int(collection,
+                                              disposition,
+                                              refprop,
+                                              idx,
+                                              type,
+                                              ret_ref);
+
+    col_unlock(collection);
+
+    return error;
+}
+
 /* Extract item from the collection */
-int col_extract_item(struct collection_item *collection,
-                     const char *subcollection,
-                     int disposition,
-                     const char *refprop,
-                     int idx,
-                     int type,
-                     struct collection_item **ret_ref)
+static int col_extract_item_int(struct collection_item *collection,
+                                const char *subcollection,
+                                int disposition,
+                                const char *refprop,
+                                int idx,
+                                int type,
+                                struct collection_item **ret_ref)
 {
     struct collection_item *col = NULL;
     int error = EOK;
@@ -967,7 +1492,7 @@ int col_extract_item(struct collection_item *collection,
                                      COL_TYPE_COLLECTIONREF,
                                      COL_TRAVERSE_DEFAULT,
                                      col_get_subcollection, (void *)(&col),
-                                     COLLECTION_ACTION_FIND);
+                                     COLLECTION_ACTION_FIND_WRITE);
         if (error) {
             TRACE_ERROR_NUMBER("Search for subcollection returned error:", error);
             return error;
@@ -996,6 +1521,33 @@ int col_extract_item(struct collection_item *collection,
     return EOK;
 }
 
+/* Extract item from the collection holding the lock */
+int col_extract_item(struct collection_item *collection,
+                     const char *subcollection,
+                     int disposition,
+                     const char *refprop,
+                     int idx,
+                     int type,
+                     struct collection_item **ret_ref)
+{
+    int error;
+
+    error = col_lock(collection, 1);
+    if (error) return error;
+
+    error = col_extract_item_int(collection,
+                                 subcollection,
+                                 disposition,
+                                 refprop,
+                                 idx,
+                                 type,
+                                 ret_ref);
+
+    col_unlock(collection);
+
+    return error;
+}
+
 
 /* Remove item (property) from collection with callback.*/
 int col_remove_item_with_cb(struct collection_item *ci,
@@ -1076,54 +1628,72 @@ int col_remove_item_from_current(struct collection_item *ci,
 
 
 /* Insert the item into the collection or subcollection */
-int col_insert_item(struct collection_item *collection,
-                    const char *subcollection,
-                    struct collection_item *item,
-                    int disposition,
-                    const char *refprop,
-                    int idx,
-                    unsigned flags)
+/* Find the collection the item should be added to */
+static int col_get_acceptor(struct collection_item *collection,
+                            const char *subcollection,
+                            struct collection_item **acceptor)
 {
     int error;
-    struct collection_item *acceptor = NULL;
-
-    TRACE_FLOW_STRING("col_insert_item", "Entry point.");
 
-    /* Do best effort on the item */
-    if ((!item) || (item->next)) {
-        TRACE_ERROR_STRING("Passed in item is invalid", "");
-        return EINVAL;
-    }
+    TRACE_FLOW_STRING("col_get_acceptor", "Entry point.");
 
-    /* Check that collection is not empty */
-    if ((collection == NULL) && (item->type != COL_TYPE_COLLECTION)) {
-        TRACE_ERROR_STRING("Collection can't be NULL", "");
-        return EINVAL;
-    }
+    *acceptor = NULL;
 
-    /* Add item to collection */
     if (subcollection == NULL) {
-        acceptor = collection;
+        *acceptor = collection;
     }
     else {
         TRACE_INFO_STRING("Subcollection id not null, searching", subcollection);
         error = col_find_item_and_do(collection, subcollection,
                                      COL_TYPE_COLLECTIONREF,
                                      COL_TRAVERSE_DEFAULT,
-                                     col_get_subcollection, (void *)(&acceptor),
-                                     COLLECTION_ACTION_FIND);
+                                     col_get_subcollection, (void *)acceptor,
+                                     COLLECTION_ACTION_FIND_WRITE);
         if (error) {
             TRACE_ERROR_NUMBER("Search for subcollection returned error:", error);
             return error;
         }
 
-        if (acceptor == NULL) {
+        if (*acceptor == NULL) {
             TRACE_ERROR_STRING("Search for subcollection returned NULL pointer", "");
             return ENOENT;
         }
 
     }
 
+    TRACE_FLOW_STRING("col_get_acceptor", "Exit");
+    return EOK;
+}
+
+static int col_insert_item_int(struct collection_item *collection,
+                               const char *subcollection,
+                               struct collection_item *item,
+                               int disposition,
+                               const char *refprop,
+                               int idx,
+                               unsigned flags)
+{
+    int error;
+    struct collection_item *acceptor = NULL;
+
+    TRACE_FLOW_STRING("col_insert_item", "Entry point.");
+
+    /* Do best effort on the item */
+    if ((!item) || (item->next)) {
+        TRACE_ERROR_STRING("Passed in item is invalid", "");
+        return EINVAL;
+    }
+
+    /* Check that collection is not empty */
+    if ((collection == NULL) && (item->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_STRING("Collection can't be NULL", "");
+        return EINVAL;
+    }
+
+    /* Add item to collection */
+    error = col_get_acceptor(collection, subcollection, &acceptor);
+    if (error) return error;
+
     /* Instert item to the current collection */
     error = col_insert_item_into_current(acceptor,
                                          item,
@@ -1141,6 +1711,33 @@ int col_insert_item(struct collection_item *collection,
     return EOK;
 }
 
+/* Insert item into the collection holding the lock */
+int col_insert_item(struct collection_item *collection,
+                    const char *subcollection,
+                    struct collection_item *item,
+                    int disposition,
+                    const char *refprop,
+                    int idx,
+                    unsigned flags)
+{
+    int error;
+
+    error = col_lock(collection, 1);
+    if (error) return error;
+
+    error = col_insert_item_int(collection,
+                                subcollection,
+                                item,
+                                disposition,
+                                refprop,
+                                idx,
+                                flags);
+
+    col_unlock(collection);
+
+    return error;
+}
+
 
 /* Insert property with reference.
  * This is internal function so we do not check parameters.
@@ -1159,20 +1756,39 @@ static int col_insert_property_with_ref_int(struct collection_item *collection,
                                             struct collection_item **ret_ref)
 {
     struct collection_item *item = NULL;
+    struct collection_item *acceptor = NULL;
+    struct col_arena *arena = NULL;
+    int intern = 0;
     int error;
 
     TRACE_FLOW_STRING("col_insert_property_with_ref_int", "Entry point.");
 
+    /* The item is allocated from the arena of the collection
+     * it goes to. The header of a new collection is allocated
+     * from the arena of this collection.
+     */
+    if (collection == NULL) {
+        if (type == COL_TYPE_COLLECTION)
+            arena = ((const struct collection_header *)data)->arena;
+    }
+    else {
+        error = col_get_acceptor(collection, subcollection, &acceptor);
+        if (error) return error;
+        arena = col_get_arena(acceptor);
+        intern = col_get_flags(acceptor) & COL_CREATE_INTERN;
+    }
+
     /* Create a new property out of the given parameters */
-    error = col_allocate_item(&item, property, data, length, type);
+    error = col_allocate_item_int(&item, arena, intern,
+                                  property, data, length, type);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to allocate item", error);
         return error;
     }
 
     /* Send the property to the insert_item function */
-    error = col_insert_item(collection,
-                            subcollection,
+    error = col_insert_item(acceptor,
+                            NULL,
                             item,
                             disposition,
                             refprop,
@@ -1208,7 +1824,9 @@ static int col_copy_item_with_cb(struct collection_item *collection,
     TRACE_FLOW_STRING("col_copy_item_with_cb", "Entry point.");
 
     /* Create a new property out of the given parameters */
-    error = col_allocate_item(&item, property, data, length, type);
+    error = col_allocate_item_int(&item, col_get_arena(collection),
+                                  col_get_flags(collection) & COL_CREATE_INTERN,
+                                  property, data, length, type);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to allocate item", error);
         return error;
@@ -1273,6 +1891,9 @@ int col_insert_property_with_ref(struct collection_item *collection,
         return EINVAL;
     }
 
+    error = col_lock(collection, 1);
+    if (error) return error;
+
     error = col_insert_property_with_ref_int(collection,
                                              subcollection,
                                              disposition,
@@ -1285,9 +1906,325 @@ int col_insert_property_with_ref(struct collection_item *collection,
                                              length,
                                              ret_ref);
 
+    col_unlock(collection);
+
     TRACE_FLOW_NUMBER("col_insert_property_with_ref_int Returning:", error);
     return error;
 }
+
+/* Find the slot of the batch table that holds the item
+ * with the same name (and type) or the empty slot.
+ * Slots hold the position of the item in the batch plus one.
+ */
+static unsigned *col_batch_slot(unsigned *slots,
+                                unsigned size,
+                                struct collection_item **run,
+                                struct collection_item *item,
+                                int use_type)
+{
+    struct collection_item *other;
+    unsigned i;
+
+    i = item->phash & (size - 1);
+    while (slots[i]) {
+        other = run[slots[i] - 1];
+        if ((other->phash == item->phash) &&
+            (other->property_len == item->property_len) &&
+            ((!use_type) || (other->type == item->type)) &&
+            (strncasecmp(other->property, item->property,
+                         item->property_len) == 0)) break;
+        i = (i + 1) & (size - 1);
+    }
+
+    return &(slots[i]);
+}
+
+/* Insert the batch of properties into the current collection.
+ * Duplicates are resolved first: the batch is checked against
+ * itself using a table and against the collection using its index.
+ * The rest of the batch is then linked in one run.
+ */
+static int col_insert_batch_int(struct collection_item *collection,
+                                int disposition,
+                                const char *refprop,
+                                int idx,
+                                unsigned flags,
+                                const struct col_batch_property *batch,
+                                unsigned count)
+{
+    struct collection_header *header;
+    struct collection_item **run;
+    struct collection_item *item;
+    struct collection_item *current;
+    struct collection_item *parent = NULL;
+    struct collection_item *anchor = NULL;
+    struct collection_item *first = NULL;
+    struct collection_item *last = NULL;
+    struct collection_item *prev;
+    struct col_arena *arena;
+    unsigned *slots = NULL;
+    unsigned *slot;
+    unsigned size = 0;
+    unsigned linked = 0;
+    unsigned i;
+    int intern;
+    int use_type = 0;
+    int position = -1;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+
+    switch (flags) {
+    case COL_INSERT_NOCHECK:
+    case COL_INSERT_DUPOVER:
+    case COL_INSERT_DUPERROR:
+    case COL_INSERT_DUPMOVE:    break;
+    case COL_INSERT_DUPOVERT:
+    case COL_INSERT_DUPERRORT:
+    case COL_INSERT_DUPMOVET:   use_type = 1;
+                                break;
+    default:                    TRACE_ERROR_NUMBER("Flag is not implemented", ENOSYS);
+                                return ENOSYS;
+    }
+
+    /* The position is found before the collection changes */
+    switch (disposition) {
+    case COL_DSP_END:
+    case COL_DSP_INDEX:     break;
+    case COL_DSP_FRONT:     anchor = collection;
+                            break;
+    case COL_DSP_BEFORE:
+    case COL_DSP_AFTER:     if (!refprop) {
+                                TRACE_ERROR_STRING("In this case property is required", "");
+                                return EINVAL;
+                            }
+                            if (!col_find_property(collection, refprop, 0, 0, 0, &parent)) {
+                                TRACE_ERROR_STRING("Property not found", refprop);
+                                return ENOENT;
+                            }
+                            anchor = (disposition == COL_DSP_BEFORE) ? parent : parent->next;
+                            break;
+    default:                TRACE_ERROR_STRING("Disposition is not supported", "");
+                            return ENOSYS;
+    }
+
+    if (flags != COL_INSERT_NOCHECK) {
+        size = 2;
+        while (size < count * 2) size <<= 1;
+    }
+
+    /* Batch and the table are allocated as one block */
+    run = (struct collection_item **)calloc(1, count * sizeof(struct collection_item *) +
+                                               size * sizeof(unsigned));
+    if (run == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate batch", ENOMEM);
+        return ENOMEM;
+    }
+    if (size) slots = (unsigned *)(run + count);
+
+    arena = col_get_arena(collection);
+    intern = col_get_flags(collection) & COL_CREATE_INTERN;
+
+    for (i = 0; i < count; i++) {
+        if (batch[i].property == NULL) {
+            TRACE_ERROR_NUMBER("Property name is NULL", EINVAL);
+            error = EINVAL;
+            break;
+        }
+        error = col_allocate_item_int(&(run[i]), arena, intern,
+                                      batch[i].property, batch[i].data,
+                                      batch[i].length, batch[i].type);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to allocate item", error);
+            break;
+        }
+    }
+
+    if ((!error) && (flags != COL_INSERT_NOCHECK))
+        COL_STAT_ADD(collection, duplicate_checks, count);
+
+    /* Duplicates that are errors are found before anything changes */
+    if ((flags == COL_INSERT_DUPERROR) || (flags == COL_INSERT_DUPERRORT)) {
+        for (i = 0; (i < count) && (!error); i++) {
+            slot = col_batch_slot(slots, size, run, run[i], use_type);
+            if ((*slot) ||
+                (col_find_property(collection, run[i]->property, 0,
+                                   use_type, run[i]->type, &parent))) {
+                TRACE_ERROR_STRING("Duplicate property", run[i]->property);
+                error = EEXIST;
+            }
+            else *slot = i + 1;
+        }
+    }
+
+    if (error) {
+        for (i = 0; i < count; i++) col_delete_item(run[i]);
+        free(run);
+        return error;
+    }
+
+    /* Other duplicates replace or move the items */
+    if ((flags != COL_INSERT_NOCHECK) &&
+        (flags != COL_INSERT_DUPERROR) && (flags != COL_INSERT_DUPERRORT)) {
+        for (i = 0; i < count; i++) {
+            item = run[i];
+            slot = col_batch_slot(slots, size, run, item, use_type);
+
+            if (*slot) {
+                /* Same property appeared earlier in the batch */
+                current = run[*slot - 1];
+                if ((flags == COL_INSERT_DUPOVER) || (flags == COL_INSERT_DUPOVERT)) {
+                    run[*slot - 1] = item;
+                    run[i] = NULL;
+                }
+                else {
+                    run[*slot - 1] = NULL;
+                    *slot = i + 1;
+                }
+                col_delete_item(current);
+                continue;
+            }
+
+            if (col_find_property(collection, item->property, 0,
+                                  use_type, item->type, &parent)) {
+                current = parent->next;
+                col_index_remove(collection, parent, current);
+                col_position_remove(collection, parent, current, -1);
+                if ((flags == COL_INSERT_DUPOVER) || (flags == COL_INSERT_DUPOVERT)) {
+                    /* Overwrite in place, later duplicates find it there */
+                    item->next = current->next;
+                    parent->next = item;
+                    if (header->last == current) header->last = item;
+                    col_index_add(collection, parent, item);
+                    col_position_add(collection, parent, item, -1);
+                    if (anchor == current) anchor = item;
+                    run[i] = NULL;
+                    col_delete_item(current);
+                    COL_STAT_ADD(collection, deletes, 1);
+                    col_stat_insert(collection, item);
+                    continue;
+                }
+                parent->next = current->next;
+                if (header->last == current) header->last = parent;
+                if (anchor == current) anchor = parent;
+                col_delete_item(current);
+                COL_STAT_ADD(collection, deletes, 1);
+                header->count--;
+            }
+
+            *slot = i + 1;
+        }
+    }
+
+    /* Chain what is left of the batch */
+    for (i = 0; i < count; i++) {
+        if (run[i] == NULL) continue;
+        if (last) last->next = run[i];
+        else first = run[i];
+        last = run[i];
+        linked++;
+    }
+
+    free(run);
+
+    if (linked == 0) {
+        TRACE_FLOW_STRING("Nothing left to link", "");
+        return EOK;
+    }
+
+    switch (disposition) {
+    case COL_DSP_END:       prev = header->last;
+                            break;
+    case COL_DSP_INDEX:     if (idx == 0) {
+                                prev = collection;
+                                position = 0;
+                            }
+                            else if (idx >= header->count - 1) prev = header->last;
+                            else {
+                                position = idx;
+                                prev = col_position_prev(collection, idx);
+                                if (prev == NULL) {
+                                    prev = collection;
+                                    while ((idx > 0) && (prev->next)) {
+                                        idx--;
+                                        prev = prev->next;
+                                    }
+                                }
+                            }
+                            break;
+    default:                prev = anchor;
+                            if (prev == collection) position = 0;
+                            break;
+    }
+
+    header->count += linked;
+
+    /* Items are linked one after another keeping the index in sync */
+    item = first;
+    while (item) {
+        current = item->next;
+        item->next = prev->next;
+        prev->next = item;
+        if (header->last == prev) header->last = item;
+        col_index_add(collection, prev, item);
+        col_position_add(collection, prev, item, position);
+        col_stat_insert(collection, item);
+        if (position >= 0) position++;
+        prev = item;
+        item = current;
+    }
+
+    TRACE_INFO_NUMBER("Number of items in collection now is.", header->count);
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Insert the batch of properties holding the lock */
+int col_insert_batch(struct collection_item *ci,
+                     const char *subcollection,
+                     int disposition,
+                     const char *refprop,
+                     int idx,
+                     unsigned flags,
+                     const struct col_batch_property *batch,
+                     unsigned count)
+{
+    struct collection_item *acceptor = NULL;
+    int error;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((ci == NULL) || ((batch == NULL) && (count))) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    error = col_lock(ci, 1);
+    if (error) return error;
+
+    error = col_get_acceptor(ci, subcollection, &acceptor);
+    if (!error) {
+        error = col_lock(acceptor, 1);
+        if (!error) {
+            if (count) error = col_insert_batch_int(acceptor,
+                                                    disposition,
+                                                    refprop,
+                                                    idx,
+                                                    flags,
+                                                    batch,
+                                                    count);
+            col_unlock(acceptor);
+        }
+    }
+
+    col_unlock(ci);
+
+    TRACE_FLOW_RETURN(error);
+    return error;
+}
 /* TRAVERSE HANDLERS */
 
 /* Special handler to just set a flag if the item is found */
@@ -1346,6 +2283,11 @@ static void col_delete_collection(struct collection_item *ci,
                                   col_item_cleanup_fn cb,
                                   void *custom_data)
 {
+    struct col_arena *arena;
+    struct col_lock *lock;
+    struct collection_item *previous = NULL;
+    struct collection_item *next;
+
     TRACE_FLOW_STRING("col_delete_collection", "Entry.");
 
     if (ci == NULL) {
@@ -1355,12 +2297,37 @@ static void col_delete_collection(struct collection_item *ci,
 
     TRACE_INFO_STRING("Real work to do", "");
     TRACE_INFO_STRING("Property", ci->property);
-    TRACE_INFO_NUMBER("Next item", ci->next);
 
-    col_delete_collection(ci->next, cb, custom_data);
+    /* Items are deleted from the last one to the header.
+     * The list is reversed first so that the long
+     * collection does not need deep recursion.
+     */
+    while (ci) {
+        next = ci->next;
+        ci->next = previous;
+        previous = ci;
+        ci = next;
+    }
+
+    while (previous) {
+        next = previous->next;
+
+        /* Only the header has arena and lock. It is deleted last. */
+        arena = col_get_arena(previous);
+        lock = NULL;
+        if (previous->type == COL_TYPE_COLLECTION)
+            lock = ((struct collection_header *)previous->data)->lock;
+
+        /* Delete this item */
+        col_delete_item_with_cb(previous, cb, custom_data);
+
+        /* Free all the memory allocated from the arena at once */
+        col_arena_unref(arena);
+        col_lock_destroy(lock);
+
+        previous = next;
+    }
 
-    /* Delete this item */
-    col_delete_item_with_cb(ci, cb, custom_data);
     TRACE_FLOW_STRING("col_delete_collection", "Exit.");
 }
 
@@ -1374,11 +2341,15 @@ struct find_name {
     const char *name_to_find;
     int name_len_to_find;
     uint64_t hash;
+    const void *fold;
     int type_to_match;
     char *given_name;
     int given_len;
+    struct collection_item *given_ref;
+    struct collection_item *given_owner;
     struct path_data *current_path;
     int action;
+    unsigned scanned;
 };
 
 /* Create a new name */
@@ -1424,6 +2395,10 @@ static int col_create_path_data(struct path_data **name_path,
     new_name_path->length += property_len;
     new_name_path->name[new_name_path->length] = '\0';
 
+    /* Reference the path goes through is set by the caller */
+    new_name_path->ref = NULL;
+    new_name_path->owner = NULL;
+
     /* Link to the chain */
     new_name_path->previous_path = *name_path;
     *name_path = new_name_path;
@@ -1469,6 +2444,18 @@ static int col_match_item(struct collection_item *current,
         start = current->property;
         data_str = start + current->property_len;
 
+        /* Interned name is compared by its class so only
+         * the path in front of it is compared as a string.
+         */
+        if (current->flags & COL_ITEM_INTERN_PROPERTY) {
+            if (!col_intern_match(current, NULL, traverse_data->fold)) {
+                TRACE_INFO_STRING("col_match_item","Returning NO match!");
+                return COL_NOMATCH;
+            }
+            find_str -= current->property_len;
+            data_str = start;
+        }
+
         TRACE_INFO_STRING("Searching for:", traverse_data->name_to_find);
         TRACE_INFO_STRING("Item name:", current->property);
         TRACE_INFO_STRING("Current path:", traverse_data->current_path->name);
@@ -1543,11 +2530,78 @@ static void col_delete_path_data(struct path_data *path)
 
 /* MAIN TRAVERSAL FUNCTION */
 
+/* Depth of the walk that does not need memory for the stack */
+#define COL_WALK_INLINE_DEPTH   16
+
+/* Level of the collection the walk is in */
+struct col_walk_frame {
+    struct collection_item *ci;
+    struct collection_item *parent;
+    struct collection_item *current;
+};
+
+/* Stack of the walk.
+ * It starts on the stack of the caller
+ * and moves to the heap only if the tree is deeper.
+ */
+struct col_walk_stack {
+    struct col_walk_frame *frames;
+    unsigned size;
+    unsigned count;
+    struct col_walk_frame inline_frames[COL_WALK_INLINE_DEPTH];
+};
+
+/* Enter the collection */
+static int col_walk_push(struct col_walk_stack *stack,
+                         struct collection_item *ci)
+{
+    struct col_walk_frame *temp;
+    struct col_walk_frame *frame;
+
+    if (stack->count == stack->size) {
+        if (stack->frames == stack->inline_frames) {
+            temp = (struct col_walk_frame *)malloc(stack->size * 2 *
+                                                   sizeof(struct col_walk_frame));
+            if (temp) memcpy(temp, stack->inline_frames,
+                             stack->size * sizeof(struct col_walk_frame));
+        }
+        else temp = (struct col_walk_frame *)realloc(stack->frames,
+                                                     stack->size * 2 *
+                                                     sizeof(struct col_walk_frame));
+        if (temp == NULL) {
+            TRACE_ERROR_NUMBER("Failed to grow walk stack", ENOMEM);
+            return ENOMEM;
+        }
+        stack->frames = temp;
+        stack->size *= 2;
+    }
+
+    frame = &(stack->frames[stack->count++]);
+    frame->ci = ci;
+    frame->parent = NULL;
+    frame->current = ci;
+
+    return EOK;
+}
+
+/* Start loading the items the walk gets to soon.
+ * The next item was requested when the walk was on the previous one.
+ */
+static inline void col_walk_prefetch(struct collection_item *current)
+{
+    if (current->next) __builtin_prefetch(current->next->next);
+    if (current->type == COL_TYPE_COLLECTIONREF)
+        __builtin_prefetch(*((struct collection_item **)(current->data)));
+}
+
 /* Internal function to walk collection */
 /* For each item walked it will call traverse handler.
    Traverse handler accepts: current item,
    user provided item handler and user provided custom data. */
 /* See below different traverse handlers for different cases */
+/* Sub collections are walked using the explicit stack
+ * so the depth of the tree is not limited by the stack of the thread.
+ */
 static int col_walk_items(struct collection_item *ci,
                           int mode_flags,
                           internal_item_fn traverse_handler,
@@ -1556,28 +2610,79 @@ static int col_walk_items(struct collection_item *ci,
                           void *custom_data,
                           unsigned *depth)
 {
+    struct col_walk_stack stack;
+    struct col_walk_frame *frame;
     struct collection_item *current;
-    struct collection_item *parent = NULL;
     struct collection_item *sub;
+    unsigned top_depth;
+    unsigned deepest = 1;
     int stop = 0;
     int error = EOK;
 
     TRACE_FLOW_STRING("col_walk_items", "Entry.");
     TRACE_INFO_NUMBER("Mode flags:", mode_flags);
 
-    /* Increase depth */
-    /* NOTE: The depth is increased at the entry to the function.
-     * and decreased right before the exit so it is safe to decrease it.
+    stack.frames = stack.inline_frames;
+    stack.size = COL_WALK_INLINE_DEPTH;
+    stack.count = 0;
+
+    /* Depth counts the levels of the tree the walk is in.
+     * The top level of the walk is the one that is entered first.
      */
-    (*depth)++;
+    top_depth = *depth + 1;
+    (void)col_walk_push(&stack, ci);
+    if (ci) __builtin_prefetch(ci->next);
+
+    while (stack.count) {
 
-    current = ci;
+        frame = &(stack.frames[stack.count - 1]);
+        *depth = top_depth + stack.count - 1;
+        current = frame->current;
 
-    while (current) {
+        if (current == NULL) {
+
+            TRACE_INFO_STRING("Out of loop", "");
+
+            /* Check if we need to have a special
+             * call at the end of the collection.
+             */
+            if ((mode_flags & COL_TRAVERSE_END) != 0) {
+
+                /* Do this dummy invocation only:
+                 * a) If we are flattening and on the root level
+                 * b) We are not flattening
+                 */
+                if ((((mode_flags & COL_TRAVERSE_FLAT) != 0) && (*depth == 1)) ||
+                    ((mode_flags & COL_TRAVERSE_FLAT) == 0)) {
+
+                    TRACE_INFO_STRING("About to do the special end collection invocation of handler", "");
+                    error = traverse_handler(frame->ci, frame->parent, NULL,
+                                             traverse_data, user_item_handler,
+                                             custom_data, &stop);
+                }
+            }
+
+            /* Go back to the collection that refers to this one.
+             * Stop of the end invocation is not propagated.
+             */
+            stop = 0;
+            stack.count--;
+            if (error) break;
+            if (stack.count) {
+                frame = &(stack.frames[stack.count - 1]);
+                TRACE_INFO_STRING("Returned from sub collection processing", "");
+                TRACE_INFO_STRING("Done processing item:", frame->current->property);
+                frame->parent = frame->current;
+                frame->current = frame->current->next;
+            }
+            continue;
+        }
 
         TRACE_INFO_STRING("Processing item:", current->property);
         TRACE_INFO_NUMBER("Item type:", current->type);
 
+        col_walk_prefetch(current);
+
         if (current->type == COL_TYPE_COLLECTIONREF) {
 
             TRACE_INFO_STRING("Subcollection:", current->property);
@@ -1596,23 +2701,10 @@ static int col_walk_items(struct collection_item *ci,
                      * We will also not do special end collection
                      * invocation for sub collections.
                      */
-                    error = traverse_handler(ci, parent, current, traverse_data,
-                                             user_item_handler, custom_data, &stop);
-                    if (stop != 0) {
-                        TRACE_INFO_STRING("Traverse handler returned STOP.", "");
-                        error = EINTR_INTERNAL;
-                    }
-                    /* Check what error we got */
-                    if (error == EINTR_INTERNAL) {
-                        TRACE_FLOW_NUMBER("Internal error - means we are stopping.", error);
-                        (*depth)--;
-                        return error;
-                    }
-                    else if (error) {
-                        TRACE_ERROR_NUMBER("Traverse handler returned error.", error);
-                        (*depth)--;
-                        return error;
-                    }
+                    error = traverse_handler(frame->ci, frame->parent, current,
+                                             traverse_data, user_item_handler,
+                                             custom_data, &stop);
+                    if ((stop != 0) || (error)) break;
                 }
 
                 if ((mode_flags & COL_TRAVERSE_ONELEVEL) == 0) {
@@ -1620,15 +2712,13 @@ static int col_walk_items(struct collection_item *ci,
                     sub = *((struct collection_item **)(current->data));
                     TRACE_INFO_STRING("Sub collection name", sub->property);
                     TRACE_INFO_NUMBER("Header type", sub->type);
-                    /* We need to go into sub collections */
-                    error = col_walk_items(sub, mode_flags,
-                                           traverse_handler, traverse_data,
-                                           user_item_handler, custom_data,
-                                           depth);
-                    TRACE_INFO_STRING("Returned from sub collection processing", "");
-                    TRACE_INFO_STRING("Done processing item:", current->property);
-                    TRACE_INFO_NUMBER("Done processing item type:", current->type);
-
+                    /* We need to go into sub collections.
+                     * The walk moves past the reference when it returns.
+                     */
+                    error = col_walk_push(&stack, sub);
+                    if (error) break;
+                    if (stack.count > deepest) deepest = stack.count;
+                    continue;
                 }
             }
         }
@@ -1649,58 +2739,31 @@ static int col_walk_items(struct collection_item *ci,
                 (((mode_flags & COL_TRAVERSE_FLAT) != 0) && (*depth == 1)) ||
                 ((mode_flags & COL_TRAVERSE_FLAT) == 0)) {
                 /* Call handler then move on */
-                error = traverse_handler(ci, parent, current,
+                error = traverse_handler(frame->ci, frame->parent, current,
                                          traverse_data, user_item_handler,
                                          custom_data, &stop);
-
+                if ((stop != 0) || (error)) break;
             }
         }
-        /* If we are stopped - return EINTR_INTERNAL */
-        if (stop != 0) {
-            TRACE_INFO_STRING("Traverse handler returned STOP.", "");
-            error = EINTR_INTERNAL;
-        }
-        /* Check what error we got */
-        if (error == EINTR_INTERNAL) {
-            TRACE_FLOW_NUMBER("Internal error - means we are stopping.", error);
-            (*depth)--;
-            return error;
-        }
-        else if (error) {
-            TRACE_ERROR_NUMBER("Traverse handler returned error.", error);
-            (*depth)--;
-            return error;
-        }
 
         TRACE_INFO_NUMBER("Next element", current->next);
 
-        parent = current;
-        current = current->next;
+        frame->parent = current;
+        frame->current = current->next;
     }
 
-    TRACE_INFO_STRING("Out of loop", "");
+    /* If we are stopped - return EINTR_INTERNAL */
+    if (stop != 0) {
+        TRACE_INFO_STRING("Traverse handler returned STOP.", "");
+        error = EINTR_INTERNAL;
+    }
 
-    /* Check if we need to have a special
-     * call at the end of the collection.
-     */
-    if ((mode_flags & COL_TRAVERSE_END) != 0) {
+    if (stack.frames != stack.inline_frames) free(stack.frames);
 
-        /* Do this dummy invocation only:
-         * a) If we are flattening and on the root level
-         * b) We are not flattening
-         */
-        if ((((mode_flags & COL_TRAVERSE_FLAT) != 0) && (*depth == 1)) ||
-            ((mode_flags & COL_TRAVERSE_FLAT) == 0)) {
-
-            TRACE_INFO_STRING("About to do the special end collection invocation of handler", "");
-            error = traverse_handler(ci, parent, current,
-                                     traverse_data, user_item_handler,
-                                     custom_data, &stop);
-        }
-    }
+    COL_STAT_MAX(ci, max_depth, deepest);
 
     TRACE_FLOW_NUMBER("col_walk_items. Returns: ", error);
-    (*depth)--;
+    *depth = top_depth - 1;
     return error;
 }
 
@@ -1711,13 +2774,13 @@ static int col_walk_items(struct collection_item *ci,
 /* No pattern matching supported in the first implementation. */
 /* To refer to child properties use notatation like this: */
 /* parent!child!subchild!subsubchild etc.  */
-static int col_find_item_and_do(struct collection_item *ci,
-                                const char *property_to_find,
-                                int type,
-                                int mode_flags,
-                                col_item_fn item_handler,
-                                void *custom_data,
-                                int action)
+static int col_find_item_and_do_int(struct collection_item *ci,
+                                    const char *property_to_find,
+                                    int type,
+                                    int mode_flags,
+                                    col_item_fn item_handler,
+                                    void *custom_data,
+                                    int action)
 {
 
     int error = EOK;
@@ -1725,13 +2788,18 @@ static int col_find_item_and_do(struct collection_item *ci,
     unsigned depth = 0;
     int count = 0;
     const char *last_part;
-    char *sep;
+    char *sep = NULL;
+    struct col_index *index = NULL;
+    struct collection_item *current = NULL;
+    struct collection_item *previous = NULL;
+    int stop = 0;
 
     TRACE_FLOW_STRING("col_find_item_and_do", "Entry.");
 
     /* Item handler is always required */
     if ((item_handler == NULL) &&
-        (action == COLLECTION_ACTION_FIND)) {
+        ((action == COLLECTION_ACTION_FIND) ||
+         (action == COLLECTION_ACTION_FIND_WRITE))) {
         TRACE_ERROR_NUMBER("No item handler - returning error!", EINVAL);
         return EINVAL;
     }
@@ -1751,6 +2819,19 @@ static int col_find_item_and_do(struct collection_item *ci,
         return ENOENT;
     }
 
+    /* Flat search does not know the path to the item
+     * so all shared sub collections are copied first.
+     */
+    if ((COL_WRITE_ACTION(action)) &&
+        ((mode_flags & (COL_TRAVERSE_FLAT | COL_TRAVERSE_IGNORE |
+                        COL_TRAVERSE_ONELEVEL)) == COL_TRAVERSE_FLAT)) {
+        error = col_unshare_tree(ci);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to unshare collection", error);
+            return error;
+        }
+    }
+
     /* Prepare data for traversal */
     traverse_data = (struct find_name *)malloc(sizeof(struct find_name));
     if (traverse_data == NULL) {
@@ -1788,23 +2869,64 @@ static int col_find_item_and_do(struct collection_item *ci,
 
         /* Create hash of the string to search */
         while(last_part[count] != 0) {
-            traverse_data->hash = traverse_data->hash ^ toupper(last_part[count]);
-            traverse_data->hash *= FNV1a_prime;
+            traverse_data->hash = col_hash_char(traverse_data->hash,
+                                                last_part[count]);
             count++;
         }
+
+        /* Interned names are compared by their class */
+        traverse_data->fold = col_intern_class(last_part,
+                                               traverse_data->hash);
     }
     else {
         /* We a looking for a first element of a given type */
         TRACE_INFO_STRING("No search string", "");
         traverse_data->name_len_to_find = 0;
+        traverse_data->fold = NULL;
     }
 
 
     traverse_data->type_to_match = type;
     traverse_data->given_name = NULL;
     traverse_data->given_len = 0;
+    traverse_data->given_ref = NULL;
+    traverse_data->given_owner = NULL;
     traverse_data->current_path = NULL;
     traverse_data->action = action;
+    traverse_data->scanned = 0;
+
+    COL_STAT_ADD(ci, lookups, 1);
+
+    /* The simple name can be looked up in the index if the search
+     * does not need to go into sub collections.
+     */
+    if ((property_to_find != NULL) && (*property_to_find != '\0') &&
+        (sep == NULL) && (ci->type == COL_TYPE_COLLECTION)) {
+        index = col_index_get(ci);
+        if ((index) &&
+            (((mode_flags & COL_TRAVERSE_ONELEVEL) != 0) ||
+             (index->refs == 0))) {
+            TRACE_INFO_STRING("col_find_item_and_do", "Using index.");
+            current = col_index_find(index, traverse_data->hash,
+                                     property_to_find, traverse_data->fold,
+                                     type,
+                                     mode_flags & (COL_TRAVERSE_IGNORE |
+                                                   COL_TRAVERSE_FLAT),
+                                     &previous);
+            if (current) {
+                COL_STAT_ADD(ci, hash_hits, 1);
+                /* Same as in the walk the action interrupts the search
+                 * so whatever it returns the search succeeds.
+                 */
+                (void)col_act_on_item(ci, previous, current, traverse_data,
+                                      item_handler, custom_data, &stop);
+            }
+            else COL_STAT_ADD(ci, hash_misses, 1);
+            free(traverse_data);
+            TRACE_FLOW_STRING("Index lookup done.", "");
+            return EOK;
+        }
+    }
 
     mode_flags |= COL_TRAVERSE_END;
 
@@ -1821,6 +2943,7 @@ static int col_find_item_and_do(struct collection_item *ci,
         col_delete_path_data(traverse_data->current_path);
     }
 
+    COL_STAT_ADD(ci, items_scanned, traverse_data->scanned);
     free(traverse_data);
 
     if (error && (error != EINTR_INTERNAL)) {
@@ -1833,6 +2956,36 @@ static int col_find_item_and_do(struct collection_item *ci,
     }
 }
 
+/* Search the collection holding the lock.
+ * Only deletion and update change the collection.
+ */
+static int col_find_item_and_do(struct collection_item *ci,
+                                const char *property_to_find,
+                                int type,
+                                int mode_flags,
+                                col_item_fn item_handler,
+                                void *custom_data,
+                                int action)
+{
+    int error;
+
+    error = col_lock(ci, (action == COLLECTION_ACTION_DEL) ||
+                         (action == COLLECTION_ACTION_UPDATE));
+    if (error) return error;
+
+    error = col_find_item_and_do_int(ci,
+                                     property_to_find,
+                                     type,
+                                     mode_flags,
+                                     item_handler,
+                                     custom_data,
+                                     action);
+
+    col_unlock(ci);
+
+    return error;
+}
+
 /* Function to replace data in the item */
 static int col_update_current_item(struct collection_item *current,
                                    struct update_property *update_data)
@@ -1846,7 +2999,7 @@ static int col_update_current_item(struct collection_item *current,
         ((current->type == COL_TYPE_STRING) ||
          (current->type == COL_TYPE_BINARY)))) {
         TRACE_INFO_STRING("Replacing item data buffer", "");
-        free(current->data);
+        col_free_data(current);
         current->data = malloc(update_data->length);
         if (current->data == NULL) {
             TRACE_ERROR_STRING("Failed to allocate memory", "");
@@ -1856,6 +3009,10 @@ static int col_update_current_item(struct collection_item *current,
         current->length = update_data->length;
     }
 
+    /* Indexes count sub collection references */
+    if ((current->type != update_data->type) &&
+        (update_data->type == COL_TYPE_COLLECTIONREF)) col_index_invalidate(current);
+
     TRACE_INFO_STRING("Overwriting item data", "");
     memcpy(current->data, update_data->data, current->length);
     current->type = update_data->type;
@@ -1920,6 +3077,7 @@ static int col_parent_traverse_handler(struct collection_item *head,
     TRACE_FLOW_STRING("col_parent_traverse_handler", "Entry.");
 
     to_find = (struct property_search *)custom_data;
+    to_find->scanned++;
 
     TRACE_INFO_NUMBER("Looking for HASH:", (unsigned)(to_find->hash));
     TRACE_INFO_NUMBER("Current HASH:", (unsigned)(current->phash));
@@ -1934,7 +3092,7 @@ static int col_parent_traverse_handler(struct collection_item *head,
         }
 
         /* Validate property. Make sure we include terminating 0 in the comparison */
-        if (strncasecmp(current->property, to_find->property, current->property_len + 1) == 0) {
+        if (col_intern_match(current, to_find->property, to_find->fold)) {
 
             match = 1;
             to_find->found = 1;
@@ -2007,6 +3165,127 @@ static int col_parent_traverse_handler(struct collection_item *head,
 }
 
 
+/* Perform the requested action on the found item */
+static int col_act_on_item(struct collection_item *head,
+                           struct collection_item *previous,
+                           struct collection_item *current,
+                           struct find_name *traverse_data,
+                           col_item_fn user_item_handler,
+                           void *custom_data,
+                           int *stop)
+{
+    int error = EOK;
+    struct collection_header *header;
+    struct update_property *update_data;
+    struct collection_item *collection;
+
+    TRACE_FLOW_STRING("col_act_on_item", "Entry.");
+
+    /* Collections shared with the copy are copied before they change */
+    if (COL_WRITE_ACTION(traverse_data->action)) {
+        collection = head;
+        error = col_unshare_path(traverse_data->current_path, &collection);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to unshare path", error);
+            return error;
+        }
+
+        if (collection != head) {
+            previous = col_find_same_item(head, collection, previous);
+            current = col_find_same_item(head, collection, current);
+            head = collection;
+        }
+
+        if ((traverse_data->action == COLLECTION_ACTION_FIND_WRITE) &&
+            (current->type == COL_TYPE_COLLECTIONREF)) {
+            error = col_unshare_item(head, current);
+            if (error) {
+                TRACE_ERROR_NUMBER("Failed to unshare collection", error);
+                return error;
+            }
+        }
+    }
+
+    switch (traverse_data->action) {
+    case COLLECTION_ACTION_FIND:
+    case COLLECTION_ACTION_FIND_WRITE:
+        TRACE_INFO_STRING("It is a find action - calling handler.", "");
+        if (user_item_handler != NULL) {
+            /* Call user handler */
+            error = user_item_handler(current->property,
+                                      current->property_len,
+                                      current->type,
+                                      current->data,
+                                      current->length,
+                                      custom_data,
+                                      stop);
+
+            TRACE_INFO_NUMBER("Handler returned:", error);
+            TRACE_INFO_NUMBER("Handler set STOP to:", *stop);
+
+        }
+        break;
+
+    case COLLECTION_ACTION_GET:
+        TRACE_INFO_STRING("It is a get action.", "");
+        if (custom_data != NULL)
+            *((struct collection_item **)(custom_data)) = current;
+        break;
+
+    case COLLECTION_ACTION_DEL:
+        TRACE_INFO_STRING("It is a delete action.", "");
+        /* Make sure we tell the caller we found a match */
+        if (custom_data != NULL)
+            *(int *)custom_data = COL_MATCH;
+
+        /* Adjust header of the collection */
+        header = (struct collection_header *)head->data;
+        header->count--;
+        if (current->next == NULL)
+            header->last = previous;
+        COL_STAT_ADD(head, deletes, 1);
+
+        /* Unlink and delete iteam */
+        /* Previous can't be NULL here becuase we never delete
+         * header elements */
+        col_index_remove(head, previous, current);
+        col_position_remove(head, previous, current, -1);
+        previous->next = current->next;
+        col_delete_item(current);
+        TRACE_INFO_STRING("Did the delete of the item.", "");
+        break;
+
+    case COLLECTION_ACTION_UPDATE:
+        TRACE_INFO_STRING("It is an update action.", "");
+        if((current->type == COL_TYPE_COLLECTION) ||
+           (current->type == COL_TYPE_COLLECTIONREF)) {
+            TRACE_ERROR_STRING("Can't update collections it is an error for now", "");
+            return EINVAL;
+        }
+
+        /* Make sure we tell the caller we found a match */
+        if (custom_data != NULL) {
+            update_data = (struct update_property *)custom_data;
+            update_data->found = COL_MATCH;
+            error = col_update_current_item(current, update_data);
+        }
+        else {
+            TRACE_ERROR_STRING("Error - update data is required", "");
+            return EINVAL;
+        }
+
+        TRACE_INFO_STRING("Did the delete of the item.", "");
+        break;
+    default:
+        break;
+    }
+    /* Force interrupt if we found */
+    *stop = 1;
+
+    TRACE_FLOW_NUMBER("col_act_on_item returning", error);
+    return error;
+}
+
 /* Traverse callback for find & delete function */
 static int col_act_traverse_handler(struct collection_item *head,
                                     struct collection_item *previous,
@@ -2021,10 +3300,8 @@ static int col_act_traverse_handler(struct collection_item *head,
     char *name;
     int length;
     struct path_data *temp;
-    struct collection_header *header;
     char *property;
     int property_len;
-    struct update_property *update_data;
 
     TRACE_FLOW_STRING("col_act_traverse_handler", "Entry.");
 
@@ -2040,10 +3317,14 @@ static int col_act_traverse_handler(struct collection_item *head,
         col_delete_path_data(temp);
         traverse_data->given_name = NULL;
         traverse_data->given_len = 0;
+        traverse_data->given_ref = NULL;
+        traverse_data->given_owner = NULL;
         TRACE_FLOW_NUMBER("Handling end of collection - removed path. Returning:", error);
         return error;
     }
 
+    traverse_data->scanned++;
+
     /* Create new path at the beginning of a new sub collection */
     if (current->type == COL_TYPE_COLLECTION) {
 
@@ -2079,6 +3360,11 @@ static int col_act_traverse_handler(struct collection_item *head,
                                      property, property_len, '!');
 
         TRACE_INFO_NUMBER("col_create_path_data returned:", error);
+        if (error) return error;
+
+        /* Remember how the search got here */
+        traverse_data->current_path->ref = traverse_data->given_ref;
+        traverse_data->current_path->owner = traverse_data->given_owner;
         return error;
     }
 
@@ -2086,6 +3372,8 @@ static int col_act_traverse_handler(struct collection_item *head,
     if (current->type == COL_TYPE_COLLECTIONREF) {
         traverse_data->given_name = current->property;
         traverse_data->given_len = current->property_len;
+        traverse_data->given_ref = current;
+        traverse_data->given_owner = head;
         TRACE_INFO_STRING("Saved given name:", traverse_data->given_name);
     }
 
@@ -2094,77 +3382,8 @@ static int col_act_traverse_handler(struct collection_item *head,
     /* Do here what we do with items */
     if (col_match_item(current, traverse_data)) {
         TRACE_INFO_STRING("Matched item:", current->property);
-        switch (traverse_data->action) {
-        case COLLECTION_ACTION_FIND:
-            TRACE_INFO_STRING("It is a find action - calling handler.", "");
-            if (user_item_handler != NULL) {
-                /* Call user handler */
-                error = user_item_handler(current->property,
-                                          current->property_len,
-                                          current->type,
-                                          current->data,
-                                          current->length,
-                                          custom_data,
-                                          stop);
-
-                TRACE_INFO_NUMBER("Handler returned:", error);
-                TRACE_INFO_NUMBER("Handler set STOP to:", *stop);
-
-            }
-            break;
-
-        case COLLECTION_ACTION_GET:
-            TRACE_INFO_STRING("It is a get action.", "");
-            if (custom_data != NULL)
-                *((struct collection_item **)(custom_data)) = current;
-            break;
-
-        case COLLECTION_ACTION_DEL:
-            TRACE_INFO_STRING("It is a delete action.", "");
-            /* Make sure we tell the caller we found a match */
-            if (custom_data != NULL)
-                *(int *)custom_data = COL_MATCH;
-
-            /* Adjust header of the collection */
-            header = (struct collection_header *)head->data;
-            header->count--;
-            if (current->next == NULL)
-                header->last = previous;
-
-            /* Unlink and delete iteam */
-            /* Previous can't be NULL here becuase we never delete
-             * header elements */
-            previous->next = current->next;
-            col_delete_item(current);
-            TRACE_INFO_STRING("Did the delete of the item.", "");
-            break;
-
-        case COLLECTION_ACTION_UPDATE:
-            TRACE_INFO_STRING("It is an update action.", "");
-            if((current->type == COL_TYPE_COLLECTION) ||
-               (current->type == COL_TYPE_COLLECTIONREF)) {
-                TRACE_ERROR_STRING("Can't update collections it is an error for now", "");
-                return EINVAL;
-            }
-
-            /* Make sure we tell the caller we found a match */
-            if (custom_data != NULL) {
-                update_data = (struct update_property *)custom_data;
-                update_data->found = COL_MATCH;
-                error = col_update_current_item(current, update_data);
-            }
-            else {
-                TRACE_ERROR_STRING("Error - update data is required", "");
-                return EINVAL;
-            }
-
-            TRACE_INFO_STRING("Did the delete of the item.", "");
-            break;
-        default:
-            break;
-        }
-        /* Force interrupt if we found */
-        *stop = 1;
+        error = col_act_on_item(head, previous, current, traverse_data,
+                                user_item_handler, custom_data, stop);
     }
 
     TRACE_FLOW_NUMBER("col_act_traverse_handler returning", error);
@@ -2184,6 +3403,7 @@ static int col_copy_traverse_handler(struct collection_item *head,
     int error = EOK;
     struct collection_item *parent;
     struct collection_item *other = NULL;
+    struct collection_item *ref = NULL;
     struct col_copy *traverse_data;
     struct path_data *temp;
     char *name;
@@ -2192,6 +3412,7 @@ static int col_copy_traverse_handler(struct collection_item *head,
     int property_len;
     struct collection_header *header;
     char *offset;
+    int shared;
 
     TRACE_FLOW_STRING("col_copy_traverse_handler", "Entry.");
 
@@ -2277,12 +3498,16 @@ static int col_copy_traverse_handler(struct collection_item *head,
         switch (traverse_data->mode) {
         case COL_COPY_NORMAL:
 
-            error = col_copy_collection_with_cb(&other,
+            /* Sub collection shares the arena and flags of the copy */
+            error = col_copy_collection_int(&other,
                                         *((struct collection_item **)(current->data)),
                                         current->property,
                                         COL_COPY_NORMAL,
                                         traverse_data->copy_cb,
-                                        traverse_data->ext_data);
+                                        traverse_data->ext_data,
+                                        col_get_arena(parent),
+                                        col_get_flags(parent) &
+                                        ~COL_CREATE_THREADSAFE);
             if (error) {
                 TRACE_ERROR_NUMBER("Copy subcollection returned error:", error);
                 return error;
@@ -2310,7 +3535,7 @@ static int col_copy_traverse_handler(struct collection_item *head,
             /* Just increase reference count of the referenced collection */
 			other = *((struct collection_item **)(current->data));
             header = (struct collection_header *)(other->data);
-            header->reference_count++;
+            col_reference_add(header);
 
             /* Add new item to a collection
              * all references are now sub collections */
@@ -2324,10 +3549,72 @@ static int col_copy_traverse_handler(struct collection_item *head,
                                                      COL_TYPE_COLLECTIONREF,
                                                      (void *)(&other),
                                                      sizeof(struct collection_item **),
-                                                     NULL);
+                                                     &ref);
+
+            /* Collection shared with a copy stays copy-on-write */
+            if ((!error) && (current->flags & COL_ITEM_SHARED))
+                ref->flags |= COL_ITEM_SHARED;
+
             TRACE_FLOW_NUMBER("col_copy_traverse_handler returning in KEEPREF mode:", error);
             return error;
 
+        case COL_COPY_COW:
+
+            other = *((struct collection_item **)(current->data));
+            header = (struct collection_header *)(other->data);
+
+            /* Sub collection that is also referenced from other
+             * places can be changed through them so it is copied now.
+             */
+            shared = (header->reference_count == 1) ||
+                     (current->flags & COL_ITEM_SHARED);
+            if (shared) col_reference_add(header);
+            else {
+                error = col_copy_collection_int(&other,
+                                                other,
+                                                current->property,
+                                                COL_COPY_COW,
+                                                traverse_data->copy_cb,
+                                                traverse_data->ext_data,
+                                                col_get_arena(parent),
+                                                col_get_flags(parent) &
+                                                ~COL_CREATE_THREADSAFE);
+                if (error) {
+                    TRACE_ERROR_NUMBER("Copy subcollection returned error:", error);
+                    return error;
+                }
+            }
+
+            error = col_insert_property_with_ref_int(parent,
+                                                     NULL,
+                                                     COL_DSP_END,
+                                                     NULL,
+                                                     0,
+                                                     0,
+                                                     current->property,
+                                                     COL_TYPE_COLLECTIONREF,
+                                                     (void *)(&other),
+                                                     sizeof(struct collection_item **),
+                                                     &ref);
+            if (error) {
+                TRACE_ERROR_NUMBER("Failed to add subcollection:", error);
+                col_destroy_collection(other);
+                return error;
+            }
+
+            /* Both references copy the collection before changing it.
+             * Frozen collection never changes so its reference is left as is.
+             */
+            if (shared) {
+                ref->flags |= COL_ITEM_SHARED;
+                header = (struct collection_header *)(head->data);
+                if (!(header->flags & COL_HEADER_FROZEN))
+                    current->flags |= COL_ITEM_SHARED;
+            }
+
+            TRACE_FLOW_NUMBER("col_copy_traverse_handler returning in COW mode:", error);
+            return error;
+
         case COL_COPY_TOP:
             /* Told to ignore sub collections */
             TRACE_FLOW_NUMBER("col_copy_traverse_handler returning in TOP mode:", error);
@@ -2406,9 +3693,14 @@ static int col_copy_traverse_handler(struct collection_item *head,
 
 /* CREATE */
 
-/* Function that creates an named collection of a given class*/
-int col_create_collection(struct collection_item **ci, const char *name,
-                          unsigned cclass)
+/* Create a collection that allocates items from the given arena.
+ * If arena is NULL the items are allocated from the heap.
+ */
+static int col_create_collection_int(struct collection_item **ci,
+                                     const char *name,
+                                     unsigned cclass,
+                                     struct col_arena *arena,
+                                     unsigned flags)
 {
     struct collection_item *handle = NULL;
     struct collection_header header;
@@ -2421,6 +3713,21 @@ int col_create_collection(struct collection_item **ci, const char *name,
     header.reference_count = 1;
     header.count = 0;
     header.cclass = cclass;
+    header.index = NULL;
+    header.index_epoch = 0;
+    header.arena = arena;
+    header.flags = flags;
+    header.lock = NULL;
+    memset(header.statistics, 0, sizeof(header.statistics));
+    header.position = NULL;
+
+    if (flags & COL_CREATE_THREADSAFE) {
+        error = col_lock_create(&(header.lock));
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to create lock", error);
+            return error;
+        }
+    }
 
     /* Create a collection type property */
     error = col_insert_property_with_ref_int(NULL,
@@ -2436,7 +3743,13 @@ int col_create_collection(struct collection_item **ci, const char *name,
                                              &handle);
 
 
-    if (error) return error;
+    if (error) {
+        col_lock_destroy(header.lock);
+        return error;
+    }
+
+    /* Collection holds the arena till it is destroyed */
+    col_arena_ref(arena);
 
     *ci = handle;
 
@@ -2444,6 +3757,53 @@ int col_create_collection(struct collection_item **ci, const char *name,
     return EOK;
 }
 
+/* Function that creates a named collection of a given class*/
+int col_create_collection(struct collection_item **ci, const char *name,
+                          unsigned cclass)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_create_collection", "Entry.");
+
+    error = col_create_collection_int(ci, name, cclass, NULL, 0);
+
+    TRACE_FLOW_NUMBER("col_create_collection. Exit. Returning", error);
+    return error;
+}
+
+/* Function that creates a named collection using flags */
+int col_create_collection_ex(struct collection_item **ci, const char *name,
+                             unsigned cclass, unsigned flags)
+{
+    struct col_arena *arena = NULL;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_create_collection_ex", "Entry.");
+
+    if (flags & ~(COL_CREATE_ARENA |
+                  COL_CREATE_INTERN |
+                  COL_CREATE_THREADSAFE)) {
+        TRACE_ERROR_NUMBER("Invalid flags", flags);
+        return EINVAL;
+    }
+
+    if (flags & COL_CREATE_ARENA) {
+        error = col_arena_create(&arena);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to create arena", error);
+            return error;
+        }
+    }
+
+    error = col_create_collection_int(ci, name, cclass, arena, flags);
+
+    /* The collection has its own reference if it was created */
+    col_arena_unref(arena);
+
+    TRACE_FLOW_NUMBER("col_create_collection_ex. Exit. Returning", error);
+    return error;
+}
+
 
 /* DESTROY */
 
@@ -2459,137 +3819,531 @@ void col_destroy_collection_with_cb(struct collection_item *ci,
     /* Do not try to delete NULL */
     if (ci == NULL) return;
 
-    /* You can delete only whole collection not a part of it */
-    if (ci->type != COL_TYPE_COLLECTION) {
-        TRACE_ERROR_STRING("Attempt to delete a non collection - BAD!", "");
-        TRACE_ERROR_NUMBER("Actual type is:", ci->type);
-        return;
+    /* You can delete only whole collection not a part of it */
+    if (ci->type != COL_TYPE_COLLECTION) {
+        TRACE_ERROR_STRING("Attempt to delete a non collection - BAD!", "");
+        TRACE_ERROR_NUMBER("Actual type is:", ci->type);
+        return;
+    }
+
+    TRACE_INFO_STRING("Name:", ci->property);
+
+    /* Collection can be referenced by other collection */
+    header = (struct collection_header *)(ci->data);
+    TRACE_INFO_NUMBER("Reference count:", header->reference_count);
+    if (col_reference_release(header) > 0) {
+        TRACE_INFO_STRING("Dereferenced a referenced collection.", "");
+        TRACE_INFO_NUMBER("Number after dereferencing.",
+                          header->reference_count);
+    }
+    else {
+        col_delete_collection(ci, cb, custom_data);
+    }
+
+    TRACE_FLOW_STRING("col_destroy_collection_with_cb", "Exit.");
+}
+
+
+/* Function that destroys a collection */
+void col_destroy_collection(struct collection_item *ci)
+{
+    TRACE_FLOW_STRING("col_destroy_collection", "Entry.");
+
+    col_destroy_collection_with_cb(ci, NULL, NULL);
+
+    TRACE_FLOW_STRING("col_destroy_collection", "Exit.");
+}
+
+/* LOCK */
+
+/* Lock the collection for a sequence of operations */
+int col_lock_collection(struct collection_item *ci, int write)
+{
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_lock_collection", "Entry.");
+
+    if ((ci == NULL) || (ci->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Invalid collection", EINVAL);
+        return EINVAL;
+    }
+
+    error = col_lock(ci, write);
+
+    TRACE_FLOW_NUMBER("col_lock_collection. Exit. Returning", error);
+    return error;
+}
+
+/* Unlock the collection */
+int col_unlock_collection(struct collection_item *ci)
+{
+    TRACE_FLOW_STRING("col_unlock_collection", "Entry.");
+
+    if ((ci == NULL) || (ci->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Invalid collection", EINVAL);
+        return EINVAL;
+    }
+
+    col_unlock(ci);
+
+    TRACE_FLOW_STRING("col_unlock_collection", "Exit.");
+    return EOK;
+}
+
+/* COPY */
+
+/* Wrapper around a more advanced function */
+int col_copy_collection(struct collection_item **collection_copy,
+                        struct collection_item *collection_to_copy,
+                        const char *name_to_use,
+                        int copy_mode)
+{
+    int error = EOK;
+    TRACE_FLOW_STRING("col_copy_collection", "Entry.");
+
+    error = col_copy_collection_with_cb(collection_copy,
+                                        collection_to_copy,
+                                        name_to_use,
+                                        copy_mode,
+                                        NULL,
+                                        NULL);
+
+    TRACE_FLOW_NUMBER("col_copy_collection. Exit. Returning", error);
+    return error;
+}
+
+/* Create a deep copy of the current collection. */
+/* Referenced collections of the donor are copied as sub collections. */
+/* Items of the copy are allocated from the given arena if any. */
+static int col_copy_collection_int(struct collection_item **collection_copy,
+                                   struct collection_item *collection_to_copy,
+                                   const char *name_to_use,
+                                   int copy_mode,
+                                   col_copy_cb copy_cb,
+                                   void *ext_data,
+                                   struct col_arena *arena,
+                                   unsigned create_flags)
+{
+    int error = EOK;
+    struct collection_item *new_collection = NULL;
+    const char *name;
+    struct collection_header *header;
+    unsigned depth = 0;
+    struct col_copy traverse_data;
+    int flags;
+
+    TRACE_FLOW_STRING("col_copy_collection_with_cb", "Entry.");
+
+    /* Collection is required */
+    if (collection_to_copy == NULL) {
+        TRACE_ERROR_NUMBER("No collection to search!", EINVAL);
+        return EINVAL;
+    }
+
+    /* Storage is required too */
+    if (collection_copy == NULL) {
+        TRACE_ERROR_NUMBER("No memory provided to receive collection copy!", EINVAL);
+        return EINVAL;
+    }
+
+    /* NOTE: Refine this check if adding a new copy mode */
+    if ((copy_mode < 0) || (copy_mode > COL_COPY_COW)) {
+        TRACE_ERROR_NUMBER("Invalid copy mode:", copy_mode);
+        return EINVAL;
+    }
+
+    /* Determine what name to use */
+    if (name_to_use != NULL)
+        name = name_to_use;
+    else
+        name = collection_to_copy->property;
+
+    header = (struct collection_header *)collection_to_copy->data;
+
+    /* Create a new collection */
+    error = col_create_collection_int(&new_collection, name,
+                                      header->cclass, arena, create_flags);
+    if (error) {
+        TRACE_ERROR_NUMBER("col_create_collection failed returning", error);
+        return error;
+    }
+
+    traverse_data.mode = copy_mode;
+    traverse_data.current_path = NULL;
+    traverse_data.given_name = NULL;
+    traverse_data.given_len = 0;
+    traverse_data.copy_cb = copy_cb;
+    traverse_data.ext_data = ext_data;
+
+    if (copy_mode == COL_COPY_FLATDOT) flags = COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END;
+    else if (copy_mode == COL_COPY_FLAT) flags = COL_TRAVERSE_FLAT;
+    else flags = COL_TRAVERSE_ONELEVEL;
+
+    error = col_walk_items(collection_to_copy, flags,
+                           col_copy_traverse_handler, (void *)(&traverse_data),
+                           NULL, new_collection, &depth);
+
+    if (!error) *collection_copy = new_collection;
+    else col_destroy_collection(new_collection);
+
+    TRACE_FLOW_NUMBER("col_copy_collection_with_cb returning", error);
+    return error;
+
+}
+
+/* Create a deep copy of the collection.
+ * Copy of the collection that uses arena gets its own arena.
+ * The copy is created with the same flags as the original.
+ */
+int col_copy_collection_with_cb(struct collection_item **collection_copy,
+                                struct collection_item *collection_to_copy,
+                                const char *name_to_use,
+                                int copy_mode,
+                                col_copy_cb copy_cb,
+                                void *ext_data)
+{
+    struct col_arena *arena = NULL;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_copy_collection_with_cb", "Entry.");
+
+    /* Readers of the thread-safe collection can't change
+     * the shared sub collections so the copy is deep.
+     */
+    if ((copy_mode == COL_COPY_COW) &&
+        (col_get_flags(collection_to_copy) & COL_CREATE_THREADSAFE))
+        copy_mode = COL_COPY_NORMAL;
+
+    if (col_get_arena(collection_to_copy)) {
+        error = col_arena_create(&arena);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to create arena", error);
+            return error;
+        }
+    }
+
+    error = col_lock(collection_to_copy, 0);
+    if (error) {
+        col_arena_unref(arena);
+        return error;
+    }
+
+    error = col_copy_collection_int(collection_copy,
+                                    collection_to_copy,
+                                    name_to_use,
+                                    copy_mode,
+                                    copy_cb,
+                                    ext_data,
+                                    arena,
+                                    col_get_flags(collection_to_copy));
+
+    col_unlock(collection_to_copy);
+
+    /* The copy has its own reference if it was created */
+    col_arena_unref(arena);
+
+    TRACE_FLOW_NUMBER("col_copy_collection_with_cb returning", error);
+    return error;
+
+}
+
+/* Make private copy of the sub collection that is shared
+ * with a copy-on-write copy. The reference is updated to point
+ * to the new copy that uses the arena and flags of the collection.
+ */
+int col_unshare_item(struct collection_item *collection,
+                     struct collection_item *item)
+{
+    struct collection_item *sub;
+    struct collection_item *copy = NULL;
+    struct collection_header *header;
+    int error = EOK;
+
+    if (!(item->flags & COL_ITEM_SHARED)) return EOK;
+
+    TRACE_FLOW_STRING("col_unshare_item", item->property);
+
+    sub = *((struct collection_item **)(item->data));
+    header = (struct collection_header *)(sub->data);
+
+    /* The other side might have stopped sharing already */
+    if (header->reference_count > 1) {
+        error = col_copy_collection_int(&copy,
+                                        sub,
+                                        NULL,
+                                        COL_COPY_COW,
+                                        NULL,
+                                        NULL,
+                                        col_get_arena(collection),
+                                        col_get_flags(collection) &
+                                        ~COL_CREATE_THREADSAFE);
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to copy shared collection", error);
+            return error;
+        }
+
+        *((struct collection_item **)(item->data)) = copy;
+        col_destroy_collection(sub);
+    }
+
+    item->flags &= ~COL_ITEM_SHARED;
+
+    TRACE_FLOW_STRING("col_unshare_item", "Exit.");
+    return EOK;
+}
+
+/* Find the item that is at the same position in the copy of the collection */
+static struct collection_item *col_find_same_item(struct collection_item *from,
+                                                  struct collection_item *to,
+                                                  struct collection_item *item)
+{
+    while ((from != item) && (to != NULL)) {
+        from = from->next;
+        to = to->next;
+    }
+
+    return to;
+}
+
+/* Unshare the sub collections the search went through to get
+ * to the collection. Outer collections are unshared first.
+ * The private copy of the collection is returned in place of it.
+ */
+static int col_unshare_path(struct path_data *path,
+                            struct collection_item **collection)
+{
+    struct collection_item *owner;
+    struct collection_item *ref;
+    int error;
+
+    /* Top collection is never shared */
+    if ((path == NULL) || (path->ref == NULL)) return EOK;
+
+    owner = path->owner;
+    error = col_unshare_path(path->previous_path, &owner);
+    if (error) return error;
+
+    ref = col_find_same_item(path->owner, owner, path->ref);
+    error = col_unshare_item(owner, ref);
+    if (error) return error;
+
+    *collection = *((struct collection_item **)(ref->data));
+    return EOK;
+}
+
+/* Unshare all sub collections of the collection */
+static int col_unshare_tree(struct collection_item *collection)
+{
+    struct collection_item *current;
+    int error;
+
+    for (current = collection->next; current; current = current->next) {
+        if (current->type != COL_TYPE_COLLECTIONREF) continue;
+
+        error = col_unshare_item(collection, current);
+        if (error) return error;
+
+        error = col_unshare_tree(*((struct collection_item **)(current->data)));
+        if (error) return error;
+    }
+
+    return EOK;
+}
+
+/* Freeze the collection and its sub collections.
+ * Lookup tables are built before so that readers never change them.
+ */
+static void col_freeze(struct collection_item *collection)
+{
+    struct collection_header *header;
+    struct collection_item *current;
+
+    TRACE_FLOW_STRING("col_freeze", "Entry.");
+
+    header = (struct collection_header *)collection->data;
+    if (header->flags & COL_HEADER_FROZEN) return;
+
+    col_index_freeze(collection);
+    header->flags |= COL_HEADER_FROZEN;
+    collection->flags |= COL_ITEM_FROZEN;
+
+    for (current = collection->next; current; current = current->next) {
+        current->flags |= COL_ITEM_FROZEN;
+        if (current->type == COL_TYPE_COLLECTIONREF)
+            col_freeze(*((struct collection_item **)current->data));
+    }
+
+    TRACE_FLOW_STRING("col_freeze", "Exit.");
+}
+
+/* Make an immutable copy of the collection.
+ * The copy is allocated from its own arena and
+ * can be read by many threads without locking.
+ */
+int col_copy_frozen(struct collection_item **collection_copy,
+                    struct collection_item *collection)
+{
+    struct col_arena *arena = NULL;
+    struct collection_item *new_collection = NULL;
+    int error = EOK;
+
+    TRACE_FLOW_STRING("col_copy_frozen", "Entry.");
+
+    error = col_arena_create(&arena);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to create arena", error);
+        return error;
+    }
+
+    error = col_lock(collection, 0);
+    if (error) {
+        col_arena_unref(arena);
+        return error;
     }
 
-    TRACE_INFO_STRING("Name:", ci->property);
+    error = col_copy_collection_int(&new_collection,
+                                    collection,
+                                    NULL,
+                                    COL_COPY_NORMAL,
+                                    NULL,
+                                    NULL,
+                                    arena,
+                                    col_get_flags(collection) &
+                                    ~COL_CREATE_THREADSAFE);
 
-    /* Collection can be referenced by other collection */
-    header = (struct collection_header *)(ci->data);
-    TRACE_INFO_NUMBER("Reference count:", header->reference_count);
-    if (header->reference_count > 1) {
-        TRACE_INFO_STRING("Dereferencing a referenced collection.", "");
-        header->reference_count--;
-        TRACE_INFO_NUMBER("Number after dereferencing.",
-                          header->reference_count);
-    }
-    else {
-        col_delete_collection(ci, cb, custom_data);
+    col_unlock(collection);
+    col_arena_unref(arena);
+
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to copy collection", error);
+        return error;
     }
 
-    TRACE_FLOW_STRING("col_destroy_collection_with_cb", "Exit.");
-}
+    col_freeze(new_collection);
+    *collection_copy = new_collection;
 
+    TRACE_FLOW_STRING("col_copy_frozen", "Exit.");
+    return EOK;
+}
 
-/* Function that destroys a collection */
-void col_destroy_collection(struct collection_item *ci)
+/* Move the items of one level of the collection into the arena
+ * so that they follow each other in memory.
+ * The header stays in place since it is the handle of the collection.
+ */
+static int col_compact(struct collection_item *collection,
+                       struct col_arena *arena)
 {
-    TRACE_FLOW_STRING("col_destroy_collection", "Entry.");
+    struct collection_header *header;
+    struct collection_item *prev;
+    struct collection_item *current;
+    struct collection_item *moved;
 
-    col_destroy_collection_with_cb(ci, NULL, NULL);
+    TRACE_FLOW_STRING("col_compact", "Entry.");
 
-    TRACE_FLOW_STRING("col_destroy_collection", "Exit.");
-}
+    header = (struct collection_header *)collection->data;
 
-/* COPY */
+    /* Index points to the items that are moved */
+    col_index_free(header);
+    col_position_free(header);
 
-/* Wrapper around a more advanced function */
-int col_copy_collection(struct collection_item **collection_copy,
-                        struct collection_item *collection_to_copy,
-                        const char *name_to_use,
-                        int copy_mode)
-{
-    int error = EOK;
-    TRACE_FLOW_STRING("col_copy_collection", "Entry.");
+    /* Collection holds the arena its items are moved to */
+    header->arena = arena;
+    col_arena_ref(arena);
 
-    error = col_copy_collection_with_cb(collection_copy,
-                                        collection_to_copy,
-                                        name_to_use,
-                                        copy_mode,
-                                        NULL,
-                                        NULL);
+    prev = collection;
+    while ((current = prev->next)) {
+        moved = (struct collection_item *)
+                    col_arena_alloc(arena, sizeof(struct collection_item));
+        if (moved == NULL) {
+            TRACE_ERROR_NUMBER("Failed to allocate item", ENOMEM);
+            return ENOMEM;
+        }
 
-    TRACE_FLOW_NUMBER("col_copy_collection. Exit. Returning", error);
-    return error;
+        memcpy(moved, current, sizeof(struct collection_item));
+        if (current->flags & COL_ITEM_INLINE_PROPERTY)
+            moved->property = moved->space.buf +
+                              (current->property - current->space.buf);
+        if (current->flags & COL_ITEM_INLINE_DATA)
+            moved->data = moved->space.buf +
+                          ((char *)current->data - current->space.buf);
+        moved->flags |= COL_ITEM_ARENA;
+
+        prev->next = moved;
+        if (header->last == current) header->last = moved;
+        if (!(current->flags & COL_ITEM_ARENA)) free(current);
+
+        prev = moved;
+    }
+
+    TRACE_FLOW_STRING("col_compact", "Exit.");
+    return EOK;
 }
 
-/* Create a deep copy of the current collection. */
-/* Referenced collections of the donor are copied as sub collections. */
-int col_copy_collection_with_cb(struct collection_item **collection_copy,
-                                struct collection_item *collection_to_copy,
-                                const char *name_to_use,
-                                int copy_mode,
-                                col_copy_cb copy_cb,
-                                void *ext_data)
+/* Compact the collection and its sub collections
+ * that do not use an arena. They share one arena
+ * that is created when it is needed.
+ */
+static int col_compact_tree(struct collection_item *collection,
+                            struct col_arena **arena)
 {
-    int error = EOK;
-    struct collection_item *new_collection = NULL;
-    const char *name;
     struct collection_header *header;
-    unsigned depth = 0;
-    struct col_copy traverse_data;
-    int flags;
+    struct collection_item *current;
+    int error = EOK;
 
-    TRACE_FLOW_STRING("col_copy_collection_with_cb", "Entry.");
+    header = (struct collection_header *)collection->data;
+    if (header->flags & COL_HEADER_FROZEN) return EOK;
 
-    /* Collection is required */
-    if (collection_to_copy == NULL) {
-        TRACE_ERROR_NUMBER("No collection to search!", EINVAL);
-        return EINVAL;
+    if (header->arena == NULL) {
+        if ((*arena == NULL) && (error = col_arena_create(arena))) {
+            TRACE_ERROR_NUMBER("Failed to create arena", error);
+            return error;
+        }
+        error = col_compact(collection, *arena);
+        if (error) return error;
     }
 
-    /* Storage is required too */
-    if (collection_copy == NULL) {
-        TRACE_ERROR_NUMBER("No memory provided to receive collection copy!", EINVAL);
-        return EINVAL;
+    for (current = collection->next; current; current = current->next) {
+        if (current->type == COL_TYPE_COLLECTIONREF) {
+            error = col_compact_tree(*((struct collection_item **)current->data),
+                                     arena);
+            if (error) return error;
+        }
     }
 
-    /* NOTE: Refine this check if adding a new copy mode */
-    if ((copy_mode < 0) || (copy_mode > COL_COPY_TOP)) {
-        TRACE_ERROR_NUMBER("Invalid copy mode:", copy_mode);
-        return EINVAL;
-    }
+    return EOK;
+}
 
-    /* Determine what name to use */
-    if (name_to_use != NULL)
-        name = name_to_use;
-    else
-        name = collection_to_copy->property;
+/* Make the collection immutable in place */
+int col_freeze_collection(struct collection_item *ci)
+{
+    struct col_arena *arena = NULL;
+    int error = EOK;
 
-    header = (struct collection_header *)collection_to_copy->data;
+    TRACE_FLOW_STRING("col_freeze_collection", "Entry.");
 
-    /* Create a new collection */
-    error = col_create_collection(&new_collection, name, header->cclass);
-    if (error) {
-        TRACE_ERROR_NUMBER("col_create_collection failed returning", error);
-        return error;
+    if ((ci == NULL) || (ci->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
     }
 
-    traverse_data.mode = copy_mode;
-    traverse_data.current_path = NULL;
-    traverse_data.given_name = NULL;
-    traverse_data.given_len = 0;
-    traverse_data.copy_cb = copy_cb;
-    traverse_data.ext_data = ext_data;
+    if (((struct collection_header *)ci->data)->flags & COL_HEADER_FROZEN) {
+        TRACE_FLOW_STRING("Collection is already frozen", "");
+        return EOK;
+    }
 
-    if (copy_mode == COL_COPY_FLATDOT) flags = COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END;
-    else if (copy_mode == COL_COPY_FLAT) flags = COL_TRAVERSE_FLAT;
-    else flags = COL_TRAVERSE_ONELEVEL;
+    error = col_lock(ci, 1);
+    if (error) return error;
 
-    error = col_walk_items(collection_to_copy, flags,
-                           col_copy_traverse_handler, (void *)(&traverse_data),
-                           NULL, new_collection, &depth);
+    /* Sub collections shared with copies must stay changeable for them */
+    error = col_unshare_tree(ci);
+    if (!error) error = col_compact_tree(ci, &arena);
+    if (!error) col_freeze(ci);
 
-    if (!error) *collection_copy = new_collection;
-    else col_destroy_collection(new_collection);
+    col_unlock(ci);
+    col_arena_unref(arena);
 
-    TRACE_FLOW_NUMBER("col_copy_collection_with_cb returning", error);
+    TRACE_FLOW_NUMBER("col_freeze_collection. Returning", error);
     return error;
-
 }
 
 
@@ -2622,7 +4376,7 @@ int col_get_collection_reference(struct collection_item *ci,
                                      COL_TRAVERSE_DEFAULT,
                                      col_get_subcollection,
                                      (void *)(&subcollection),
-                                     COLLECTION_ACTION_FIND);
+                                     COLLECTION_ACTION_FIND_WRITE);
         if (error) {
             TRACE_ERROR_NUMBER("Search failed returning error", error);
             return error;
@@ -2642,7 +4396,7 @@ int col_get_collection_reference(struct collection_item *ci,
     header = (struct collection_header *)subcollection->data;
     TRACE_INFO_NUMBER("Count:", header->count);
     TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-    header->reference_count++;
+    col_reference_add(header);
     TRACE_INFO_NUMBER("Ref count after increment:", header->reference_count);
     *acceptor = subcollection;
 
@@ -2671,7 +4425,7 @@ int col_get_reference_from_item(struct collection_item *ci,
     header = (struct collection_header *)subcollection->data;
     TRACE_INFO_NUMBER("Count:", header->count);
     TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-    header->reference_count++;
+    col_reference_add(header);
     TRACE_INFO_NUMBER("Ref count after increment:", header->reference_count);
     *acceptor = subcollection;
 
@@ -2682,11 +4436,11 @@ int col_get_reference_from_item(struct collection_item *ci,
 /* ADDITION */
 
 /* Add collection to collection */
-int col_add_collection_to_collection(struct collection_item *ci,
-                                     const char *sub_collection_name,
-                                     const char *as_property,
-                                     struct collection_item *collection_to_add,
-                                     int mode)
+static int col_add_collection_to_collection_int(struct collection_item *ci,
+                                                const char *sub_collection_name,
+                                                const char *as_property,
+                                                struct collection_item *collection_to_add,
+                                                int mode)
 {
     struct collection_item *acceptor = NULL;
     const char *name_to_use;
@@ -2717,7 +4471,7 @@ int col_add_collection_to_collection(struct collection_item *ci,
                                      COL_TRAVERSE_DEFAULT,
                                      col_get_subcollection,
                                      (void *)(&acceptor),
-                                     COLLECTION_ACTION_FIND);
+                                     COLLECTION_ACTION_FIND_WRITE);
         if (error) {
             TRACE_ERROR_NUMBER("Search failed returning error", error);
             return error;
@@ -2774,7 +4528,7 @@ int col_add_collection_to_collection(struct collection_item *ci,
         header = (struct collection_header *)collection_to_add->data;
         TRACE_INFO_NUMBER("Count:", header->count);
         TRACE_INFO_NUMBER("Ref count:", header->reference_count);
-        header->reference_count++;
+        col_reference_add(header);
         TRACE_INFO_NUMBER("Ref count after increment:",
                           header->reference_count);
         /* -> Transaction end */
@@ -2813,9 +4567,21 @@ int col_add_collection_to_collection(struct collection_item *ci,
         TRACE_INFO_STRING("Name we will use.", name_to_use);
 
         /* For future thread safety: Transaction start -> */
-        error = col_copy_collection(&collection_copy,
-                                    collection_to_add, name_to_use,
-                                    COL_COPY_NORMAL);
+        /* The clone becomes a sub collection so it shares
+         * the arena and the flags of the acceptor.
+         * It is protected by the lock of the collection.
+         */
+        if ((col_get_arena(acceptor)) || (col_get_flags(acceptor)))
+            error = col_copy_collection_int(&collection_copy,
+                                            collection_to_add, name_to_use,
+                                            COL_COPY_NORMAL, NULL, NULL,
+                                            col_get_arena(acceptor),
+                                            col_get_flags(acceptor) &
+                                            ~COL_CREATE_THREADSAFE);
+        else
+            error = col_copy_collection(&collection_copy,
+                                        collection_to_add, name_to_use,
+                                        COL_COPY_NORMAL);
         if (error) return error;
 
         TRACE_INFO_STRING("We have a collection copy.", collection_copy->property);
@@ -2915,14 +4681,46 @@ int col_add_collection_to_collection(struct collection_item *ci,
     return error;
 }
 
+/* Add collection to collection holding the locks.
+ * The collection that is added is locked for reading.
+ */
+int col_add_collection_to_collection(struct collection_item *ci,
+                                     const char *sub_collection_name,
+                                     const char *as_property,
+                                     struct collection_item *collection_to_add,
+                                     int mode)
+{
+    int error;
+
+    error = col_lock(ci, 1);
+    if (error) return error;
+
+    error = col_lock(collection_to_add, 0);
+    if (error) {
+        col_unlock(ci);
+        return error;
+    }
+
+    error = col_add_collection_to_collection_int(ci,
+                                                 sub_collection_name,
+                                                 as_property,
+                                                 collection_to_add,
+                                                 mode);
+
+    col_unlock(collection_to_add);
+    col_unlock(ci);
+
+    return error;
+}
+
 /* TRAVERSING */
 
 /* Function to traverse the entire collection including optionally
  * sub collections */
-int col_traverse_collection(struct collection_item *ci,
-                            int mode_flags,
-                            col_item_fn item_handler,
-                            void *custom_data)
+static int col_traverse_collection_int(struct collection_item *ci,
+                                       int mode_flags,
+                                       col_item_fn item_handler,
+                                       void *custom_data)
 {
 
     int error = EOK;
@@ -2947,6 +4745,218 @@ int col_traverse_collection(struct collection_item *ci,
     return EOK;
 }
 
+/* Traverse collection holding the lock */
+int col_traverse_collection(struct collection_item *ci,
+                            int mode_flags,
+                            col_item_fn item_handler,
+                            void *custom_data)
+{
+    int error;
+
+    error = col_lock(ci, 0);
+    if (error) return error;
+
+    error = col_traverse_collection_int(ci,
+                                        mode_flags,
+                                        item_handler,
+                                        custom_data);
+
+    col_unlock(ci);
+
+    return error;
+}
+
+/* Maximum number of threads that traverse sub collections */
+#define COL_TRAVERSE_THREADS_MAX 16
+
+/* Sub collections that are traversed in parallel.
+ * Threads take the references from the list one by one.
+ */
+struct col_traverse_work {
+    struct collection_item *next;
+    int mode_flags;
+    col_item_fn item_handler;
+    void *custom_data;
+    int stop;
+    int error;
+    pthread_mutex_t mutex;
+};
+
+/* Stops the walk as soon as any thread stops or fails */
+static int col_parallel_traverse_handler(struct collection_item *head,
+                                         struct collection_item *previous,
+                                         struct collection_item *current,
+                                         void *traverse_data,
+                                         col_item_fn user_item_handler,
+                                         void *custom_data,
+                                         int *stop)
+{
+    struct col_traverse_work *work = (struct col_traverse_work *)traverse_data;
+
+    if (__atomic_load_n(&(work->stop), __ATOMIC_RELAXED)) {
+        *stop = 1;
+        return EOK;
+    }
+
+    return col_simple_traverse_handler(head, previous, current, NULL,
+                                       user_item_handler, custom_data, stop);
+}
+
+/* Traverse sub collections till there is nothing left */
+static void *col_traverse_worker(void *data)
+{
+    struct col_traverse_work *work = (struct col_traverse_work *)data;
+    struct collection_item *item;
+    unsigned depth;
+    int error;
+
+    TRACE_FLOW_ENTRY();
+
+    for (;;) {
+        pthread_mutex_lock(&(work->mutex));
+        while ((work->next) &&
+               (work->next->type != COL_TYPE_COLLECTIONREF))
+            work->next = work->next->next;
+        item = work->stop ? NULL : work->next;
+        if (item) work->next = item->next;
+        pthread_mutex_unlock(&(work->mutex));
+
+        if (item == NULL) break;
+
+        /* Sub collection is walked as the second level of the tree */
+        depth = 1;
+        error = col_walk_items(*((struct collection_item **)(item->data)),
+                               work->mode_flags,
+                               col_parallel_traverse_handler,
+                               (void *)work, work->item_handler,
+                               work->custom_data, &depth);
+        if (error) {
+            pthread_mutex_lock(&(work->mutex));
+            if ((error != EINTR_INTERNAL) && (!work->error)) {
+                TRACE_ERROR_NUMBER("Subcollection traverse failed", error);
+                work->error = error;
+            }
+            __atomic_store_n(&(work->stop), 1, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&(work->mutex));
+        }
+    }
+
+    TRACE_FLOW_EXIT();
+    return NULL;
+}
+
+/* Traverse the collection and its sub collections using several threads */
+static int col_traverse_parallel_int(struct collection_item *ci,
+                                     int mode_flags,
+                                     unsigned threads,
+                                     col_item_fn item_handler,
+                                     void *custom_data)
+{
+    struct col_traverse_work work;
+    pthread_t workers[COL_TRAVERSE_THREADS_MAX];
+    unsigned depth = 0;
+    unsigned count = 0;
+    unsigned i;
+    long cpus;
+    int stop = 0;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((ci == NULL) || (item_handler == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    if (threads == 0) {
+        cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = (cpus > 0) ? (unsigned)cpus : 1;
+    }
+    if (threads > COL_TRAVERSE_THREADS_MAX) threads = COL_TRAVERSE_THREADS_MAX;
+
+    /* Nothing to spread between the threads */
+    if ((threads == 1) ||
+        (mode_flags & (COL_TRAVERSE_ONELEVEL | COL_TRAVERSE_IGNORE))) {
+        error = col_traverse_collection_int(ci, mode_flags,
+                                            item_handler, custom_data);
+        TRACE_FLOW_RETURN(error);
+        return error;
+    }
+
+    /* Items of the top level are processed first by the calling thread */
+    error = col_walk_items(ci,
+                           (mode_flags & ~COL_TRAVERSE_END) |
+                           COL_TRAVERSE_ONELEVEL,
+                           col_simple_traverse_handler,
+                           NULL, item_handler, custom_data, &depth);
+    if (error) {
+        if (error == EINTR_INTERNAL) error = EOK;
+        TRACE_FLOW_RETURN(error);
+        return error;
+    }
+
+    work.next = ci->next;
+    work.mode_flags = mode_flags;
+    work.item_handler = item_handler;
+    work.custom_data = custom_data;
+    work.stop = 0;
+    work.error = EOK;
+    if (pthread_mutex_init(&(work.mutex), NULL)) {
+        TRACE_ERROR_NUMBER("Failed to init mutex", ENOMEM);
+        return ENOMEM;
+    }
+
+    /* The calling thread is one of the traversing threads */
+    for (i = 1; i < threads; i++) {
+        if (pthread_create(&(workers[count]), NULL,
+                           col_traverse_worker, &work)) {
+            TRACE_INFO_NUMBER("Failed to start thread", i);
+            break;
+        }
+        count++;
+    }
+
+    TRACE_INFO_NUMBER("Number of traversing threads:", count + 1);
+
+    col_traverse_worker(&work);
+
+    for (i = 0; i < count; i++) pthread_join(workers[i], NULL);
+
+    pthread_mutex_destroy(&(work.mutex));
+
+    /* End of the top level comes after all sub collections */
+    error = work.error;
+    if ((!work.stop) && (mode_flags & COL_TRAVERSE_END))
+        error = col_simple_traverse_handler(ci, NULL, NULL, NULL,
+                                            item_handler, custom_data, &stop);
+
+    TRACE_FLOW_RETURN(error);
+    return error;
+}
+
+/* Traverse collection in parallel holding the lock */
+int col_traverse_collection_parallel(struct collection_item *ci,
+                                     int mode_flags,
+                                     unsigned threads,
+                                     col_item_fn item_handler,
+                                     void *custom_data)
+{
+    int error;
+
+    error = col_lock(ci, 0);
+    if (error) return error;
+
+    error = col_traverse_parallel_int(ci,
+                                      mode_flags,
+                                      threads,
+                                      item_handler,
+                                      custom_data);
+
+    col_unlock(ci);
+
+    return error;
+}
+
 /* CHECK */
 
 /* Convenience function to check if specific property is in the collection */
@@ -3091,12 +5101,18 @@ int col_modify_item(struct collection_item *item,
         return EINVAL;
     }
 
+    /* Lookup tables of the frozen collection are never updated */
+    if (item->flags & COL_ITEM_FROZEN) {
+        TRACE_ERROR_NUMBER("Item of the frozen collection", EPERM);
+        return EPERM;
+    }
+
     if (property != NULL) {
         if (col_validate_property(property)) {
             TRACE_ERROR_STRING("Invalid chracters in the property name", property);
             return EINVAL;
         }
-        free(item->property);
+        col_free_property(item);
         item->property = strdup(property);
         if (item->property == NULL) {
             TRACE_ERROR_STRING("Failed to allocate memory", "");
@@ -3105,6 +5121,9 @@ int col_modify_item(struct collection_item *item,
 
         /* Update property length and hash if we rename the property */
         item->phash = col_make_hash(property, 0, &(item->property_len));
+
+        /* Indexes that contain this item are now stale */
+        if (item->type != COL_TYPE_COLLECTION) col_index_invalidate(item);
         TRACE_INFO_NUMBER("Item hash", item->phash);
         TRACE_INFO_NUMBER("Item property length", item->property_len);
         TRACE_INFO_NUMBER("Item property strlen", strlen(item->property));
@@ -3120,7 +5139,7 @@ int col_modify_item(struct collection_item *item,
             ((item->type == type) &&
             ((item->type == COL_TYPE_STRING) || (item->type == COL_TYPE_BINARY)))) {
             TRACE_INFO_STRING("Replacing item data buffer", "");
-            free(item->data);
+            col_free_data(item);
             item->data = malloc(length);
             if (item->data == NULL) {
                 TRACE_ERROR_STRING("Failed to allocate memory", "");
@@ -3130,6 +5149,11 @@ int col_modify_item(struct collection_item *item,
             item->length = length;
         }
 
+        /* Indexes count sub collection references */
+        if ((item->type != type) &&
+            ((item->type == COL_TYPE_COLLECTIONREF) ||
+             (type == COL_TYPE_COLLECTIONREF))) col_index_invalidate(item);
+
         TRACE_INFO_STRING("Overwriting item data", "");
         memcpy(item->data, data, item->length);
         item->type = type;
@@ -3263,14 +5287,19 @@ uint64_t col_make_hash(const char *string, int sub_len, int *length)
 
     if (string) {
         hash = FNV1a_base;
-        while (string[str_len] != 0) {
-
-            /* Check if we need to stop */
-            if ((sub_len > 0) && (str_len == sub_len)) break;
 
-            hash = hash ^ toupper(string[str_len]);
-            hash *= FNV1a_prime;
-            str_len++;
+        /* Check if we need to stop only when the length is given */
+        if (sub_len > 0) {
+            while ((str_len < sub_len) && (string[str_len] != 0)) {
+                hash = col_hash_char(hash, string[str_len]);
+                str_len++;
+            }
+        }
+        else {
+            while (string[str_len] != 0) {
+                hash = col_hash_char(hash, string[str_len]);
+                str_len++;
+            }
         }
     }
 
@@ -22,6 +22,7 @@
 #ifndef COLLECTION_H
 #define COLLECTION_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 /** @mainpage The COLLECTION interface
@@ -240,6 +241,68 @@
  * @}
  */
 
+/**
+ * @defgroup createflags Flags used when a collection is created
+ *
+ * The following flags can be passed to \ref col_create_collection_ex.
+ *
+ * @{
+ */
+/**
+ * @brief Allocate items of the collection from an arena.
+ *
+ * Items, property names and values are carved out of
+ * large memory blocks that are all released at once
+ * when the collection is destroyed.
+ * Sub collections that the library creates inside such
+ * collection, for example when a collection is added in the
+ * \ref COL_ADD_MODE_CLONE mode, use the same arena.
+ * A copy of such collection gets its own arena.<br>
+ * Memory of the items that are deleted or modified
+ * is not reused until the collection is destroyed so
+ * this mode is best for collections that are built
+ * once and then mostly read, like parsed configuration.
+ * Extracted items are moved out of the arena.
+ */
+#define COL_CREATE_ARENA       0x00000001
+/**
+ * @brief Intern property names of the collection.
+ *
+ * Property names are stored once in a table shared by all
+ * collections created with this flag, together with
+ * their precomputed hash.
+ * Names that differ only in case are then compared
+ * without looking at the strings.
+ * A renamed item gets its own copy of the name.
+ * Copies of such collection and collections cloned
+ * into it intern their names too.
+ */
+#define COL_CREATE_INTERN      0x00000002
+/**
+ * @brief Make the collection safe to use from several threads.
+ *
+ * The collection gets a read-write lock.
+ * Functions that search or traverse the collection
+ * take the lock for reading so many threads can
+ * read the collection at the same time.
+ * Functions that change the collection take
+ * the lock for writing. The reference count
+ * of the collection is changed atomically.<br>
+ * The lock covers the sub collections that are
+ * reached through the collection. Sub collections the
+ * library creates inside the collection do not have
+ * a lock of their own.<br>
+ * Iterators, \ref col_modify_item and the functions that
+ * work on the items directly do not lock the collection.
+ * Use \ref col_lock_collection around them.<br>
+ * Callbacks called with the read lock held
+ * must not change the collection.
+ */
+#define COL_CREATE_THREADSAFE  0x00000004
+/**
+ * @}
+ */
+
 
 /**
  * @defgroup traverseconst Constants defining traverse modes
@@ -367,6 +430,23 @@
 #define COL_COPY_KEEPREF        3
 /** @brief Copy only top level collection. */
 #define COL_COPY_TOP            4
+/**
+ * @brief Perform a copy-on-write copy.
+ *
+ * Only the top level collection is copied. Sub collections
+ * are shared with the donor until they are changed through
+ * either of the two collections. Then only the sub collections
+ * on the path to the changed item are copied.
+ * The copy callback is not called for the items of the shared
+ * sub collections.
+ * Items returned by \ref col_get_item, iterators or
+ * \ref col_get_reference_from_item can belong to a shared
+ * sub collection so changing them directly changes both
+ * collections. Use \ref col_get_collection_reference to get a
+ * sub collection that can be changed.
+ * Thread-safe collections are always copied deeply.
+ */
+#define COL_COPY_COW            5
 /**
  * @}
  */
@@ -393,6 +473,16 @@
  * Ignored if \ref COL_SORT_SUB is not specified.
  */
 #define COL_SORT_MYSUB  0x00000004
+/**
+ * @brief Sort sub collections in parallel.
+ *
+ * Sub collections are sorted by several threads.
+ * Used only together with \ref COL_SORT_SUB and
+ * \ref COL_SORT_MYSUB so that only the sub collections
+ * that are not referenced from other places are sorted
+ * and no collection is sorted by two threads at once.
+ */
+#define COL_SORT_PARALLEL 0x00000008
 /**
  * @}
  */
@@ -432,6 +522,35 @@ struct collection_iterator;
 
 #endif /* COLLECTION_PRIV_H */
 
+/**
+ * @struct collection_iterator_storage
+ * @brief Storage for the iterator provided by the caller.
+ *
+ * The storage can be declared on the stack or embedded
+ * into other structure. See \ref col_bind_iterator_storage.
+ *
+ * Caller should never assume
+ * anything about internals of this structure.
+ */
+struct collection_iterator_storage {
+    /** @cond Internal */
+    void *reserved[20];
+    /** @endcond */
+};
+
+/**
+ * @struct col_snapshot
+ * @brief Opaque snapshot structure.
+ *
+ * The snapshot holds the immutable copy
+ * of the collection that is published
+ * to the readers.
+ *
+ * Caller should never assume
+ * anything about internals of this structure.
+ */
+struct col_snapshot;
+
 
 /**
  * @brief Create a collection
@@ -473,6 +592,31 @@ int col_create_collection(struct collection_item **ci,
                           const char *name,
                           unsigned cclass);
 
+/**
+ * @brief Create a collection using flags
+ *
+ * The function is the same as \ref col_create_collection
+ * but allows to control how the collection is created.
+ *
+ * @param[out] ci     Newly allocated collection object.
+ * @param[in]  name   The name of the collection.
+ *                    See \ref col_create_collection for details.
+ * @param[in]  cclass Class of the collection.
+ *                    See \ref col_create_collection for details.
+ * @param[in]  flags  Bit mask of the flags.
+ *                    See \ref createflags "create flags" for details.
+ *
+ * @return 0          - Collection was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid characters in the collection name
+ *                      or invalid flags.
+ * @return EMSGSIZE   - Collection name is too long.
+ */
+int col_create_collection_ex(struct collection_item **ci,
+                             const char *name,
+                             unsigned cclass,
+                             unsigned flags);
+
 /**
  * @brief Destroy a collection
  *
@@ -483,6 +627,72 @@ int col_create_collection(struct collection_item **ci,
  */
 void col_destroy_collection(struct collection_item *ci);
 
+/**
+ * @brief Lock a collection
+ *
+ * Locks a collection created with \ref COL_CREATE_THREADSAFE
+ * flag so that a sequence of operations is done atomically.
+ * The library functions called by the thread that holds
+ * the lock do not lock the collection again.
+ * The lock held for reading can't be upgraded.
+ * The function does nothing for other collections.
+ *
+ * @param[in] ci      Collection object.
+ * @param[in] write   Lock for writing if not 0,
+ *                    for reading otherwise.
+ *
+ * @return 0          - Collection was locked successfully.
+ * @return EINVAL     - Invalid parameter.
+ * @return EDEADLK    - The thread holds the lock for reading
+ *                      and wants to write or holds locks of
+ *                      too many collections.
+ * @return EPERM      - Immutable collection can't be locked
+ *                      for writing.
+ */
+int col_lock_collection(struct collection_item *ci, int write);
+
+/**
+ * @brief Unlock a collection
+ *
+ * Releases the lock taken by \ref col_lock_collection.
+ *
+ * @param[in] ci      Collection object.
+ *
+ * @return 0          - Collection was unlocked successfully.
+ * @return EINVAL     - Invalid parameter.
+ */
+int col_unlock_collection(struct collection_item *ci);
+
+/**
+ * @brief Freeze a collection
+ *
+ * Makes the collection and its sub collections immutable.
+ * Functions that would change them return EPERM afterwards.
+ * Every level of the collection gets a perfect hash
+ * so that the lookup of a property takes one probe.
+ * Items of the collections that were not created with
+ * \ref COL_CREATE_ARENA are moved into one block of memory
+ * in the order of the list.
+ *
+ * The collection handle stays valid but the items
+ * obtained from the collection before it was frozen
+ * and the iterators bound to it must not be used.
+ * Sub collections shared with \ref COL_COPY_COW "copies"
+ * are copied first. Sub collections added by reference
+ * to other collections are frozen for them too.
+ * \ref col_modify_item returns EPERM for the items
+ * of the frozen collection.
+ *
+ * @param[in] ci      Collection object.
+ *
+ * @return 0          - Collection was frozen successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter.
+ * @return EDEADLK    - The thread holds the lock of the
+ *                      thread-safe collection for reading.
+ */
+int col_freeze_collection(struct collection_item *ci);
+
 /**
  * @brief Cleanup Callback
  *
@@ -715,6 +925,52 @@ int col_traverse_collection(struct collection_item *ci,
                             col_item_fn item_handler,
                             void *custom_data);
 
+/**
+ * @brief Traverse collection using several threads
+ *
+ * Works like \ref col_traverse_collection but the sub collections
+ * referenced from the top level of the collection are traversed
+ * by a pool of threads. The items of the top level are processed
+ * first by the calling thread. Then each sub collection with all
+ * its nested sub collections is processed by one of the threads.
+ * The end of the top level collection is reported last.
+ *
+ * The handler is called at the same time from different threads
+ * and must be reentrant. Items of one sub collection are passed
+ * to the handler in the usual order by the same thread. Items
+ * of different sub collections come in any order.
+ * If the handler changes the custom data it has to synchronize
+ * the access. The handler must not change the collection.
+ *
+ * If the handler stops the traversal or returns an error
+ * the other threads stop at the next item.
+ *
+ * @param[in]  ci           Collection object to traverse.
+ * @param[in]  mode_flags   How to traverse.
+ *                          See details \ref traverseconst "here".
+ *                          With \ref COL_TRAVERSE_ONELEVEL or
+ *                          \ref COL_TRAVERSE_IGNORE the collection
+ *                          is traversed by the calling thread.
+ * @param[in]  threads      Maximum number of threads including
+ *                          the calling one. If 0 the number of
+ *                          processors is used. At most 16 threads
+ *                          are used.
+ * @param[in]  item_handler Application supplied callback.
+ * @param[in]  custom_data  Custom data that application
+ *                          might want to pass to the callback.
+ *
+ * @return 0          - Collection was traversed successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - The value of some of the arguments is invalid.
+ * @return Any error code returned by the callback.
+ *
+ */
+int col_traverse_collection_parallel(struct collection_item *ci,
+                                     int mode_flags,
+                                     unsigned threads,
+                                     col_item_fn item_handler,
+                                     void *custom_data);
+
 /**
  * @brief Search and do function.
  *
@@ -865,9 +1121,10 @@ int col_get_dup_item(struct collection_item *ci,
  * is sorted with sub collections the referenced
  * collection will be sorted more than once.
  *
- * NOTE: Current implementation of the sorting
- * function is very simple and alternative
- * implementations might be provided later.
+ * The sort is stable in both orders: items that compare
+ * as same keep their order. Items are relinked in place
+ * so the function does not allocate memory unless
+ * \ref COL_SORT_PARALLEL is used.
  *
  * @param[in]  col         Collection to sort.
  * @param[in]  cmp_flags   For more information see
@@ -877,6 +1134,7 @@ int col_get_dup_item(struct collection_item *ci,
  *
  * @return 0          - No internal errors during sorting.
  * @return EINVAL     - The value of some of the arguments is invalid.
+ * @return ENOMEM     - No memory to start parallel sorting.
  *
  */
 int col_sort_collection(struct collection_item *col,
@@ -1976,6 +2234,73 @@ int col_insert_property_with_ref(struct collection_item *ci,
                                  int length,
                                  struct collection_item **ret_ref);
 
+/**
+ * @brief Property inserted by \ref col_insert_batch.
+ */
+struct col_batch_property {
+    /** Name of the property. */
+    const char *property;
+    /** Type of the property, see \ref coltypes "type definitions". */
+    int type;
+    /** Data of the property. */
+    const void *data;
+    /** Length of the data. */
+    int length;
+};
+
+/**
+ * @brief Insert a batch of properties.
+ *
+ * The properties are inserted in the order of the array
+ * as one run at the position defined by the disposition.
+ * The collection is locked once and each property is
+ * checked for duplicates once.
+ *
+ * Duplicates inside the batch are handled as if the
+ * properties were inserted one by one: with
+ * \ref COL_INSERT_DUPOVER the later property replaces
+ * the earlier one, with \ref COL_INSERT_DUPMOVE the earlier
+ * one is removed. With \ref COL_INSERT_DUPERROR nothing
+ * is inserted if any duplicate is found.
+ *
+ * Only \ref COL_DSP_END, \ref COL_DSP_FRONT,
+ * \ref COL_DSP_BEFORE, \ref COL_DSP_AFTER and
+ * \ref COL_DSP_INDEX dispositions are supported.
+ * The reference property must exist before the batch
+ * is inserted.
+ *
+ * @param[in] ci            Root collection object.
+ * @param[in] subcollection Name of the inner collection to
+ *                          add properties to. If NULL the properties
+ *                          are added to the root collection.
+ * @param[in] disposition   Defines relation point.
+ *                          For more information see
+ *                          \ref dispvalues "disposition defines".
+ * @param[in] refprop       Property to relate to.
+ * @param[in] idx           Index of the position.
+ * @param[in] flags         Flags that control naming issues.
+ *                          For more information see
+ *                          \ref insflags "insert flags".
+ * @param[in] batch         Array of the properties.
+ * @param[in] count         Number of the properties in the array.
+ *
+ * @return 0          - Properties were inserted successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - The value of some of the arguments is invalid.
+ * @return EEXIST     - Duplicate was found and nothing was inserted.
+ * @return ENOENT     - Reference property or subcollection was not found.
+ * @return ENOSYS     - Disposition or flags are not supported.
+ * @return EMSGSIZE   - Data of some property is too long.
+ */
+int col_insert_batch(struct collection_item *ci,
+                     const char *subcollection,
+                     int disposition,
+                     const char *refprop,
+                     int idx,
+                     unsigned flags,
+                     const struct col_batch_property *batch,
+                     unsigned count);
+
 
 /**
  * @}
@@ -2646,6 +2971,8 @@ int col_compare_items(struct collection_item *first,
  *                      The attempt to modify an item which is
  *                      a reference to a collection or a collection
  *                      name.
+ * @return EPERM      - The item belongs to a frozen or loaded
+ *                      collection.
  */
 int col_modify_item(struct collection_item *item,
                     const char *property,
@@ -3245,9 +3572,38 @@ int col_bind_iterator(struct collection_iterator **iterator,
                       struct collection_item *ci,
                       int mode_flags);
 
+/**
+ * @brief Bind iterator to a collection using the storage of the caller.
+ *
+ * This function is the same as \ref col_bind_iterator
+ * but it places the iterator into the storage provided
+ * by the caller. Memory is allocated only when the iterator
+ * follows more than 8 levels of sub collections.
+ * The storage must not be moved or reused till
+ * the iterator is unbound with \ref col_unbind_iterator.
+ *
+ * @param[out] iterator   Iterator object that uses the storage.
+ * @param[in]  storage    Storage for the iterator.
+ * @param[in]  ci         Collection to iterate.
+ * @param[in]  mode_flags Flags define how to traverse the collection.
+ *                        For more information see \ref traverseconst
+ *                        "constants defining traverse modes".
+ *
+ * @return 0          - Iterator was bound successfully.
+ * @return EINVAL     - The value of some of the arguments is invalid.
+ *
+ */
+int col_bind_iterator_storage(struct collection_iterator **iterator,
+                              struct collection_iterator_storage *storage,
+                              struct collection_item *ci,
+                              int mode_flags);
+
 /**
  * @brief Unbind the iterator from the collection.
  *
+ * The iterator that uses the storage of the caller
+ * is unbound but the storage itself is not freed.
+ *
  * @param[in] iterator   Iterator object to free.
  */
 void col_unbind_iterator(struct collection_iterator *iterator);
@@ -3402,6 +3758,249 @@ void col_pin_iterator(struct collection_iterator *iterator);
 void col_rewind_iterator(struct collection_iterator *iterator);
 
 
+/**
+ * @}
+ */
+
+
+/**
+ * @defgroup snapshotfunc Snapshot interface
+ *
+ * The functions in this section allow publishing
+ * the collection to the readers running in other threads.
+ * Readers get the current copy of the collection
+ * without waiting for the writer or for each other.
+ * The copies are immutable. Functions that would
+ * change them return EPERM.
+ * The copy is freed when it is replaced and the
+ * last reader that uses it releases it.
+ *
+ * @{
+ */
+
+/**
+ * @brief Create a snapshot
+ *
+ * Creates a snapshot and publishes a copy
+ * of the collection in it.
+ *
+ * @param[out] snapshot   Newly created snapshot.
+ * @param[in]  ci         Collection to publish.
+ *
+ * @return 0          - Snapshot was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter.
+ */
+int col_create_snapshot(struct col_snapshot **snapshot,
+                        struct collection_item *ci);
+
+/**
+ * @brief Publish a new version of the collection
+ *
+ * Makes a copy of the collection and replaces
+ * the copy that the snapshot holds with it.
+ * Readers that pinned the old copy continue using it.
+ * The function is meant to be called by the writer
+ * and waits briefly for the readers that are
+ * in the middle of \ref col_pin_snapshot.
+ *
+ * @param[in] snapshot    Snapshot object.
+ * @param[in] ci          Collection to publish.
+ *
+ * @return 0          - Collection was published successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter.
+ */
+int col_publish_snapshot(struct col_snapshot *snapshot,
+                         struct collection_item *ci);
+
+/**
+ * @brief Pin the current copy
+ *
+ * Returns the current copy of the collection.
+ * The copy stays valid until it is released
+ * by \ref col_unpin_snapshot. The function
+ * never waits for the writer or other readers.
+ *
+ * @param[in]  snapshot   Snapshot object.
+ * @param[out] ci         Immutable copy of the collection.
+ *
+ * @return 0          - Copy was pinned successfully.
+ * @return EINVAL     - Invalid parameter.
+ */
+int col_pin_snapshot(struct col_snapshot *snapshot,
+                     struct collection_item **ci);
+
+/**
+ * @brief Unpin the copy
+ *
+ * Releases the copy returned by \ref col_pin_snapshot.
+ * The copy is freed if it was replaced and
+ * nobody else uses it.
+ *
+ * @param[in] ci          Copy of the collection.
+ */
+void col_unpin_snapshot(struct collection_item *ci);
+
+/**
+ * @brief Destroy a snapshot
+ *
+ * Releases the current copy and the snapshot.
+ * Pinned copies stay valid until they are unpinned.
+ *
+ * @param[in] snapshot    Snapshot object.
+ */
+void col_destroy_snapshot(struct col_snapshot *snapshot);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup wirefunc Binary wire format
+ *
+ * The functions in this section pack the collection
+ * into a compact binary form and load it back.
+ * The packed form keeps the types, names and their hashes
+ * and the nested sub collections. Numbers are stored in
+ * the byte order of the host and the loader refuses
+ * the buffer that was packed on a host with other byte order.
+ *
+ * The loader does not copy names and values.
+ * Only the items that point to them are allocated.
+ * The loaded collection is immutable. Functions that would
+ * change it, \ref col_modify_item included, return EPERM.
+ *
+ * @{
+ */
+
+/**
+ * @brief Pack the collection
+ *
+ * Packs the collection and all its sub collections
+ * into a newly allocated buffer.
+ *
+ * @param[in]  ci         Collection to pack.
+ * @param[out] buffer     Packed collection.
+ *                        The caller must free it.
+ * @param[out] size       Size of the packed collection.
+ *
+ * @return 0          - Collection was packed successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter.
+ * @return E2BIG      - Sub collections are nested too deep.
+ */
+int col_pack_collection(struct collection_item *ci,
+                        void **buffer,
+                        size_t *size);
+
+/**
+ * @brief Load the packed collection
+ *
+ * Creates the collection that uses the names and values
+ * stored in the buffer. The buffer must be aligned to 8 bytes
+ * and must not be changed or freed till the collection
+ * is destroyed.
+ *
+ * @param[out] ci         Loaded collection.
+ * @param[in]  buffer     Packed collection.
+ * @param[in]  size       Size of the packed collection.
+ *
+ * @return 0          - Collection was loaded successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter or the buffer
+ *                      is not a valid packed collection.
+ */
+int col_load_packed(struct collection_item **ci,
+                    const void *buffer,
+                    size_t size);
+
+/**
+ * @brief Load the packed collection from a file
+ *
+ * Maps the file into memory and loads the collection from it.
+ * The file stays mapped till the collection is destroyed.
+ *
+ * @param[out] ci         Loaded collection.
+ * @param[in]  path       File with the packed collection.
+ *
+ * @return 0          - Collection was loaded successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid parameter or the file
+ *                      is not a valid packed collection.
+ * @return Any error returned by open or mmap.
+ */
+int col_load_packed_file(struct collection_item **ci,
+                         const char *path);
+
+/**
+ * @}
+ */
+
+/**
+ * @defgroup statfunc Statistics
+ *
+ * The collections can count the work they do.
+ * Counting is off by default and is turned on for the whole
+ * library with \ref col_enable_statistics.
+ * Every collection keeps its own counters and the library
+ * keeps the sum of the counters of all collections.
+ *
+ * @{
+ */
+
+/**
+ * @brief Counters of the collection
+ *
+ * Lookups and scanned items are counted in the collection
+ * where the search starts. Hash hits and misses are the
+ * lookups that used the hash index of the collection.
+ */
+struct col_statistics {
+    /** @brief Number of lookups by name. */
+    unsigned long lookups;
+    /** @brief Number of items compared while looking up. */
+    unsigned long items_scanned;
+    /** @brief Number of lookups that found the item in the index. */
+    unsigned long hash_hits;
+    /** @brief Number of lookups that did not find the item in the index. */
+    unsigned long hash_misses;
+    /** @brief Number of items added to the collection. */
+    unsigned long inserts;
+    /** @brief Number of inserts that checked for duplicates. */
+    unsigned long duplicate_checks;
+    /** @brief Number of items removed from the collection. */
+    unsigned long deletes;
+    /** @brief Deepest nesting of sub collections seen while traversing. */
+    unsigned long max_depth;
+    /** @brief Bytes allocated for the items added to the collection. */
+    unsigned long bytes_allocated;
+};
+
+/**
+ * @brief Turn statistics on or off
+ *
+ * When statistics are off the counters are not updated
+ * and keep their values.
+ *
+ * @param[in] enable      Nonzero to turn counting on.
+ */
+void col_enable_statistics(int enable);
+
+/**
+ * @brief Get statistics
+ *
+ * @param[in]  ci         Collection to get the counters of.
+ *                        If NULL the counters of the library
+ *                        are returned.
+ * @param[out] statistics Counters.
+ *
+ * @return 0          - Counters were copied successfully.
+ * @return EINVAL     - Invalid parameter.
+ */
+int col_get_statistics(struct collection_item *ci,
+                       struct col_statistics *statistics);
+
 /**
  * @}
  */
@@ -0,0 +1,189 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the arena used to allocate collection items.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Size of the regular slab */
+#define COL_ARENA_SLAB_SIZE     65536
+
+/* Blocks bigger than this get a slab of their own */
+#define COL_ARENA_BIG_BLOCK     (COL_ARENA_SLAB_SIZE / 4)
+
+/* One chunk of memory blocks are carved from.
+ * The blocks follow the header of the slab.
+ */
+struct col_arena_slab {
+    struct col_arena_slab *next;
+    size_t size;
+    size_t used;
+};
+
+/* Arena is shared by the collection and the
+ * sub collections the library creates inside it.
+ */
+struct col_arena {
+    struct col_arena_slab *slabs;
+    unsigned refs;
+    void *mapping;
+    size_t mapping_size;
+};
+
+/* Allocate a new slab with given space for blocks */
+static struct col_arena_slab *col_arena_new_slab(size_t size)
+{
+    struct col_arena_slab *slab;
+
+    slab = (struct col_arena_slab *)
+              malloc(COL_ARENA_ALIGN(sizeof(struct col_arena_slab)) + size);
+    if (slab == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate slab", ENOMEM);
+        return NULL;
+    }
+
+    slab->next = NULL;
+    slab->size = size;
+    slab->used = 0;
+
+    return slab;
+}
+
+/* Create arena */
+int col_arena_create(struct col_arena **arena)
+{
+    struct col_arena *new_arena;
+
+    TRACE_FLOW_ENTRY();
+
+    new_arena = (struct col_arena *)malloc(sizeof(struct col_arena));
+    if (new_arena == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate arena", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_arena->slabs = NULL;
+    new_arena->refs = 1;
+    new_arena->mapping = NULL;
+    new_arena->mapping_size = 0;
+
+    *arena = new_arena;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Add reference to the arena */
+void col_arena_ref(struct col_arena *arena)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (arena) arena->refs++;
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Remove reference and free the arena with all its slabs
+ * when the last reference is gone.
+ */
+void col_arena_unref(struct col_arena *arena)
+{
+    struct col_arena_slab *slab;
+
+    TRACE_FLOW_ENTRY();
+
+    if (arena == NULL) return;
+
+    arena->refs--;
+    if (arena->refs > 0) {
+        TRACE_FLOW_NUMBER("Arena is still referenced", arena->refs);
+        return;
+    }
+
+    while (arena->slabs) {
+        slab = arena->slabs;
+        arena->slabs = slab->next;
+        free(slab);
+    }
+
+    if (arena->mapping) munmap(arena->mapping, arena->mapping_size);
+
+    free(arena);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Let the arena own the mapped file the items point to.
+ * The file is unmapped together with the arena.
+ */
+void col_arena_keep_mapping(struct col_arena *arena,
+                            void *mapping, size_t size)
+{
+    arena->mapping = mapping;
+    arena->mapping_size = size;
+}
+
+/* Allocate block from the arena.
+ * Blocks are never freed individually.
+ */
+void *col_arena_alloc(struct col_arena *arena, size_t size)
+{
+    struct col_arena_slab *slab;
+    void *block;
+
+    TRACE_FLOW_ENTRY();
+
+    size = COL_ARENA_ALIGN(size);
+
+    if (size > COL_ARENA_BIG_BLOCK) {
+        /* Put the big block behind the current slab
+         * so that the rest of the current slab can still be used.
+         */
+        slab = col_arena_new_slab(size);
+        if (slab == NULL) return NULL;
+        if (arena->slabs) {
+            slab->next = arena->slabs->next;
+            arena->slabs->next = slab;
+        }
+        else arena->slabs = slab;
+    }
+    else if ((arena->slabs == NULL) ||
+             (arena->slabs->size - arena->slabs->used < size)) {
+        slab = col_arena_new_slab(COL_ARENA_SLAB_SIZE);
+        if (slab == NULL) return NULL;
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+    }
+    else slab = arena->slabs;
+
+    block = (char *)slab + COL_ARENA_ALIGN(sizeof(struct col_arena_slab)) +
+            slab->used;
+    slab->used += size;
+
+    TRACE_FLOW_EXIT();
+    return block;
+}
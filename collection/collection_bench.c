@@ -0,0 +1,459 @@
+/*
+    COLLECTION LIBRARY
+
+    Benchmark of the collection operations.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Every measurement is printed as one line:
+ *
+ *     <operation> <items> <depth> <operations> <ns per operation>
+ *
+ * Lines that start with '#' are comments.
+ * Small collections are processed several times
+ * so that every measurement covers enough operations.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#define TRACE_HOME
+#include "trace.h"
+#include "collection.h"
+
+/* Minimal number of operations in a measurement */
+#define BENCH_MIN_OPS       100000
+
+/* Length of the generated names */
+#define BENCH_NAME_LEN      24
+
+/* Number of items on each level of the nested collections */
+#define BENCH_LEVEL_ITEMS   100
+
+int verbose = 0;
+
+#define COLOUT(foo) \
+    do { \
+        if (verbose) foo; \
+    } while(0)
+
+enum bench_op {
+    BENCH_INSERT,
+    BENCH_LOOKUP_HIT,
+    BENCH_LOOKUP_MISS,
+    BENCH_ITERATE,
+    BENCH_COPY,
+    BENCH_SORT,
+    BENCH_DELETE,
+    BENCH_DESTROY,
+    BENCH_OP_COUNT
+};
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+    "insert",
+    "lookup_hit",
+    "lookup_miss",
+    "iterate",
+    "copy",
+    "sort",
+    "delete",
+    "destroy"
+};
+
+/* Time in nanoseconds */
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void bench_print(const char *op, unsigned items, unsigned depth,
+                        unsigned long ops, double ns)
+{
+    printf("%s %u %u %lu %.1f\n", op, items, depth, ops,
+           ops ? ns / (double)ops : 0.0);
+    fflush(stdout);
+}
+
+/* Generate names of the items and names that are not there */
+static char *bench_names(unsigned count, const char *prefix)
+{
+    char *names;
+    unsigned i;
+
+    names = malloc((size_t)count * BENCH_NAME_LEN);
+    if (names == NULL) return NULL;
+
+    for (i = 0; i < count; i++)
+        snprintf(names + (size_t)i * BENCH_NAME_LEN, BENCH_NAME_LEN,
+                 "%s%u", prefix, i);
+
+    return names;
+}
+
+#define BENCH_NAME(names, i) ((names) + (size_t)(i) * BENCH_NAME_LEN)
+
+/* Visit the items in the order that does not follow the list */
+static unsigned bench_scatter(unsigned i, unsigned count)
+{
+    return (unsigned)(((unsigned long long)i * 2654435761ULL) % count);
+}
+
+/* Do all operations on the collection of the given size once */
+static int bench_round(unsigned count,
+                       const char *hits,
+                       const char *misses,
+                       double *ns)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    struct collection_iterator *iterator = NULL;
+    double start;
+    unsigned i;
+    int error = EOK;
+
+    start = bench_now();
+    error = col_create_collection(&col, "bench", 0);
+    for (i = 0; (i < count) && (!error); i++)
+        error = col_add_int_property(col, NULL, BENCH_NAME(hits, i),
+                                     (int32_t)bench_scatter(i, count));
+    ns[BENCH_INSERT] += bench_now() - start;
+    if (error) {
+        printf("Failed to add item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    for (i = 0; (i < count) && (!error); i++) {
+        error = col_get_item(col, BENCH_NAME(hits, bench_scatter(i, count)),
+                             COL_TYPE_ANY, COL_TRAVERSE_ONELEVEL, &item);
+        if ((!error) && (item == NULL)) error = ENOENT;
+    }
+    ns[BENCH_LOOKUP_HIT] += bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; (i < count) && (!error); i++) {
+        item = NULL;
+        error = col_get_item(col, BENCH_NAME(misses, i),
+                             COL_TYPE_ANY, COL_TRAVERSE_ONELEVEL, &item);
+        if ((!error) && (item != NULL)) error = EEXIST;
+    }
+    ns[BENCH_LOOKUP_MISS] += bench_now() - start;
+    if (error) {
+        printf("Lookup failed. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    error = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL);
+    if (!error) {
+        do {
+            error = col_iterate_collection(iterator, &item);
+        }
+        while ((!error) && (item));
+        col_unbind_iterator(iterator);
+    }
+    ns[BENCH_ITERATE] += bench_now() - start;
+    if (error) {
+        printf("Iteration failed. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    error = col_copy_collection(&copy, col, "copy", COL_COPY_NORMAL);
+    ns[BENCH_COPY] += bench_now() - start;
+    if (error) {
+        printf("Failed to copy collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    error = col_sort_collection(copy, COL_CMPIN_DATA, COL_SORT_ASC);
+    ns[BENCH_SORT] += bench_now() - start;
+    if (error) {
+        printf("Failed to sort collection. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    for (i = 0; (i < count) && (!error); i++)
+        error = col_delete_property(copy,
+                                    BENCH_NAME(hits, bench_scatter(i, count)),
+                                    COL_TYPE_ANY, COL_TRAVERSE_ONELEVEL);
+    ns[BENCH_DELETE] += bench_now() - start;
+    col_destroy_collection(copy);
+    if (error) {
+        printf("Failed to delete item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    col_destroy_collection(col);
+    ns[BENCH_DESTROY] += bench_now() - start;
+
+    return EOK;
+}
+
+/* Measure the operations on the flat collection */
+static int bench_size(unsigned count)
+{
+    char *hits;
+    char *misses;
+    double ns[BENCH_OP_COUNT];
+    unsigned rounds;
+    unsigned i;
+    int error = EOK;
+
+    COLOUT(printf("# Collection of %u items\n", count));
+
+    hits = bench_names(count, "key");
+    misses = bench_names(count, "miss");
+    if ((hits == NULL) || (misses == NULL)) {
+        printf("Failed to allocate names.\n");
+        free(hits);
+        free(misses);
+        return ENOMEM;
+    }
+
+    memset(ns, 0, sizeof(ns));
+    rounds = (BENCH_MIN_OPS + count - 1) / count;
+    for (i = 0; (i < rounds) && (!error); i++)
+        error = bench_round(count, hits, misses, ns);
+
+    free(hits);
+    free(misses);
+    if (error) return error;
+
+    for (i = 0; i < BENCH_OP_COUNT; i++)
+        bench_print(bench_op_names[i], count, 1,
+                    (unsigned long)rounds * count, ns[i]);
+
+    return EOK;
+}
+
+/* Build collection with the given number of nested levels */
+static int bench_nested(struct collection_item **col, unsigned depth)
+{
+    struct collection_item *level = NULL;
+    struct collection_item *sub = NULL;
+    char name[BENCH_NAME_LEN];
+    unsigned i;
+    unsigned j;
+    int error = EOK;
+
+    for (i = depth; i > 0; i--) {
+        snprintf(name, sizeof(name), "level%u", i);
+        error = col_create_collection(&level, name, 0);
+        for (j = 0; (j < BENCH_LEVEL_ITEMS) && (!error); j++) {
+            snprintf(name, sizeof(name), "key%u", j);
+            error = col_add_int_property(level, NULL, name, (int32_t)j);
+        }
+        if ((!error) && (i == depth))
+            error = col_add_int_property(level, NULL, "leaf", (int32_t)i);
+        if ((!error) && (sub))
+            error = col_add_collection_to_collection(level, NULL, NULL, sub,
+                                                     COL_ADD_MODE_EMBED);
+        if (error) {
+            printf("Failed to build nested collection. Error %d\n", error);
+            col_destroy_collection(level);
+            col_destroy_collection(sub);
+            return error;
+        }
+        sub = level;
+    }
+
+    *col = level;
+    return EOK;
+}
+
+/* Count the items while traversing */
+static int bench_counter(const char *property,
+                         int property_len,
+                         int type,
+                         void *data,
+                         int length,
+                         void *custom_data,
+                         int *dummy)
+{
+    (*((unsigned long *)custom_data))++;
+    return EOK;
+}
+
+/* Measure the operations on the nested collections */
+static int bench_depth(unsigned depth)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    char path[BENCH_NAME_LEN];
+    unsigned long visited = 0;
+    unsigned long ops = 0;
+    unsigned items;
+    unsigned rounds;
+    unsigned i;
+    double start;
+    int error = EOK;
+
+    COLOUT(printf("# Collection nested %u levels deep\n", depth));
+
+    error = bench_nested(&col, depth);
+    if (error) return error;
+
+    items = depth * (BENCH_LEVEL_ITEMS + 1);
+    rounds = (BENCH_MIN_OPS + items - 1) / items;
+
+    /* Path forces the lookup to walk the tree */
+    snprintf(path, sizeof(path), "level%u!leaf", depth);
+    start = bench_now();
+    for (i = 0; (i < rounds) && (!error); i++) {
+        error = col_get_item(col, path, COL_TYPE_ANY,
+                             COL_TRAVERSE_DEFAULT, &item);
+        if ((!error) && (item == NULL)) error = ENOENT;
+    }
+    bench_print("lookup_path", items, depth, rounds, bench_now() - start);
+    if (error) {
+        printf("Path lookup failed. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    start = bench_now();
+    for (i = 0; (i < rounds) && (!error); i++)
+        error = col_traverse_collection(col, COL_TRAVERSE_DEFAULT,
+                                        bench_counter, &visited);
+    ops = visited;
+    bench_print("traverse", items, depth, ops, bench_now() - start);
+
+    col_destroy_collection(col);
+    if (error) printf("Traverse failed. Error %d\n", error);
+    return error;
+}
+
+/* Hash the way it was done with toupper() */
+static uint64_t bench_hash_toupper(const char *string)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int i;
+
+    for (i = 0; string[i] != 0; i++) {
+        hash = hash ^ toupper(string[i]);
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+/* Compare the hash of the names with the one that used toupper() */
+static int bench_hash(void)
+{
+    const char *keys[] = { "id", "name", "server_uri", "ldap_search_base",
+                           "krb5_validate_with_ticket_lifetime",
+                           "Dynamic_DNS_Update_Refresh_Interval" };
+    unsigned count = sizeof(keys) / sizeof(keys[0]);
+    unsigned rounds = (BENCH_MIN_OPS * 10) / count;
+    uint64_t hash1 = 0;
+    uint64_t hash2 = 0;
+    double start;
+    unsigned i;
+    unsigned j;
+
+    COLOUT(printf("# Hash of %u typical names\n", count));
+
+    start = bench_now();
+    for (i = 0; i < rounds; i++)
+        for (j = 0; j < count; j++) hash1 += bench_hash_toupper(keys[j]);
+    bench_print("hash_toupper", count, 1,
+                (unsigned long)rounds * count, bench_now() - start);
+
+    start = bench_now();
+    for (i = 0; i < rounds; i++)
+        for (j = 0; j < count; j++) hash2 += col_make_hash(keys[j], 0, NULL);
+    bench_print("hash", count, 1,
+                (unsigned long)rounds * count, bench_now() - start);
+
+    /* Both loops produce the same values */
+    if (hash1 != hash2) {
+        printf("Hash mismatch\n");
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+static void bench_usage(const char *name)
+{
+    printf("Usage: %s [-v] [-m max_items] [-d max_depth]\n", name);
+}
+
+/* Main function of the benchmark */
+
+int main(int argc, char *argv[])
+{
+    unsigned long max_items = 1000000;
+    unsigned long max_depth = 64;
+    unsigned long count;
+    int opt;
+    int error = EOK;
+
+    while ((opt = getopt(argc, argv, "vm:d:h")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'm':
+            max_items = strtoul(optarg, NULL, 10);
+            break;
+        case 'd':
+            max_depth = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            bench_usage(argv[0]);
+            return EINVAL;
+        }
+    }
+
+    printf("# operation items depth operations ns_per_operation\n");
+
+    error = bench_hash();
+
+    for (count = 10; (count <= max_items) && (!error); count *= 10)
+        error = bench_size((unsigned)count);
+
+    for (count = 1; (count <= max_depth) && (!error); count *= 4)
+        error = bench_depth((unsigned)count);
+
+    if (error) {
+        printf("Failed!\n");
+        return error;
+    }
+
+    return 0;
+}
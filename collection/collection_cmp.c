@@ -25,6 +25,8 @@
 #include <errno.h>
 #include <ctype.h>
 #include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include "trace.h"
 
 /* The collection should use the real structures */
@@ -34,6 +36,9 @@
 #define NONZERO 1
 #define PROP_MSK    0x000000007
 
+/* Maximum number of threads that sort sub collections */
+#define COL_SORT_THREADS_MAX    8
+
 
 #define TYPED_MATCH(type) \
     do { \
@@ -292,23 +297,213 @@ int col_compare_items(struct collection_item *first,
     return result;
 }
 
+/* Check if the first item goes after the second one.
+ * Items that are same or where the second one is greater
+ * in any way keep their order.
+ */
+static int col_sort_after(struct collection_item *first,
+                          struct collection_item *second,
+                          unsigned cmp_flags)
+{
+    unsigned out_flags = 0;
+    int res;
+
+    TRACE_INFO_STRING("Arg1:", first->property);
+    TRACE_INFO_STRING("Arg2:", second->property);
+
+    res = col_compare_items(first, second, cmp_flags, &out_flags);
+
+    TRACE_INFO_STRING("Result:", ((res == 0) ? "same" : "different"));
+    TRACE_INFO_NUMBER("Out flags", out_flags);
+
+    return ((res != 0) && (out_flags == 0));
+}
+
+/* Sort the list of items in place.
+ * This is a bottom-up merge sort that relinks the items
+ * so it is stable and does not allocate memory.
+ * The descending order is stable too.
+ * Returns the new head of the list and its last item.
+ */
+static struct collection_item *col_merge_sort(struct collection_item *list,
+                                              unsigned cmp_flags,
+                                              int desc,
+                                              struct collection_item **last)
+{
+    struct collection_item *left;
+    struct collection_item *right;
+    struct collection_item *tail;
+    struct collection_item *item;
+    unsigned width = 1;
+    unsigned left_size;
+    unsigned right_size;
+    unsigned merges;
+
+    TRACE_FLOW_ENTRY();
+
+    *last = list;
+    if (list == NULL) return NULL;
+
+    do {
+        left = list;
+        list = NULL;
+        tail = NULL;
+        merges = 0;
+
+        while (left) {
+            merges++;
+
+            /* Right run starts after at most width items */
+            right = left;
+            left_size = 0;
+            while ((left_size < width) && (right)) {
+                left_size++;
+                right = right->next;
+            }
+            right_size = width;
+
+            /* Merge the runs taking from the left on ties */
+            while ((left_size > 0) || ((right_size > 0) && (right))) {
+                if ((left_size == 0) ||
+                    ((right_size > 0) && (right) &&
+                     ((desc) ? (col_sort_after(right, left, cmp_flags)) :
+                               (col_sort_after(left, right, cmp_flags))))) {
+                    item = right;
+                    right = right->next;
+                    right_size--;
+                }
+                else {
+                    item = left;
+                    left = left->next;
+                    left_size--;
+                }
+
+                if (tail) tail->next = item;
+                else list = item;
+                tail = item;
+            }
+
+            left = right;
+        }
+
+        tail->next = NULL;
+        width *= 2;
+    }
+    while (merges > 1);
+
+    *last = tail;
+
+    TRACE_FLOW_EXIT();
+    return list;
+}
+
+/* Sub collections that are sorted in parallel.
+ * Threads take the references from the list one by one.
+ */
+struct col_sort_work {
+    struct collection_item *next;
+    unsigned cmp_flags;
+    unsigned sort_flags;
+    int error;
+    pthread_mutex_t mutex;
+};
+
+/* Sort sub collections till there is nothing left */
+static void *col_sort_worker(void *data)
+{
+    struct col_sort_work *work = (struct col_sort_work *)data;
+    struct collection_item *item;
+    int error;
+
+    TRACE_FLOW_ENTRY();
+
+    for (;;) {
+        pthread_mutex_lock(&(work->mutex));
+        while ((work->next) &&
+               (work->next->type != COL_TYPE_COLLECTIONREF))
+            work->next = work->next->next;
+        item = work->error ? NULL : work->next;
+        if (item) work->next = item->next;
+        pthread_mutex_unlock(&(work->mutex));
+
+        if (item == NULL) break;
+
+        error = col_sort_collection(*((struct collection_item **)(item->data)),
+                                    work->cmp_flags,
+                                    work->sort_flags);
+        if (error) {
+            TRACE_ERROR_NUMBER("Subcollection sort failed", error);
+            pthread_mutex_lock(&(work->mutex));
+            if (!work->error) work->error = error;
+            pthread_mutex_unlock(&(work->mutex));
+        }
+    }
+
+    TRACE_FLOW_EXIT();
+    return NULL;
+}
+
+/* Sort sub collections of the collection using several threads.
+ * Only sub collections that are not referenced from other places
+ * are sorted so the threads never touch the same collection.
+ */
+static int col_sort_parallel(struct collection_item *col,
+                             unsigned cmp_flags,
+                             unsigned sort_flags)
+{
+    struct col_sort_work work;
+    pthread_t threads[COL_SORT_THREADS_MAX];
+    long cpus;
+    int count = 0;
+    int i;
+
+    TRACE_FLOW_ENTRY();
+
+    work.next = col->next;
+    work.cmp_flags = cmp_flags;
+    work.sort_flags = sort_flags;
+    work.error = EOK;
+    if (pthread_mutex_init(&(work.mutex), NULL)) {
+        TRACE_ERROR_NUMBER("Failed to init mutex", ENOMEM);
+        return ENOMEM;
+    }
+
+    cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus > COL_SORT_THREADS_MAX) cpus = COL_SORT_THREADS_MAX;
+
+    /* The calling thread is one of the sorting threads */
+    for (i = 1; i < cpus; i++) {
+        if (pthread_create(&(threads[count]), NULL,
+                           col_sort_worker, &work)) {
+            TRACE_INFO_NUMBER("Failed to start thread", i);
+            break;
+        }
+        count++;
+    }
+
+    TRACE_INFO_NUMBER("Number of sorting threads:", count + 1);
+
+    col_sort_worker(&work);
+
+    for (i = 0; i < count; i++) pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&(work.mutex));
+
+    TRACE_FLOW_EXIT();
+    return work.error;
+}
+
 /* Sort collection */
-int col_sort_collection(struct collection_item *col,
-                        unsigned cmp_flags,
-                        unsigned sort_flags)
+static int col_sort_collection_int(struct collection_item *col,
+                                   unsigned cmp_flags,
+                                   unsigned sort_flags)
 {
     int error = EOK;
 
     struct collection_item *current;
     struct collection_header *header;
-    struct collection_item **array;
-    struct collection_item *temp_item;
     struct collection_item *other;
-    size_t size;
-    int ind, last;
-    int i, j;
-    int res;
-    unsigned out_flags;
+    struct collection_item *last;
 
     TRACE_FLOW_STRING("col_sort_collection", "Entry.");
 
@@ -320,7 +515,6 @@ int col_sort_collection(struct collection_item *col,
         return EINVAL;
     }
 
-    /* This will be a fast and simple implementation for now */
     header = (struct collection_header *)(col->data);
 
     if ((sort_flags & COL_SORT_SUB) &&
@@ -330,106 +524,72 @@ int col_sort_collection(struct collection_item *col,
         return error;
     }
 
-    size = sizeof(struct collection_item *) * (header->count - 1);
-    array = (struct collection_item **)malloc(size);
-    if (array == NULL) {
-        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
-        return ENOMEM;
-    }
-
-    /* Fill array */
-    current = col->next;
-    ind = 0;
-    while (current != NULL) {
-        TRACE_INFO_STRING("Item:", current->property);
-        array[ind] = current;
-        if ((sort_flags & COL_SORT_SUB) &&
-            (array[ind]->type == COL_TYPE_COLLECTIONREF)) {
-            /* If we found a subcollection and we need to sort it
-             * then sort it.
-             */
-            other = *((struct collection_item **)(array[ind]->data));
-            error = col_sort_collection(other, cmp_flags, sort_flags);
-            if (error) {
-                TRACE_ERROR_NUMBER("Subcollection sort failed", error);
-                free(array);
-                return error;
-            }
+    /* Sort sub collections first */
+    if (sort_flags & COL_SORT_SUB) {
+        /* Sub collections shared with a copy are sorted in private copies */
+        for (current = col->next;
+             (current != NULL) && (!error);
+             current = current->next) {
+            if (current->type == COL_TYPE_COLLECTIONREF)
+                error = col_unshare_item(col, current);
+        }
+        if (error) {
+            TRACE_ERROR_NUMBER("Failed to unshare subcollection", error);
+            return error;
         }
-        ind++;
-        current = current->next;
-    }
 
-    last = ind - 1;
-
-    for (i = 0; i < last; i++) {
-
-        TRACE_INFO_STRING("Arg1:", array[i]->property);
-        TRACE_INFO_STRING("Arg2:", array[i + 1]->property);
-
-        res = col_compare_items(array[i],
-                                array[i + 1],
-                                cmp_flags,
-                                &out_flags);
-
-        TRACE_INFO_STRING("Result:", ((res == 0) ? "same" : "different"));
-        TRACE_INFO_NUMBER("Out flags", out_flags);
-
-        /* If they are not same and second is not greater
-         * in any way then we need to swap them */
-        if ((res != 0) && (out_flags == 0)) {
-            /* Swap */
-            TRACE_INFO_STRING("Swapping:", "");
-            TRACE_INFO_STRING("Item:", array[i]->property);
-            TRACE_INFO_STRING("Item:", array[i + 1]->property);
-
-            temp_item = array[i];
-            array[i] = array[i + 1];
-            array[i + 1] = temp_item;
-
-            /* But we need to go up bubbling this item
-             */
-            j = i;
-            while (j > 0) {
-                res = col_compare_items(array[j - 1],
-                                        array[j],
-                                        cmp_flags,
-                                        &out_flags);
-                /* If they are not same and second is not greater
-                 * in any way then we need to swap them */
-                if ((res != 0) && (out_flags == 0)) {
-                    /* Swap */
-                    temp_item = array[j - 1];
-                    array[j - 1] = array[j];
-                    array[j] = temp_item;
+        if (((sort_flags & COL_SORT_PARALLEL) &&
+             (sort_flags & COL_SORT_MYSUB)) &&
+            (header->count > 2)) {
+            error = col_sort_parallel(col, cmp_flags,
+                                      sort_flags & ~COL_SORT_PARALLEL);
+        }
+        else {
+            current = col->next;
+            while ((current != NULL) && (!error)) {
+                if (current->type == COL_TYPE_COLLECTIONREF) {
+                    other = *((struct collection_item **)(current->data));
+                    error = col_sort_collection(other, cmp_flags,
+                                                sort_flags & ~COL_SORT_PARALLEL);
                 }
-                else break;
-                j--;
+                current = current->next;
             }
         }
-    }
-
-    /* Build the chain back */
-    if (sort_flags & COL_SORT_DESC) {
-        col->next = array[last];
-        for (i = last; i > 0 ; i--) {
-            array[i]->next = array[i - 1];
-        }
-        array[0]->next = NULL;
-        header->last = array[0];
-    }
-    else {
-        col->next = array[0];
-        for (i = 0; i < last ; i++) {
-            array[i]->next = array[i + 1];
+        if (error) {
+            TRACE_ERROR_NUMBER("Subcollection sort failed", error);
+            return error;
         }
-        array[last]->next = NULL;
-        header->last = array[last];
     }
 
-    free(array);
+    /* Index is not worth updating for the new order */
+    col_index_free(header);
+    col_position_free(header);
+
+    col->next = col_merge_sort(col->next, cmp_flags,
+                               sort_flags & COL_SORT_DESC, &last);
+    header->last = last;
+
+    /* Empty collection ends with the header */
+    if (header->last == NULL) header->last = col;
 
     TRACE_FLOW_STRING("col_sort_collection", "Exit.");
     return error;
 
 }
+
+/* Sort collection holding the lock */
+int col_sort_collection(struct collection_item *col,
+                        unsigned cmp_flags,
+                        unsigned sort_flags)
+{
+    int error;
+
+    error = col_lock_collection(col, 1);
+    if (error) return error;
+
+    error = col_sort_collection_int(col, cmp_flags, sort_flags);
+
+    col_unlock_collection(col);
+
+    return error;
+}
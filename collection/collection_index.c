@@ -0,0 +1,733 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the lookup index of the collection.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Collections with fewer items (header included)
+ * are searched by walking the list.
+ */
+#define COL_INDEX_THRESHOLD     16
+
+/* Average number of hashes in a bucket of the perfect hash */
+#define COL_INDEX_BUCKET_KEYS   2
+
+/* Displacements tried for one bucket before the perfect hash is given up */
+#define COL_INDEX_MAX_DISPLACE  65536
+
+/* Constant that spreads the displacements */
+#define COL_INDEX_GOLDEN        0x9E3779B97F4A7C15ULL
+
+/* Generation of the index of the collection.
+ * Item that is renamed makes the index that holds it stale.
+ * It is accessed atomically since readers of thread-safe
+ * collections check it concurrently.
+ */
+#define COL_INDEX_EPOCH(header) \
+    __atomic_load_n(&((header)->index_epoch), __ATOMIC_RELAXED)
+
+
+/* Get the number of buckets for the given number of items */
+static unsigned col_index_size(unsigned count)
+{
+    unsigned size = COL_INDEX_THRESHOLD;
+
+    while (size < count) size <<= 1;
+
+    return size;
+}
+
+/* Find the place where the entry for the item is stored */
+static struct col_index_entry **col_index_slot(struct col_index *index,
+                                               struct collection_item *item)
+{
+    struct col_index_entry **slot;
+
+    slot = &(index->buckets[item->phash & (index->size - 1)]);
+    while ((*slot) && ((*slot)->item != item)) slot = &((*slot)->next);
+
+    return slot;
+}
+
+/* Free index entries and the index itself */
+static void col_index_destroy(struct col_index *index)
+{
+    struct col_index_entry *entry;
+    struct col_index_entry *next;
+    unsigned i;
+
+    if (index == NULL) return;
+
+    for (i = 0; i < index->size; i++) {
+        entry = index->buckets[i];
+        while (entry) {
+            next = entry->next;
+            free(entry);
+            entry = next;
+        }
+    }
+
+    free(index->buckets);
+    free(index->displace);
+    free(index->first);
+    free(index->items);
+    free(index);
+}
+
+/* Add entry for the item that is already linked after prev.
+ * The entries with the same hash must follow the order
+ * of the items in the collection. If the position can't be
+ * determined without walking the list the function
+ * returns EAGAIN and the index needs to be rebuilt.
+ */
+static int col_index_link(struct col_index *index,
+                          struct collection_item *collection,
+                          struct collection_item *prev,
+                          struct collection_item *item,
+                          int append)
+{
+    struct col_index_entry *entry;
+    struct col_index_entry **slot;
+    struct col_index_entry **first = NULL;
+    struct col_index_entry **last = NULL;
+    struct col_index_entry **after_prev = NULL;
+    struct col_index_entry **before_next = NULL;
+    struct col_index_entry **where = NULL;
+
+    TRACE_FLOW_ENTRY();
+
+    slot = &(index->buckets[item->phash & (index->size - 1)]);
+    while (*slot) {
+        if ((*slot)->item->phash == item->phash) {
+            if (first == NULL) first = slot;
+            last = slot;
+            if ((*slot)->item == prev) after_prev = &((*slot)->next);
+            if ((*slot)->item == item->next) before_next = slot;
+        }
+        slot = &((*slot)->next);
+    }
+
+    if (first == NULL)
+        where = &(index->buckets[item->phash & (index->size - 1)]);
+    else if ((append) || (item->next == NULL)) where = &((*last)->next);
+    else if (prev == collection) where = first;
+    else if (after_prev) where = after_prev;
+    else if (before_next) where = before_next;
+    else {
+        TRACE_FLOW_STRING("Can't position the entry", "");
+        return EAGAIN;
+    }
+
+    entry = (struct col_index_entry *)malloc(sizeof(struct col_index_entry));
+    if (entry == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index entry", ENOMEM);
+        return ENOMEM;
+    }
+
+    entry->item = item;
+    entry->prev = prev;
+    entry->next = *where;
+    *where = entry;
+    item->index_header = (struct collection_header *)collection->data;
+
+    index->count++;
+    if (item->type == COL_TYPE_COLLECTIONREF) index->refs++;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Build index for one level of the collection */
+static struct col_index *col_index_build(struct collection_item *collection,
+                                         unsigned size)
+{
+    struct col_index *index;
+    struct collection_item *prev;
+    struct collection_item *current;
+
+    TRACE_FLOW_ENTRY();
+
+    index = (struct col_index *)malloc(sizeof(struct col_index));
+    if (index == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index", ENOMEM);
+        return NULL;
+    }
+
+    index->buckets = (struct col_index_entry **)
+                        calloc(size, sizeof(struct col_index_entry *));
+    if (index->buckets == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index buckets", ENOMEM);
+        free(index);
+        return NULL;
+    }
+
+    index->size = size;
+    index->count = 0;
+    index->refs = 0;
+    index->epoch = COL_INDEX_EPOCH((struct collection_header *)collection->data);
+    index->retired = NULL;
+    index->displace = NULL;
+    index->displace_size = 0;
+    index->slots = 0;
+    index->first = NULL;
+    index->items = NULL;
+
+    /* Headers are never indexed */
+    prev = collection;
+    current = collection->next;
+    while (current) {
+        if (col_index_link(index, collection, prev, current, 1)) {
+            TRACE_ERROR_STRING("Failed to build index", "");
+            col_index_destroy(index);
+            return NULL;
+        }
+        prev = current;
+        current = current->next;
+    }
+
+    TRACE_FLOW_EXIT();
+    return index;
+}
+
+/* Mix the bits of the hash.
+ * Property hashes are not uniform enough for the perfect hash.
+ */
+static uint64_t col_index_mix(uint64_t hash)
+{
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+/* Map 32 bits of the hash to the range from 0 to size */
+static unsigned col_index_range(uint64_t hash, unsigned size)
+{
+    return (unsigned)(((hash & 0xFFFFFFFF) * size) >> 32);
+}
+
+/* Get the bucket of the perfect hash the hash belongs to */
+static unsigned col_index_perfect_bucket(unsigned displace_size,
+                                         uint64_t hash)
+{
+    return col_index_range(col_index_mix(hash) >> 32, displace_size);
+}
+
+/* Get the slot of the hash with given displacement */
+static unsigned col_index_displaced_slot(unsigned slots,
+                                         uint64_t hash,
+                                         uint32_t displace)
+{
+    return col_index_range(col_index_mix(hash ^ (displace * COL_INDEX_GOLDEN)),
+                           slots);
+}
+
+/* Get the slot of the hash in the perfect hash */
+static unsigned col_index_perfect_slot(const struct col_index *index,
+                                       uint64_t hash)
+{
+    return col_index_displaced_slot(index->slots, hash,
+        index->displace[col_index_perfect_bucket(index->displace_size, hash)]);
+}
+
+/* Compare hashes for sorting */
+static int col_index_hash_cmp(const void *first, const void *second)
+{
+    uint64_t a = *((const uint64_t *)first);
+    uint64_t b = *((const uint64_t *)second);
+
+    return (a > b) - (a < b);
+}
+
+/* Find displacements that place distinct hashes into distinct slots.
+ * Buckets with more hashes are placed first while there is room.
+ * Returns EAGAIN if some bucket can't be placed.
+ */
+static int col_index_displace(struct col_index *index,
+                              uint64_t *hashes,
+                              unsigned count)
+{
+    unsigned *start = NULL;
+    unsigned *order = NULL;
+    unsigned *placed = NULL;
+    unsigned char *taken = NULL;
+    uint64_t *sorted = NULL;
+    unsigned max_keys = 0;
+    unsigned bucket;
+    unsigned keys;
+    unsigned slot;
+    unsigned i;
+    unsigned j;
+    unsigned k;
+    uint32_t displace;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    start = (unsigned *)calloc(index->displace_size + 1, sizeof(unsigned));
+    order = (unsigned *)malloc(index->displace_size * sizeof(unsigned));
+    taken = (unsigned char *)calloc(index->slots, 1);
+    sorted = (uint64_t *)malloc(count * sizeof(uint64_t));
+    if ((start == NULL) || (order == NULL) ||
+        (taken == NULL) || (sorted == NULL)) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        error = ENOMEM;
+        goto done;
+    }
+
+    /* Group the hashes by buckets */
+    for (i = 0; i < count; i++)
+        start[col_index_perfect_bucket(index->displace_size, hashes[i]) + 1]++;
+    for (i = 0; i < index->displace_size; i++) {
+        if (start[i + 1] > max_keys) max_keys = start[i + 1];
+        start[i + 1] += start[i];
+    }
+    for (i = 0; i < count; i++) {
+        bucket = col_index_perfect_bucket(index->displace_size, hashes[i]);
+        sorted[start[bucket]++] = hashes[i];
+    }
+    for (i = index->displace_size; i > 0; i--) start[i] = start[i - 1];
+    start[0] = 0;
+
+    /* Order the buckets from the biggest to the smallest */
+    k = 0;
+    for (keys = max_keys; keys > 0; keys--) {
+        for (i = 0; i < index->displace_size; i++)
+            if (start[i + 1] - start[i] == keys) order[k++] = i;
+    }
+
+    placed = (unsigned *)malloc(max_keys * sizeof(unsigned));
+    if (placed == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
+        error = ENOMEM;
+        goto done;
+    }
+
+    for (i = 0; i < k; i++) {
+        bucket = order[i];
+        keys = start[bucket + 1] - start[bucket];
+        for (displace = 0; displace < COL_INDEX_MAX_DISPLACE; displace++) {
+            for (j = 0; j < keys; j++) {
+                slot = col_index_displaced_slot(index->slots,
+                                                sorted[start[bucket] + j],
+                                                displace);
+                if (taken[slot]) break;
+                taken[slot] = 1;
+                placed[j] = slot;
+            }
+            if (j == keys) break;
+            /* Release the slots taken by this attempt */
+            while (j > 0) taken[placed[--j]] = 0;
+        }
+        if (displace == COL_INDEX_MAX_DISPLACE) {
+            TRACE_ERROR_NUMBER("Failed to place bucket", bucket);
+            error = EAGAIN;
+            goto done;
+        }
+        index->displace[bucket] = displace;
+    }
+
+done:
+    free(start);
+    free(order);
+    free(placed);
+    free(taken);
+    free(sorted);
+
+    TRACE_FLOW_EXIT();
+    return error;
+}
+
+/* Build perfect hash for one level of the frozen collection */
+static struct col_index *col_index_build_perfect(struct collection_item *collection,
+                                                 unsigned count)
+{
+    struct col_index *index;
+    struct collection_item *prev;
+    struct collection_item *current;
+    uint64_t *hashes;
+    unsigned *fill = NULL;
+    unsigned distinct;
+    unsigned slot;
+    unsigned i;
+
+    TRACE_FLOW_ENTRY();
+
+    hashes = (uint64_t *)malloc(count * sizeof(uint64_t));
+    index = (struct col_index *)calloc(1, sizeof(struct col_index));
+    if ((hashes == NULL) || (index == NULL)) {
+        TRACE_ERROR_NUMBER("Failed to allocate index", ENOMEM);
+        free(hashes);
+        free(index);
+        return NULL;
+    }
+
+    index->count = count;
+    index->epoch = COL_INDEX_EPOCH((struct collection_header *)collection->data);
+
+    i = 0;
+    for (current = collection->next; current; current = current->next) {
+        current->index_header = (struct collection_header *)collection->data;
+        hashes[i++] = current->phash;
+        if (current->type == COL_TYPE_COLLECTIONREF) index->refs++;
+    }
+
+    qsort(hashes, count, sizeof(uint64_t), col_index_hash_cmp);
+    distinct = 1;
+    for (i = 1; i < count; i++)
+        if (hashes[i] != hashes[distinct - 1]) hashes[distinct++] = hashes[i];
+
+    /* A few spare slots make the search for displacements short */
+    index->slots = distinct + distinct / 8 + 1;
+    index->displace_size = distinct / COL_INDEX_BUCKET_KEYS + 1;
+    index->displace = (uint32_t *)calloc(index->displace_size,
+                                         sizeof(uint32_t));
+    index->first = (unsigned *)calloc(index->slots + 1, sizeof(unsigned));
+    index->items = (struct col_index_item *)
+                      malloc(count * sizeof(struct col_index_item));
+    fill = (unsigned *)calloc(index->slots, sizeof(unsigned));
+    if ((index->displace == NULL) || (index->first == NULL) ||
+        (index->items == NULL) || (fill == NULL) ||
+        (col_index_displace(index, hashes, distinct))) {
+        TRACE_ERROR_STRING("Failed to build perfect hash", "");
+        free(hashes);
+        free(fill);
+        col_index_destroy(index);
+        return NULL;
+    }
+
+    free(hashes);
+
+    /* Items of each slot follow the order of the list */
+    for (current = collection->next; current; current = current->next)
+        index->first[col_index_perfect_slot(index, current->phash) + 1]++;
+    for (i = 0; i < index->slots; i++) index->first[i + 1] += index->first[i];
+
+    prev = collection;
+    for (current = collection->next; current; current = current->next) {
+        slot = col_index_perfect_slot(index, current->phash);
+        i = index->first[slot] + fill[slot]++;
+        index->items[i].item = current;
+        index->items[i].prev = prev;
+        prev = current;
+    }
+
+    free(fill);
+
+    TRACE_FLOW_EXIT();
+    return index;
+}
+
+/* Free indexes that were replaced while the collection was read */
+static void col_index_free_retired(struct col_index *index)
+{
+    struct col_index *retired;
+
+    while (index->retired) {
+        retired = index->retired;
+        index->retired = retired->retired;
+        col_index_destroy(retired);
+    }
+}
+
+/* Free the index of the collection */
+void col_index_free(struct collection_header *header)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (header->index) col_index_free_retired(header->index);
+    col_index_destroy(header->index);
+    header->index = NULL;
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Get index of the thread-safe collection.
+ * Readers look up the index at the same time so the index that
+ * is replaced stays on the retired list till the next writer.
+ */
+static struct col_index *col_index_get_shared(struct collection_item *collection,
+                                              struct collection_header *header)
+{
+    struct col_index *index;
+    struct col_index *new_index;
+    unsigned epoch;
+
+    TRACE_FLOW_ENTRY();
+
+    epoch = COL_INDEX_EPOCH(header);
+
+    index = __atomic_load_n(&(header->index), __ATOMIC_ACQUIRE);
+    if ((index) && (index->epoch == epoch)) return index;
+
+    if (header->count < COL_INDEX_THRESHOLD) {
+        TRACE_FLOW_STRING("Collection is too small to be indexed", "");
+        return NULL;
+    }
+
+    col_lock_index(header->lock);
+
+    /* Other reader might have built the index already */
+    index = header->index;
+    if ((index == NULL) || (index->epoch != epoch)) {
+        new_index = col_index_build(collection, col_index_size(header->count));
+        if (new_index) {
+            new_index->retired = index;
+            __atomic_store_n(&(header->index), new_index, __ATOMIC_RELEASE);
+        }
+        index = new_index;
+    }
+
+    col_unlock_index(header->lock);
+
+    TRACE_FLOW_EXIT();
+    return index;
+}
+
+/* Get a valid index of the collection building it if needed.
+ * Returns NULL if the collection should be searched by walking the list.
+ */
+struct col_index *col_index_get(struct collection_item *collection)
+{
+    struct collection_header *header;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+
+    /* Items of the frozen collection are never renamed */
+    if (header->flags & COL_HEADER_FROZEN) return header->index;
+
+    if (header->lock) return col_index_get_shared(collection, header);
+
+    if (header->index) {
+        if (header->index->epoch == COL_INDEX_EPOCH(header)) return header->index;
+        TRACE_INFO_STRING("Index is stale", "");
+        col_index_free(header);
+    }
+
+    if (header->count < COL_INDEX_THRESHOLD) {
+        TRACE_FLOW_STRING("Collection is too small to be indexed", "");
+        return NULL;
+    }
+
+    header->index = col_index_build(collection, col_index_size(header->count));
+
+    TRACE_FLOW_EXIT();
+    return header->index;
+}
+
+/* Build the index of the collection that is about to be frozen.
+ * Collection gets the perfect hash or the usual index
+ * if the perfect hash can't be built.
+ */
+void col_index_freeze(struct collection_item *collection)
+{
+    struct collection_header *header;
+    struct col_index *index;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+
+    /* Collection with the header only has nothing to look up */
+    if (header->count < 2) {
+        col_index_free(header);
+        return;
+    }
+
+    index = col_index_build_perfect(collection, header->count - 1);
+    if (index == NULL) {
+        TRACE_INFO_STRING("Using the usual index", "");
+        (void)col_index_get(collection);
+        return;
+    }
+
+    col_index_free(header);
+    header->index = index;
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Update index after the item is linked into collection after prev */
+void col_index_add(struct collection_item *collection,
+                   struct collection_item *prev,
+                   struct collection_item *item)
+{
+    struct collection_header *header;
+    struct col_index *index;
+    struct col_index_entry **slot;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+    index = header->index;
+    if (index == NULL) return;
+
+    /* Only one writer changes the collection */
+    col_index_free_retired(index);
+
+    if ((index->epoch != COL_INDEX_EPOCH(header)) ||
+        (col_index_link(index, collection, prev, item, 0))) {
+        TRACE_INFO_STRING("Dropping the index", "");
+        col_index_free(header);
+        return;
+    }
+
+    /* The item that follows the new one has a new predecessor */
+    if (item->next) {
+        slot = col_index_slot(index, item->next);
+        if (*slot) (*slot)->prev = item;
+    }
+
+    /* Grow the index rebuilding it from the list */
+    if (index->count > index->size) {
+        TRACE_INFO_NUMBER("Growing the index", index->size);
+        col_index_free(header);
+        header->index = col_index_build(collection,
+                                        col_index_size(header->count * 2));
+    }
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Update index when the item is unlinked from the collection.
+ * The item must still point to the item that followed it.
+ */
+void col_index_remove(struct collection_item *collection,
+                      struct collection_item *prev,
+                      struct collection_item *item)
+{
+    struct collection_header *header;
+    struct col_index *index;
+    struct col_index_entry **slot;
+    struct col_index_entry *entry;
+
+    TRACE_FLOW_ENTRY();
+
+    /* Item that leaves the collection is not tracked any more */
+    item->index_header = NULL;
+
+    header = (struct collection_header *)collection->data;
+    index = header->index;
+    if (index == NULL) return;
+
+    col_index_free_retired(index);
+
+    slot = col_index_slot(index, item);
+    if ((index->epoch != COL_INDEX_EPOCH(header)) || (*slot == NULL)) {
+        TRACE_INFO_STRING("Dropping the index", "");
+        col_index_free(header);
+        return;
+    }
+
+    entry = *slot;
+    *slot = entry->next;
+    free(entry);
+
+    index->count--;
+    if (item->type == COL_TYPE_COLLECTIONREF) index->refs--;
+
+    /* The item that followed the removed one has a new predecessor */
+    if (item->next) {
+        slot = col_index_slot(index, item->next);
+        if (*slot) (*slot)->prev = prev;
+    }
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Find the first item with given name and type.
+ * Name comparison is the same as the one used by the list walk.
+ */
+struct collection_item *col_index_find(struct col_index *index,
+                                       uint64_t hash,
+                                       const char *property,
+                                       const void *fold,
+                                       int type,
+                                       int skip_refs,
+                                       struct collection_item **prev)
+{
+    struct col_index_entry *entry;
+    struct collection_item *current;
+    unsigned slot;
+    unsigned i;
+
+    TRACE_FLOW_ENTRY();
+
+    /* All items in the slot have the same hash */
+    if (index->items) {
+        slot = col_index_perfect_slot(index, hash);
+        for (i = index->first[slot]; i < index->first[slot + 1]; i++) {
+            current = index->items[i].item;
+            if (current->phash != hash) break;
+            if ((type & current->type) &&
+                ((!skip_refs) || (current->type != COL_TYPE_COLLECTIONREF)) &&
+                (col_intern_match(current, property, fold))) {
+                TRACE_FLOW_STRING("Found item", current->property);
+                if (prev) *prev = index->items[i].prev;
+                return current;
+            }
+        }
+
+        TRACE_FLOW_STRING("Item not found", property);
+        return NULL;
+    }
+
+    entry = index->buckets[hash & (index->size - 1)];
+    while (entry) {
+        current = entry->item;
+        if ((current->phash == hash) &&
+            (type & current->type) &&
+            ((!skip_refs) || (current->type != COL_TYPE_COLLECTIONREF)) &&
+            (col_intern_match(current, property, fold))) {
+            TRACE_FLOW_STRING("Found item", current->property);
+            if (prev) *prev = entry->prev;
+            return current;
+        }
+        entry = entry->next;
+    }
+
+    TRACE_FLOW_STRING("Item not found", property);
+    return NULL;
+}
+
+/* Make the index that holds the item stale */
+void col_index_invalidate(struct collection_item *item)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (item->index_header)
+        __atomic_add_fetch(&(item->index_header->index_epoch), 1,
+                           __ATOMIC_RELAXED);
+
+    TRACE_FLOW_EXIT();
+}
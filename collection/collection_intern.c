@@ -0,0 +1,265 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the table of interned property names.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Initial number of buckets */
+#define COL_INTERN_MIN_SIZE     64
+
+/* Interned name.
+ * Names that differ only in case belong to the same class.
+ * The first interned name of the class represents it
+ * and is referenced by all other names of the class.
+ */
+struct col_intern {
+    struct col_intern *next;
+    struct col_intern *fold;
+    uint64_t hash;
+    unsigned refs;
+    int length;
+    char name[1];
+};
+
+/* The table is shared by all collections that intern names.
+ * It is freed when the last name is released.
+ * The mutex protects the table. Searches skip the mutex
+ * when no name is interned.
+ */
+static struct col_intern **col_intern_buckets = NULL;
+static unsigned col_intern_size = 0;
+static unsigned col_intern_count = 0;
+static pthread_mutex_t col_intern_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Get the entry the interned name belongs to */
+static struct col_intern *col_intern_entry(char *name)
+{
+    return (struct col_intern *)(name - offsetof(struct col_intern, name));
+}
+
+/* Grow the table keeping the order of entries in the buckets */
+static int col_intern_grow(void)
+{
+    struct col_intern **buckets;
+    struct col_intern **tails;
+    struct col_intern *entry;
+    unsigned size;
+    unsigned i;
+    unsigned j;
+
+    TRACE_FLOW_ENTRY();
+
+    size = col_intern_size ? col_intern_size * 2 : COL_INTERN_MIN_SIZE;
+
+    buckets = (struct col_intern **)calloc(size, sizeof(struct col_intern *));
+    tails = (struct col_intern **)calloc(size, sizeof(struct col_intern *));
+    if ((buckets == NULL) || (tails == NULL)) {
+        TRACE_ERROR_NUMBER("Failed to allocate buckets", ENOMEM);
+        free(buckets);
+        free(tails);
+        return ENOMEM;
+    }
+
+    for (i = 0; i < col_intern_size; i++) {
+        while (col_intern_buckets[i]) {
+            entry = col_intern_buckets[i];
+            col_intern_buckets[i] = entry->next;
+            entry->next = NULL;
+            j = entry->hash & (size - 1);
+            if (tails[j]) tails[j]->next = entry;
+            else buckets[j] = entry;
+            tails[j] = entry;
+        }
+    }
+
+    free(tails);
+    free(col_intern_buckets);
+    col_intern_buckets = buckets;
+    col_intern_size = size;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Get interned copy of the name together with its hash and length.
+ * Returns NULL if there is not enough memory.
+ */
+char *col_intern_name(const char *name, uint64_t *hash, int *length)
+{
+    struct col_intern *entry;
+    struct col_intern *fold = NULL;
+    uint64_t name_hash;
+    int name_len = 0;
+
+    TRACE_FLOW_ENTRY();
+
+    name_hash = col_make_hash(name, 0, &name_len);
+
+    pthread_mutex_lock(&col_intern_mutex);
+
+    if (col_intern_size) {
+        entry = col_intern_buckets[name_hash & (col_intern_size - 1)];
+        while (entry) {
+            if ((entry->hash == name_hash) &&
+                (entry->length == name_len)) {
+                if (memcmp(entry->name, name, name_len) == 0) {
+                    TRACE_FLOW_STRING("Name is already interned", name);
+                    entry->refs++;
+                    pthread_mutex_unlock(&col_intern_mutex);
+                    *hash = name_hash;
+                    *length = name_len;
+                    return entry->name;
+                }
+                if ((fold == NULL) &&
+                    (strncasecmp(entry->name, name, name_len) == 0))
+                    fold = entry->fold;
+            }
+            entry = entry->next;
+        }
+    }
+
+    if ((col_intern_count >= col_intern_size) && (col_intern_grow())) {
+        pthread_mutex_unlock(&col_intern_mutex);
+        return NULL;
+    }
+
+    entry = (struct col_intern *)malloc(offsetof(struct col_intern, name) +
+                                        name_len + 1);
+    if (entry == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate interned name", ENOMEM);
+        pthread_mutex_unlock(&col_intern_mutex);
+        return NULL;
+    }
+
+    memcpy(entry->name, name, name_len + 1);
+    entry->hash = name_hash;
+    entry->length = name_len;
+    entry->refs = 1;
+
+    /* Each name of the class holds its representative */
+    if (fold) {
+        entry->fold = fold;
+        fold->refs++;
+    }
+    else entry->fold = entry;
+
+    entry->next = col_intern_buckets[name_hash & (col_intern_size - 1)];
+    col_intern_buckets[name_hash & (col_intern_size - 1)] = entry;
+    __atomic_add_fetch(&col_intern_count, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&col_intern_mutex);
+
+    *hash = name_hash;
+    *length = name_len;
+
+    TRACE_FLOW_EXIT();
+    return entry->name;
+}
+
+/* Release interned name */
+void col_intern_release(char *name)
+{
+    struct col_intern *entry;
+    struct col_intern *fold;
+    struct col_intern **slot;
+
+    TRACE_FLOW_ENTRY();
+
+    entry = col_intern_entry(name);
+
+    pthread_mutex_lock(&col_intern_mutex);
+
+    while (entry) {
+        entry->refs--;
+        if (entry->refs > 0) break;
+
+        slot = &(col_intern_buckets[entry->hash & (col_intern_size - 1)]);
+        while (*slot != entry) slot = &((*slot)->next);
+        *slot = entry->next;
+        __atomic_sub_fetch(&col_intern_count, 1, __ATOMIC_RELEASE);
+
+        fold = (entry->fold != entry) ? entry->fold : NULL;
+        free(entry);
+        entry = fold;
+    }
+
+    if (col_intern_count == 0) {
+        TRACE_INFO_STRING("Freeing the table", "");
+        free(col_intern_buckets);
+        col_intern_buckets = NULL;
+        col_intern_size = 0;
+    }
+
+    pthread_mutex_unlock(&col_intern_mutex);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Get the class of the name that is searched.
+ * Returns NULL if no interned name matches it.
+ */
+const void *col_intern_class(const char *name, uint64_t hash)
+{
+    struct col_intern *entry;
+    const void *fold = NULL;
+
+    if (__atomic_load_n(&col_intern_count, __ATOMIC_ACQUIRE) == 0)
+        return NULL;
+
+    pthread_mutex_lock(&col_intern_mutex);
+
+    if (col_intern_size) {
+        entry = col_intern_buckets[hash & (col_intern_size - 1)];
+        while (entry) {
+            if ((entry->hash == hash) &&
+                (strncasecmp(entry->name, name, entry->length + 1) == 0)) {
+                fold = entry->fold;
+                break;
+            }
+            entry = entry->next;
+        }
+    }
+
+    pthread_mutex_unlock(&col_intern_mutex);
+
+    return fold;
+}
+
+/* Check if the property of the item matches the name that is searched.
+ * Interned properties are compared by the class of the name.
+ */
+int col_intern_match(const struct collection_item *item,
+                     const char *name,
+                     const void *fold)
+{
+    if (item->flags & COL_ITEM_INTERN_PROPERTY)
+        return (col_intern_entry(item->property)->fold == fold);
+
+    return (strncasecmp(item->property, name, item->property_len + 1) == 0);
+}
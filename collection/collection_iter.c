@@ -34,6 +34,17 @@
 /* Depth for iterator depth allocation block */
 #define STACK_DEPTH_BLOCK   15
 
+/* Iterator storage of the caller must fit the iterator */
+typedef char col_iterator_storage_check[
+    (sizeof(struct collection_iterator) <=
+     sizeof(struct collection_iterator_storage)) ? 1 : -1];
+
+/* Special end item is shared by all iterators and is never changed */
+static char col_end_property[1] = "";
+static struct collection_item col_end_item = {
+    NULL, col_end_property, 0, COL_TYPE_END, 0, 0, NULL, 0, NULL, { 0 }
+};
+
 /* Grow iteration stack */
 static int col_grow_stack(struct collection_iterator *iterator, unsigned desired)
 {
@@ -44,7 +55,16 @@ static int col_grow_stack(struct collection_iterator *iterator, unsigned desired
 
     if (desired > iterator->stack_size) {
         grow_by = (((desired - iterator->stack_size) / STACK_DEPTH_BLOCK) + 1) * STACK_DEPTH_BLOCK;
-        temp = (struct collection_item **)realloc(iterator->stack, grow_by * sizeof(struct collection_item *));
+        if (iterator->stack == iterator->inline_stack) {
+            /* Stack moves from the iterator to the heap */
+            temp = (struct collection_item **)malloc((iterator->stack_size + grow_by) *
+                                                     sizeof(struct collection_item *));
+            if (temp) memcpy(temp, iterator->inline_stack,
+                             iterator->stack_size * sizeof(struct collection_item *));
+        }
+        else temp = (struct collection_item **)realloc(iterator->stack,
+                                                       (iterator->stack_size + grow_by) *
+                                                       sizeof(struct collection_item *));
         if (temp == NULL) {
             TRACE_ERROR_NUMBER("Failed to allocate memory", ENOMEM);
             return ENOMEM;
@@ -56,15 +76,39 @@ static int col_grow_stack(struct collection_iterator *iterator, unsigned desired
     return EOK;
 }
 
+/* Initialize iterator and tie it to the collection */
+static void col_init_iterator(struct collection_iterator *iter,
+                              struct collection_item *ci,
+                              int mode_flags,
+                              unsigned in_storage)
+{
+    struct collection_header *header;
+
+    iter->stack = iter->inline_stack;
+    iter->stack_size = COL_ITERATOR_INLINE_DEPTH;
+    iter->stack_depth = 0;
+    iter->item_level = 0;
+    iter->flags = mode_flags;
+    iter->pin_level = 0;
+    iter->can_break = 0;
+    iter->in_storage = in_storage;
 
+    TRACE_INFO_NUMBER("Iterator flags", iter->flags);
+
+    /* Make sure that we tie iterator to the collection */
+    header = (struct collection_header *)ci->data;
+    col_reference_add(header);
+    iter->top = ci;
+    iter->pin = ci;
+    *(iter->stack) = ci;
+    iter->stack_depth++;
+}
 
 /* Bind iterator to a collection */
 int col_bind_iterator(struct collection_iterator **iterator,
                       struct collection_item *ci,
                       int mode_flags)
 {
-    int error;
-    struct collection_header *header;
     struct collection_iterator *iter = NULL;
 
     TRACE_FLOW_STRING("col_bind_iterator", "Entry.");
@@ -81,44 +125,35 @@ int col_bind_iterator(struct collection_iterator **iterator,
         return ENOMEM;
     }
 
-    /* Allocate memory for the stack */
-    iter->stack = NULL;
-    iter->stack_size = 0;
-    iter->stack_depth = 0;
-    iter->item_level = 0;
-    iter->flags = mode_flags;
-    iter->pin_level = 0;
-    iter->can_break = 0;
+    col_init_iterator(iter, ci, mode_flags, 0);
 
-    TRACE_INFO_NUMBER("Iterator flags", iter->flags);
+    *iterator = iter;
 
-    /* Allocate memory for stack */
-    error = col_grow_stack(iter, 1);
-    if(error) {
-        free(iter);
-        TRACE_ERROR_NUMBER("Error growing stack.", error);
-        return error;
-    }
+    TRACE_FLOW_STRING("col_bind_iterator", "Exit");
+    return EOK;
+}
+
+/* Bind iterator to a collection using the storage of the caller */
+int col_bind_iterator_storage(struct collection_iterator **iterator,
+                              struct collection_iterator_storage *storage,
+                              struct collection_item *ci,
+                              int mode_flags)
+{
+    struct collection_iterator *iter;
+
+    TRACE_FLOW_STRING("col_bind_iterator_storage", "Entry.");
 
-    /* Create a special end item */
-    error = col_allocate_item(&(iter->end_item), "", NULL, 0, COL_TYPE_END);
-    if(error) {
-        free(iter);
-        TRACE_ERROR_NUMBER("Error allocating end item.", error);
-        return error;
+    if ((iterator == NULL) || (storage == NULL) || (ci == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter.", EINVAL);
+        return EINVAL;
     }
 
-    /* Make sure that we tie iterator to the collection */
-    header = (struct collection_header *)ci->data;
-    header->reference_count++;
-    iter->top = ci;
-    iter->pin = ci;
-    *(iter->stack) = ci;
-    iter->stack_depth++;
+    iter = (struct collection_iterator *)storage;
+    col_init_iterator(iter, ci, mode_flags, 1);
 
     *iterator = iter;
 
-    TRACE_FLOW_STRING("col_bind_iterator", "Exit");
+    TRACE_FLOW_STRING("col_bind_iterator_storage", "Exit");
     return EOK;
 }
 
@@ -189,9 +224,8 @@ void col_unbind_iterator(struct collection_iterator *iterator)
     TRACE_FLOW_STRING("col_unbind_iterator", "Entry.");
     if (iterator != NULL) {
         col_destroy_collection(iterator->top);
-        col_delete_item(iterator->end_item);
-        free(iterator->stack);
-        free(iterator);
+        if (iterator->stack != iterator->inline_stack) free(iterator->stack);
+        if (!iterator->in_storage) free(iterator);
     }
     TRACE_FLOW_STRING("col_unbind_iterator", "Exit");
 }
@@ -361,7 +395,7 @@ int col_iterate_collection(struct collection_iterator *iterator,
 
                     /* Return dummy entry to indicate the end of the collection */
                     TRACE_INFO_STRING("Finished level", "told to return END");
-                    *item = iterator->end_item;
+                    *item = &col_end_item;
                     break;
                 }
             }
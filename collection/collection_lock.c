@@ -0,0 +1,209 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the locks of the thread-safe collections.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Number of different collections a thread can lock at the same time */
+#define COL_LOCK_HELD_MAX       8
+
+/* Lock of the collection.
+ * Readers and writers share the read-write lock.
+ * The mutex serializes readers that rebuild the index.
+ */
+struct col_lock {
+    pthread_rwlock_t rwlock;
+    pthread_mutex_t index_mutex;
+};
+
+/* Lock held by the thread.
+ * Library functions call each other so the lock
+ * that the thread already holds is not taken again.
+ */
+struct col_lock_held {
+    struct col_lock *lock;
+    int write;
+    unsigned depth;
+};
+
+static __thread struct col_lock_held col_lock_held[COL_LOCK_HELD_MAX];
+static __thread unsigned col_lock_held_count = 0;
+
+
+/* Create lock */
+int col_lock_create(struct col_lock **lock)
+{
+    struct col_lock *new_lock;
+
+    TRACE_FLOW_ENTRY();
+
+    new_lock = (struct col_lock *)malloc(sizeof(struct col_lock));
+    if (new_lock == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate lock", ENOMEM);
+        return ENOMEM;
+    }
+
+    if (pthread_rwlock_init(&(new_lock->rwlock), NULL)) {
+        TRACE_ERROR_NUMBER("Failed to init read-write lock", ENOMEM);
+        free(new_lock);
+        return ENOMEM;
+    }
+
+    if (pthread_mutex_init(&(new_lock->index_mutex), NULL)) {
+        TRACE_ERROR_NUMBER("Failed to init mutex", ENOMEM);
+        pthread_rwlock_destroy(&(new_lock->rwlock));
+        free(new_lock);
+        return ENOMEM;
+    }
+
+    *lock = new_lock;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Destroy lock */
+void col_lock_destroy(struct col_lock *lock)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (lock == NULL) return;
+
+    pthread_mutex_destroy(&(lock->index_mutex));
+    pthread_rwlock_destroy(&(lock->rwlock));
+    free(lock);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Find the lock among the locks held by the thread */
+static struct col_lock_held *col_lock_find(struct col_lock *lock)
+{
+    unsigned i;
+
+    for (i = 0; i < col_lock_held_count; i++) {
+        if (col_lock_held[i].lock == lock) return &(col_lock_held[i]);
+    }
+
+    return NULL;
+}
+
+/* Acquire lock for reading or writing.
+ * Returns EDEADLK if the thread holds the lock for reading
+ * and wants to write or holds too many locks.
+ */
+int col_lock_acquire(struct col_lock *lock, int write)
+{
+    struct col_lock_held *held;
+    int error;
+
+    TRACE_FLOW_ENTRY();
+
+    if (lock == NULL) return EOK;
+
+    held = col_lock_find(lock);
+    if (held) {
+        if ((write) && (!held->write)) {
+            TRACE_ERROR_NUMBER("Can't upgrade read lock", EDEADLK);
+            return EDEADLK;
+        }
+        held->depth++;
+        TRACE_FLOW_NUMBER("Lock is already held. Depth", held->depth);
+        return EOK;
+    }
+
+    if (col_lock_held_count == COL_LOCK_HELD_MAX) {
+        TRACE_ERROR_NUMBER("Too many locks held", EDEADLK);
+        return EDEADLK;
+    }
+
+    if (write) error = pthread_rwlock_wrlock(&(lock->rwlock));
+    else error = pthread_rwlock_rdlock(&(lock->rwlock));
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to acquire lock", error);
+        return error;
+    }
+
+    held = &(col_lock_held[col_lock_held_count++]);
+    held->lock = lock;
+    held->write = write;
+    held->depth = 1;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Release lock acquired by the thread */
+void col_lock_release(struct col_lock *lock)
+{
+    struct col_lock_held *held;
+
+    TRACE_FLOW_ENTRY();
+
+    if (lock == NULL) return;
+
+    held = col_lock_find(lock);
+    if (held == NULL) {
+        TRACE_ERROR_STRING("Lock is not held", "");
+        return;
+    }
+
+    held->depth--;
+    if (held->depth > 0) return;
+
+    pthread_rwlock_unlock(&(lock->rwlock));
+    *held = col_lock_held[--col_lock_held_count];
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Serialize readers that update the index */
+void col_lock_index(struct col_lock *lock)
+{
+    pthread_mutex_lock(&(lock->index_mutex));
+}
+
+void col_unlock_index(struct col_lock *lock)
+{
+    pthread_mutex_unlock(&(lock->index_mutex));
+}
+
+/* Add reference to the collection */
+void col_reference_add(struct collection_header *header)
+{
+    __atomic_add_fetch(&(header->reference_count), 1, __ATOMIC_RELAXED);
+}
+
+/* Remove reference from the collection.
+ * Returns the number of references that are left.
+ */
+unsigned col_reference_release(struct collection_header *header)
+{
+    return __atomic_sub_fetch(&(header->reference_count), 1,
+                              __ATOMIC_ACQ_REL);
+}
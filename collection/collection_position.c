@@ -0,0 +1,435 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the positional index of the collection.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <errno.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* The positional index splits the items of the collection into
+ * chunks of consecutive items. Chunks are kept in a skip list where
+ * every link knows how many items it skips. So the chunk that holds
+ * the item at the given position is found in logarithmic time and
+ * then only the items of one chunk are walked.
+ *
+ * The index is built when an item is first looked up by position.
+ * Items added or removed at the known position keep it up to date.
+ * The index is dropped when the position of the change is not known.
+ */
+
+/* Collections with fewer items are walked */
+#define COL_POSITION_THRESHOLD  64
+
+/* Number of items in the chunk when the index is built.
+ * Chunk is split when it grows twice as big.
+ */
+#define COL_POSITION_CHUNK      32
+
+/* Levels of the skip list. Every fourth chunk goes one level up. */
+#define COL_POSITION_LEVELS     12
+
+struct col_position_chunk;
+
+/* Link to the next chunk on one level of the skip list.
+ * Width is the number of items from the first item of the chunk
+ * that owns the link to the first item of the next chunk.
+ * Last link on the level counts the items till the end.
+ */
+struct col_position_link {
+    struct col_position_chunk *next;
+    unsigned width;
+};
+
+/* Chunk is a run of items that follow the prev item in the list */
+struct col_position_chunk {
+    struct collection_item *prev;
+    unsigned size;
+    unsigned levels;
+    struct col_position_link links[1];
+};
+
+struct col_position {
+    struct col_position_link head[COL_POSITION_LEVELS];
+    unsigned total;
+    uint32_t seed;
+};
+
+/* Links that lead to the position on every level */
+struct col_position_path {
+    struct col_position_link *links[COL_POSITION_LEVELS];
+    unsigned starts[COL_POSITION_LEVELS];
+    struct col_position_chunk *chunk;
+    unsigned start;
+};
+
+
+/* Pick the number of levels of the new chunk */
+static unsigned col_position_levels(struct col_position *position)
+{
+    unsigned levels = 1;
+
+    /* Xorshift is good enough to balance the list */
+    position->seed ^= position->seed << 13;
+    position->seed ^= position->seed >> 17;
+    position->seed ^= position->seed << 5;
+
+    while ((levels < COL_POSITION_LEVELS) &&
+           ((position->seed >> (2 * levels)) & 3) == 0)
+        levels++;
+
+    return levels;
+}
+
+static struct col_position_chunk *col_position_chunk(unsigned levels)
+{
+    struct col_position_chunk *chunk;
+
+    chunk = (struct col_position_chunk *)
+        malloc(sizeof(struct col_position_chunk) +
+               (levels - 1) * sizeof(struct col_position_link));
+    if (chunk) chunk->levels = levels;
+
+    return chunk;
+}
+
+static void col_position_destroy(struct col_position *position)
+{
+    struct col_position_chunk *chunk;
+    struct col_position_chunk *next;
+
+    if (position == NULL) return;
+
+    chunk = position->head[0].next;
+    while (chunk) {
+        next = chunk->links[0].next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(position);
+}
+
+/* Free the positional index of the collection */
+void col_position_free(struct collection_header *header)
+{
+    TRACE_FLOW_ENTRY();
+
+    col_position_destroy(header->position);
+    header->position = NULL;
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Build the index from the list */
+static struct col_position *col_position_build(struct collection_item *collection,
+                                               unsigned total)
+{
+    struct col_position *position;
+    struct col_position_chunk *chunk;
+    struct col_position_link *tails[COL_POSITION_LEVELS];
+    unsigned starts[COL_POSITION_LEVELS];
+    struct collection_item *prev = collection;
+    unsigned start = 0;
+    unsigned size;
+    unsigned i;
+
+    TRACE_FLOW_ENTRY();
+
+    position = (struct col_position *)malloc(sizeof(struct col_position));
+    if (position == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate index", ENOMEM);
+        return NULL;
+    }
+
+    position->total = total;
+    position->seed = 0x9E3779B9;
+    for (i = 0; i < COL_POSITION_LEVELS; i++) {
+        position->head[i].next = NULL;
+        position->head[i].width = total;
+        tails[i] = &(position->head[i]);
+        starts[i] = 0;
+    }
+
+    while (start < total) {
+        chunk = col_position_chunk(col_position_levels(position));
+        if (chunk == NULL) {
+            TRACE_ERROR_NUMBER("Failed to allocate chunk", ENOMEM);
+            col_position_destroy(position);
+            return NULL;
+        }
+
+        size = total - start;
+        if (size > COL_POSITION_CHUNK) size = COL_POSITION_CHUNK;
+        chunk->prev = prev;
+        chunk->size = size;
+
+        for (i = 0; i < chunk->levels; i++) {
+            tails[i]->next = chunk;
+            tails[i]->width = start - starts[i];
+            chunk->links[i].next = NULL;
+            chunk->links[i].width = total - start;
+            tails[i] = &(chunk->links[i]);
+            starts[i] = start;
+        }
+
+        start += size;
+        for (i = 0; i < size; i++) prev = prev->next;
+    }
+
+    TRACE_FLOW_EXIT();
+    return position;
+}
+
+/* Find the chunk with the item at the given position.
+ * The position after the last item is found in the last chunk.
+ * If strict is set the path stops before the chunk
+ * that starts at the position.
+ */
+static void col_position_search(struct col_position *position,
+                                unsigned pos,
+                                int strict,
+                                struct col_position_path *path)
+{
+    struct col_position_link *links = position->head;
+    struct col_position_chunk *chunk = NULL;
+    unsigned start = 0;
+    unsigned i = COL_POSITION_LEVELS;
+
+    while (i > 0) {
+        i--;
+        while ((links[i].next) &&
+               ((strict) ? (start + links[i].width < pos) :
+                           (start + links[i].width <= pos))) {
+            start += links[i].width;
+            chunk = links[i].next;
+            links = chunk->links;
+        }
+        path->links[i] = &(links[i]);
+        path->starts[i] = start;
+    }
+
+    path->chunk = chunk;
+    path->start = start;
+}
+
+/* Change the number of items in the chunk on the path */
+static void col_position_resize(struct col_position *position,
+                                struct col_position_path *path,
+                                int delta)
+{
+    unsigned i;
+
+    for (i = 0; i < COL_POSITION_LEVELS; i++)
+        path->links[i]->width += delta;
+
+    path->chunk->size += delta;
+    position->total += delta;
+}
+
+/* Split the chunk on the path in two */
+static int col_position_split(struct col_position *position,
+                              struct col_position_path *path)
+{
+    struct col_position_chunk *chunk = path->chunk;
+    struct col_position_chunk *second;
+    struct collection_item *prev;
+    unsigned start;
+    unsigned offset;
+    unsigned i;
+
+    second = col_position_chunk(col_position_levels(position));
+    if (second == NULL) return ENOMEM;
+
+    prev = chunk->prev;
+    for (i = 0; i < COL_POSITION_CHUNK; i++) prev = prev->next;
+
+    second->prev = prev;
+    second->size = chunk->size - COL_POSITION_CHUNK;
+    chunk->size = COL_POSITION_CHUNK;
+    start = path->start + COL_POSITION_CHUNK;
+
+    for (i = 0; i < second->levels; i++) {
+        offset = start - path->starts[i];
+        second->links[i].next = path->links[i]->next;
+        second->links[i].width = path->links[i]->width - offset;
+        path->links[i]->next = second;
+        path->links[i]->width = offset;
+    }
+
+    return EOK;
+}
+
+/* Unlink the empty chunk */
+static void col_position_unlink(struct col_position *position,
+                                struct col_position_chunk *chunk,
+                                unsigned start)
+{
+    struct col_position_path path;
+    unsigned i;
+
+    col_position_search(position, start, 1, &path);
+
+    for (i = 0; i < chunk->levels; i++) {
+        path.links[i]->next = chunk->links[i].next;
+        path.links[i]->width += chunk->links[i].width;
+    }
+
+    free(chunk);
+}
+
+/* Get the item that is before the given position.
+ * Builds the index if the collection is big enough.
+ * Returns NULL if the list has to be walked.
+ */
+struct collection_item *col_position_prev(struct collection_item *collection,
+                                          unsigned pos)
+{
+    struct collection_header *header;
+    struct col_position_path path;
+    struct collection_item *prev;
+    unsigned i;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+
+    /* Index that lost track of the list is built again */
+    if ((header->position) &&
+        (header->position->total != header->count - 1)) {
+        TRACE_INFO_STRING("Positional index is stale", "");
+        col_position_free(header);
+    }
+
+    if (header->position == NULL) {
+        if (header->count - 1 < COL_POSITION_THRESHOLD) {
+            TRACE_FLOW_STRING("Collection is too small to be indexed", "");
+            return NULL;
+        }
+        header->position = col_position_build(collection, header->count - 1);
+        if (header->position == NULL) return NULL;
+    }
+
+    if (pos > header->position->total) {
+        TRACE_ERROR_NUMBER("Position is out of range", pos);
+        return NULL;
+    }
+
+    col_position_search(header->position, pos, 0, &path);
+
+    prev = path.chunk->prev;
+    for (i = path.start; i < pos; i++) prev = prev->next;
+
+    TRACE_FLOW_EXIT();
+    return prev;
+}
+
+/* Update index after the item is linked into collection after prev.
+ * If pos is negative the position is known only at the ends.
+ */
+void col_position_add(struct collection_item *collection,
+                      struct collection_item *prev,
+                      struct collection_item *item,
+                      int pos)
+{
+    struct collection_header *header;
+    struct col_position *position;
+    struct col_position_path path;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+    position = header->position;
+    if (position == NULL) return;
+
+    if (pos < 0) {
+        if (prev == collection) pos = 0;
+        else if (item->next == NULL) pos = position->total;
+        else {
+            TRACE_INFO_STRING("Dropping the positional index", "");
+            col_position_free(header);
+            return;
+        }
+    }
+
+    col_position_search(position, pos, 0, &path);
+    col_position_resize(position, &path, 1);
+
+    if ((path.chunk->size > 2 * COL_POSITION_CHUNK) &&
+        (col_position_split(position, &path))) {
+        TRACE_INFO_STRING("Dropping the positional index", "");
+        col_position_free(header);
+    }
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Update index when the item is unlinked from the collection.
+ * The item must still point to the item that followed it.
+ * If pos is negative the position is known only at the ends.
+ */
+void col_position_remove(struct collection_item *collection,
+                         struct collection_item *prev,
+                         struct collection_item *item,
+                         int pos)
+{
+    struct collection_header *header;
+    struct col_position *position;
+    struct col_position_path path;
+    struct col_position_chunk *chunk;
+
+    TRACE_FLOW_ENTRY();
+
+    header = (struct collection_header *)collection->data;
+    position = header->position;
+    if (position == NULL) return;
+
+    if (pos < 0) {
+        if (prev == collection) pos = 0;
+        else if (item->next == NULL) pos = position->total - 1;
+        else {
+            TRACE_INFO_STRING("Dropping the positional index", "");
+            col_position_free(header);
+            return;
+        }
+    }
+
+    if (position->total == 1) {
+        col_position_free(header);
+        return;
+    }
+
+    col_position_search(position, pos, 0, &path);
+    chunk = path.chunk;
+
+    /* Next chunk follows the item that was before the removed one */
+    if ((pos == path.start + chunk->size - 1) && (chunk->links[0].next))
+        chunk->links[0].next->prev = prev;
+
+    col_position_resize(position, &path, -1);
+
+    if (chunk->size == 0) col_position_unlink(position, chunk, path.start);
+
+    TRACE_FLOW_EXIT();
+}
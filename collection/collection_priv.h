@@ -22,8 +22,12 @@
 #ifndef COLLECTION_PRIV_H
 #define COLLECTION_PRIV_H
 
+#include <stddef.h>
 #include <stdint.h>
 
+/* Size of the space for short property and data inside the item */
+#define COL_ITEM_INLINE_SIZE    40
+
 /* Define real strcutures */
 /* Structure that holds one property.
  * This structure should never be assumed and used directly other than
@@ -44,14 +48,73 @@ struct collection_item {
     int property_len;
     int type;
     int length;
+    unsigned flags;
     void *data;
     uint64_t phash;
+
+    /* Header of the collection whose index holds the item.
+     * Renaming the item makes only that index stale.
+     */
+    struct collection_header *index_header;
+
+    /* Short property and data are stored here
+     * so that they are in the same cache line as the item.
+     */
+    union {
+        uint64_t align;
+        char buf[COL_ITEM_INLINE_SIZE];
+    } space;
 };
 
+/* Flags that tell which parts of the item are allocated from the arena */
+#define COL_ITEM_ARENA          0x00000001
+#define COL_ITEM_ARENA_PROPERTY 0x00000002
+#define COL_ITEM_ARENA_DATA     0x00000004
+
+/* Flags that tell which parts of the item are stored inside it */
+#define COL_ITEM_INLINE_PROPERTY 0x00000008
+#define COL_ITEM_INLINE_DATA     0x00000010
+
+/* Flag that tells that the property name is interned */
+#define COL_ITEM_INTERN_PROPERTY 0x00000020
+
+/* Flag of the reference to the sub collection that is shared
+ * with a copy-on-write copy. The sub collection is copied
+ * before it is changed through this reference.
+ */
+#define COL_ITEM_SHARED         0x00000040
+
+/* Flag of the item of the frozen collection that can't be modified */
+#define COL_ITEM_FROZEN         0x00000080
+
+/* Alignment of the blocks carved from the arena */
+#define COL_ARENA_ALIGN(size)   (((size) + 7) & ~((size_t)7))
+
+/* Internal flag of the collection that is never changed again */
+#define COL_HEADER_FROZEN       0x80000000
+
+/* Arena the items are allocated from */
+struct col_arena;
+
+/* Lock of the thread-safe collection */
+struct col_lock;
+
+/* Index of the items by their position */
+struct col_position;
+
 
 /* Internal iterator structure - exposed for reference.
  * Never access internals of this structure in your application.
  */
+/* Depth of the iteration that does not need memory for the stack */
+#define COL_ITERATOR_INLINE_DEPTH   8
+
+/* Iterator.
+ * The stack starts in the iterator and moves
+ * to the heap only if the tree is deeper.
+ * The iterator bound in the storage of the caller
+ * is not freed when it is unbound.
+ */
 struct collection_iterator {
     struct collection_item *top;
     struct collection_item **stack;
@@ -59,19 +122,69 @@ struct collection_iterator {
     unsigned stack_depth;
     unsigned item_level;
     int flags;
-    struct collection_item *end_item;
     struct collection_item *pin;
     unsigned pin_level;
     unsigned can_break;
+    unsigned in_storage;
+    struct collection_item *inline_stack[COL_ITERATOR_INLINE_DEPTH];
 };
 
 
+/* Entry of the lookup index.
+ * Entries with the same hash are kept in the order
+ * in which the items appear in the collection.
+ */
+struct col_index_entry {
+    struct collection_item *item;
+    struct collection_item *prev;
+    struct col_index_entry *next;
+};
+
+/* Entry of the perfect hash of the frozen collection */
+struct col_index_item {
+    struct collection_item *item;
+    struct collection_item *prev;
+};
+
+/* Lookup index of one level of the collection.
+ * It is built on demand when the collection grows
+ * big enough and is dropped when it can't be
+ * maintained cheaply. It will be rebuilt on the next lookup.
+ * Frozen collection uses the perfect hash instead of the buckets.
+ * Every distinct hash gets its own slot and the items with
+ * the same hash are stored next to each other in the list order.
+ */
+struct col_index {
+    struct col_index_entry **buckets;
+    unsigned size;
+    unsigned count;
+    unsigned refs;
+    unsigned epoch;                 /* index_epoch of the header */
+    struct col_index *retired;
+    uint32_t *displace;
+    unsigned displace_size;
+    unsigned slots;
+    unsigned *first;
+    struct col_index_item *items;
+};
+
+
+/* Number of counters in struct col_statistics */
+#define COL_STAT_COUNT          9
+
 /* Special type of data that stores collection header information. */
 struct collection_header {
     struct collection_item *last;
     unsigned reference_count;
     unsigned count;
     unsigned cclass;
+    struct col_index *index;
+    unsigned index_epoch;
+    struct col_arena *arena;
+    unsigned flags;
+    struct col_lock *lock;
+    unsigned long statistics[COL_STAT_COUNT];
+    struct col_position *position;
 };
 
 /* Internal function to allocate item */
@@ -81,4 +194,113 @@ int col_allocate_item(struct collection_item **ci,
                       int length,
                       int type);
 
+/* Internal functions to maintain the lookup index */
+struct col_index *col_index_get(struct collection_item *collection);
+void col_index_free(struct collection_header *header);
+void col_index_add(struct collection_item *collection,
+                   struct collection_item *prev,
+                   struct collection_item *item);
+void col_index_remove(struct collection_item *collection,
+                      struct collection_item *prev,
+                      struct collection_item *item);
+struct collection_item *col_index_find(struct col_index *index,
+                                       uint64_t hash,
+                                       const char *property,
+                                       const void *fold,
+                                       int type,
+                                       int skip_refs,
+                                       struct collection_item **prev);
+void col_index_invalidate(struct collection_item *item);
+void col_index_freeze(struct collection_item *collection);
+
+/* Internal functions to maintain the positional index */
+struct collection_item *col_position_prev(struct collection_item *collection,
+                                          unsigned pos);
+void col_position_free(struct collection_header *header);
+void col_position_add(struct collection_item *collection,
+                      struct collection_item *prev,
+                      struct collection_item *item,
+                      int pos);
+void col_position_remove(struct collection_item *collection,
+                         struct collection_item *prev,
+                         struct collection_item *item,
+                         int pos);
+
+/* Internal functions to manage the arena */
+int col_arena_create(struct col_arena **arena);
+void col_arena_ref(struct col_arena *arena);
+void col_arena_unref(struct col_arena *arena);
+void *col_arena_alloc(struct col_arena *arena, size_t size);
+void col_arena_keep_mapping(struct col_arena *arena,
+                            void *mapping, size_t size);
+
+/* Internal functions to manage interned property names */
+char *col_intern_name(const char *name, uint64_t *hash, int *length);
+void col_intern_release(char *name);
+const void *col_intern_class(const char *name, uint64_t hash);
+int col_intern_match(const struct collection_item *item,
+                     const char *name,
+                     const void *fold);
+
+/* Internal function to make immutable copy of the collection */
+int col_copy_frozen(struct collection_item **collection_copy,
+                    struct collection_item *collection);
+
+/* Internal function to make private copy of the shared sub collection */
+int col_unshare_item(struct collection_item *collection,
+                     struct collection_item *item);
+
+/* Growable ring buffer of values of the same size.
+ * It backs the value queues and stacks.
+ * The capacity is always a power of two.
+ */
+struct col_ring {
+    char *buffer;
+    size_t value_size;
+    unsigned capacity;
+    unsigned head;
+    unsigned count;
+};
+
+/* Internal functions to manage the ring buffer */
+void col_ring_init(struct col_ring *ring, size_t value_size);
+void col_ring_free(struct col_ring *ring);
+int col_ring_put(struct col_ring *ring, const void *value);
+int col_ring_get(struct col_ring *ring, void *value, int last);
+
+/* Internal functions to count the work done by the collections.
+ * The counters are the fields of struct col_statistics.
+ */
+extern int col_statistics_enabled;
+void col_stat_add(struct collection_item *collection,
+                  size_t offset,
+                  unsigned long value);
+void col_stat_max(struct collection_item *collection,
+                  size_t offset,
+                  unsigned long value);
+
+#define COL_STAT_ADD(collection, field, value) \
+    do { \
+        if (__atomic_load_n(&col_statistics_enabled, __ATOMIC_RELAXED)) \
+            col_stat_add((collection), \
+                         offsetof(struct col_statistics, field), (value)); \
+    } while (0)
+
+#define COL_STAT_MAX(collection, field, value) \
+    do { \
+        if (__atomic_load_n(&col_statistics_enabled, __ATOMIC_RELAXED)) \
+            col_stat_max((collection), \
+                         offsetof(struct col_statistics, field), (value)); \
+    } while (0)
+
+/* Internal functions to lock thread-safe collections */
+int col_lock_create(struct col_lock **lock);
+void col_lock_destroy(struct col_lock *lock);
+int col_lock_acquire(struct col_lock *lock, int write);
+void col_lock_release(struct col_lock *lock);
+void col_lock_index(struct col_lock *lock);
+void col_unlock_index(struct col_lock *lock);
+void col_reference_add(struct collection_header *header);
+unsigned col_reference_release(struct collection_header *header);
+
 #endif
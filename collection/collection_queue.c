@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <errno.h>
+#include "collection_priv.h"
 #include "collection_queue.h"
 #include "trace.h"
 
@@ -359,3 +360,84 @@ int col_dequeue_item(struct collection_item *queue,
     TRACE_FLOW_STRING("col_dequeue_item", "Exit.");
     return error;
 }
+
+/* Value queue is a ring buffer of values */
+struct col_value_queue {
+    struct col_ring ring;
+};
+
+/* Create value queue */
+int col_create_value_queue(struct col_value_queue **queue,
+                           size_t value_size)
+{
+    struct col_value_queue *new_queue;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((queue == NULL) || (value_size == 0)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    new_queue = (struct col_value_queue *)malloc(sizeof(struct col_value_queue));
+    if (new_queue == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate queue", ENOMEM);
+        return ENOMEM;
+    }
+
+    col_ring_init(&(new_queue->ring), value_size);
+    *queue = new_queue;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Destroy value queue */
+void col_destroy_value_queue(struct col_value_queue *queue)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (queue == NULL) return;
+
+    col_ring_free(&(queue->ring));
+    free(queue);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Put value into the value queue */
+int col_enqueue_value(struct col_value_queue *queue,
+                      const void *value)
+{
+    if ((queue == NULL) || (value == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    return col_ring_put(&(queue->ring), value);
+}
+
+/* Take the oldest value from the value queue */
+int col_dequeue_value(struct col_value_queue *queue,
+                      void *value)
+{
+    if ((queue == NULL) || (value == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    return col_ring_get(&(queue->ring), value, 0);
+}
+
+/* Get number of values in the value queue */
+int col_get_value_queue_count(struct col_value_queue *queue,
+                              unsigned *count)
+{
+    if ((queue == NULL) || (count == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    *count = queue->ring.count;
+    return EOK;
+}
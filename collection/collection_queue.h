@@ -22,6 +22,7 @@
 #ifndef COLLECTION_QUEUE_H
 #define COLLECTION_QUEUE_H
 
+#include <stddef.h>
 #include "collection.h"
 
 /**
@@ -38,6 +39,9 @@
 /** @brief All queues use this name as the name of the collection */
 #define COL_NAME_QUEUE  "queue"
 
+/** @brief Value queue object */
+struct col_value_queue;
+
 /**
  * @brief Create queue.
  *
@@ -319,6 +323,71 @@ int col_enqueue_item(struct collection_item *queue,
 int col_dequeue_item(struct collection_item *queue,
                      struct collection_item **item);
 
+/**
+ * @brief Create value queue.
+ *
+ * Value queue stores values of the same fixed size
+ * in a growable ring buffer. Unlike the queue of the
+ * properties it does not allocate memory for each value
+ * and values have no names.
+ *
+ * @param[out] queue             Newly created queue object.
+ * @param[in]  value_size        Size of each value.
+ *
+ * @return 0          - Queue was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ *
+ */
+int col_create_value_queue(struct col_value_queue **queue,
+                           size_t value_size);
+
+/**
+ * @brief Destroy value queue.
+ *
+ * @param[in] queue              Value queue object to destroy.
+ *
+ */
+void col_destroy_value_queue(struct col_value_queue *queue);
+
+/**
+ * @brief Add value to the queue.
+ *
+ * @param[in] queue       Value queue object.
+ * @param[in] value       Pointer to the value to copy.
+ *
+ * @return 0          - Value was added successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_enqueue_value(struct col_value_queue *queue,
+                      const void *value);
+
+/**
+ * @brief Get the oldest value from the queue.
+ *
+ * @param[in]  queue      Value queue object.
+ * @param[out] value      Memory that receives the value.
+ *
+ * @return 0          - Value was retrieved successfully.
+ * @return ENOENT     - Queue is empty.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_dequeue_value(struct col_value_queue *queue,
+                      void *value);
+
+/**
+ * @brief Get number of values in the queue.
+ *
+ * @param[in]  queue      Value queue object.
+ * @param[out] count      Number of values.
+ *
+ * @return 0          - Success.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_get_value_queue_count(struct col_value_queue *queue,
+                              unsigned *count);
+
 /**
  * @}
  */
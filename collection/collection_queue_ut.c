@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection_queue.h"
@@ -186,12 +187,82 @@ static int empty_test(void)
 }
 
 
+/* Value queue test */
+static int value_queue_test(void)
+{
+    struct col_value_queue *queue = NULL;
+    uint64_t value;
+    uint64_t next = 0;
+    uint64_t expected = 0;
+    unsigned count = 0;
+    int i;
+    int error = EOK;
+
+    COLOUT(printf("\n\nVALUE QUEUE TEST!!!.\n\n\n"));
+
+    error = col_create_value_queue(&queue, sizeof(uint64_t));
+    if (error) {
+        printf("Failed to create value queue. Error %d\n", error);
+        return error;
+    }
+
+    /* Two values in and one out so the values
+     * wrap around the buffer while it grows.
+     */
+    for (i = 0; i < 1000; i++) {
+        error = col_enqueue_value(queue, &next);
+        next++;
+        if (!error) error = col_enqueue_value(queue, &next);
+        next++;
+        if (error) {
+            printf("Failed to enqueue value. Error %d\n", error);
+            col_destroy_value_queue(queue);
+            return error;
+        }
+
+        if ((error = col_dequeue_value(queue, &value)) ||
+            (value != expected++)) {
+            printf("Dequeued %llu instead of %llu. Error %d\n",
+                   (unsigned long long)value,
+                   (unsigned long long)(expected - 1), error);
+            col_destroy_value_queue(queue);
+            return error ? error : EINVAL;
+        }
+    }
+
+    col_get_value_queue_count(queue, &count);
+    COLOUT(printf("Values left in the queue %u\n", count));
+
+    while ((error = col_dequeue_value(queue, &value)) == EOK) {
+        if (value != expected++) {
+            printf("Dequeued %llu instead of %llu\n",
+                   (unsigned long long)value,
+                   (unsigned long long)(expected - 1));
+            col_destroy_value_queue(queue);
+            return EINVAL;
+        }
+        count--;
+    }
+
+    col_destroy_value_queue(queue);
+
+    if ((error != ENOENT) || (count != 0) || (expected != next)) {
+        printf("Queue was not emptied. Error %d\n", error);
+        return EINVAL;
+    }
+
+    COLOUT(printf("\n\nEND OF VALUE QUEUE TEST!!!.\n\n\n"));
+
+    return EOK;
+}
+
 /* Main function of the unit test */
 int main(int argc, char *argv[])
 {
     int error = 0;
     test_fn tests[] = { queue_test,
                         empty_test,
+                        value_queue_test,
                         NULL };
     test_fn t;
     int i = 0;
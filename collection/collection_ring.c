@@ -0,0 +1,129 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the ring buffer of values.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Number of values the buffer is allocated for first */
+#define COL_RING_MIN_SIZE       16
+
+/* Get the address of the value at the position in the buffer */
+#define COL_RING_VALUE(ring, pos) \
+    ((ring)->buffer + (size_t)((pos) & ((ring)->capacity - 1)) * \
+                      (ring)->value_size)
+
+
+/* Prepare empty ring buffer. Memory is allocated by the first put. */
+void col_ring_init(struct col_ring *ring, size_t value_size)
+{
+    ring->buffer = NULL;
+    ring->value_size = value_size;
+    ring->capacity = 0;
+    ring->head = 0;
+    ring->count = 0;
+}
+
+/* Free the memory of the ring buffer */
+void col_ring_free(struct col_ring *ring)
+{
+    free(ring->buffer);
+    col_ring_init(ring, ring->value_size);
+}
+
+/* Double the size of the buffer.
+ * Values that wrapped around are moved
+ * right after the end of the old buffer.
+ */
+static int col_ring_grow(struct col_ring *ring)
+{
+    char *buffer;
+    unsigned capacity;
+    unsigned wrapped;
+
+    TRACE_FLOW_ENTRY();
+
+    capacity = ring->capacity ? ring->capacity * 2 : COL_RING_MIN_SIZE;
+    if ((capacity < ring->capacity) ||
+        ((size_t)capacity > ((size_t)-1) / ring->value_size)) {
+        TRACE_ERROR_NUMBER("Ring buffer is too big", ENOMEM);
+        return ENOMEM;
+    }
+
+    buffer = (char *)realloc(ring->buffer, (size_t)capacity * ring->value_size);
+    if (buffer == NULL) {
+        TRACE_ERROR_NUMBER("Failed to grow ring buffer", ENOMEM);
+        return ENOMEM;
+    }
+
+    if (ring->head + ring->count > ring->capacity) {
+        wrapped = ring->head + ring->count - ring->capacity;
+        memcpy(buffer + (size_t)ring->capacity * ring->value_size,
+               buffer, (size_t)wrapped * ring->value_size);
+    }
+
+    ring->buffer = buffer;
+    ring->capacity = capacity;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Add value at the end */
+int col_ring_put(struct col_ring *ring, const void *value)
+{
+    int error;
+
+    if (ring->count == ring->capacity) {
+        error = col_ring_grow(ring);
+        if (error) return error;
+    }
+
+    memcpy(COL_RING_VALUE(ring, ring->head + ring->count),
+           value, ring->value_size);
+    ring->count++;
+
+    return EOK;
+}
+
+/* Take the first or the last value */
+int col_ring_get(struct col_ring *ring, void *value, int last)
+{
+    if (ring->count == 0) return ENOENT;
+
+    ring->count--;
+    if (last) {
+        memcpy(value, COL_RING_VALUE(ring, ring->head + ring->count),
+               ring->value_size);
+    }
+    else {
+        memcpy(value, COL_RING_VALUE(ring, ring->head), ring->value_size);
+        ring->head = (ring->head + 1) & (ring->capacity - 1);
+    }
+
+    return EOK;
+}
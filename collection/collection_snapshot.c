@@ -0,0 +1,203 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the snapshots of the collection.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Snapshot holds the current frozen copy of the collection.
+ * Each copy is reference counted. The snapshot holds one reference
+ * and every reader that pinned the copy holds another.
+ * Readers that are between reading the current copy and
+ * taking the reference are counted in one of two phases.
+ * Publisher waits for both phases to drain before
+ * it drops the reference of the snapshot to the old copy.
+ */
+struct col_snapshot {
+    struct collection_item *current;
+    unsigned phase;
+    unsigned readers[2];
+    pthread_mutex_t mutex;
+};
+
+/* Wait till no reader can be taking the reference to the old copy.
+ * New readers enter the other phase so the wait is bounded.
+ */
+static void col_snapshot_wait(struct col_snapshot *snapshot)
+{
+    unsigned phase;
+    int i;
+
+    TRACE_FLOW_ENTRY();
+
+    for (i = 0; i < 2; i++) {
+        phase = __atomic_load_n(&(snapshot->phase), __ATOMIC_SEQ_CST);
+        __atomic_store_n(&(snapshot->phase), phase ^ 1, __ATOMIC_SEQ_CST);
+        while (__atomic_load_n(&(snapshot->readers[phase]), __ATOMIC_SEQ_CST))
+            sched_yield();
+    }
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Create snapshot of the collection */
+int col_create_snapshot(struct col_snapshot **snapshot,
+                        struct collection_item *ci)
+{
+    struct col_snapshot *new_snapshot;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((snapshot == NULL) ||
+        (ci == NULL) ||
+        (ci->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    new_snapshot = (struct col_snapshot *)malloc(sizeof(struct col_snapshot));
+    if (new_snapshot == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate snapshot", ENOMEM);
+        return ENOMEM;
+    }
+
+    if (pthread_mutex_init(&(new_snapshot->mutex), NULL)) {
+        TRACE_ERROR_NUMBER("Failed to init mutex", ENOMEM);
+        free(new_snapshot);
+        return ENOMEM;
+    }
+
+    new_snapshot->phase = 0;
+    new_snapshot->readers[0] = 0;
+    new_snapshot->readers[1] = 0;
+
+    error = col_copy_frozen(&(new_snapshot->current), ci);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to copy collection", error);
+        pthread_mutex_destroy(&(new_snapshot->mutex));
+        free(new_snapshot);
+        return error;
+    }
+
+    *snapshot = new_snapshot;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Replace the copy of the collection in the snapshot */
+int col_publish_snapshot(struct col_snapshot *snapshot,
+                         struct collection_item *ci)
+{
+    struct collection_item *copy = NULL;
+    struct collection_item *old;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((snapshot == NULL) ||
+        (ci == NULL) ||
+        (ci->type != COL_TYPE_COLLECTION)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    /* Copy is made before anything is locked */
+    error = col_copy_frozen(&copy, ci);
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to copy collection", error);
+        return error;
+    }
+
+    pthread_mutex_lock(&(snapshot->mutex));
+
+    old = __atomic_exchange_n(&(snapshot->current), copy, __ATOMIC_SEQ_CST);
+    col_snapshot_wait(snapshot);
+
+    pthread_mutex_unlock(&(snapshot->mutex));
+
+    /* Old copy is freed here or by the last reader that unpins it */
+    col_destroy_collection(old);
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Get the current copy of the collection */
+int col_pin_snapshot(struct col_snapshot *snapshot,
+                     struct collection_item **ci)
+{
+    struct collection_item *current;
+    unsigned phase;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((snapshot == NULL) || (ci == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    phase = __atomic_load_n(&(snapshot->phase), __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&(snapshot->readers[phase]), 1, __ATOMIC_SEQ_CST);
+
+    current = __atomic_load_n(&(snapshot->current), __ATOMIC_SEQ_CST);
+    col_reference_add((struct collection_header *)current->data);
+
+    __atomic_sub_fetch(&(snapshot->readers[phase]), 1, __ATOMIC_SEQ_CST);
+
+    *ci = current;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Release the copy of the collection */
+void col_unpin_snapshot(struct collection_item *ci)
+{
+    TRACE_FLOW_ENTRY();
+
+    col_destroy_collection(ci);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Destroy snapshot */
+void col_destroy_snapshot(struct col_snapshot *snapshot)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (snapshot == NULL) return;
+
+    /* Pinned copies stay alive till they are unpinned */
+    col_destroy_collection(snapshot->current);
+    pthread_mutex_destroy(&(snapshot->mutex));
+    free(snapshot);
+
+    TRACE_FLOW_EXIT();
+}
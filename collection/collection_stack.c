@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdlib.h>
 #include <errno.h>
+#include "collection_priv.h"
 #include "collection_stack.h"
 #include "trace.h"
 
@@ -357,3 +358,84 @@ int col_pop_item(struct collection_item *stack,
     TRACE_FLOW_STRING("col_pop_item", "Exit.");
     return error;
 }
+
+/* Value stack is a ring buffer of values */
+struct col_value_stack {
+    struct col_ring ring;
+};
+
+/* Create value stack */
+int col_create_value_stack(struct col_value_stack **stack,
+                           size_t value_size)
+{
+    struct col_value_stack *new_stack;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((stack == NULL) || (value_size == 0)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    new_stack = (struct col_value_stack *)malloc(sizeof(struct col_value_stack));
+    if (new_stack == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate stack", ENOMEM);
+        return ENOMEM;
+    }
+
+    col_ring_init(&(new_stack->ring), value_size);
+    *stack = new_stack;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Destroy value stack */
+void col_destroy_value_stack(struct col_value_stack *stack)
+{
+    TRACE_FLOW_ENTRY();
+
+    if (stack == NULL) return;
+
+    col_ring_free(&(stack->ring));
+    free(stack);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Push value into the value stack */
+int col_push_value(struct col_value_stack *stack,
+                   const void *value)
+{
+    if ((stack == NULL) || (value == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    return col_ring_put(&(stack->ring), value);
+}
+
+/* Pop the last value from the value stack */
+int col_pop_value(struct col_value_stack *stack,
+                  void *value)
+{
+    if ((stack == NULL) || (value == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    return col_ring_get(&(stack->ring), value, 1);
+}
+
+/* Get number of values in the value stack */
+int col_get_value_stack_count(struct col_value_stack *stack,
+                              unsigned *count)
+{
+    if ((stack == NULL) || (count == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    *count = stack->ring.count;
+    return EOK;
+}
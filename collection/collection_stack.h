@@ -22,6 +22,7 @@
 #ifndef COLLECTION_STACK_H
 #define COLLECTION_STACK_H
 
+#include <stddef.h>
 #include <collection.h>
 
 /**
@@ -38,6 +39,9 @@
 /** @brief All stacks use this name as the name of the collection */
 #define COL_NAME_STACK  "stack"
 
+/** @brief Value stack object */
+struct col_value_stack;
+
 /**
  * @brief Create stack.
  *
@@ -322,6 +326,71 @@ int col_push_item(struct collection_item *stack,
 int col_pop_item(struct collection_item *stack,
                  struct collection_item **item);
 
+/**
+ * @brief Create value stack.
+ *
+ * Value stack stores values of the same fixed size
+ * in a growable ring buffer. Unlike the stack of the
+ * properties it does not allocate memory for each value
+ * and values have no names.
+ *
+ * @param[out] stack             Newly created stack object.
+ * @param[in]  value_size        Size of each value.
+ *
+ * @return 0          - Stack was created successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ *
+ */
+int col_create_value_stack(struct col_value_stack **stack,
+                           size_t value_size);
+
+/**
+ * @brief Destroy value stack.
+ *
+ * @param[in] stack              Value stack object to destroy.
+ *
+ */
+void col_destroy_value_stack(struct col_value_stack *stack);
+
+/**
+ * @brief Push value to the stack.
+ *
+ * @param[in] stack       Value stack object.
+ * @param[in] value       Pointer to the value to copy.
+ *
+ * @return 0          - Value was added successfully.
+ * @return ENOMEM     - No memory.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_push_value(struct col_value_stack *stack,
+                   const void *value);
+
+/**
+ * @brief Pop the last pushed value from the stack.
+ *
+ * @param[in]  stack      Value stack object.
+ * @param[out] value      Memory that receives the value.
+ *
+ * @return 0          - Value was retrieved successfully.
+ * @return ENOENT     - Stack is empty.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_pop_value(struct col_value_stack *stack,
+                  void *value);
+
+/**
+ * @brief Get number of values in the stack.
+ *
+ * @param[in]  stack      Value stack object.
+ * @param[out] count      Number of values.
+ *
+ * @return 0          - Success.
+ * @return EINVAL     - Invalid argument.
+ */
+int col_get_value_stack_count(struct col_value_stack *stack,
+                              unsigned *count);
+
 /**
  * @}
  */
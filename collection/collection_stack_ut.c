@@ -22,6 +22,7 @@
 #include "config.h"
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection_stack.h"
@@ -103,12 +104,66 @@ static int stack_test(void)
     return error;
 }
 
+/* Value stack test */
+static int value_stack_test(void)
+{
+    struct col_value_stack *stack = NULL;
+    int32_t value;
+    int32_t i;
+    unsigned count = 0;
+    int error = EOK;
+
+    COLOUT(printf("\n\nVALUE STACK TEST!!!.\n\n\n"));
+
+    error = col_create_value_stack(&stack, sizeof(int32_t));
+    if (error) {
+        printf("Failed to create value stack. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 100; i++) {
+        if ((error = col_push_value(stack, &i))) {
+            printf("Failed to push value. Error %d\n", error);
+            col_destroy_value_stack(stack);
+            return error;
+        }
+    }
+
+    col_get_value_stack_count(stack, &count);
+    if (count != 100) {
+        printf("Stack has %u values instead of 100\n", count);
+        col_destroy_value_stack(stack);
+        return EINVAL;
+    }
+
+    for (i = 99; i >= 0; i--) {
+        if ((error = col_pop_value(stack, &value)) || (value != i)) {
+            printf("Popped %d instead of %d. Error %d\n", value, i, error);
+            col_destroy_value_stack(stack);
+            return error ? error : EINVAL;
+        }
+    }
+
+    error = col_pop_value(stack, &value);
+    col_destroy_value_stack(stack);
+
+    if (error != ENOENT) {
+        printf("Empty stack returned %d\n", error);
+        return EINVAL;
+    }
+
+    COLOUT(printf("\n\nEND OF VALUE STACK TEST!!!.\n\n\n"));
+
+    return EOK;
+}
+
 /* Main function of the unit test */
 
 int main(int argc, char *argv[])
 {
     int error = 0;
     test_fn tests[] = { stack_test,
+                        value_stack_test,
                         NULL };
     test_fn t;
     int i = 0;
@@ -0,0 +1,128 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the statistics of the collections.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <errno.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Counters of the header must match the public structure */
+typedef char col_statistics_check[
+    (sizeof(struct col_statistics) ==
+     COL_STAT_COUNT * sizeof(unsigned long)) ? 1 : -1];
+
+/* Counting is off till it is enabled.
+ * Counters are updated atomically since readers
+ * of thread-safe collections count at the same time.
+ */
+int col_statistics_enabled = 0;
+static unsigned long col_statistics_global[COL_STAT_COUNT];
+
+
+/* Get the counters of the collection */
+static unsigned long *col_stat_counters(struct collection_item *collection)
+{
+    if ((collection == NULL) || (collection->type != COL_TYPE_COLLECTION))
+        return NULL;
+
+    return ((struct collection_header *)collection->data)->statistics;
+}
+
+/* Add to the counter of the collection and to the global one */
+void col_stat_add(struct collection_item *collection,
+                  size_t offset,
+                  unsigned long value)
+{
+    unsigned long *counters;
+    unsigned field = offset / sizeof(unsigned long);
+
+    __atomic_add_fetch(&(col_statistics_global[field]), value,
+                       __ATOMIC_RELAXED);
+
+    counters = col_stat_counters(collection);
+    if (counters)
+        __atomic_add_fetch(&(counters[field]), value, __ATOMIC_RELAXED);
+}
+
+/* Raise the counter to the value if it is lower */
+static void col_stat_raise(unsigned long *counter, unsigned long value)
+{
+    unsigned long current;
+
+    current = __atomic_load_n(counter, __ATOMIC_RELAXED);
+    while ((current < value) &&
+           (!__atomic_compare_exchange_n(counter, &current, value, 1,
+                                         __ATOMIC_RELAXED,
+                                         __ATOMIC_RELAXED)));
+}
+
+/* Keep the highest value of the counter */
+void col_stat_max(struct collection_item *collection,
+                  size_t offset,
+                  unsigned long value)
+{
+    unsigned long *counters;
+    unsigned field = offset / sizeof(unsigned long);
+
+    col_stat_raise(&(col_statistics_global[field]), value);
+
+    counters = col_stat_counters(collection);
+    if (counters) col_stat_raise(&(counters[field]), value);
+}
+
+/* Turn counting on or off */
+void col_enable_statistics(int enable)
+{
+    TRACE_FLOW_ENTRY();
+
+    __atomic_store_n(&col_statistics_enabled, enable ? 1 : 0,
+                     __ATOMIC_RELAXED);
+
+    TRACE_FLOW_EXIT();
+}
+
+/* Get the counters of the collection or the global ones */
+int col_get_statistics(struct collection_item *ci,
+                       struct col_statistics *statistics)
+{
+    unsigned long *counters;
+    unsigned long *result;
+    unsigned i;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((statistics == NULL) ||
+        ((ci != NULL) && (ci->type != COL_TYPE_COLLECTION))) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    counters = ci ? col_stat_counters(ci) : col_statistics_global;
+    result = (unsigned long *)statistics;
+    for (i = 0; i < COL_STAT_COUNT; i++)
+        result[i] = __atomic_load_n(&(counters[i]), __ATOMIC_RELAXED);
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
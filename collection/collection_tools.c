@@ -24,11 +24,23 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 #include "trace.h"
 #include "collection_priv.h"
 #include "collection.h"
 #include "collection_tools.h"
 
+/* Amount of serialized data collected before it is written out */
+#define COL_SERIAL_CHUNK_SIZE   4096
+
+/* State of the serialization that is written out in chunks */
+struct col_serial_stream {
+    struct col_serial_data buf_data;
+    col_serial_fn writer;
+    void *writer_data;
+};
+
 /* Debug handle */
 int col_debug_handle(const char *property,
                      int property_len,
@@ -302,10 +314,14 @@ static int col_copy_esc(char *dest, const char *source, char esc)
     return j;
 }
 
-/* Grow buffer to accomodate more space */
+/* Grow buffer to accomodate more space.
+ * The size is doubled so that the big output
+ * does not cause a reallocation for each block.
+ */
 int col_grow_buffer(struct col_serial_data *buf_data, int len)
 {
     char *tmp;
+    int size;
 
     TRACE_FLOW_STRING("col_grow_buffer", "Entry point");
     TRACE_INFO_NUMBER("Current length: ", buf_data->length);
@@ -314,14 +330,22 @@ int col_grow_buffer(struct col_serial_data *buf_data, int len)
     TRACE_INFO_NUMBER("Current size: ", buf_data->size);
 
     /* Grow buffer if needed */
-    while (buf_data->length+len >= buf_data->size) {
-        tmp = realloc(buf_data->buffer, buf_data->size + BLOCK_SIZE);
+    if (buf_data->length+len >= buf_data->size) {
+        size = buf_data->size ? buf_data->size : BLOCK_SIZE;
+        while (buf_data->length+len >= size) {
+            if (size > INT_MAX / 2) {
+                TRACE_ERROR_NUMBER("Error. Buffer is too big.", ENOMEM);
+                return ENOMEM;
+            }
+            size *= 2;
+        }
+        tmp = realloc(buf_data->buffer, size);
         if (tmp == NULL) {
             TRACE_ERROR_NUMBER("Error. Failed to allocate memory.", ENOMEM);
             return ENOMEM;
         }
         buf_data->buffer = tmp;
-        buf_data->size += BLOCK_SIZE;
+        buf_data->size = size;
         TRACE_INFO_NUMBER("New size: ", buf_data->size);
 
     }
@@ -535,6 +559,144 @@ int col_serialize(const char *property_in,
 
 }
 
+/* Write out what was serialized so far.
+ * The trailing comma is kept because the end
+ * of the collection removes it.
+ */
+static int col_serial_flush(struct col_serial_stream *stream, int all)
+{
+    struct col_serial_data *buf_data = &(stream->buf_data);
+    int len;
+    int error;
+
+    len = buf_data->length;
+    if ((!all) && (len > 0) && (buf_data->buffer[len - 1] == ',')) len--;
+    if (len == 0) return EOK;
+
+    error = stream->writer(buf_data->buffer, (size_t)len, stream->writer_data);
+    if (error) {
+        TRACE_ERROR_NUMBER("Writer returned error", error);
+        return error;
+    }
+
+    memmove(buf_data->buffer, buf_data->buffer + len, buf_data->length - len);
+    buf_data->length -= len;
+    buf_data->buffer[buf_data->length] = '\0';
+
+    return EOK;
+}
+
+/* Serialize item and write the data out when enough is collected */
+static int col_serialize_stream(const char *property,
+                                int property_len,
+                                int type,
+                                void *data,
+                                int length,
+                                void *custom_data,
+                                int *dummy)
+{
+    struct col_serial_stream *stream;
+    int error;
+
+    stream = (struct col_serial_stream *)custom_data;
+
+    error = col_serialize(property, property_len, type,
+                          data, length, &(stream->buf_data), dummy);
+    if (error) return error;
+
+    if (stream->buf_data.length < COL_SERIAL_CHUNK_SIZE) return EOK;
+
+    return col_serial_flush(stream, 0);
+}
+
+/* Serialize collection passing the output to the writer in chunks */
+int col_serialize_with_writer(struct collection_item *handle,
+                              col_serial_fn writer,
+                              void *writer_data)
+{
+    struct col_serial_stream stream;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((handle == NULL) || (writer == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    stream.buf_data.buffer = NULL;
+    stream.buf_data.length = 0;
+    stream.buf_data.size = 0;
+    stream.buf_data.nest_level = 0;
+    stream.writer = writer;
+    stream.writer_data = writer_data;
+
+    error = col_traverse_collection(handle,
+                                    COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                    col_serialize_stream, (void *)(&stream));
+    if (!error) error = col_serial_flush(&stream, 1);
+
+    free(stream.buf_data.buffer);
+
+    TRACE_FLOW_NUMBER("col_serialize_with_writer returning", error);
+    return error;
+}
+
+/* Writer that writes to the stream */
+static int col_serial_file_writer(const char *data,
+                                  size_t length,
+                                  void *writer_data)
+{
+    if (fwrite(data, 1, length, (FILE *)writer_data) != length) {
+        TRACE_ERROR_NUMBER("Failed to write to file", EIO);
+        return EIO;
+    }
+
+    return EOK;
+}
+
+/* Writer that writes to the file descriptor */
+static int col_serial_fd_writer(const char *data,
+                                size_t length,
+                                void *writer_data)
+{
+    int fd = *((int *)writer_data);
+    ssize_t written;
+    int error;
+
+    while (length > 0) {
+        written = write(fd, data, length);
+        if (written < 0) {
+            error = errno;
+            if (error == EINTR) continue;
+            TRACE_ERROR_NUMBER("Failed to write to file descriptor", error);
+            return error;
+        }
+        data += written;
+        length -= (size_t)written;
+    }
+
+    return EOK;
+}
+
+/* Serialize collection into the stream */
+int col_serialize_to_file(struct collection_item *handle, FILE *file)
+{
+    if (file == NULL) return EINVAL;
+
+    return col_serialize_with_writer(handle, col_serial_file_writer,
+                                     (void *)file);
+}
+
+/* Serialize collection into the file descriptor */
+int col_serialize_to_fd(struct collection_item *handle, int fd)
+{
+    if (fd < 0) return EINVAL;
+
+    return col_serialize_with_writer(handle, col_serial_fd_writer,
+                                     (void *)(&fd));
+}
+
 /* Print the collection using default serialization */
 int col_print_collection(struct collection_item *handle)
 {
@@ -23,6 +23,7 @@
 #ifndef COLLECTION_TOOLS_H
 #define COLLECTION_TOOLS_H
 
+#include <stdio.h>
 #include "collection.h"
 
 /**
@@ -69,8 +70,9 @@
 #define TEXT_COLLEN 3
 
 /**
- * @brief The data will be allocated in BLOCK_SIZE
- * blocks during serialization.
+ * @brief The data will be allocated starting with BLOCK_SIZE
+ * bytes during serialization. The buffer is doubled
+ * each time it has to grow.
  */
 #define BLOCK_SIZE 1024
 
@@ -146,6 +148,73 @@ int col_serialize(const char *property_in,
                   void *custom_data,
                   int *dummy);
 
+/**
+ * @brief Serialization writer callback.
+ *
+ * Called by \ref col_serialize_with_writer each time
+ * a chunk of the serialized collection is ready.
+ *
+ * @param[in] data            Serialized data.
+ *                            It is not NULL terminated.
+ * @param[in] length          Length of the data.
+ * @param[in] writer_data     Data passed to the serialization
+ *                            function by the caller.
+ *
+ * @return 0 - Success.
+ * @return Any error code that stops the serialization.
+ */
+typedef int (*col_serial_fn)(const char *data,
+                             size_t length,
+                             void *writer_data);
+
+/**
+ * @brief Serialize collection in chunks.
+ *
+ * Produces the same output as the traversal with
+ * \ref col_serialize but passes it to the writer
+ * in chunks of few kilobytes. The memory used does not
+ * depend on the size of the collection, only on the size
+ * of the biggest property.
+ *
+ * @param[in] handle          Collection to serialize.
+ * @param[in] writer          Callback that receives the output.
+ * @param[in] writer_data     Data to pass to the writer.
+ *
+ * @return 0      - Success.
+ * @return ENOMEM - No memory.
+ * @return EINVAL - Invalid argument.
+ * @return Any error code returned by the writer.
+ */
+int col_serialize_with_writer(struct collection_item *handle,
+                              col_serial_fn writer,
+                              void *writer_data);
+
+/**
+ * @brief Serialize collection into a stream.
+ *
+ * @param[in] handle          Collection to serialize.
+ * @param[in] file            Stream to write to.
+ *
+ * @return 0      - Success.
+ * @return ENOMEM - No memory.
+ * @return EINVAL - Invalid argument.
+ * @return EIO    - Failed to write to the stream.
+ */
+int col_serialize_to_file(struct collection_item *handle, FILE *file);
+
+/**
+ * @brief Serialize collection into a file descriptor.
+ *
+ * @param[in] handle          Collection to serialize.
+ * @param[in] fd              File descriptor to write to.
+ *
+ * @return 0      - Success.
+ * @return ENOMEM - No memory.
+ * @return EINVAL - Invalid argument.
+ * @return Any error returned by write().
+ */
+int col_serialize_to_fd(struct collection_item *handle, int fd);
+
 /**
  * @brief Debug property callback.
  *
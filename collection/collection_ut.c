@@ -23,6 +23,11 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
 #define TRACE_HOME
 #include "trace.h"
 #include "collection.h"
@@ -2223,6 +2228,2624 @@ static int sort_test(void)
     return EOK;
 }
 
+/* Check that the integers are sorted and equal ones kept their order */
+static int merge_sort_check(struct collection_item *col, int desc)
+{
+    struct collection_iterator *iterator = NULL;
+    struct collection_item *item = NULL;
+    int32_t value;
+    int32_t prev_value = 0;
+    int ind;
+    int prev_ind = 0;
+    int count = 0;
+    int error = 0;
+
+    error = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL);
+    if (error) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        return error;
+    }
+
+    for (;;) {
+        error = col_iterate_collection(iterator, &item);
+        if (error) {
+            printf("Failed to iterate. Error %d\n", error);
+            col_unbind_iterator(iterator);
+            return error;
+        }
+        if (item == NULL) break;
+        if (col_get_item_type(item) != COL_TYPE_INTEGER) continue;
+
+        value = *((int32_t *)(col_get_item_data(item)));
+        ind = atoi(col_get_item_property(item, NULL) + 1);
+
+        if ((count) &&
+            ((desc ? (value > prev_value) : (value < prev_value)) ||
+             ((value == prev_value) && (ind < prev_ind)))) {
+            printf("Item %s is out of order\n",
+                   col_get_item_property(item, NULL));
+            col_unbind_iterator(iterator);
+            return EINVAL;
+        }
+
+        prev_value = value;
+        prev_ind = ind;
+        count++;
+    }
+
+    col_unbind_iterator(iterator);
+
+    return EOK;
+}
+
+/* Check the names and values of the items */
+static int batch_check(struct collection_item *col, const char *expected)
+{
+    struct collection_iterator *iterator = NULL;
+    struct collection_iterator_storage storage;
+    struct collection_item *item = NULL;
+    char result[200];
+    int error = 0;
+
+    result[0] = '\0';
+
+    error = col_bind_iterator_storage(&iterator, &storage, col,
+                                      COL_TRAVERSE_ONELEVEL);
+    if (error) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        return error;
+    }
+
+    for (;;) {
+        error = col_iterate_collection(iterator, &item);
+        if ((error) || (item == NULL)) break;
+        if (col_get_item_type(item) != COL_TYPE_INTEGER) continue;
+        sprintf(result + strlen(result), "%s%s=%d",
+                result[0] ? "," : "",
+                col_get_item_property(item, NULL),
+                *((int32_t *)(col_get_item_data(item))));
+    }
+
+    col_unbind_iterator(iterator);
+
+    if (error) {
+        printf("Failed to iterate. Error %d\n", error);
+        return error;
+    }
+
+    COLOUT(printf("Collection: %s\n", result));
+
+    if (strcmp(result, expected) != 0) {
+        printf("Expected %s got %s\n", expected, result);
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+/* Batch insert test */
+static int batch_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    int32_t values[6] = { 0, 1, 2, 3, 4, 5 };
+    struct col_batch_property batch[4];
+    int error = 0;
+
+    COLOUT(printf("\n\n==== BATCH TEST ====\n\n"));
+
+    batch[0].property = "b";
+    batch[1].property = "c";
+    batch[2].property = "d";
+    batch[3].property = "c";
+    batch[0].type = batch[1].type = batch[2].type = batch[3].type = COL_TYPE_INTEGER;
+    batch[0].length = batch[1].length = batch[2].length = batch[3].length = sizeof(int32_t);
+    batch[0].data = &values[1];
+    batch[1].data = &values[2];
+    batch[2].data = &values[3];
+    batch[3].data = &values[4];
+
+    if ((error = col_create_collection(&col, "batch", 0)) ||
+        (error = col_add_int_property(col, NULL, "a", 0)) ||
+        (error = col_add_int_property(col, NULL, "e", 5)) ||
+        (error = col_insert_batch(col, NULL, COL_DSP_AFTER, "a", 0,
+                                  COL_INSERT_NOCHECK, batch, 3)) ||
+        (error = batch_check(col, "a=0,b=1,c=2,d=3,e=5"))) {
+        printf("Failed to insert batch. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Duplicate in the collection or in the batch adds nothing */
+    if ((col_insert_batch(col, NULL, COL_DSP_END, NULL, 0,
+                          COL_INSERT_DUPERROR, batch + 2, 1) != EEXIST) ||
+        (col_insert_batch(col, NULL, COL_DSP_END, NULL, 0,
+                          COL_INSERT_DUPERRORT, batch + 1, 3) != EEXIST) ||
+        (col_insert_batch(col, NULL, COL_DSP_FIRSTDUP, NULL, 0,
+                          COL_INSERT_NOCHECK, batch, 1) != ENOSYS) ||
+        (col_insert_batch(col, NULL, COL_DSP_BEFORE, "x", 0,
+                          COL_INSERT_NOCHECK, batch, 1) != ENOENT) ||
+        (error = batch_check(col, "a=0,b=1,c=2,d=3,e=5"))) {
+        printf("Batch with duplicates was inserted. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Later duplicate overwrites the earlier one */
+    batch[0].property = "x";
+    batch[1].property = "d";
+    batch[2].property = "x";
+    batch[3].property = "e";
+    error = col_insert_batch(col, NULL, COL_DSP_FRONT, NULL, 0,
+                             COL_INSERT_DUPOVER, batch, 4);
+    if ((error) ||
+        (error = batch_check(col, "x=3,a=0,b=1,c=2,d=2,e=4"))) {
+        printf("Failed to overwrite with batch. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Moved items go where the batch goes even if they were the reference */
+    error = col_insert_batch(col, NULL, COL_DSP_BEFORE, "d", 0,
+                             COL_INSERT_DUPMOVE, batch, 4);
+    if ((error) ||
+        (error = batch_check(col, "a=0,b=1,c=2,d=2,x=3,e=4"))) {
+        printf("Failed to move with batch. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    error = col_insert_batch(col, NULL, COL_DSP_INDEX, NULL, 2,
+                             COL_INSERT_DUPMOVET, batch + 3, 1);
+    if ((error) ||
+        (error = col_add_int_property(col, NULL, "z", 5)) ||
+        (error = batch_check(col, "a=0,b=1,e=4,c=2,d=2,x=3,z=5"))) {
+        printf("Failed to insert batch at index. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    item = NULL;
+    error = col_get_item(col, "X", COL_TYPE_INTEGER,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item == NULL)) {
+        printf("Item inserted with batch is not found. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : ENOENT;
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== BATCH TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Get integer value of the property or -1 if there is none */
+static int cow_value(struct collection_item *col, const char *property)
+{
+    struct collection_item *item = NULL;
+
+    if ((col_get_item(col, property, COL_TYPE_INTEGER,
+                      COL_TRAVERSE_DEFAULT, &item)) || (item == NULL))
+        return -1;
+
+    return *((int32_t *)col_get_item_data(item));
+}
+
+/* Check if the sub collection is shared by both collections */
+static int cow_shared(struct collection_item *col1,
+                      struct collection_item *col2,
+                      const char *property)
+{
+    struct collection_item *item1 = NULL;
+    struct collection_item *item2 = NULL;
+
+    col_get_item(col1, property, COL_TYPE_COLLECTIONREF,
+                 COL_TRAVERSE_DEFAULT, &item1);
+    col_get_item(col2, property, COL_TYPE_COLLECTIONREF,
+                 COL_TRAVERSE_DEFAULT, &item2);
+
+    return (item1) && (item2) &&
+           (*((struct collection_item **)col_get_item_data(item1)) ==
+            *((struct collection_item **)col_get_item_data(item2)));
+}
+
+/* Copy-on-write copy test */
+static int cow_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *copy2 = NULL;
+    struct collection_item *sub = NULL;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== COPY-ON-WRITE TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "cow", 0)) ||
+        (error = col_add_int_property(col, NULL, "top", 1)) ||
+        (error = col_create_collection(&sub, "a", 0)) ||
+        (error = col_add_int_property(sub, NULL, "x", 1)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    sub = NULL;
+    if ((error = col_create_collection(&sub, "b", 0)) ||
+        (error = col_add_int_property(sub, NULL, "y", 1)) ||
+        (error = col_add_collection_to_collection(col, "a", NULL, sub,
+                                                  COL_ADD_MODE_EMBED))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    sub = NULL;
+    if ((error = col_create_collection(&sub, "c", 0)) ||
+        (error = col_add_int_property(sub, NULL, "z", 1)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_copy_collection(&copy, col, NULL, COL_COPY_COW))) {
+        printf("Failed to copy collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    if ((!cow_shared(col, copy, "a")) || (!cow_shared(col, copy, "c"))) {
+        printf("Sub collections are not shared.\n");
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Change deep in the copy copies only the path to it */
+    if ((error = col_update_int_property(copy, "a!b!y",
+                                         COL_TRAVERSE_DEFAULT, 2)) ||
+        (cow_value(col, "a!b!y") != 1) ||
+        (cow_value(copy, "a!b!y") != 2) ||
+        (cow_shared(col, copy, "a")) ||
+        (cow_shared(col, copy, "b")) ||
+        (!cow_shared(col, copy, "c"))) {
+        printf("Update of the copy is wrong. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Changes of the original do not show in the copy */
+    if ((error = col_delete_property(col, "a!x", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT)) ||
+        (error = col_add_int_property(col, "c", "w", 2)) ||
+        (cow_value(copy, "a!x") != 1) ||
+        (cow_value(col, "a!x") != -1) ||
+        (cow_value(copy, "c!w") != -1) ||
+        (cow_value(col, "c!w") != 2) ||
+        (cow_value(copy, "c!z") != 1)) {
+        printf("Change of the original shows in the copy. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Copy of the copy, flat search and sort */
+    error = col_copy_collection(&copy2, copy, NULL, COL_COPY_COW);
+    if ((error) ||
+        (error = col_delete_property(copy2, "z", COL_TYPE_ANY,
+                                     COL_TRAVERSE_FLAT)) ||
+        (error = col_add_int_property(copy2, "b", "a", 3)) ||
+        (error = col_sort_collection(copy2, COL_CMPIN_PROP_EQU,
+                                     COL_SORT_SUB)) ||
+        (cow_value(copy, "c!z") != 1) ||
+        (cow_value(copy2, "c!z") != -1) ||
+        (cow_value(copy, "b!a") != -1) ||
+        (cow_value(copy2, "b!a") != 3)) {
+        printf("Copy of the copy is wrong. Error %d\n", error);
+        col_destroy_collection(copy2);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if (verbose) {
+        col_debug_collection(col, COL_TRAVERSE_DEFAULT);
+        col_debug_collection(copy, COL_TRAVERSE_DEFAULT);
+        col_debug_collection(copy2, COL_TRAVERSE_DEFAULT);
+    }
+
+    col_destroy_collection(col);
+    col_destroy_collection(copy2);
+    col_destroy_collection(copy);
+
+    COLOUT(printf("\n\n==== COPY-ON-WRITE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Output collected by the serialization writer */
+struct serial_out {
+    char *buffer;
+    size_t length;
+    size_t max_chunk;
+    int calls;
+    int fail_at;
+};
+
+/* Serialization writer that collects the output */
+static int serial_writer(const char *data, size_t length, void *writer_data)
+{
+    struct serial_out *out = (struct serial_out *)writer_data;
+    char *tmp;
+
+    out->calls++;
+    if (out->calls == out->fail_at) return EIO;
+
+    tmp = realloc(out->buffer, out->length + length + 1);
+    if (tmp == NULL) return ENOMEM;
+    out->buffer = tmp;
+
+    memcpy(out->buffer + out->length, data, length);
+    out->length += length;
+    out->buffer[out->length] = '\0';
+    if (length > out->max_chunk) out->max_chunk = length;
+
+    return EOK;
+}
+
+/* Check that the stream contains the expected output */
+static int serial_check_file(FILE *file, const char *expected)
+{
+    char *buffer;
+    size_t length = strlen(expected);
+    int error = EOK;
+
+    buffer = malloc(length + 1);
+    if (buffer == NULL) return ENOMEM;
+
+    rewind(file);
+    if ((fread(buffer, 1, length + 1, file) != length) ||
+        (memcmp(buffer, expected, length) != 0)) error = EINVAL;
+
+    free(buffer);
+    return error;
+}
+
+/* Streaming serialization test */
+static int serial_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct col_serial_data buf_data;
+    struct serial_out out;
+    FILE *file;
+    char name[20];
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== SERIALIZATION TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "serial", 0)) ||
+        (error = col_create_collection(&sub, "sub", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; (i < 5000) && (!error); i++) {
+        sprintf(name, "item%d", i);
+        if (i % 3) error = col_add_int_property(i % 2 ? sub : col, NULL,
+                                                name, i);
+        else error = col_add_str_property(col, NULL, name, "a \"value\",", 0);
+    }
+
+    if ((error) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_add_bool_property(col, NULL, "last", 1))) {
+        printf("Failed to fill collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Output of the whole buffer */
+    memset(&buf_data, 0, sizeof(buf_data));
+    error = col_traverse_collection(col,
+                                    COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                    col_serialize, (void *)(&buf_data));
+    if (error) {
+        printf("Failed to serialize collection. Error %d\n", error);
+        free(buf_data.buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    memset(&out, 0, sizeof(out));
+    error = col_serialize_with_writer(col, serial_writer, &out);
+    if ((error) ||
+        (out.length != (size_t)buf_data.length) ||
+        (strcmp(out.buffer, buf_data.buffer) != 0) ||
+        (out.calls < 2) ||
+        (out.max_chunk > 8192)) {
+        printf("Streamed output is different. Error %d\n", error);
+        free(out.buffer);
+        free(buf_data.buffer);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    COLOUT(printf("Serialized %d bytes in %d chunks, biggest %u\n",
+                  buf_data.length, out.calls, (unsigned)out.max_chunk));
+
+    /* Error of the writer stops the serialization */
+    free(out.buffer);
+    memset(&out, 0, sizeof(out));
+    out.fail_at = 2;
+    error = col_serialize_with_writer(col, serial_writer, &out);
+    free(out.buffer);
+    if (error != EIO) {
+        printf("Writer error is not returned. Error %d\n", error);
+        free(buf_data.buffer);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    file = tmpfile();
+    if (file == NULL) {
+        printf("Failed to create file\n");
+        free(buf_data.buffer);
+        col_destroy_collection(col);
+        return errno;
+    }
+
+    if ((error = col_serialize_to_file(col, file)) ||
+        (fflush(file) != 0) ||
+        (error = serial_check_file(file, buf_data.buffer)) ||
+        (ftruncate(fileno(file), 0) != 0) ||
+        (lseek(fileno(file), 0, SEEK_SET) != 0) ||
+        (error = col_serialize_to_fd(col, fileno(file))) ||
+        (error = serial_check_file(file, buf_data.buffer))) {
+        printf("Output to file is wrong. Error %d\n", error);
+        fclose(file);
+        free(buf_data.buffer);
+        col_destroy_collection(col);
+        return error ? error : EIO;
+    }
+
+    fclose(file);
+    free(buf_data.buffer);
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== SERIALIZATION TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Iterator in the storage of the caller test */
+static int iterator_storage_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *item = NULL;
+    struct collection_item *other = NULL;
+    struct collection_iterator *iterator = NULL;
+    struct collection_iterator *heap_iterator = NULL;
+    struct collection_iterator_storage storage;
+    char name[20];
+    int count = 0;
+    int ends = 0;
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== ITERATOR STORAGE TEST ====\n\n"));
+
+    /* Tree is deeper than the stack inside the iterator */
+    for (i = 12; i >= 0; i--) {
+        sprintf(name, "level%d", i);
+        error = col_create_collection(&sub, name, 0);
+        if (!error) error = col_add_int_property(sub, NULL, "value", i);
+        if ((!error) && (col))
+            error = col_add_collection_to_collection(sub, NULL, NULL, col,
+                                                     COL_ADD_MODE_EMBED);
+        if (error) {
+            printf("Failed to build tree. Error %d\n", error);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            return error;
+        }
+        col = sub;
+        sub = NULL;
+    }
+
+    if ((error = col_bind_iterator_storage(&iterator, &storage, col,
+                                           COL_TRAVERSE_DEFAULT |
+                                           COL_TRAVERSE_END)) ||
+        (error = col_bind_iterator(&heap_iterator, col,
+                                   COL_TRAVERSE_DEFAULT |
+                                   COL_TRAVERSE_END))) {
+        printf("Failed to bind iterator. Error %d\n", error);
+        col_unbind_iterator(iterator);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Both iterators walk the tree the same way */
+    for (;;) {
+        if ((error = col_iterate_collection(iterator, &item)) ||
+            (error = col_iterate_collection(heap_iterator, &other))) {
+            printf("Failed to iterate. Error %d\n", error);
+            break;
+        }
+        if (item != other) {
+            if ((item == NULL) || (other == NULL) ||
+                (col_get_item_type(item) != COL_TYPE_END) ||
+                (col_get_item_type(other) != COL_TYPE_END)) {
+                printf("Iterators returned different items\n");
+                error = EINVAL;
+                break;
+            }
+        }
+        if (item == NULL) break;
+        if (col_get_item_type(item) == COL_TYPE_END) ends++;
+        COLOUT(printf("Item: %s\n", col_get_item_property(item, NULL)));
+        count++;
+    }
+
+    col_unbind_iterator(iterator);
+    col_unbind_iterator(heap_iterator);
+    col_destroy_collection(col);
+    if (error) return error;
+
+    /* Header of the top level, value on each of 13 levels,
+     * 12 references and the end of each level.
+     */
+    if ((count != 1 + 13 + 12 + 13) || (ends != 13)) {
+        printf("Unexpected number of items %d, ends %d\n", count, ends);
+        return EINVAL;
+    }
+
+    COLOUT(printf("\n\n==== ITERATOR STORAGE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Merge sort test */
+static int merge_sort_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    int count = 20000;
+    int i, j;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== MERGE SORT TEST ====\n\n"));
+
+    error = col_create_collection(&col, "merge", 0);
+    if (error) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    /* Sorting the empty collection keeps it usable */
+    error = col_sort_collection(col, COL_CMPIN_DATA, 0);
+    if (error) {
+        printf("Failed to sort empty collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    srand(2);
+    for (i = 0; i < count; i++) {
+        sprintf(name, "i%d", i);
+        error = col_add_int_property(col, NULL, name, rand() % 100);
+        if (error) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Item added after the sort must go last to keep the order */
+    for (j = 0; j < 2; j++) {
+        error = col_sort_collection(col, COL_CMPIN_DATA,
+                                    j ? COL_SORT_DESC : COL_SORT_ASC);
+        if (error) {
+            printf("Failed sort. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+
+        sprintf(name, "i%d", count + j);
+        if ((error = col_add_int_property(col, NULL, name,
+                                          j ? -1 : 100)) ||
+            (error = merge_sort_check(col, j))) {
+            printf("Sorted collection is wrong. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+
+        error = col_delete_property(col, name, COL_TYPE_ANY,
+                                    COL_TRAVERSE_ONELEVEL);
+        if (error) {
+            printf("Failed to delete property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    col_destroy_collection(col);
+    col = NULL;
+
+    /* Embedded sub collections are sorted in parallel */
+    error = col_create_collection(&col, "parallel", 0);
+    if (error) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 8; i++) {
+        sprintf(name, "sub%d", i);
+        error = col_create_collection(&sub, name, 0);
+        for (j = 0; (j < 1000) && (!error); j++) {
+            sprintf(name, "i%d", j);
+            error = col_add_int_property(sub, NULL, name, rand() % 10);
+        }
+        if (!error)
+            error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                     COL_ADD_MODE_EMBED);
+        if (error) {
+            printf("Failed to add sub collection. Error %d\n", error);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    error = col_sort_collection(col, COL_CMPIN_DATA,
+                                COL_SORT_SUB | COL_SORT_MYSUB |
+                                COL_SORT_PARALLEL);
+    if (error) {
+        printf("Failed parallel sort. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; i < 8; i++) {
+        sprintf(name, "sub%d", i);
+        sub = NULL;
+        item = NULL;
+        error = col_get_item(col, name, COL_TYPE_COLLECTIONREF,
+                             COL_TRAVERSE_ONELEVEL, &item);
+        if ((!error) && (item == NULL)) error = ENOENT;
+        if (!error) {
+            sub = *((struct collection_item **)(col_get_item_data(item)));
+            error = merge_sort_check(sub, 0);
+        }
+        if (error) {
+            printf("Sub collection %d is not sorted. Error %d\n", i, error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== MERGE SORT TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Check that the property has expected value or is missing */
+static int index_check(struct collection_item *col,
+                       const char *property,
+                       int present,
+                       int32_t value)
+{
+    struct collection_item *item = NULL;
+    int error = 0;
+
+    error = col_get_item(col, property, COL_TYPE_ANY,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if (error) {
+        printf("Failed to search for %s. Error %d\n", property, error);
+        return error;
+    }
+
+    if (!present) {
+        if (item) {
+            printf("Property %s should not be found\n", property);
+            return EINVAL;
+        }
+        return EOK;
+    }
+
+    if ((item == NULL) ||
+        (*((int32_t *)col_get_item_data(item)) != value)) {
+        printf("Property %s is not found or has wrong value\n", property);
+        return EINVAL;
+    }
+
+    COLOUT(printf("Property %s = %d\n", property, value));
+    return EOK;
+}
+
+static int index_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *other = NULL;
+    struct collection_item *item = NULL;
+    char property[20];
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== INDEX TEST ====\n\n"));
+
+    error = col_create_collection(&col, "index", 0);
+    if (error) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 100; i++) {
+        sprintf(property, "key%d", i);
+        if ((error = col_add_int_property(col, NULL, property, i)) ||
+            ((i % 10 == 0) &&
+             (error = col_add_int_property(col, NULL, "dup", i)))) {
+            printf("Failed to build collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Lookups in the large collection go through the index */
+    if ((error = index_check(col, "key0", 1, 0)) ||
+        (error = index_check(col, "KEY57", 1, 57)) ||
+        (error = index_check(col, "key99", 1, 99)) ||
+        (error = index_check(col, "dup", 1, 0)) ||
+        (error = index_check(col, "key100", 0, 0)) ||
+        (error = index_check(col, "key", 0, 0))) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Duplicates are found in the order of the list */
+    error = col_get_dup_item(col, NULL, "dup", COL_TYPE_ANY, 3, 1, &item);
+    if ((error) || (item == NULL) ||
+        (*((int32_t *)col_get_item_data(item)) != 30)) {
+        printf("Failed to get duplicate. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Inserts in different positions */
+    if ((error = col_insert_int_property(col, NULL, COL_DSP_FRONT, NULL, 0,
+                                         COL_INSERT_NOCHECK, "dup", -1)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_BEFORE, "key50", 0,
+                                         COL_INSERT_NOCHECK, "dup", -2)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_AFTER, "key10", 0,
+                                         COL_INSERT_NOCHECK, "dup", -3)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_INDEX, NULL, 5,
+                                         COL_INSERT_NOCHECK, "new5", 5)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                         COL_INSERT_DUPOVER, "key20", -20))) {
+        printf("Failed to insert property. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    error = col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                    COL_INSERT_DUPERROR, "key30", 0);
+    if (error != EEXIST) {
+        printf("Expected EEXIST. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = index_check(col, "dup", 1, -1)) ||
+        (error = index_check(col, "new5", 1, 5)) ||
+        (error = index_check(col, "key20", 1, -20))) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    error = col_get_dup_item(col, NULL, "dup", COL_TYPE_ANY, 2, 1, &item);
+    if ((error) || (item == NULL) ||
+        (*((int32_t *)col_get_item_data(item)) != -3)) {
+        printf("Failed to get duplicate. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Delete, extract and rename */
+    if ((error = col_delete_property(col, "key42", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT)) ||
+        (error = col_delete_property(col, "dup", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT)) ||
+        (error = index_check(col, "key42", 0, 0)) ||
+        (error = index_check(col, "key43", 1, 43)) ||
+        (error = index_check(col, "dup", 1, 0))) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    error = col_extract_item(col, NULL, COL_DSP_AFTER, "key10", 0,
+                             COL_TYPE_ANY, &item);
+    if ((error) || (*((int32_t *)col_get_item_data(item)) != -3)) {
+        printf("Failed to extract item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+    col_delete_item(item);
+
+    error = col_get_item(col, "key77", COL_TYPE_ANY,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item == NULL) ||
+        (error = col_modify_item_property(item, "renamed")) ||
+        (error = index_check(col, "renamed", 1, 77)) ||
+        (error = index_check(col, "key77", 0, 0))) {
+        printf("Failed to rename item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Item moved to another indexed collection is renamed there */
+    if ((error = col_create_collection(&other, "other", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    for (i = 0; (i < 20) && (!error); i++) {
+        sprintf(property, "other%d", i);
+        error = col_add_int_property(other, NULL, property, i);
+    }
+    if ((error) ||
+        (error = index_check(other, "other5", 1, 5)) ||
+        (error = col_extract_item(col, NULL, COL_DSP_AFTER, "renamed", 0,
+                                  COL_TYPE_ANY, &item)) ||
+        (error = col_insert_item(other, NULL, item, COL_DSP_END, NULL, 0,
+                                 COL_INSERT_NOCHECK)) ||
+        (error = col_modify_item_property(item, "moved")) ||
+        (error = index_check(other, "moved", 1, 78)) ||
+        (error = index_check(other, "key78", 0, 0)) ||
+        (error = index_check(col, "moved", 0, 0)) ||
+        (error = index_check(col, "key79", 1, 79))) {
+        printf("Failed to rename moved item. Error %d\n", error);
+        col_destroy_collection(other);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+    col_destroy_collection(other);
+
+    /* Sort and check again */
+    if ((error = col_sort_collection(col, COL_CMPIN_PROP_EQU, 0)) ||
+        (error = index_check(col, "key1", 1, 1)) ||
+        (error = index_check(col, "renamed", 1, 77)) ||
+        (error = index_check(col, "key200", 0, 0))) {
+        printf("Failed to sort collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    COLOUT(col_debug_collection(col, COL_TRAVERSE_DEFAULT));
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== INDEX TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Build and destroy a big collection to compare allocation modes */
+static int arena_timing(unsigned flags)
+{
+    struct collection_item *col = NULL;
+    char property[20];
+    clock_t start;
+    int error = 0;
+    int i;
+
+    start = clock();
+
+    error = col_create_collection_ex(&col, "timing", 0, flags);
+    if (error) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 20000; i++) {
+        sprintf(property, "key%d", i);
+        error = col_add_str_property(col, NULL, property, property, 0);
+        if (error) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("%s mode took %ld clock ticks\n",
+                  (flags & COL_CREATE_ARENA) ? "Arena" : "Heap",
+                  (long)(clock() - start)));
+
+    return EOK;
+}
+
+static int arena_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *heap = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    char property[20];
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== ARENA TEST ====\n\n"));
+
+    error = col_create_collection_ex(&col, "arena", 0, COL_CREATE_ARENA | 0x80000000);
+    if (error != EINVAL) {
+        printf("Expected EINVAL. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_create_collection_ex(&col, "arena", 0, COL_CREATE_ARENA)) ||
+        (error = col_create_collection(&sub, "sub", 0)) ||
+        (error = col_create_collection(&heap, "heap", 0)) ||
+        (error = col_add_int_property(sub, NULL, "subint", 1)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_CLONE)) ||
+        (error = col_add_collection_to_collection(col, NULL, "ref", sub,
+                                                  COL_ADD_MODE_REFERENCE))) {
+        printf("Failed to build collection. Error %d\n", error);
+        col_destroy_collection(col);
+        col_destroy_collection(sub);
+        col_destroy_collection(heap);
+        return error;
+    }
+
+    for (i = 0; i < 1000; i++) {
+        sprintf(property, "key%d", i);
+        if ((error = col_add_str_property(col, NULL, property, property, 0)) ||
+            (error = col_add_int_property(col, "sub", property, i))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            col_destroy_collection(sub);
+            col_destroy_collection(heap);
+            return error;
+        }
+    }
+
+    /* Modify, delete and extract items */
+    if ((error = col_get_item(col, "key10", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (error = col_modify_str_item(item, "renamed", "new value", 0)) ||
+        (error = col_update_int_property(col, "key11", COL_TRAVERSE_DEFAULT, 11)) ||
+        (error = col_delete_property(col, "key12", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT)) ||
+        (error = col_extract_item(col, NULL, COL_DSP_AFTER, "key20", 0,
+                                  COL_TYPE_ANY, &item)) ||
+        (error = col_insert_item(heap, NULL, item, COL_DSP_END, NULL, 0, 0)) ||
+        (error = col_copy_collection(&copy, col, "copy", COL_COPY_NORMAL))) {
+        printf("Failed to change collection. Error %d\n", error);
+        col_destroy_collection(col);
+        col_destroy_collection(sub);
+        col_destroy_collection(heap);
+        return error;
+    }
+
+    col_destroy_collection(col);
+
+    /* Extracted item, copy and referenced collection outlive the arena */
+    if ((error = col_get_item(heap, "key21", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (strcmp((const char *)col_get_item_data(item), "key21") != 0) ||
+        (error = col_get_item(copy, "renamed", COL_TYPE_STRING,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (strcmp((const char *)col_get_item_data(item), "new value") != 0) ||
+        (error = col_get_item(copy, "sub!key999", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (error = col_get_item(sub, "subint", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL)) {
+        printf("Item is not found after arena is released. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(sub);
+        col_destroy_collection(heap);
+        return error ? error : EINVAL;
+    }
+
+    COLOUT(col_debug_collection(heap, COL_TRAVERSE_DEFAULT));
+
+    col_destroy_collection(copy);
+    col_destroy_collection(sub);
+    col_destroy_collection(heap);
+
+    if ((error = arena_timing(0)) ||
+        (error = arena_timing(COL_CREATE_ARENA))) return error;
+
+    COLOUT(printf("\n\n==== ARENA TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int inline_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    const char *long_name = "property_with_a_very_long_name_that_is_not_inline";
+    const char *long_value = "value that is too long to be stored inside the item";
+    unsigned flags[] = { 0, COL_CREATE_ARENA };
+    double number = 0;
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== INLINE TEST ====\n\n"));
+
+    for (i = 0; i < 2; i++) {
+        if ((error = col_create_collection_ex(&col, "inline", 0, flags[i])) ||
+            (error = col_add_int_property(col, NULL, "int", 1)) ||
+            (error = col_add_double_property(col, NULL, "double", 2.5)) ||
+            (error = col_add_str_property(col, NULL, "short", "short value", 0)) ||
+            (error = col_add_str_property(col, NULL, "long", long_value, 0)) ||
+            (error = col_add_str_property(col, NULL, long_name, "x", 0)) ||
+            (error = col_add_str_property(col, NULL, long_name, long_value, 0))) {
+            printf("Failed to build collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+
+        /* Rename short property to long and long to short */
+        if ((error = col_get_item(col, "short", COL_TYPE_ANY,
+                                  COL_TRAVERSE_DEFAULT, &item)) ||
+            (error = col_modify_item_property(item, long_name)) ||
+            (error = col_get_item(col, "long", COL_TYPE_ANY,
+                                  COL_TRAVERSE_DEFAULT, &item)) ||
+            (error = col_modify_str_item(item, "l", "changed", 0)) ||
+            (error = col_update_double_property(col, "double",
+                                                COL_TRAVERSE_DEFAULT, 3.5))) {
+            printf("Failed to modify collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+
+        if ((error = col_get_item(col, "double", COL_TYPE_DOUBLE,
+                                  COL_TRAVERSE_DEFAULT, &item)) ||
+            (item == NULL)) {
+            printf("Failed to find double. Error %d\n", error);
+            col_destroy_collection(col);
+            return error ? error : ENOENT;
+        }
+        memcpy(&number, col_get_item_data(item), sizeof(double));
+
+        if ((number != 3.5) ||
+            (error = col_get_item(col, "l", COL_TYPE_STRING,
+                                  COL_TRAVERSE_DEFAULT, &item)) ||
+            (item == NULL) ||
+            (strcmp((const char *)col_get_item_data(item), "changed") != 0)) {
+            printf("Unexpected value. Error %d\n", error);
+            col_destroy_collection(col);
+            return error ? error : EINVAL;
+        }
+
+        /* Extracted item keeps short property and data */
+        error = col_extract_item(col, NULL, COL_DSP_FRONT, NULL, 0,
+                                 COL_TYPE_ANY, &item);
+        if ((error) ||
+            (strcmp(col_get_item_property(item, NULL), "int") != 0) ||
+            (*((int32_t *)col_get_item_data(item)) != 1)) {
+            printf("Failed to extract item. Error %d\n", error);
+            col_delete_item(item);
+            col_destroy_collection(col);
+            return error ? error : EINVAL;
+        }
+
+        COLOUT(col_debug_collection(col, COL_TRAVERSE_DEFAULT));
+
+        col_destroy_collection(col);
+        col = NULL;
+
+        /* Item outlives the collection */
+        if (*((int32_t *)col_get_item_data(item)) != 1) {
+            printf("Extracted item is broken.\n");
+            col_delete_item(item);
+            return EINVAL;
+        }
+        col_delete_item(item);
+    }
+
+    COLOUT(printf("\n\n==== INLINE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Check that the item with given name has expected value */
+static int intern_check(struct collection_item *col,
+                        const char *name,
+                        int32_t value)
+{
+    struct collection_item *item = NULL;
+    int error;
+
+    error = col_get_item(col, name, COL_TYPE_INTEGER,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item == NULL) ||
+        (*((int32_t *)col_get_item_data(item)) != value)) {
+        printf("Failed to find %s. Error %d\n", name, error);
+        return error ? error : ENOENT;
+    }
+
+    return EOK;
+}
+
+static int intern_test(void)
+{
+    struct collection_item *col1 = NULL;
+    struct collection_item *col2 = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== INTERN TEST ====\n\n"));
+
+    /* Both collections share names that differ in case */
+    if ((error = col_create_collection_ex(&col1, "first", 0,
+                                          COL_CREATE_INTERN)) ||
+        (error = col_create_collection_ex(&col2, "second", 0,
+                                          COL_CREATE_INTERN |
+                                          COL_CREATE_ARENA))) {
+        printf("Failed to create collections. Error %d\n", error);
+        col_destroy_collection(col1);
+        return error;
+    }
+
+    for (i = 0; i < 40; i++) {
+        sprintf(name, "Key%d", i);
+        if ((error = col_add_int_property(col1, NULL, name, i))) break;
+        sprintf(name, "key%d", i);
+        if ((error = col_add_int_property(col2, NULL, name, i + 100))) break;
+    }
+    if (error) {
+        printf("Failed to add property. Error %d\n", error);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error;
+    }
+
+    if ((error = intern_check(col1, "KEY5", 5)) ||
+        (error = intern_check(col2, "KEY5", 105)) ||
+        (error = intern_check(col1, "key39", 39)) ||
+        (error = intern_check(col2, "Key39", 139)) ||
+        (error = col_add_collection_to_collection(col1, NULL, "sub", col2,
+                                                  COL_ADD_MODE_CLONE)) ||
+        (error = intern_check(col1, "SUB!key7", 107)) ||
+        (error = intern_check(col1, "first!sub!KEY8", 108))) {
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error;
+    }
+
+    /* Name that is not interned is not found */
+    item = NULL;
+    error = col_get_item(col1, "KEY40", COL_TYPE_ANY,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item != NULL)) {
+        printf("Found item that does not exist. Error %d\n", error);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error ? error : EINVAL;
+    }
+
+    /* Renamed item is found by the new name only */
+    if ((error = col_get_item(col2, "KEY3", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (error = col_modify_item_property(item, "renamed")) ||
+        (error = intern_check(col2, "RENAMED", 103))) {
+        printf("Rename failed. Error %d\n", error);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error;
+    }
+
+    item = NULL;
+    error = col_get_item(col2, "key3", COL_TYPE_ANY,
+                         COL_TRAVERSE_DEFAULT, &item);
+    if ((error) || (item != NULL)) {
+        printf("Found renamed item by old name. Error %d\n", error);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error ? error : EINVAL;
+    }
+
+    /* Extracted item keeps the name after the collection is gone */
+    error = col_extract_item(col2, NULL, COL_DSP_FIRSTDUP, "KEY10", 0,
+                             COL_TYPE_ANY, &item);
+    if (error) {
+        printf("Failed to extract item. Error %d\n", error);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error;
+    }
+
+    /* Copy shares the names */
+    if ((error = col_copy_collection(&copy, col1, "copy", COL_COPY_NORMAL)) ||
+        (error = intern_check(copy, "key20", 20)) ||
+        (error = intern_check(copy, "copy!sub!KEY20", 120))) {
+        printf("Failed to copy collection. Error %d\n", error);
+        col_delete_item(item);
+        col_destroy_collection(col1);
+        col_destroy_collection(col2);
+        return error;
+    }
+
+    COLOUT(col_debug_collection(copy, COL_TRAVERSE_DEFAULT));
+
+    col_destroy_collection(col1);
+    col_destroy_collection(col2);
+    col_destroy_collection(copy);
+
+    if ((strcmp(col_get_item_property(item, NULL), "key10") != 0) ||
+        (*((int32_t *)col_get_item_data(item)) != 110)) {
+        printf("Extracted item is broken.\n");
+        col_delete_item(item);
+        return EINVAL;
+    }
+    col_delete_item(item);
+
+    COLOUT(printf("\n\n==== INTERN TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Hash the way it was done with toupper() */
+static uint64_t hash_reference(const char *string, int sub_len)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    int i = 0;
+
+    while ((string[i] != 0) && ((sub_len <= 0) || (i < sub_len))) {
+        hash = hash ^ toupper(string[i]);
+        hash *= 1099511628211ULL;
+        i++;
+    }
+
+    return hash;
+}
+
+static int hash_test(void)
+{
+    char buffer[80];
+    int len;
+    int i;
+    int j;
+
+    COLOUT(printf("\n\n==== HASH TEST ====\n\n"));
+
+    /* All characters hash the same as before */
+    for (i = 1; i < 256; i++) {
+        buffer[0] = (char)i;
+        buffer[1] = (char)(256 - i);
+        buffer[2] = '\0';
+        if ((col_make_hash(buffer, 0, &len) != hash_reference(buffer, 0)) ||
+            (col_make_hash(buffer, 1, &len) != hash_reference(buffer, 1)) ||
+            (len != 1)) {
+            printf("Hash mismatch for character %d\n", i);
+            return EINVAL;
+        }
+    }
+
+    srand(1);
+    for (i = 0; i < 1000; i++) {
+        len = rand() % 79;
+        for (j = 0; j < len; j++) buffer[j] = (char)(rand() % 255 + 1);
+        buffer[len] = '\0';
+        if ((col_make_hash(buffer, 0, NULL) != hash_reference(buffer, 0)) ||
+            (col_make_hash(buffer, len / 2, NULL) !=
+             hash_reference(buffer, len / 2))) {
+            printf("Hash mismatch for string of length %d\n", len);
+            return EINVAL;
+        }
+    }
+
+    COLOUT(printf("\n\n==== HASH TEST END ====\n\n"));
+
+    return EOK;
+}
+
+#define THREAD_ITEMS 200
+#define THREAD_LOOKUPS 100000
+
+/* Data shared by the threads that use the same collection */
+struct thread_data {
+    struct collection_item *col;
+    struct col_snapshot *snapshot;
+    unsigned seed;
+    int lookups;
+    int error;
+};
+
+/* Count items */
+static int thread_count_cb(const char *property,
+                           int property_len,
+                           int type,
+                           void *data,
+                           int length,
+                           void *custom_data,
+                           int *stop)
+{
+    (*((int *)custom_data))++;
+    return EOK;
+}
+
+/* Reader looks up items that never change and takes references */
+static void *thread_reader(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    struct collection_item *item = NULL;
+    struct collection_item *ref = NULL;
+    char name[20];
+    int count;
+    int key;
+    int i;
+
+    for (i = 0; i < data->lookups; i++) {
+        key = rand_r(&(data->seed)) % THREAD_ITEMS;
+        sprintf(name, "key%d", key);
+        item = NULL;
+        data->error = col_get_item(data->col, name, COL_TYPE_INTEGER,
+                                   COL_TRAVERSE_ONELEVEL, &item);
+        if ((data->error) || (item == NULL) ||
+            (*((int32_t *)col_get_item_data(item)) != key)) {
+            printf("Reader failed to find %s. Error %d\n", name, data->error);
+            if (!data->error) data->error = ENOENT;
+            return NULL;
+        }
+
+        if ((i % 1000) == 0) {
+            count = 0;
+            if ((data->error = col_traverse_collection(data->col,
+                                                       COL_TRAVERSE_ONELEVEL,
+                                                       thread_count_cb,
+                                                       &count)) ||
+                (data->error = col_get_collection_reference(data->col,
+                                                            &ref, NULL))) {
+                printf("Reader failed to traverse. Error %d\n", data->error);
+                return NULL;
+            }
+            col_destroy_collection(ref);
+            if (count < THREAD_ITEMS) {
+                printf("Reader found only %d items\n", count);
+                data->error = EINVAL;
+                return NULL;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/* Writer adds and removes other items */
+static void *thread_writer(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    char name[20];
+    int i;
+
+    for (i = 0; i < data->lookups; i++) {
+        sprintf(name, "extra%d", i % 50);
+        if (i % 100 < 50)
+            data->error = col_add_int_property(data->col, NULL, name, i);
+        else
+            data->error = col_delete_property(data->col, name,
+                                              COL_TYPE_ANY,
+                                              COL_TRAVERSE_ONELEVEL);
+        if (data->error) {
+            printf("Writer failed on %s. Error %d\n", name, data->error);
+            return NULL;
+        }
+    }
+
+    return NULL;
+}
+
+/* Run readers and optional writer */
+static int thread_run(struct collection_item *col,
+                      int readers,
+                      int writer,
+                      double *elapsed)
+{
+    pthread_t threads[5];
+    struct thread_data data[5];
+    struct timespec start;
+    struct timespec end;
+    int error = EOK;
+    int i;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (i = 0; i < readers + writer; i++) {
+        data[i].col = col;
+        data[i].seed = i + 1;
+        data[i].lookups = (i < readers) ? THREAD_LOOKUPS : 2000;
+        data[i].error = EOK;
+        if (pthread_create(&(threads[i]), NULL,
+                           (i < readers) ? thread_reader : thread_writer,
+                           &(data[i]))) {
+            printf("Failed to create thread\n");
+            readers = i;
+            writer = 0;
+            error = EAGAIN;
+            break;
+        }
+    }
+
+    for (i = 0; i < readers + writer; i++) {
+        pthread_join(threads[i], NULL);
+        if (data[i].error) error = data[i].error;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    *elapsed = (end.tv_sec - start.tv_sec) +
+               (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    return error;
+}
+
+static int threadsafe_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    double elapsed;
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== THREAD SAFE TEST ====\n\n"));
+
+    error = col_create_collection_ex(&col, "threads", 0,
+                                     COL_CREATE_THREADSAFE);
+    if (error) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < THREAD_ITEMS; i++) {
+        sprintf(name, "key%d", i);
+        error = col_add_int_property(col, NULL, name, i);
+        if (error) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Read lock can't be upgraded but write lock is reentrant */
+    if ((error = col_lock_collection(col, 0)) ||
+        (col_delete_property(col, "key1", COL_TYPE_ANY,
+                             COL_TRAVERSE_DEFAULT) != EDEADLK) ||
+        (error = col_unlock_collection(col)) ||
+        (error = col_lock_collection(col, 1)) ||
+        (error = col_get_item(col, "key1", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (error = col_unlock_collection(col))) {
+        printf("Unexpected locking result. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Readers compete with the writer */
+    error = thread_run(col, 4, 1, &elapsed);
+    if (error) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Read scaling */
+    for (i = 1; i <= 4; i *= 2) {
+        error = thread_run(col, i, 0, &elapsed);
+        if (error) {
+            col_destroy_collection(col);
+            return error;
+        }
+        COLOUT(printf("%d reader(s): %.0f lookups per second\n",
+                      i, i * THREAD_LOOKUPS / elapsed));
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== THREAD SAFE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Reader of the snapshot checks that the copy is consistent */
+static void *snapshot_reader(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    struct collection_item *copy = NULL;
+    struct collection_item *first = NULL;
+    struct collection_item *last = NULL;
+    int i;
+
+    for (i = 0; i < data->lookups; i++) {
+        if ((data->error = col_pin_snapshot(data->snapshot, &copy)) ||
+            (data->error = col_get_item(copy, "first", COL_TYPE_INTEGER,
+                                        COL_TRAVERSE_DEFAULT, &first)) ||
+            (data->error = col_get_item(copy, "sub!last", COL_TYPE_INTEGER,
+                                        COL_TRAVERSE_DEFAULT, &last)) ||
+            (first == NULL) || (last == NULL) ||
+            (*((int32_t *)col_get_item_data(first)) !=
+             *((int32_t *)col_get_item_data(last)))) {
+            printf("Snapshot is inconsistent. Error %d\n", data->error);
+            if (!data->error) data->error = EINVAL;
+            return NULL;
+        }
+        col_unpin_snapshot(copy);
+    }
+
+    return NULL;
+}
+
+/* Change both values of the collection and publish it */
+static int snapshot_version(struct col_snapshot *snapshot,
+                            struct collection_item *col,
+                            int32_t version)
+{
+    int error;
+
+    if ((error = col_update_int_property(col, "first",
+                                         COL_TRAVERSE_DEFAULT, version)) ||
+        (error = col_update_int_property(col, "sub!last",
+                                         COL_TRAVERSE_DEFAULT, version)) ||
+        ((snapshot) && (error = col_publish_snapshot(snapshot, col)))) {
+        printf("Failed to publish version %d. Error %d\n", version, error);
+        return error;
+    }
+
+    return EOK;
+}
+
+static int snapshot_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *old = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    struct col_snapshot *snapshot = NULL;
+    pthread_t threads[2];
+    struct thread_data data[2];
+    char name[20];
+    int created;
+    int error = 0;
+    int i;
+
+    COLOUT(printf("\n\n==== SNAPSHOT TEST ====\n\n"));
+
+    if ((error = col_create_collection_ex(&col, "config", 0,
+                                          COL_CREATE_THREADSAFE)) ||
+        (error = col_create_collection(&sub, "sub", 0)) ||
+        (error = col_add_int_property(col, NULL, "first", 0)) ||
+        (error = col_add_int_property(sub, NULL, "last", 0)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        col_destroy_collection(sub);
+        return error;
+    }
+
+    for (i = 0; i < 40; i++) {
+        sprintf(name, "key%d", i);
+        if ((error = col_add_int_property(col, NULL, name, i))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    if ((error = col_create_snapshot(&snapshot, col)) ||
+        (error = col_pin_snapshot(snapshot, &old)) ||
+        (error = snapshot_version(snapshot, col, 1)) ||
+        (error = col_pin_snapshot(snapshot, &copy))) {
+        printf("Failed to use snapshot. Error %d\n", error);
+        col_destroy_snapshot(snapshot);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Old copy is still alive and copies can't be changed */
+    if ((error = col_get_item(old, "first", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (*((int32_t *)col_get_item_data(item)) != 0) ||
+        (error = col_get_item(copy, "key39", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (*((int32_t *)col_get_item_data(item)) != 39) ||
+        (col_add_int_property(copy, NULL, "new", 1) != EPERM) ||
+        (col_delete_property(old, "sub!last", COL_TYPE_ANY,
+                             COL_TRAVERSE_DEFAULT) != EPERM)) {
+        printf("Unexpected snapshot state. Error %d\n", error);
+        col_unpin_snapshot(old);
+        col_unpin_snapshot(copy);
+        col_destroy_snapshot(snapshot);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    col_unpin_snapshot(old);
+    col_unpin_snapshot(copy);
+
+    /* Readers run while new versions are published */
+    for (created = 0; created < 2; created++) {
+        data[created].snapshot = snapshot;
+        data[created].lookups = 20000;
+        data[created].error = EOK;
+        if (pthread_create(&(threads[created]), NULL,
+                           snapshot_reader, &(data[created]))) {
+            printf("Failed to create thread\n");
+            error = EAGAIN;
+            break;
+        }
+    }
+
+    for (i = 2; (!error) && (i < 100); i++)
+        error = snapshot_version(snapshot, col, i);
+
+    for (i = 0; i < created; i++) {
+        pthread_join(threads[i], NULL);
+        if ((!error) && (data[i].error)) error = data[i].error;
+    }
+
+    col_destroy_snapshot(snapshot);
+    col_destroy_collection(col);
+
+    if (error) return error;
+
+    COLOUT(printf("\n\n==== SNAPSHOT TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Check that the loaded collection is the same as the original */
+static int wire_check(struct collection_item *col,
+                      struct collection_item *loaded,
+                      const char *expected)
+{
+    struct collection_item *item = NULL;
+    struct serial_out out;
+    int error;
+
+    memset(&out, 0, sizeof(out));
+    error = col_serialize_with_writer(loaded, serial_writer, &out);
+    if ((error == EOK) && (strcmp(out.buffer, expected) != 0)) error = EINVAL;
+    free(out.buffer);
+    if (error) return error;
+
+    if ((cow_value(loaded, "sub!deep!x") != 7) ||
+        (cow_value(loaded, "item19") != 19) ||
+        (col_get_item(loaded, "sub!deep!d", COL_TYPE_DOUBLE,
+                      COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (*((double *)col_get_item_data(item)) != 1.5)) return EINVAL;
+
+    /* Loaded collection can't be changed */
+    if ((col_add_int_property(loaded, NULL, "new", 1) != EPERM) ||
+        (col_delete_property(loaded, "sub!deep!x", COL_TYPE_ANY,
+                             COL_TRAVERSE_DEFAULT) != EPERM) ||
+        (col_modify_item_property(item, "renamed") != EPERM)) return EINVAL;
+
+    return (cow_value(col, "sub!deep!x") == 7) ? EOK : EINVAL;
+}
+
+static int wire_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *deep = NULL;
+    struct collection_item *loaded = NULL;
+    struct serial_out out;
+    unsigned char bin[3] = { 1, 0, 2 };
+    char name[20];
+    char path[] = "./col_wire_XXXXXX";
+    void *buffer = NULL;
+    char *copy;
+    size_t size = 0;
+    int fd;
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== WIRE FORMAT TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "wire", 5)) ||
+        (error = col_create_collection(&sub, "sub", 6)) ||
+        (error = col_create_collection(&deep, "deep", 7))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; (i < 20) && (!error); i++) {
+        sprintf(name, "item%d", i);
+        error = col_add_int_property(col, NULL, name, i);
+    }
+
+    if ((error) ||
+        (error = col_add_str_property(col, NULL, "str", "value", 0)) ||
+        (error = col_add_binary_property(col, NULL, "bin", bin, 3)) ||
+        (error = col_add_binary_property(col, NULL, "empty", bin, 0)) ||
+        (error = col_add_unsigned_property(sub, NULL, "u", 3)) ||
+        (error = col_add_long_property(sub, NULL, "l", -4)) ||
+        (error = col_add_ulong_property(sub, NULL, "ul", 5)) ||
+        (error = col_add_bool_property(sub, NULL, "b", 1)) ||
+        (error = col_add_int_property(deep, NULL, "x", 7)) ||
+        (error = col_add_double_property(deep, NULL, "d", 1.5)) ||
+        (error = col_add_collection_to_collection(sub, NULL, NULL, deep,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_add_int_property(col, NULL, "last", 8))) {
+        printf("Failed to fill collection. Error %d\n", error);
+        col_destroy_collection(deep);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    memset(&out, 0, sizeof(out));
+    if ((error = col_serialize_with_writer(col, serial_writer, &out)) ||
+        (error = col_pack_collection(col, &buffer, &size))) {
+        printf("Failed to pack collection. Error %d\n", error);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    COLOUT(printf("Packed size %lu\n", (unsigned long)size));
+
+    /* Loaded from the buffer */
+    if ((error = col_load_packed(&loaded, buffer, size)) ||
+        (error = wire_check(col, loaded, out.buffer))) {
+        printf("Collection loaded from buffer is wrong. Error %d\n", error);
+        col_destroy_collection(loaded);
+        free(buffer);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    col_destroy_collection(loaded);
+    loaded = NULL;
+
+    /* Broken buffers are refused */
+    copy = (char *)buffer;
+    if ((col_load_packed(&loaded, buffer, size - 8) != EINVAL) ||
+        (col_load_packed(&loaded, buffer, 16) != EINVAL) ||
+        (col_load_packed(&loaded, copy + 8, size - 8) != EINVAL)) {
+        printf("Broken buffer was loaded\n");
+        free(buffer);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Hash of the collection name that follows the wire header */
+    copy[24] ^= 1;
+    if (col_load_packed(&loaded, buffer, size) != EINVAL) {
+        printf("Buffer with a wrong hash was loaded\n");
+        free(buffer);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+    copy[24] ^= 1;
+
+    /* Length of the first item that follows the wire and
+     * collection headers and the name of the collection
+     */
+    copy[24 + 24 + 8 + 17] = 0x7f;
+    if (col_load_packed(&loaded, buffer, size) != EINVAL) {
+        printf("Corrupted buffer was loaded\n");
+        free(buffer);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Restore the original content */
+    free(buffer);
+    if ((error = col_pack_collection(col, &buffer, &size))) {
+        printf("Failed to pack collection. Error %d\n", error);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Loaded from the mapped file that is removed right away */
+    fd = mkstemp(path);
+    if (fd == -1) {
+        printf("Failed to create file\n");
+        free(buffer);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return errno;
+    }
+
+    if ((write(fd, buffer, size) != (ssize_t)size) ||
+        (close(fd) != 0)) error = EIO;
+    else error = col_load_packed_file(&loaded, path);
+    unlink(path);
+    free(buffer);
+
+    if ((error) ||
+        (error = wire_check(col, loaded, out.buffer))) {
+        printf("Collection loaded from file is wrong. Error %d\n", error);
+        col_destroy_collection(loaded);
+        free(out.buffer);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    col_destroy_collection(loaded);
+    free(out.buffer);
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== WIRE FORMAT TEST END ====\n\n"));
+
+    return EOK;
+}
+
+static int freeze_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *copy = NULL;
+    struct collection_item *item = NULL;
+    char name[20];
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== FREEZE TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "freeze", 0)) ||
+        (error = col_create_collection(&sub, "sub", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    for (i = 0; (i < 200) && (!error); i++) {
+        sprintf(name, "item%d", i);
+        error = col_add_int_property(col, NULL, name, i);
+        if (!error) error = col_add_int_property(sub, NULL, name, -i);
+    }
+
+    if ((error) ||
+        (error = col_add_str_property(col, NULL, "dup", "first", 0)) ||
+        (error = col_add_int_property(col, NULL, "dup", 1)) ||
+        (error = col_add_int_property(col, NULL, "DUP", 2)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_copy_collection(&copy, col, NULL, COL_COPY_COW))) {
+        printf("Failed to fill collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    if ((error = col_freeze_collection(col)) ||
+        (error = col_freeze_collection(col))) {
+        printf("Failed to freeze collection. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Every item is found and names are not case sensitive */
+    for (i = 0; i < 200; i++) {
+        sprintf(name, "ITEM%d", i);
+        if (cow_value(col, name) != i) break;
+        sprintf(name, "sub!item%d", i);
+        if (cow_value(col, name) != -i) break;
+    }
+
+    if ((i < 200) ||
+        (cow_value(col, "dup") != 1) ||
+        (col_get_item(col, "item200", COL_TYPE_ANY,
+                      COL_TRAVERSE_ONELEVEL, &item)) ||
+        (item != NULL) ||
+        (col_get_item(col, "Dup", COL_TYPE_STRING,
+                      COL_TRAVERSE_ONELEVEL, &item)) ||
+        (item == NULL) ||
+        (strcmp((char *)col_get_item_data(item), "first") != 0)) {
+        printf("Lookup in frozen collection failed at %d\n", i);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Frozen collection can't be changed but its copy can */
+    if ((col_add_int_property(col, NULL, "new", 1) != EPERM) ||
+        (col_modify_item_property(item, "renamed") != EPERM) ||
+        (col_modify_int_item(item, NULL, 5) != EPERM) ||
+        (cow_value(col, "Dup") != 1) ||
+        (col_update_int_property(col, "sub!item1", COL_TRAVERSE_DEFAULT,
+                                 5) != EPERM) ||
+        (error = col_update_int_property(copy, "sub!item1",
+                                         COL_TRAVERSE_DEFAULT, 5)) ||
+        (cow_value(copy, "sub!item1") != 5) ||
+        (cow_value(col, "sub!item1") != -1)) {
+        printf("Frozen collection was changed. Error %d\n", error);
+        col_destroy_collection(copy);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    col_destroy_collection(copy);
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== FREEZE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Counts of the items seen by the walk */
+struct walk_count {
+    int headers;
+    int refs;
+    int ends;
+    int items;
+    int stop_at;
+};
+
+static int walk_counter(const char *property,
+                        int property_len,
+                        int type,
+                        void *data,
+                        int length,
+                        void *custom_data,
+                        int *stop)
+{
+    struct walk_count *count = (struct walk_count *)custom_data;
+
+    switch (type) {
+    case COL_TYPE_COLLECTION:       count->headers++; break;
+    case COL_TYPE_COLLECTIONREF:    count->refs++; break;
+    case COL_TYPE_END:              count->ends++; break;
+    default:                        count->items++; break;
+    }
+
+    if ((count->stop_at) && (count->items == count->stop_at)) *stop = 1;
+
+    return EOK;
+}
+
+static int walk_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *item = NULL;
+    struct walk_count count;
+    char name[20];
+    int depth = 200;
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== DEEP WALK TEST ====\n\n"));
+
+    /* The tree is built from the deepest level up */
+    for (i = depth; i > 0; i--) {
+        sprintf(name, "level%d", i);
+        if ((error = col_create_collection(&col, name, 0)) ||
+            (error = col_add_int_property(col, NULL,
+                                          i == depth ? "leaf" : "value", i)) ||
+            ((sub) &&
+             (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                       COL_ADD_MODE_EMBED)))) {
+            printf("Failed to create collection. Error %d\n", error);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            return error;
+        }
+        sub = col;
+    }
+
+    memset(&count, 0, sizeof(count));
+    error = col_traverse_collection(col, COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                    walk_counter, &count);
+    if ((error) ||
+        (count.headers != depth) || (count.refs != depth - 1) ||
+        (count.ends != depth) || (count.items != depth)) {
+        printf("Walk is wrong. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    memset(&count, 0, sizeof(count));
+    error = col_traverse_collection(col, COL_TRAVERSE_FLAT | COL_TRAVERSE_END,
+                                    walk_counter, &count);
+    if ((error) ||
+        (count.headers != 1) || (count.refs != 0) ||
+        (count.ends != 1) || (count.items != depth)) {
+        printf("Flat walk is wrong. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Stop deep in the tree ends the whole walk */
+    memset(&count, 0, sizeof(count));
+    count.stop_at = depth / 2;
+    error = col_traverse_collection(col, COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                                    walk_counter, &count);
+    if ((error) ||
+        (count.items != depth / 2) || (count.ends != 0)) {
+        printf("Stopped walk is wrong. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_get_item(col, "leaf", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL) ||
+        (*((int32_t *)col_get_item_data(item)) != depth)) {
+        printf("Deep item is not found. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== DEEP WALK TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Check the counters of the collection */
+static int stats_check(struct col_statistics *stats,
+                       unsigned long lookups,
+                       unsigned long hash_hits,
+                       unsigned long hash_misses,
+                       unsigned long inserts,
+                       unsigned long deletes,
+                       unsigned long max_depth)
+{
+    COLOUT(printf("Lookups %lu, scanned %lu, hits %lu, misses %lu, "
+                  "inserts %lu, checks %lu, deletes %lu, depth %lu, "
+                  "bytes %lu\n",
+                  stats->lookups, stats->items_scanned, stats->hash_hits,
+                  stats->hash_misses, stats->inserts,
+                  stats->duplicate_checks, stats->deletes,
+                  stats->max_depth, stats->bytes_allocated));
+
+    if ((stats->lookups != lookups) ||
+        (stats->hash_hits != hash_hits) ||
+        (stats->hash_misses != hash_misses) ||
+        (stats->inserts != inserts) ||
+        (stats->deletes != deletes) ||
+        (stats->max_depth != max_depth)) {
+        printf("Statistics are wrong.\n");
+        return EINVAL;
+    }
+
+    return EOK;
+}
+
+/* Statistics of the batch insert */
+static int stats_batch(void)
+{
+    struct collection_item *col = NULL;
+    struct col_statistics stats;
+    struct col_batch_property batch[3];
+    unsigned long bytes;
+    int32_t values[3] = { 1, 2, 3 };
+    int i;
+    int error = 0;
+
+    batch[0].property = "b";
+    batch[1].property = "c";
+    batch[2].property = "d";
+    for (i = 0; i < 3; i++) {
+        batch[i].type = COL_TYPE_INTEGER;
+        batch[i].data = &values[i];
+        batch[i].length = sizeof(int32_t);
+    }
+
+    if ((error = col_create_collection(&col, "batch", 0)) ||
+        (error = col_add_int_property(col, NULL, "a", 0)) ||
+        (error = col_add_int_property(col, NULL, "b", 0)) ||
+        (error = col_get_statistics(col, &stats))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    bytes = stats.bytes_allocated;
+
+    /* Existing item is overwritten, the others are linked */
+    if ((error = col_insert_batch(col, NULL, COL_DSP_END, NULL, 0,
+                                  COL_INSERT_DUPOVER, batch, 3)) ||
+        (error = col_get_statistics(col, &stats))) {
+        printf("Failed to insert batch. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    COLOUT(printf("Batch: inserts %lu, checks %lu, deletes %lu, bytes %lu\n",
+                  stats.inserts, stats.duplicate_checks,
+                  stats.deletes, stats.bytes_allocated));
+
+    if ((stats.inserts != 5) || (stats.duplicate_checks != 3) ||
+        (stats.deletes != 1) || (stats.bytes_allocated <= bytes)) {
+        printf("Batch statistics are wrong.\n");
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    col_destroy_collection(col);
+    return EOK;
+}
+
+static int stats_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *item = NULL;
+    struct col_statistics before;
+    struct col_statistics stats;
+    char name[20];
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== STATISTICS TEST ====\n\n"));
+
+    if ((col_get_statistics(NULL, NULL) != EINVAL) ||
+        (col_get_statistics(NULL, &before))) {
+        printf("Failed to get global statistics.\n");
+        return EINVAL;
+    }
+
+    col_enable_statistics(1);
+
+    if ((error = col_create_collection(&col, "stats", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_enable_statistics(0);
+        return error;
+    }
+
+    /* Enough items for the collection to be indexed */
+    for (i = 0; i < 20; i++) {
+        sprintf(name, "value%d", i);
+        if ((error = col_add_int_property(col, NULL, name, i))) {
+            printf("Failed to add property. Error %d\n", error);
+            col_destroy_collection(col);
+            col_enable_statistics(0);
+            return error;
+        }
+    }
+
+    /* Hit and miss in the index, the duplicate
+     * that is overwritten and the deleted item.
+     */
+    item = NULL;
+    if ((error = col_get_item(col, "value5", COL_TYPE_INTEGER,
+                              COL_TRAVERSE_ONELEVEL, &item)) ||
+        (item == NULL) ||
+        (error = col_get_item(col, "nothere", COL_TYPE_ANY,
+                              COL_TRAVERSE_ONELEVEL, &item)) ||
+        (error = col_insert_int_property(col, NULL, COL_DSP_END, NULL, 0,
+                                         COL_INSERT_DUPOVER, "value3", 33)) ||
+        (error = col_delete_property(col, "value4", COL_TYPE_ANY,
+                                     COL_TRAVERSE_DEFAULT))) {
+        printf("Failed to use collection. Error %d\n", error);
+        col_destroy_collection(col);
+        col_enable_statistics(0);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_get_statistics(col, &stats)) ||
+        (error = stats_check(&stats, 4, 3, 1, 21, 2, 0)) ||
+        (stats.duplicate_checks != 1) ||
+        (stats.bytes_allocated == 0)) {
+        printf("Failed to check statistics. Error %d\n", error);
+        col_destroy_collection(col);
+        col_enable_statistics(0);
+        return error ? error : EINVAL;
+    }
+
+    /* The path is looked up by walking the tree */
+    if ((error = col_create_collection(&sub, "sub", 0)) ||
+        (error = col_add_int_property(sub, NULL, "deep", 1)) ||
+        (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                  COL_ADD_MODE_EMBED)) ||
+        (error = col_get_item(col, "sub!deep", COL_TYPE_ANY,
+                              COL_TRAVERSE_DEFAULT, &item)) ||
+        (item == NULL)) {
+        printf("Failed to find item in sub collection. Error %d\n", error);
+        col_destroy_collection(sub);
+        col_destroy_collection(col);
+        col_enable_statistics(0);
+        return error ? error : EINVAL;
+    }
+
+    if ((error = col_get_statistics(col, &stats)) ||
+        (stats.lookups < 5) || (stats.inserts != 22) ||
+        (stats.items_scanned < 20) || (stats.max_depth != 2)) {
+        printf("Failed to check walk statistics. Error %d\n", error);
+        col_destroy_collection(col);
+        col_enable_statistics(0);
+        return error ? error : EINVAL;
+    }
+
+    /* Batch counts the same as the items inserted one by one */
+    if ((error = stats_batch())) {
+        col_destroy_collection(col);
+        col_enable_statistics(0);
+        return error;
+    }
+
+    /* Counters stay the same when counting is off */
+    col_enable_statistics(0);
+    if ((error = col_get_item(col, "value5", COL_TYPE_ANY,
+                              COL_TRAVERSE_ONELEVEL, &item)) ||
+        (error = col_get_statistics(col, &before)) ||
+        (memcmp(&before, &stats, sizeof(stats))) ||
+        (col_get_statistics(item, &stats) != EINVAL)) {
+        printf("Failed to check disabled statistics. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    /* Library counts at least as much as the collection */
+    if ((error = col_get_statistics(NULL, &stats)) ||
+        (stats.lookups < before.lookups) ||
+        (stats.inserts < before.inserts) ||
+        (stats.deletes < before.deletes) ||
+        (stats.max_depth < 2)) {
+        printf("Failed to check global statistics. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== STATISTICS TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Counts of the items seen by the threads */
+struct parallel_count {
+    int headers;
+    int refs;
+    int ends;
+    int items;
+    long sum;
+    int32_t stop_at;
+    int32_t fail_at;
+};
+
+static int parallel_counter(const char *property,
+                            int property_len,
+                            int type,
+                            void *data,
+                            int length,
+                            void *custom_data,
+                            int *stop)
+{
+    struct parallel_count *count = (struct parallel_count *)custom_data;
+    int32_t value;
+
+    switch (type) {
+    case COL_TYPE_COLLECTION:
+        __atomic_add_fetch(&(count->headers), 1, __ATOMIC_RELAXED);
+        break;
+    case COL_TYPE_COLLECTIONREF:
+        __atomic_add_fetch(&(count->refs), 1, __ATOMIC_RELAXED);
+        break;
+    case COL_TYPE_END:
+        __atomic_add_fetch(&(count->ends), 1, __ATOMIC_RELAXED);
+        break;
+    default:
+        value = *((int32_t *)data);
+        __atomic_add_fetch(&(count->items), 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&(count->sum), value, __ATOMIC_RELAXED);
+        if (value == count->fail_at) return EIO;
+        if (value == count->stop_at) *stop = 1;
+        break;
+    }
+
+    return EOK;
+}
+
+static int parallel_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_item *inner = NULL;
+    struct parallel_count count;
+    struct parallel_count serial;
+    char name[20];
+    int subs = 8;
+    int items = 100;
+    int flags[] = { COL_TRAVERSE_DEFAULT | COL_TRAVERSE_END,
+                    COL_TRAVERSE_FLAT | COL_TRAVERSE_END,
+                    COL_TRAVERSE_DEFAULT,
+                    COL_TRAVERSE_ONELEVEL | COL_TRAVERSE_END };
+    int i, j;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== PARALLEL TRAVERSE TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "top", 0)) ||
+        (error = col_add_int_property(col, NULL, "first", 1)) ||
+        (error = col_add_int_property(col, NULL, "second", 2))) {
+        printf("Failed to create collection. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Every sub collection has one more nested below it */
+    for (i = 1; i <= subs; i++) {
+        sprintf(name, "sub%d", i);
+        if ((error = col_create_collection(&sub, name, 0)) ||
+            (error = col_create_collection(&inner, "inner", 0))) {
+            printf("Failed to create collection. Error %d\n", error);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            return error;
+        }
+        for (j = 1; (j <= items) && (!error); j++) {
+            sprintf(name, "item%d", j);
+            error = col_add_int_property(j % 10 ? sub : inner, NULL,
+                                         name, i * 1000 + j);
+        }
+        if ((error) ||
+            (error = col_add_collection_to_collection(sub, NULL, NULL, inner,
+                                                      COL_ADD_MODE_EMBED)) ||
+            (error = col_add_collection_to_collection(col, NULL, NULL, sub,
+                                                      COL_ADD_MODE_EMBED))) {
+            printf("Failed to build collection. Error %d\n", error);
+            col_destroy_collection(inner);
+            col_destroy_collection(sub);
+            col_destroy_collection(col);
+            return error;
+        }
+        sub = NULL;
+        inner = NULL;
+    }
+
+    /* Same items are seen as in the serial traversal */
+    for (i = 0; i < (int)(sizeof(flags) / sizeof(flags[0])); i++) {
+        memset(&serial, 0, sizeof(serial));
+        memset(&count, 0, sizeof(count));
+        if ((error = col_traverse_collection(col, flags[i],
+                                             parallel_counter, &serial)) ||
+            (error = col_traverse_collection_parallel(col, flags[i], 4,
+                                                      parallel_counter,
+                                                      &count))) {
+            printf("Failed to traverse collection. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+        COLOUT(printf("Flags %d: headers %d, refs %d, ends %d, items %d\n",
+                      flags[i], count.headers, count.refs,
+                      count.ends, count.items));
+        if (memcmp(&serial, &count, sizeof(count))) {
+            printf("Parallel traverse with flags %d is wrong.\n", flags[i]);
+            col_destroy_collection(col);
+            return EINVAL;
+        }
+    }
+
+    /* Error of the handler ends the traversal */
+    memset(&count, 0, sizeof(count));
+    count.fail_at = 3050;
+    error = col_traverse_collection_parallel(col, COL_TRAVERSE_DEFAULT, 4,
+                                             parallel_counter, &count);
+    if (error != EIO) {
+        printf("Expected error %d, got %d\n", EIO, error);
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    /* Stop is not an error */
+    memset(&count, 0, sizeof(count));
+    count.stop_at = 5005;
+    if ((error = col_traverse_collection_parallel(col, COL_TRAVERSE_DEFAULT |
+                                                  COL_TRAVERSE_END, 0,
+                                                  parallel_counter, &count)) ||
+        (count.items >= 2 + subs * items)) {
+        printf("Failed to stop traversal. Error %d\n", error);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+
+    if (col_traverse_collection_parallel(col, COL_TRAVERSE_DEFAULT, 4,
+                                         NULL, NULL) != EINVAL) {
+        printf("Traversal without handler should fail.\n");
+        col_destroy_collection(col);
+        return EINVAL;
+    }
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== PARALLEL TRAVERSE TEST END ====\n\n"));
+
+    return EOK;
+}
+
+/* Compare the collection with the expected order of values */
+static int position_check(struct collection_item *col,
+                          int32_t *values,
+                          int count)
+{
+    struct collection_iterator *iterator = NULL;
+    struct collection_item *item = NULL;
+    int i = 0;
+    int error;
+
+    error = col_bind_iterator(&iterator, col, COL_TRAVERSE_ONELEVEL);
+    if (error) return error;
+
+    /* Skip header */
+    error = col_iterate_collection(iterator, &item);
+    while (!error) {
+        error = col_iterate_collection(iterator, &item);
+        if ((error) || (item == NULL)) break;
+        if ((i >= count) ||
+            (*((int32_t *)col_get_item_data(item)) != values[i])) {
+            printf("Item %d is out of order.\n", i);
+            error = EINVAL;
+            break;
+        }
+        i++;
+    }
+
+    col_unbind_iterator(iterator);
+
+    if ((!error) && (i != count)) {
+        printf("Expected %d items, found %d\n", count, i);
+        error = EINVAL;
+    }
+
+    return error;
+}
+
+static int position_test(void)
+{
+    struct collection_item *col = NULL;
+    struct collection_item *item = NULL;
+    int32_t values[3000];
+    char name[20];
+    unsigned seed = 12345;
+    int32_t next = 0;
+    int count = 0;
+    int idx;
+    int op;
+    int i;
+    int error = 0;
+
+    COLOUT(printf("\n\n==== POSITION TEST ====\n\n"));
+
+    if ((error = col_create_collection(&col, "position", 0))) {
+        printf("Failed to create collection. Error %d\n", error);
+        return error;
+    }
+
+    for (i = 0; i < 1000; i++) {
+        sprintf(name, "item%d", next);
+        if ((error = col_add_int_property(col, NULL, name, next))) {
+            printf("Failed to add item. Error %d\n", error);
+            col_destroy_collection(col);
+            return error;
+        }
+        values[count++] = next++;
+    }
+
+    /* Random positional inserts and extracts mixed
+     * with the changes at the ends and by name.
+     */
+    for (i = 0; i < 20000; i++) {
+        seed = seed * 1103515245 + 12345;
+        op = (seed >> 16) % 10;
+        seed = seed * 1103515245 + 12345;
+        idx = (int)((seed >> 8) % (unsigned)count);
+
+        if ((op < 4) && (count < 2900)) {
+            sprintf(name, "item%d", next);
+            error = col_insert_int_property(col, NULL, COL_DSP_INDEX, NULL,
+                                            idx, COL_INSERT_NOCHECK,
+                                            name, next);
+            memmove(&values[idx + 1], &values[idx],
+                    (count - idx) * sizeof(int32_t));
+            values[idx] = next++;
+            count++;
+        }
+        else if ((op < 8) && (count > 100)) {
+            item = NULL;
+            error = col_extract_item(col, NULL, COL_DSP_INDEX, NULL,
+                                     idx, 0, &item);
+            if ((!error) &&
+                (*((int32_t *)col_get_item_data(item)) != values[idx])) {
+                printf("Extracted wrong item at %d\n", idx);
+                error = EINVAL;
+            }
+            col_delete_item(item);
+            memmove(&values[idx], &values[idx + 1],
+                    (count - idx - 1) * sizeof(int32_t));
+            count--;
+        }
+        else if (op == 8) {
+            sprintf(name, "item%d", next);
+            error = col_add_int_property(col, NULL, name, next);
+            values[count++] = next++;
+        }
+        else if (count > 100) {
+            /* Removal by name drops the index */
+            sprintf(name, "item%d", values[idx]);
+            error = col_delete_property(col, name, COL_TYPE_ANY,
+                                        COL_TRAVERSE_ONELEVEL);
+            memmove(&values[idx], &values[idx + 1],
+                    (count - idx - 1) * sizeof(int32_t));
+            count--;
+        }
+
+        if (error) {
+            printf("Operation %d failed at step %d. Error %d\n", op, i, error);
+            col_destroy_collection(col);
+            return error;
+        }
+    }
+
+    /* Last item is found through the index too */
+    item = NULL;
+    if ((error = col_extract_item(col, NULL, COL_DSP_END, NULL,
+                                  0, 0, &item)) ||
+        (*((int32_t *)col_get_item_data(item)) != values[count - 1])) {
+        printf("Failed to extract last item. Error %d\n", error);
+        col_delete_item(item);
+        col_destroy_collection(col);
+        return error ? error : EINVAL;
+    }
+    col_delete_item(item);
+    count--;
+
+    if ((error = position_check(col, values, count))) {
+        col_destroy_collection(col);
+        return error;
+    }
+
+    /* Sorting drops the index */
+    if ((error = col_sort_collection(col, COL_CMPIN_DATA, COL_SORT_DESC)) ||
+        (error = col_extract_item(col, NULL, COL_DSP_INDEX, NULL,
+                                  count / 2, 0, &item))) {
+        printf("Failed to extract sorted item. Error %d\n", error);
+        col_destroy_collection(col);
+        return error;
+    }
+    col_delete_item(item);
+
+    col_destroy_collection(col);
+
+    COLOUT(printf("\n\n==== POSITION TEST END ====\n\n"));
+
+    return EOK;
+}
+
 /* Main function of the unit test */
 
 int main(int argc, char *argv[])
@@ -2237,7 +4860,25 @@ int main(int argc, char *argv[])
                         delete_test,
                         search_test,
                         sort_test,
+                        merge_sort_test,
+                        iterator_storage_test,
+                        batch_test,
+                        cow_test,
+                        serial_test,
+                        wire_test,
+                        freeze_test,
+                        walk_test,
+                        stats_test,
+                        parallel_test,
+                        position_test,
                         dup_test,
+                        index_test,
+                        arena_test,
+                        inline_test,
+                        intern_test,
+                        hash_test,
+                        threadsafe_test,
+                        snapshot_test,
                         NULL };
     test_fn t;
     int i = 0;
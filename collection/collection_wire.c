@@ -0,0 +1,532 @@
+/*
+    COLLECTION LIBRARY
+
+    Implementation of the binary wire format of the collection.
+
+    Copyright (C) ding-libs contributors 2026
+
+    Collection Library is free software: you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    Collection Library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with Collection Library.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "config.h"
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "trace.h"
+
+/* The collection should use the real structures */
+#include "collection_priv.h"
+#include "collection.h"
+
+/* Version of the format and the mark of the byte order */
+#define COL_WIRE_VERSION        1
+#define COL_WIRE_BYTE_ORDER     0x01020304
+
+/* Deepest nesting of the sub collections that is accepted */
+#define COL_WIRE_MAX_DEPTH      256
+
+/* The packed collection starts with the header.
+ * Numbers are stored in the byte order of the host
+ * that packed the collection.
+ */
+struct col_wire_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t reserved;
+    uint64_t size;
+};
+
+/* Every item is stored as a record followed by the
+ * property name with its terminating zero and the data.
+ * Both are padded to 8 bytes so that the data can be
+ * used in place. The record of the collection header
+ * has the class in the length and the number of the
+ * items that follow it in the count.
+ * The reference to the sub collection has no data.
+ * The sub collection is stored right after it.
+ */
+struct col_wire_record {
+    uint64_t hash;
+    int32_t type;
+    uint32_t property_len;
+    uint32_t length;
+    uint32_t count;
+};
+
+/* Position in the packed collection that is loaded */
+struct col_wire_reader {
+    char *buffer;
+    size_t size;
+    size_t offset;
+    struct col_arena *arena;
+};
+
+static const char col_wire_magic[4] = { 'C', 'O', 'L', 'W' };
+
+
+/* Store the block padding it to 8 bytes.
+ * Only the size is counted if there is no buffer.
+ */
+static void col_wire_put(char *buffer, size_t *offset,
+                         const void *block, size_t length)
+{
+    if (buffer) memcpy(buffer + *offset, block, length);
+    *offset += COL_ARENA_ALIGN(length);
+}
+
+/* Store one item */
+static void col_wire_put_item(char *buffer, size_t *offset,
+                              struct collection_item *item,
+                              uint32_t length, uint32_t count)
+{
+    struct col_wire_record record;
+
+    record.hash = item->phash;
+    record.type = item->type;
+    record.property_len = item->property_len;
+    record.length = length;
+    record.count = count;
+
+    col_wire_put(buffer, offset, &record, sizeof(record));
+    col_wire_put(buffer, offset, item->property, item->property_len + 1);
+    if ((item->type != COL_TYPE_COLLECTION) &&
+        (item->type != COL_TYPE_COLLECTIONREF))
+        col_wire_put(buffer, offset, item->data, length);
+}
+
+/* Store the collection and its sub collections */
+static int col_wire_put_collection(char *buffer, size_t *offset,
+                                   struct collection_item *collection,
+                                   unsigned depth)
+{
+    struct collection_header *header;
+    struct collection_item *current;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if (depth > COL_WIRE_MAX_DEPTH) {
+        TRACE_ERROR_NUMBER("Collection is nested too deep", E2BIG);
+        return E2BIG;
+    }
+
+    header = (struct collection_header *)collection->data;
+    col_wire_put_item(buffer, offset, collection,
+                      header->cclass, header->count - 1);
+
+    for (current = collection->next; current; current = current->next) {
+        if (current->type == COL_TYPE_COLLECTIONREF) {
+            col_wire_put_item(buffer, offset, current, 0, 0);
+            error = col_wire_put_collection(buffer, offset,
+                        *((struct collection_item **)current->data),
+                        depth + 1);
+            if (error) return error;
+        }
+        else col_wire_put_item(buffer, offset, current, current->length, 0);
+    }
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Pack the collection into the buffer */
+int col_pack_collection(struct collection_item *ci,
+                        void **buffer,
+                        size_t *size)
+{
+    struct col_wire_header *header;
+    char *new_buffer;
+    size_t offset = sizeof(struct col_wire_header);
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((ci == NULL) ||
+        (ci->type != COL_TYPE_COLLECTION) ||
+        (buffer == NULL) ||
+        (size == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    error = col_lock_collection(ci, 0);
+    if (error) return error;
+
+    /* The first pass only measures the collection */
+    error = col_wire_put_collection(NULL, &offset, ci, 0);
+    if (error) {
+        col_unlock_collection(ci);
+        return error;
+    }
+
+    new_buffer = (char *)calloc(1, offset);
+    if (new_buffer == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate buffer", ENOMEM);
+        col_unlock_collection(ci);
+        return ENOMEM;
+    }
+
+    header = (struct col_wire_header *)new_buffer;
+    memcpy(header->magic, col_wire_magic, sizeof(col_wire_magic));
+    header->version = COL_WIRE_VERSION;
+    header->byte_order = COL_WIRE_BYTE_ORDER;
+    header->reserved = 0;
+    header->size = offset;
+
+    offset = sizeof(struct col_wire_header);
+    (void)col_wire_put_collection(new_buffer, &offset, ci, 0);
+
+    col_unlock_collection(ci);
+
+    *buffer = new_buffer;
+    *size = offset;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Take the next block of the packed collection */
+static char *col_wire_take(struct col_wire_reader *reader,
+                           size_t length)
+{
+    char *block;
+
+    if (COL_ARENA_ALIGN(length) > reader->size - reader->offset) {
+        TRACE_ERROR_NUMBER("Packed collection is truncated", reader->offset);
+        return NULL;
+    }
+
+    block = reader->buffer + reader->offset;
+    reader->offset += COL_ARENA_ALIGN(length);
+
+    return block;
+}
+
+/* Check that the data has the size its type requires */
+static int col_wire_check_data(int type, const char *data, uint32_t length)
+{
+    switch (type) {
+    case COL_TYPE_STRING:   return ((length > 0) && (data[length - 1] == '\0'));
+    case COL_TYPE_BINARY:   return 1;
+    case COL_TYPE_INTEGER:  return (length == sizeof(int32_t));
+    case COL_TYPE_UNSIGNED: return (length == sizeof(uint32_t));
+    case COL_TYPE_LONG:     return (length == sizeof(int64_t));
+    case COL_TYPE_ULONG:    return (length == sizeof(uint64_t));
+    case COL_TYPE_DOUBLE:   return (length == sizeof(double));
+    case COL_TYPE_BOOL:     return (length == sizeof(unsigned char));
+    default:                return 0;
+    }
+}
+
+/* Read one item.
+ * The property and the data stay in the buffer.
+ */
+static int col_wire_get_item(struct col_wire_reader *reader,
+                             struct collection_item **item,
+                             const struct col_wire_record **record,
+                             size_t extra)
+{
+    const struct col_wire_record *new_record;
+    struct collection_item *new_item;
+    char *property;
+    char *data = NULL;
+    int len = 0;
+
+    new_record = (const struct col_wire_record *)
+                    col_wire_take(reader, sizeof(struct col_wire_record));
+    if ((new_record == NULL) ||
+        (new_record->property_len >= COL_MAX_DATA) ||
+        (new_record->length >= COL_MAX_DATA)) {
+        TRACE_ERROR_NUMBER("Invalid item record", EINVAL);
+        return EINVAL;
+    }
+
+    property = col_wire_take(reader, new_record->property_len + 1);
+    if ((property == NULL) || (property[new_record->property_len] != '\0')) {
+        TRACE_ERROR_NUMBER("Invalid property", EINVAL);
+        return EINVAL;
+    }
+
+    /* Items with a wrong hash could not be found */
+    if ((col_make_hash(property, 0, &len) != new_record->hash) ||
+        ((uint32_t)len != new_record->property_len)) {
+        TRACE_ERROR_NUMBER("Invalid hash of the property", EINVAL);
+        return EINVAL;
+    }
+
+    if ((new_record->type != COL_TYPE_COLLECTION) &&
+        (new_record->type != COL_TYPE_COLLECTIONREF)) {
+        data = col_wire_take(reader, new_record->length);
+        if ((data == NULL) ||
+            (!col_wire_check_data(new_record->type, data,
+                                  new_record->length))) {
+            TRACE_ERROR_NUMBER("Invalid data", EINVAL);
+            return EINVAL;
+        }
+    }
+
+    new_item = (struct collection_item *)
+                  col_arena_alloc(reader->arena,
+                                  COL_ARENA_ALIGN(sizeof(struct collection_item)) +
+                                  extra);
+    if (new_item == NULL) {
+        TRACE_ERROR_NUMBER("Failed to allocate item", ENOMEM);
+        return ENOMEM;
+    }
+
+    new_item->next = NULL;
+    new_item->index_header = NULL;
+    new_item->property = property;
+    new_item->property_len = new_record->property_len;
+    new_item->type = new_record->type;
+    new_item->length = new_record->length;
+    new_item->flags = COL_ITEM_ARENA | COL_ITEM_ARENA_PROPERTY |
+                      COL_ITEM_ARENA_DATA | COL_ITEM_FROZEN;
+    new_item->data = data;
+    new_item->phash = new_record->hash;
+
+    *item = new_item;
+    *record = new_record;
+    return EOK;
+}
+
+/* Read the collection and its sub collections */
+static int col_wire_get_collection(struct col_wire_reader *reader,
+                                   struct collection_item **collection,
+                                   unsigned depth)
+{
+    const struct col_wire_record *record;
+    struct collection_item *new_collection = NULL;
+    struct collection_item *item = NULL;
+    struct collection_item *sub = NULL;
+    struct collection_header *header;
+    uint32_t count;
+    uint32_t i;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if (depth > COL_WIRE_MAX_DEPTH) {
+        TRACE_ERROR_NUMBER("Collection is nested too deep", EINVAL);
+        return EINVAL;
+    }
+
+    error = col_wire_get_item(reader, &new_collection, &record,
+                              sizeof(struct collection_header));
+    if (error) return error;
+
+    if (record->type != COL_TYPE_COLLECTION) {
+        TRACE_ERROR_NUMBER("Collection header expected", EINVAL);
+        return EINVAL;
+    }
+
+    /* Header is placed right after the item */
+    header = (struct collection_header *)
+                ((char *)new_collection +
+                 COL_ARENA_ALIGN(sizeof(struct collection_item)));
+    header->last = new_collection;
+    header->reference_count = 1;
+    header->count = 1;
+    header->cclass = record->length;
+    header->index = NULL;
+    header->index_epoch = 0;
+    header->arena = reader->arena;
+    header->flags = COL_CREATE_ARENA;
+    header->lock = NULL;
+    memset(header->statistics, 0, sizeof(header->statistics));
+    header->position = NULL;
+
+    new_collection->data = header;
+    new_collection->length = sizeof(struct collection_header);
+    col_arena_ref(reader->arena);
+
+    count = record->count;
+    for (i = 0; i < count; i++) {
+        error = col_wire_get_item(reader, &item, &record, 0);
+        if (error) break;
+
+        if (record->type == COL_TYPE_COLLECTION) {
+            TRACE_ERROR_NUMBER("Unexpected collection header", EINVAL);
+            error = EINVAL;
+            break;
+        }
+
+        /* Sub collection is linked only when it is complete */
+        if (record->type == COL_TYPE_COLLECTIONREF) {
+            error = col_wire_get_collection(reader, &sub, depth + 1);
+            if (error) break;
+            item->flags = (item->flags & ~COL_ITEM_ARENA_DATA) |
+                          COL_ITEM_INLINE_DATA;
+            item->data = item->space.buf;
+            item->length = sizeof(struct collection_item *);
+            *((struct collection_item **)item->data) = sub;
+        }
+
+        header->last->next = item;
+        header->last = item;
+        header->count++;
+    }
+
+    if (error) {
+        col_destroy_collection(new_collection);
+        return error;
+    }
+
+    /* Nobody can change the loaded collection */
+    col_index_freeze(new_collection);
+    header->flags |= COL_HEADER_FROZEN;
+
+    *collection = new_collection;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Load the packed collection.
+ * The mapping, if any, is owned by the arena from now on.
+ */
+static int col_wire_load(struct collection_item **ci,
+                         const void *buffer,
+                         size_t size,
+                         void *mapping)
+{
+    const struct col_wire_header *header;
+    struct col_wire_reader reader;
+    struct collection_item *new_collection = NULL;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    error = col_arena_create(&(reader.arena));
+    if (error) {
+        TRACE_ERROR_NUMBER("Failed to create arena", error);
+        if (mapping) munmap(mapping, size);
+        return error;
+    }
+
+    if (mapping) col_arena_keep_mapping(reader.arena, mapping, size);
+
+    header = (const struct col_wire_header *)buffer;
+    if ((size < sizeof(struct col_wire_header)) ||
+        (((uintptr_t)buffer) & 7) ||
+        (memcmp(header->magic, col_wire_magic, sizeof(col_wire_magic))) ||
+        (header->version != COL_WIRE_VERSION) ||
+        (header->byte_order != COL_WIRE_BYTE_ORDER) ||
+        (header->size != size)) {
+        TRACE_ERROR_NUMBER("Invalid or incompatible packed collection", EINVAL);
+        col_arena_unref(reader.arena);
+        return EINVAL;
+    }
+
+    /* Items point into the buffer but never change it */
+    reader.buffer = (char *)(uintptr_t)buffer;
+    reader.size = size;
+    reader.offset = sizeof(struct col_wire_header);
+
+    error = col_wire_get_collection(&reader, &new_collection, 0);
+    if ((error == EOK) && (reader.offset != size)) {
+        TRACE_ERROR_NUMBER("Trailing data in packed collection", EINVAL);
+        col_destroy_collection(new_collection);
+        error = EINVAL;
+    }
+
+    /* Collections hold the arena from now on */
+    col_arena_unref(reader.arena);
+
+    if (error) return error;
+
+    *ci = new_collection;
+
+    TRACE_FLOW_EXIT();
+    return EOK;
+}
+
+/* Load the packed collection without copying it */
+int col_load_packed(struct collection_item **ci,
+                    const void *buffer,
+                    size_t size)
+{
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((ci == NULL) || (buffer == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    error = col_wire_load(ci, buffer, size, NULL);
+
+    TRACE_FLOW_NUMBER("col_load_packed. Returning", error);
+    return error;
+}
+
+/* Map the file with the packed collection and load it */
+int col_load_packed_file(struct collection_item **ci,
+                         const char *path)
+{
+    struct stat st;
+    void *mapping;
+    int fd;
+    int error = EOK;
+
+    TRACE_FLOW_ENTRY();
+
+    if ((ci == NULL) || (path == NULL)) {
+        TRACE_ERROR_NUMBER("Invalid parameter", EINVAL);
+        return EINVAL;
+    }
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        error = errno;
+        TRACE_ERROR_NUMBER("Failed to open file", error);
+        return error;
+    }
+
+    if (fstat(fd, &st) == -1) {
+        error = errno;
+        TRACE_ERROR_NUMBER("Failed to stat file", error);
+        close(fd);
+        return error;
+    }
+
+    if ((st.st_size < (off_t)sizeof(struct col_wire_header)) ||
+        ((uint64_t)st.st_size > SIZE_MAX)) {
+        TRACE_ERROR_NUMBER("File has wrong size", EINVAL);
+        close(fd);
+        return EINVAL;
+    }
+
+    mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED) {
+        error = errno;
+        TRACE_ERROR_NUMBER("Failed to map file", error);
+        close(fd);
+        return error;
+    }
+
+    /* Mapping stays valid after the file is closed */
+    close(fd);
+
+    error = col_wire_load(ci, mapping, (size_t)st.st_size, mapping);
+
+    TRACE_FLOW_NUMBER("col_load_packed_file. Returning", error);
+    return error;
+}
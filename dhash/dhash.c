@@ -45,6 +45,14 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 #include "dhash.h"
 
 /*****************************************************************************/
@@ -54,6 +62,10 @@
 #define PRIME_1                 37
 #define PRIME_2                 1048583
 
+/* Constants of hash_fast_key() */
+#define FAST_P0                 0xa0761d6478bd642fULL
+#define FAST_P1                 0xe7037ed1a0b428dbULL
+
 #ifndef MIN
     #define MIN(a,b) (((a) < (b)) ? (a) : (b))
 #endif
@@ -62,6 +74,25 @@
     #define MAX(a,b) (((a) > (b)) ? (a) : (b))
 #endif
 
+/* Open addressing: slots are probed in groups of control bytes */
+#define GROUP_SIZE              16
+#define CTRL_EMPTY              0x80
+#define CTRL_DELETED            0xFE
+#define CTRL_IS_FULL(ctrl)      (((ctrl) & 0x80) == 0)
+#define CTRL_HASH(h)            ((unsigned char)((h) & 0x7F))
+#define GROUP_HASH(h)           ((h) >> 7)
+
+/* Number of locks of the buckets of the thread safe table, power of 2 */
+#define HASH_STRIPES            64
+
+/* Pool: chunks up to POOL_MAX bytes are carved out of slabs in classes
+ * of POOL_GRAIN bytes. Slabs double in size up to POOL_SLAB_MAX. */
+#define POOL_GRAIN              16
+#define POOL_CLASSES            8
+#define POOL_MAX                (POOL_GRAIN * POOL_CLASSES)
+#define POOL_SLAB_MIN           1024
+#define POOL_SLAB_MAX           65536
+
 #define halloc(table, size) table->halloc(size, table->halloc_pvt)
 #define hfree(table, ptr) table->hfree(ptr, table->halloc_pvt)
 #define hdelete_callback(table, type, entry) do { \
@@ -70,15 +101,56 @@
     } \
 } while(0)
 
+#ifdef HASH_STATISTICS
+/* Counters of the thread safe table are spread over the stripes */
+#define hstat_inc(table, h, field) do { \
+    if ((table)->thread_safe) { \
+        __atomic_add_fetch(&(table)->stripes[(h) & (HASH_STRIPES - 1)].statistics.field, \
+                           1, __ATOMIC_RELAXED); \
+    } else { \
+        (table)->statistics.field++; \
+    } \
+} while(0)
+#else
+#define hstat_inc(table, h, field) do { } while(0)
+#endif
+
 /*****************************************************************************/
 /************************** Internal Type Definitions ************************/
 /*****************************************************************************/
 
+typedef unsigned long address_t;
+
 typedef struct element_t {
     hash_entry_t entry;
+    address_t hash;             /* hash of the key before it is masked */
     struct element_t *next;
 } element_t, *segment_t;
 
+/* Slab of the pool, the chunks follow the header */
+struct hash_slab {
+    struct hash_slab *next;
+};
+
+/* Free lists of the chunks and the unused rest of the last slab */
+struct hash_pool {
+    void *free[POOL_CLASSES];
+    char *unused;
+    size_t unused_size;
+    size_t slab_size;               /* size of the next slab */
+};
+
+/* Lock of the buckets whose address ends with the index of the stripe */
+struct hash_stripe {
+    pthread_rwlock_t lock;
+    struct hash_pool pool;          /* used under the write lock */
+#ifdef HASH_STATISTICS
+    hash_statistics_t statistics;
+#endif
+    /* Keeps the locks of the neighbouring stripes in different cache lines */
+    char padding[64];
+};
+
 
 struct hash_table_str {
     unsigned long   p;             /* Next bucket to be split */
@@ -97,15 +169,31 @@ struct hash_table_str {
     hash_alloc_func *halloc;
     hash_free_func *hfree;
     void *halloc_pvt;
+    hash_key_func *key_func;
+    void *key_pvt;
+    unsigned long seed;            /* seed of hash_set_random_seed() */
+    /* Thread safe table */
+    bool            thread_safe;
+    pthread_rwlock_t resize_lock;  /* write locked to change the layout */
+    struct hash_stripe *stripes;
+    /* Pool of elements and keys */
+    bool            pooled;
+    struct hash_pool pool;
+    struct hash_slab *slabs;
     segment_t **directory;
+    /* Open addressing table */
+    bool            open_addressing;
+    unsigned long   slot_count;     /* power of 2, multiple of GROUP_SIZE */
+    unsigned long   min_slot_count;
+    unsigned long   deleted_count;  /* slots marked CTRL_DELETED */
+    unsigned char  *control;        /* hash byte or CTRL_* of every slot */
+    hash_entry_t   *slots;
 #ifdef HASH_STATISTICS
     hash_statistics_t statistics;
 #endif
 
 };
 
-typedef unsigned long address_t;
-
 typedef struct hash_keys_callback_data_t {
     unsigned long index;
     hash_key_t *keys;
@@ -142,6 +230,7 @@ enum hash_iter_state {
 
 static address_t convert_key(hash_key_t *key);
 static address_t hash(hash_table_t *table, hash_key_t *key);
+static address_t hash_address(hash_table_t *table, address_t h);
 static bool key_equal(hash_key_t *a, hash_key_t *b);
 static int contract_table(hash_table_t *table);
 static int expand_table(hash_table_t *table);
@@ -199,12 +288,89 @@ static address_t convert_key(hash_key_t *key)
     return h;
 }
 
+/* Multiply to 128 bits and fold the halves */
+static inline uint64_t fast_mix(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 r = (unsigned __int128)a * b;
+
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a;
+    uint64_t hb = b >> 32, lb = (uint32_t)b;
+    uint64_t hh = ha * hb, hl = ha * lb, lh = la * hb, ll = la * lb;
+    uint64_t lo, carry;
+
+    lo = ll + (hl << 32);
+    carry = lo < ll;
+    lo += lh << 32;
+    carry += lo < (lh << 32);
+
+    return lo ^ (hh + (hl >> 32) + (lh >> 32) + carry);
+#endif
+}
+
+static inline uint64_t fast_read64(const unsigned char *p)
+{
+    uint64_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t fast_read32(const unsigned char *p)
+{
+    uint32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/* wyhash style hash of the bytes, 16 bytes per round */
+static uint64_t fast_hash_bytes(const unsigned char *p, size_t len,
+                                uint64_t seed)
+{
+    uint64_t a, b;
+    size_t i;
+
+    seed ^= FAST_P0;
+    if (len <= 16) {
+        if (len >= 4) {
+            /* Two overlapping reads from each end cover all bytes */
+            a = (fast_read32(p) << 32) | fast_read32(p + ((len >> 3) << 2));
+            b = (fast_read32(p + len - 4) << 32) |
+                fast_read32(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[len >> 1] << 8) | p[len - 1];
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        for (i = len; i > 16; i -= 16, p += 16) {
+            seed = fast_mix(fast_read64(p) ^ FAST_P1, fast_read64(p + 8) ^ seed);
+        }
+        /* Last 16 bytes, they may overlap the last round */
+        a = fast_read64(p + i - 16);
+        b = fast_read64(p + i - 8);
+    }
+
+    return fast_mix(FAST_P1 ^ len, fast_mix(a ^ FAST_P1, b ^ seed));
+}
+
 static address_t hash(hash_table_t *table, hash_key_t *key)
 {
-    address_t h, address;
+    if (table->key_func) {
+        return table->key_func(key, table->key_pvt);
+    }
+    return convert_key(key) % PRIME_2;
+}
+
+/* Bucket of the hash in the current address space */
+static address_t hash_address(hash_table_t *table, address_t h)
+{
+    address_t address;
 
-    h = convert_key(key);
-    h %= PRIME_2;
     address = h & (table->maxp-1);            /* h % maxp */
     if (address < table->p)
         address = h & ((table->maxp << 1)-1); /* h % (2*table->maxp) */
@@ -256,6 +422,131 @@ static bool key_equal(hash_key_t *a, hash_key_t *b)
     return false;
 }
 
+/* Header of the slab keeps the chunks aligned */
+typedef char hash_slab_check[(sizeof(struct hash_slab) <= POOL_GRAIN) ? 1 : -1];
+
+static void *pool_alloc(hash_table_t *table, struct hash_pool *pool, size_t size)
+{
+    struct hash_slab *slab;
+    unsigned int c;
+    void *chunk;
+
+    if (!table->pooled || size > POOL_MAX) return halloc(table, size);
+
+    c = (size - 1) / POOL_GRAIN;
+    if ((chunk = pool->free[c]) != NULL) {
+        pool->free[c] = *(void **)chunk;
+        return chunk;
+    }
+
+    size = (c + 1) * POOL_GRAIN;
+    if (pool->unused_size < size) {
+        /* The rest of the last slab is too small and stays unused */
+        if (pool->slab_size < POOL_SLAB_MIN) pool->slab_size = POOL_SLAB_MIN;
+        slab = (struct hash_slab *)halloc(table, POOL_GRAIN + pool->slab_size);
+        if (slab == NULL) return NULL;
+
+        /* Pools of the stripes add their slabs at the same time */
+        slab->next = __atomic_load_n(&table->slabs, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&table->slabs, &slab->next, slab, 1,
+                                            __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+        pool->unused = (char *)slab + POOL_GRAIN;
+        pool->unused_size = pool->slab_size;
+        if (pool->slab_size < POOL_SLAB_MAX) pool->slab_size <<= 1;
+    }
+
+    chunk = pool->unused;
+    pool->unused += size;
+    pool->unused_size -= size;
+    return chunk;
+}
+
+/* Chunk goes to the free list of any pool, the slabs belong to the table */
+static void pool_free(hash_table_t *table, struct hash_pool *pool,
+                      void *chunk, size_t size)
+{
+    unsigned int c;
+
+    if (!table->pooled || size > POOL_MAX) {
+        hfree(table, chunk);
+        return;
+    }
+
+    c = (size - 1) / POOL_GRAIN;
+    *(void **)chunk = pool->free[c];
+    pool->free[c] = chunk;
+}
+
+/* Pool of the stripe that is write locked, or of the table */
+static struct hash_pool *pool_of(hash_table_t *table, struct hash_stripe *stripe)
+{
+    return stripe ? &stripe->pool : &table->pool;
+}
+
+static int copy_key(hash_table_t *table, struct hash_pool *pool,
+                    hash_key_t *dst, hash_key_t *src)
+{
+    size_t len;
+
+    switch(dst->type = src->type) {
+    case HASH_KEY_ULONG:
+        dst->ul = src->ul;
+        break;
+    case HASH_KEY_STRING:
+    case HASH_KEY_CONST_STRING:
+        len = strlen(src->c_str) + 1;
+        dst->str = pool_alloc(table, pool, len);
+        if (dst->str == NULL) {
+            return HASH_ERROR_NO_MEMORY;
+        }
+        memcpy(dst->str, src->str, len);
+        break;
+    }
+    return HASH_SUCCESS;
+}
+
+static void free_key(hash_table_t *table, struct hash_pool *pool,
+                     hash_key_t *key)
+{
+    if (key->type == HASH_KEY_STRING || key->type == HASH_KEY_CONST_STRING) {
+        /* Internally we do not use constant memory for keys
+         * in hash table elements. */
+        pool_free(table, pool, key->str,
+                  table->pooled ? strlen(key->str) + 1 : 0);
+    }
+}
+
+static void copy_value(hash_value_t *dst, hash_value_t *src)
+{
+    switch(dst->type = src->type) {
+    case HASH_VALUE_UNDEF:
+        dst->ul = 0;
+        break;
+    case HASH_VALUE_PTR:
+        dst->ptr = src->ptr;
+        break;
+    case HASH_VALUE_INT:
+        dst->i = src->i;
+        break;
+    case HASH_VALUE_UINT:
+        dst->ui = src->ui;
+        break;
+    case HASH_VALUE_LONG:
+        dst->l = src->l;
+        break;
+    case HASH_VALUE_ULONG:
+        dst->ul = src->ul;
+        break;
+    case HASH_VALUE_FLOAT:
+        dst->f = src->f;
+        break;
+    case HASH_VALUE_DOUBLE:
+        dst->d = src->d;
+        break;
+    }
+}
+
 
 static int expand_table(hash_table_t *table)
 {
@@ -313,7 +604,7 @@ static int expand_table(hash_table_t *table)
         last_of_new = &new_segment[new_segment_index];
         *last_of_new = NULL;
         while (current != NULL) {
-            if (hash(table, &current->entry.key) == new_address) {
+            if (hash_address(table, current->hash) == new_address) {
                 /*
                  * Attach it to the end of the new chain
                  */
@@ -383,7 +674,7 @@ static int contract_table(hash_table_t *table)
          * Find the last bucket to merge back
          */
         if((current = old_segment[old_segment_index]) != NULL) {
-            new_address = hash(table, &old_segment[old_segment_index]->entry.key);
+            new_address = hash_address(table, old_segment[old_segment_index]->hash);
             new_segment_dir = new_address >> table->segment_size_shift;
             new_segment_index = new_address & (table->segment_size-1); /* new_address % segment_size */
             new_segment = table->directory[new_segment_dir];
@@ -424,7 +715,8 @@ static int contract_table(hash_table_t *table)
     return HASH_SUCCESS;
 }
 
-static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg, segment_t **chain_arg)
+static int lookup(hash_table_t *table, hash_key_t *key, address_t full_hash,
+                  element_t **element_arg, segment_t **chain_arg)
 {
     address_t h;
     segment_t *current_segment;
@@ -436,14 +728,12 @@ static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg,
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-#ifdef HASH_STATISTICS
-    table->statistics.hash_accesses++;
-#endif
-    h = hash(table, key);
+    hstat_inc(table, full_hash, hash_accesses);
+    h = hash_address(table, full_hash);
     segment_dir = h >> table->segment_size_shift;
     segment_index = h & (table->segment_size-1); /* h % segment_size */
     /*
-     * valid segment ensured by hash()
+     * valid segment ensured by hash_address()
      */
     current_segment = table->directory[segment_dir];
 
@@ -457,14 +747,13 @@ static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg,
     chain = &current_segment[segment_index];
     element = *chain;
     /*
-     * Follow collision chain
+     * Follow collision chain, keys are compared only when hashes match
      */
-    while (element != NULL && !key_equal(&element->entry.key, key)) {
+    while (element != NULL &&
+           (element->hash != full_hash || !key_equal(&element->entry.key, key))) {
         chain = &element->next;
         element = *chain;
-#ifdef HASH_STATISTICS
-        table->statistics.hash_collisions++;
-#endif
+        hstat_inc(table, full_hash, hash_collisions);
     }
     *element_arg = element;
     *chain_arg = chain;
@@ -472,6 +761,392 @@ static int lookup(hash_table_t *table, hash_key_t *key, element_t **element_arg,
     return HASH_SUCCESS;
 }
 
+/*
+ * Locking of the thread safe table.
+ *
+ * Every operation holds the resize lock. Lookups and changes of the entries
+ * read lock it and lock the stripe of the bucket, for reading or writing.
+ * Changes of the layout of the table (expanding, contracting, resizing the
+ * open table) and iterations write lock it. The open addressing table has
+ * no stripes, its changes write lock the resize lock.
+ *
+ * The functions do nothing when the table is not thread safe.
+ */
+
+static void table_lock(hash_table_t *table, bool write)
+{
+    if (!table->thread_safe) return;
+
+    if (write) {
+        pthread_rwlock_wrlock(&table->resize_lock);
+    } else {
+        pthread_rwlock_rdlock(&table->resize_lock);
+    }
+}
+
+static void table_unlock(hash_table_t *table)
+{
+    if (table->thread_safe) pthread_rwlock_unlock(&table->resize_lock);
+}
+
+/* Lock the stripe of the bucket of the hash, the table must be locked */
+static struct hash_stripe *stripe_lock(hash_table_t *table, address_t h,
+                                       bool write)
+{
+    struct hash_stripe *stripe;
+
+    if (!table->thread_safe) return NULL;
+
+    stripe = &table->stripes[hash_address(table, h) & (HASH_STRIPES - 1)];
+    if (write) {
+        pthread_rwlock_wrlock(&stripe->lock);
+    } else {
+        pthread_rwlock_rdlock(&stripe->lock);
+    }
+    return stripe;
+}
+
+static void stripe_unlock(struct hash_stripe *stripe)
+{
+    if (stripe) pthread_rwlock_unlock(&stripe->lock);
+}
+
+/* Change the entry count, writers of different stripes change it at once */
+static unsigned long count_add(hash_table_t *table, unsigned long delta)
+{
+    if (table->thread_safe) {
+        return __atomic_add_fetch(&table->entry_count, delta, __ATOMIC_RELAXED);
+    }
+    return table->entry_count += delta;
+}
+
+/* Expand or contract the linear hashing table by one bucket */
+static int resize_table(hash_table_t *table, bool grow)
+{
+    int error = HASH_SUCCESS;
+    unsigned long load;
+
+    table_lock(table, true);
+    /* Another thread could have resized the table in the meantime */
+    load = table->entry_count / table->bucket_count;
+    if (grow && load > table->max_load_factor) {
+        error = expand_table(table);
+    } else if (!grow && load < table->min_load_factor) {
+        error = contract_table(table);
+    }
+    table_unlock(table);
+
+    return error;
+}
+
+/*
+ * Open addressing table.
+ *
+ * Every slot has a control byte which is either CTRL_EMPTY, CTRL_DELETED or
+ * the low 7 bits of the hash of the key stored in the slot. The rest of the
+ * hash selects the first group of GROUP_SIZE slots to probe. All control
+ * bytes of a group are compared at once so only the keys whose hash byte
+ * matches are compared. Groups are probed in triangular order which visits
+ * every group of the table. A probe stops at the first group with an empty
+ * slot.
+ */
+
+static address_t open_hash(hash_table_t *table, hash_key_t *key)
+{
+    uint64_t h;
+
+    /* Mix the bits of the key so that both parts of the hash are random */
+    if (table->key_func) {
+        h = table->key_func(key, table->key_pvt);
+    } else {
+        h = convert_key(key);
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+
+    return (address_t)h;
+}
+
+/* Bit i of the mask is set when control byte i of the group equals ctrl */
+static inline unsigned int group_match(const unsigned char *group,
+                                       unsigned char ctrl)
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128((const __m128i *)group);
+
+    return (unsigned int)_mm_movemask_epi8(
+                _mm_cmpeq_epi8(bytes, _mm_set1_epi8((char)ctrl)));
+#else
+    unsigned int mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < GROUP_SIZE; i++) {
+        if (group[i] == ctrl) mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+/* Bit i of the mask is set when slot i of the group is empty or deleted */
+static inline unsigned int group_match_free(const unsigned char *group)
+{
+#ifdef __SSE2__
+    return (unsigned int)_mm_movemask_epi8(
+                _mm_loadu_si128((const __m128i *)group));
+#else
+    unsigned int mask = 0;
+    unsigned int i;
+
+    for (i = 0; i < GROUP_SIZE; i++) {
+        if (!CTRL_IS_FULL(group[i])) mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+static bool open_lookup(hash_table_t *table, hash_key_t *key, address_t h,
+                        unsigned long *slot_arg)
+{
+    unsigned long group_count = table->slot_count / GROUP_SIZE;
+    unsigned long g = GROUP_HASH(h) & (group_count - 1);
+    unsigned long step, slot;
+    unsigned char *group;
+    unsigned int mask;
+
+    hstat_inc(table, h, hash_accesses);
+    for (step = 0; step < group_count; step++) {
+        group = &table->control[g * GROUP_SIZE];
+        for (mask = group_match(group, CTRL_HASH(h)); mask; mask &= mask - 1) {
+            slot = g * GROUP_SIZE + __builtin_ctz(mask);
+            if (key_equal(&table->slots[slot].key, key)) {
+                *slot_arg = slot;
+                return true;
+            }
+        }
+        if (group_match(group, CTRL_EMPTY)) break;
+        hstat_inc(table, h, hash_collisions);
+        g = (g + step + 1) & (group_count - 1);
+    }
+    return false;
+}
+
+/* Find the first empty or deleted slot on the probe sequence of h */
+static unsigned long open_free_slot(unsigned char *control,
+                                    unsigned long slot_count, address_t h)
+{
+    unsigned long group_count = slot_count / GROUP_SIZE;
+    unsigned long g = GROUP_HASH(h) & (group_count - 1);
+    unsigned long step;
+    unsigned int mask;
+
+    /* The load factor is below 100% so there is always a free slot */
+    for (step = 0; ; step++) {
+        mask = group_match_free(&control[g * GROUP_SIZE]);
+        if (mask) return g * GROUP_SIZE + __builtin_ctz(mask);
+        g = (g + step + 1) & (group_count - 1);
+    }
+}
+
+/* Move all entries into new arrays of slot_count slots */
+static int open_resize(hash_table_t *table, unsigned long slot_count)
+{
+    unsigned char *control;
+    hash_entry_t *slots;
+    unsigned long i, slot;
+
+    control = (unsigned char *)halloc(table, slot_count);
+    if (control == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    slots = (hash_entry_t *)halloc(table, slot_count * sizeof(hash_entry_t));
+    if (slots == NULL) {
+        hfree(table, control);
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(control, CTRL_EMPTY, slot_count);
+
+    for (i = 0; i < table->slot_count; i++) {
+        if (CTRL_IS_FULL(table->control[i])) {
+            slot = open_free_slot(control, slot_count,
+                                  open_hash(table, &table->slots[i].key));
+            control[slot] = table->control[i];
+            slots[slot] = table->slots[i];
+        }
+    }
+
+#ifdef HASH_STATISTICS
+    if (slot_count > table->slot_count) {
+        table->statistics.table_expansions++;
+    } else if (slot_count < table->slot_count) {
+        table->statistics.table_contractions++;
+    }
+#endif
+    hfree(table, table->control);
+    hfree(table, table->slots);
+    table->control = control;
+    table->slots = slots;
+    table->slot_count = slot_count;
+    table->deleted_count = 0;
+
+    return HASH_SUCCESS;
+}
+
+static int open_enter(hash_table_t *table, hash_key_t *key, hash_value_t *value,
+                      hash_value_t *existing)
+{
+    int error;
+    address_t h;
+    unsigned long slot, slot_count;
+
+    h = open_hash(table, key);
+    if (open_lookup(table, key, h, &slot)) {
+        if (existing) {
+            /* hash_get_default() keeps the current value */
+            *existing = table->slots[slot].value;
+            return HASH_SUCCESS;
+        }
+        hdelete_callback(table, HASH_ENTRY_DESTROY, &table->slots[slot]);
+        copy_value(&table->slots[slot].value, value);
+        return HASH_SUCCESS;
+    }
+
+    /*
+     * Table over-full? Deleted slots are purged if they take the room,
+     * otherwise the table is doubled.
+     */
+    if ((table->entry_count + table->deleted_count + 1) * 100 >
+            table->slot_count * table->max_load_factor) {
+        slot_count = table->slot_count;
+        if ((table->entry_count + 1) * 200 > slot_count * table->max_load_factor) {
+            slot_count <<= 1;
+        }
+        if ((error = open_resize(table, slot_count)) != HASH_SUCCESS) {
+            return error;
+        }
+    }
+
+    slot = open_free_slot(table->control, table->slot_count, h);
+    if ((error = copy_key(table, &table->pool, &table->slots[slot].key, key)) != HASH_SUCCESS) {
+        return error;
+    }
+    copy_value(&table->slots[slot].value, value);
+    if (existing) *existing = *value;
+    if (table->control[slot] == CTRL_DELETED) table->deleted_count--;
+    table->control[slot] = CTRL_HASH(h);
+    table->entry_count++;
+
+    return HASH_SUCCESS;
+}
+
+static int open_delete(hash_table_t *table, hash_key_t *key)
+{
+    unsigned long slot;
+    unsigned char *group;
+
+    if (!open_lookup(table, key, open_hash(table, key), &slot)) {
+        return HASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    hdelete_callback(table, HASH_ENTRY_DESTROY, &table->slots[slot]);
+    free_key(table, &table->pool, &table->slots[slot].key);
+
+    /*
+     * A group that already has an empty slot stops every probe, so the
+     * slot can be emptied. Otherwise probes must go on past it.
+     */
+    group = &table->control[slot & ~(unsigned long)(GROUP_SIZE - 1)];
+    if (group_match(group, CTRL_EMPTY)) {
+        table->control[slot] = CTRL_EMPTY;
+    } else {
+        table->control[slot] = CTRL_DELETED;
+        table->deleted_count++;
+    }
+    table->entry_count--;
+
+    /*
+     * Table too sparse?
+     */
+    if (table->slot_count > table->min_slot_count &&
+            table->entry_count * 100 < table->slot_count * table->min_load_factor) {
+        return open_resize(table, table->slot_count >> 1);
+    }
+    return HASH_SUCCESS;
+}
+
+/*
+ * Enter the value under the key. If existing is not NULL a value which is
+ * already in the table is kept and returned in existing, otherwise the value
+ * is entered and also returned in existing.
+ */
+static int enter(hash_table_t *table, hash_key_t *key, hash_value_t *value,
+                 hash_value_t *existing)
+{
+    int error = HASH_SUCCESS;
+    bool expand = false;
+    address_t h;
+    struct hash_stripe *stripe;
+    segment_t element, *chain;
+
+    if (table->open_addressing) {
+        table_lock(table, true);
+        error = open_enter(table, key, value, existing);
+        table_unlock(table);
+        return error;
+    }
+
+    h = hash(table, key);
+    table_lock(table, false);
+    stripe = stripe_lock(table, h, true);
+    lookup(table, key, h, &element, &chain);
+
+    if (element != NULL) {
+        if (existing) {
+            /* hash_get_default() keeps the current value */
+            *existing = element->entry.value;
+        } else {
+            hdelete_callback(table, HASH_ENTRY_DESTROY, &element->entry);
+            copy_value(&element->entry.value, value);
+        }
+    } else {
+        element = (element_t *)pool_alloc(table, pool_of(table, stripe), sizeof(element_t));
+        if (element == NULL) {
+            error = HASH_ERROR_NO_MEMORY;
+        } else {
+            memset(element, 0, sizeof(element_t));
+            /*
+             * Initialize new element
+             */
+            error = copy_key(table, pool_of(table, stripe), &element->entry.key, key);
+            if (error != HASH_SUCCESS) {
+                pool_free(table, pool_of(table, stripe), element, sizeof(element_t));
+            } else {
+                element->hash = h;
+                copy_value(&element->entry.value, value);
+                if (existing) *existing = *value;
+
+                *chain = element;             /* link into chain */
+                element->next = NULL;
+
+                /*
+                 * Table over-full?
+                 */
+                expand = count_add(table, 1) / table->bucket_count > table->max_load_factor;
+            }
+        }
+    }
+
+    stripe_unlock(stripe);
+    table_unlock(table);
+
+    if (expand) {
+        error = resize_table(table, true); /* doesn't affect element */
+    }
+    return error;
+}
+
 static bool hash_keys_callback(hash_entry_t *item, void *user_data)
 {
     hash_keys_callback_data_t *data = (hash_keys_callback_data_t *)user_data;
@@ -506,6 +1181,59 @@ const char* hash_error_string(int error)
 }
 
 
+static int open_create(unsigned long count, hash_table_t **tbl,
+                       unsigned long min_load_factor,
+                       unsigned long max_load_factor,
+                       hash_alloc_func *alloc_func,
+                       hash_free_func *free_func,
+                       void *alloc_private_data,
+                       hash_delete_callback *delete_callback,
+                       void *delete_private_data)
+{
+    unsigned long slot_count;
+    hash_table_t *table;
+
+    if (min_load_factor == 0) min_load_factor = HASH_OPEN_DEFAULT_MIN_LOAD_FACTOR;
+    if (max_load_factor == 0) max_load_factor = HASH_OPEN_DEFAULT_MAX_LOAD_FACTOR;
+
+    /* Halving or doubling the table must not cross the other limit */
+    if (max_load_factor >= 100 || min_load_factor * 2 >= max_load_factor) {
+        return EINVAL;
+    }
+
+    for (slot_count = GROUP_SIZE;
+         slot_count * max_load_factor < count * 100;
+         slot_count <<= 1);
+
+    table = (hash_table_t *)alloc_func(sizeof(hash_table_t),
+                                       alloc_private_data);
+    if (table == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(table, 0, sizeof(hash_table_t));
+    table->halloc = alloc_func;
+    table->hfree = free_func;
+    table->halloc_pvt = alloc_private_data;
+    table->delete_callback = delete_callback;
+    table->delete_pvt = delete_private_data;
+    table->min_load_factor = min_load_factor;
+    table->max_load_factor = max_load_factor;
+
+    table->open_addressing = true;
+    table->slot_count = slot_count;
+    table->min_slot_count = slot_count;
+    table->control = (unsigned char *)halloc(table, slot_count);
+    table->slots = (hash_entry_t *)halloc(table, slot_count * sizeof(hash_entry_t));
+    if (table->control == NULL || table->slots == NULL) {
+        hash_destroy(table);
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(table->control, CTRL_EMPTY, slot_count);
+
+    *tbl = table;
+    return HASH_SUCCESS;
+}
+
 int hash_create(unsigned long count, hash_table_t **tbl,
                 hash_delete_callback *delete_callback,
                 void *delete_private_data)
@@ -539,6 +1267,12 @@ int hash_create_ex(unsigned long count, hash_table_t **tbl,
     if (alloc_func == NULL) alloc_func = sys_malloc_wrapper;
     if (free_func == NULL) free_func = sys_free_wrapper;
 
+    if (directory_bits == HASH_OPEN_ADDRESSING) {
+        return open_create(count, tbl, min_load_factor, max_load_factor,
+                           alloc_func, free_func, alloc_private_data,
+                           delete_callback, delete_private_data);
+    }
+
     /* Compute directory and segment parameters */
 
     /* compute power of 2 >= count; it's the number of requested buckets */
@@ -648,18 +1382,151 @@ int hash_create_ex(unsigned long count, hash_table_t **tbl,
     return HASH_SUCCESS;
 }
 
+int hash_set_key_func(hash_table_t *table, hash_key_func *key_func,
+                      void *key_private_data)
+{
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    /* Entries already in the table are placed by the old hash */
+    if (table->entry_count != 0) return EINVAL;
+
+    table->key_func = key_func;
+    table->key_pvt = key_func ? key_private_data : NULL;
+
+    return HASH_SUCCESS;
+}
+
+unsigned long hash_fast_key(hash_key_t *key, void *pvt)
+{
+    uint64_t seed = pvt ? *(unsigned long *)pvt : 0;
+
+    switch(key->type) {
+    case HASH_KEY_STRING:
+    case HASH_KEY_CONST_STRING:
+        return (unsigned long)fast_hash_bytes((const unsigned char *)key->c_str,
+                                              strlen(key->c_str), seed);
+    default:
+        return (unsigned long)fast_mix(key->ul ^ seed ^ FAST_P0, FAST_P1);
+    }
+}
+
+int hash_set_random_seed(hash_table_t *table)
+{
+    unsigned long seed = 0;
+    struct timespec ts;
+    int fd;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (table->entry_count != 0) return EINVAL;
+
+    fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+    if (fd != -1) {
+        if (read(fd, &seed, sizeof(seed)) != sizeof(seed)) seed = 0;
+        close(fd);
+    }
+    if (seed == 0) {
+        /* Less random but still differs between tables and runs */
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        seed = (unsigned long)fast_mix((uint64_t)ts.tv_nsec ^ (uintptr_t)table,
+                                       (uint64_t)ts.tv_sec ^ FAST_P1);
+    }
+
+    table->seed = seed;
+    return hash_set_key_func(table, hash_fast_key, &table->seed);
+}
+
+int hash_set_pool(hash_table_t *table)
+{
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    /* Entries already in the table were not allocated from the pool */
+    if (table->entry_count != 0) return EINVAL;
+
+    table->pooled = true;
+    return HASH_SUCCESS;
+}
+
+int hash_set_thread_safe(hash_table_t *table)
+{
+    struct hash_stripe *stripes;
+    unsigned long i;
+    int error;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (table->thread_safe) return HASH_SUCCESS;
+
+    stripes = (struct hash_stripe *)halloc(table, HASH_STRIPES * sizeof(struct hash_stripe));
+    if (stripes == NULL) {
+        return HASH_ERROR_NO_MEMORY;
+    }
+    memset(stripes, 0, HASH_STRIPES * sizeof(struct hash_stripe));
+
+    error = pthread_rwlock_init(&table->resize_lock, NULL);
+    for (i = 0; i < HASH_STRIPES && error == 0; i++) {
+        error = pthread_rwlock_init(&stripes[i].lock, NULL);
+    }
+    if (error) {
+        if (i > 0) {
+            for (i--; i > 0; i--) pthread_rwlock_destroy(&stripes[i - 1].lock);
+            pthread_rwlock_destroy(&table->resize_lock);
+        }
+        hfree(table, stripes);
+        return error;
+    }
+
+    table->stripes = stripes;
+    table->thread_safe = true;
+    return HASH_SUCCESS;
+}
+
 #ifdef HASH_STATISTICS
 int hash_get_statistics(hash_table_t *table, hash_statistics_t *statistics)
 {
+    unsigned long i;
+
     if (!table) return HASH_ERROR_BAD_TABLE;
     if (!statistics) return EINVAL;
 
+    table_lock(table, false);
     *statistics = table->statistics;
+    if (table->thread_safe) {
+        for (i = 0; i < HASH_STRIPES; i++) {
+            statistics->hash_accesses +=
+                __atomic_load_n(&table->stripes[i].statistics.hash_accesses, __ATOMIC_RELAXED);
+            statistics->hash_collisions +=
+                __atomic_load_n(&table->stripes[i].statistics.hash_collisions, __ATOMIC_RELAXED);
+        }
+    }
+    table_unlock(table);
 
     return HASH_SUCCESS;
 }
 #endif
 
+/* Release all chunks of the pool at once */
+static void destroy_pool(hash_table_t *table)
+{
+    struct hash_slab *slab;
+
+    while ((slab = table->slabs) != NULL) {
+        table->slabs = slab->next;
+        hfree(table, slab);
+    }
+}
+
+static void destroy_locks(hash_table_t *table)
+{
+    unsigned long i;
+
+    if (!table->thread_safe) return;
+
+    for (i = 0; i < HASH_STRIPES; i++) {
+        pthread_rwlock_destroy(&table->stripes[i].lock);
+    }
+    pthread_rwlock_destroy(&table->resize_lock);
+    hfree(table, table->stripes);
+}
+
 int hash_destroy(hash_table_t *table)
 {
     unsigned long i, j;
@@ -668,6 +1535,23 @@ int hash_destroy(hash_table_t *table)
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
+    if (table->open_addressing) {
+        if (table->control && table->slots) {
+            for (i = 0; i < table->slot_count; i++) {
+                if (CTRL_IS_FULL(table->control[i])) {
+                    hdelete_callback(table, HASH_TABLE_DESTROY, &table->slots[i]);
+                    free_key(table, &table->pool, &table->slots[i].key);
+                }
+            }
+        }
+        hfree(table, table->control);
+        hfree(table, table->slots);
+        destroy_pool(table);
+        destroy_locks(table);
+        hfree(table, table);
+        return HASH_SUCCESS;
+    }
+
     if (table != NULL) {
         if (table->directory) {
             for (i = 0; i < table->segment_count; i++) {
@@ -678,13 +1562,8 @@ int hash_destroy(hash_table_t *table)
                         while (p != NULL) {
                             q = p->next;
                             hdelete_callback(table, HASH_TABLE_DESTROY, &p->entry);
-                            if (p->entry.key.type == HASH_KEY_STRING
-                                    || p->entry.key.type == HASH_KEY_CONST_STRING) {
-                                /* Internally we do not use constant memory for keys
-                                 * in hash table elements. */
-                                hfree(table, p->entry.key.str);
-                            }
-                            hfree(table, (char *)p);
+                            free_key(table, &table->pool, &p->entry.key);
+                            pool_free(table, &table->pool, p, sizeof(element_t));
                             p = q;
                         }
                     }
@@ -693,19 +1572,28 @@ int hash_destroy(hash_table_t *table)
             }
             hfree(table, table->directory);
         }
+        destroy_pool(table);
+        destroy_locks(table);
         hfree(table, table);
         table = NULL;
     }
     return HASH_SUCCESS;
 }
 
-int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data)
+static int iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data)
 {
     unsigned long i, j;
     segment_t *s;
     element_t *p;
 
-    if (!table) return HASH_ERROR_BAD_TABLE;
+    if (table->open_addressing) {
+        for (i = 0; i < table->slot_count; i++) {
+            if (CTRL_IS_FULL(table->control[i])) {
+                if(!(*callback)(&table->slots[i], user_data)) return HASH_SUCCESS;
+            }
+        }
+        return HASH_SUCCESS;
+    }
 
     if (table != NULL) {
         for (i = 0; i < table->segment_count; i++) {
@@ -724,6 +1612,20 @@ int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user
     return HASH_SUCCESS;
 }
 
+int hash_iterate(hash_table_t *table, hash_iterate_callback callback, void *user_data)
+{
+    int error;
+
+    if (!table) return HASH_ERROR_BAD_TABLE;
+
+    /* Nothing changes the thread safe table during the iteration */
+    table_lock(table, true);
+    error = iterate(table, callback, user_data);
+    table_unlock(table);
+
+    return error;
+}
+
 static hash_entry_t *hash_iter_next(struct hash_iter_context_t *iter_arg)
 {
     struct _hash_iter_context_t *iter = (struct _hash_iter_context_t *) iter_arg;
@@ -732,6 +1634,16 @@ static hash_entry_t *hash_iter_next(struct hash_iter_context_t *iter_arg)
 
     if (iter->table == NULL) return NULL;
 
+    if (iter->table->open_addressing) {
+        while (iter->i < iter->table->slot_count) {
+            if (CTRL_IS_FULL(iter->table->control[iter->i])) {
+                return &iter->table->slots[iter->i++];
+            }
+            iter->i++;
+        }
+        return NULL;
+    }
+
     while (state != HI_STATE_0) {
 
         switch (state) {
@@ -800,15 +1712,20 @@ struct hash_iter_context_t *new_hash_iter_context(hash_table_t *table)
     iter->table = table;
     iter->i = 0;
     iter->j = 0;
-    iter->s = table->directory[iter->i];
-    iter->p = iter->s[iter->j];
+    if (table->open_addressing) {
+        iter->s = NULL;
+        iter->p = NULL;
+    } else {
+        iter->s = table->directory[iter->i];
+        iter->p = iter->s[iter->j];
+    }
 
     return (struct hash_iter_context_t *)iter;
 }
 
 unsigned long hash_count(hash_table_t *table)
 {
-    return table->entry_count;
+    return __atomic_load_n(&table->entry_count, __ATOMIC_RELAXED);
 }
 
 
@@ -820,10 +1737,13 @@ int hash_keys(hash_table_t *table, unsigned long *count_arg, hash_key_t **keys_a
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
+    /* Entries can not be added before they are copied */
+    table_lock(table, true);
     count = table->entry_count;
     if (count == 0) {
         *count_arg = 0;
         *keys_arg = NULL;
+        table_unlock(table);
         return HASH_SUCCESS;
     }
 
@@ -831,13 +1751,15 @@ int hash_keys(hash_table_t *table, unsigned long *count_arg, hash_key_t **keys_a
     if (keys == NULL) {
         *count_arg = -1;
         *keys_arg = NULL;
+        table_unlock(table);
         return HASH_ERROR_NO_MEMORY;
     }
 
     data.index = 0;
     data.keys = keys;
 
-    hash_iterate(table, hash_keys_callback, &data);
+    iterate(table, hash_keys_callback, &data);
+    table_unlock(table);
 
     *count_arg = count;
     *keys_arg = keys;
@@ -852,10 +1774,13 @@ int hash_values(hash_table_t *table, unsigned long *count_arg, hash_value_t **va
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
+    /* Entries can not be added before they are copied */
+    table_lock(table, true);
     count = table->entry_count;
     if (count == 0) {
         *count_arg = 0;
         *values_arg = NULL;
+        table_unlock(table);
         return HASH_SUCCESS;
     }
 
@@ -863,13 +1788,15 @@ int hash_values(hash_table_t *table, unsigned long *count_arg, hash_value_t **va
     if (values == NULL) {
         *count_arg = -1;
         *values_arg = NULL;
+        table_unlock(table);
         return HASH_ERROR_NO_MEMORY;
     }
 
     data.index = 0;
     data.values = values;
 
-    hash_iterate(table, hash_values_callback, &data);
+    iterate(table, hash_values_callback, &data);
+    table_unlock(table);
 
     *count_arg = count;
     *values_arg = values;
@@ -897,10 +1824,13 @@ int hash_entries(hash_table_t *table, unsigned long *count_arg, hash_entry_t **e
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
+    /* Entries can not be added before they are copied */
+    table_lock(table, true);
     count = table->entry_count;
     if (count == 0) {
         *count_arg = 0;
         *entries_arg = NULL;
+        table_unlock(table);
         return HASH_SUCCESS;
     }
 
@@ -908,13 +1838,15 @@ int hash_entries(hash_table_t *table, unsigned long *count_arg, hash_entry_t **e
     if (entries == NULL) {
         *count_arg = -1;
         *entries_arg = NULL;
+        table_unlock(table);
         return HASH_ERROR_NO_MEMORY;
     }
 
     data.index = 0;
     data.entries = entries;
 
-    hash_iterate(table, hash_entries_callback, &data);
+    iterate(table, hash_entries_callback, &data);
+    table_unlock(table);
 
     *count_arg = count;
     *entries_arg = entries;
@@ -934,32 +1866,20 @@ bool hash_has_key(hash_table_t *table, hash_key_t *key)
 
 int hash_get_default(hash_table_t *table, hash_key_t *key, hash_value_t *value, hash_value_t *default_value)
 {
-    int error;
-
     if (!table) return HASH_ERROR_BAD_TABLE;
 
-    error = hash_lookup(table, key, value);
-    if (error == HASH_ERROR_KEY_NOT_FOUND) {
+    if (!is_valid_key_type(key->type))
+        return HASH_ERROR_BAD_KEY_TYPE;
 
-        error = hash_enter(table, key, default_value);
-        if (error != HASH_SUCCESS) {
-            return error;
-        }
-        *value = *default_value;
-        return HASH_SUCCESS;
-    } else {
-        if (error != HASH_SUCCESS) return error;
-    }
+    if (!is_valid_value_type(default_value->type))
+        return HASH_ERROR_BAD_VALUE_TYPE;
 
-    return HASH_SUCCESS;
+    /* Lookup and enter under one lock so that the default is entered once */
+    return enter(table, key, default_value, value);
 }
 
 int hash_enter(hash_table_t *table, hash_key_t *key, hash_value_t *value)
 {
-    int error;
-    segment_t element, *chain;
-    size_t len;
-
     if (!table) return HASH_ERROR_BAD_TABLE;
 
     if (!is_valid_key_type(key->type))
@@ -968,102 +1888,48 @@ int hash_enter(hash_table_t *table, hash_key_t *key, hash_value_t *value)
     if (!is_valid_value_type(value->type))
         return HASH_ERROR_BAD_VALUE_TYPE;
 
-    lookup(table, key, &element, &chain);
-
-    if (element == NULL) {                    /* not found */
-        element = (element_t *)halloc(table, sizeof(element_t));
-        if (element == NULL) {
-            /* Allocation failed, return NULL */
-            return HASH_ERROR_NO_MEMORY;
-        }
-        memset(element, 0, sizeof(element_t));
-        /*
-         * Initialize new element
-         */
-        switch(element->entry.key.type = key->type) {
-        case HASH_KEY_ULONG:
-            element->entry.key.ul = key->ul;
-            break;
-        case HASH_KEY_STRING:
-        case HASH_KEY_CONST_STRING:
-            len = strlen(key->c_str) + 1;
-            element->entry.key.str = halloc(table, len);
-            if (element->entry.key.str == NULL) {
-                hfree(table, element);
-                return HASH_ERROR_NO_MEMORY;
-            }
-            memcpy(element->entry.key.str, key->str, len);
-            break;
-        }
-
-        *chain = element;             /* link into chain */
-        element->next = NULL;
-
-        /*
-         * Table over-full?
-         */
-        if (++table->entry_count / table->bucket_count > table->max_load_factor) {
-            if ((error = expand_table(table)) != HASH_SUCCESS) { /* doesn't affect element */
-                return error;
-            }
-        }
-
-    } else {
-        hdelete_callback(table, HASH_ENTRY_DESTROY, &element->entry);
-    }
-
-    switch(element->entry.value.type = value->type) {
-    case HASH_VALUE_UNDEF:
-        element->entry.value.ul = 0;
-        break;
-    case HASH_VALUE_PTR:
-        element->entry.value.ptr = value->ptr;
-        break;
-    case HASH_VALUE_INT:
-        element->entry.value.i = value->i;
-        break;
-    case HASH_VALUE_UINT:
-        element->entry.value.ui = value->ui;
-        break;
-    case HASH_VALUE_LONG:
-        element->entry.value.l = value->l;
-        break;
-    case HASH_VALUE_ULONG:
-        element->entry.value.ul = value->ul;
-        break;
-    case HASH_VALUE_FLOAT:
-        element->entry.value.f = value->f;
-        break;
-    case HASH_VALUE_DOUBLE:
-        element->entry.value.d = value->d;
-        break;
-    }
-
-    return HASH_SUCCESS;
+    return enter(table, key, value, NULL);
 }
 
 int hash_lookup(hash_table_t *table, hash_key_t *key, hash_value_t *value)
 {
+    address_t h;
+    struct hash_stripe *stripe;
     segment_t element, *chain;
+    unsigned long slot;
+    bool found;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
 
     if (!is_valid_key_type(key->type))
         return HASH_ERROR_BAD_KEY_TYPE;
 
-    lookup(table, key, &element, &chain);
-
-    if (element) {
-        *value = element->entry.value;
-        return HASH_SUCCESS;
+    if (table->open_addressing) {
+        h = open_hash(table, key);
+        table_lock(table, false);
+        found = open_lookup(table, key, h, &slot);
+        if (found) *value = table->slots[slot].value;
+        table_unlock(table);
     } else {
-        return HASH_ERROR_KEY_NOT_FOUND;
+        h = hash(table, key);
+        table_lock(table, false);
+        stripe = stripe_lock(table, h, false);
+        lookup(table, key, h, &element, &chain);
+        found = (element != NULL);
+        if (found) *value = element->entry.value;
+        stripe_unlock(stripe);
+        table_unlock(table);
     }
+
+    return found ? HASH_SUCCESS : HASH_ERROR_KEY_NOT_FOUND;
 }
 
 int hash_delete(hash_table_t *table, hash_key_t *key)
 {
-    int error;
+    int error = HASH_SUCCESS;
+    bool contract = false;
+    address_t h;
+    struct hash_stripe *stripe;
     segment_t element, *chain;
 
     if (!table) return HASH_ERROR_BAD_TABLE;
@@ -1071,28 +1937,38 @@ int hash_delete(hash_table_t *table, hash_key_t *key)
     if (!is_valid_key_type(key->type))
         return HASH_ERROR_BAD_KEY_TYPE;
 
-    lookup(table, key, &element, &chain);
+    if (table->open_addressing) {
+        table_lock(table, true);
+        error = open_delete(table, key);
+        table_unlock(table);
+        return error;
+    }
+
+    h = hash(table, key);
+    table_lock(table, false);
+    stripe = stripe_lock(table, h, true);
+    lookup(table, key, h, &element, &chain);
 
     if (element) {
         hdelete_callback(table, HASH_ENTRY_DESTROY, &element->entry);
         *chain = element->next; /* remove from chain */
+        free_key(table, pool_of(table, stripe), &element->entry.key);
+        pool_free(table, pool_of(table, stripe), element, sizeof(element_t));
         /*
          * Table too sparse?
          */
-        if (--table->entry_count / table->bucket_count < table->min_load_factor) {
-            if ((error = contract_table(table)) != HASH_SUCCESS) { /* doesn't affect element */
-                return error;
-            }
-        }
-        if (element->entry.key.type == HASH_KEY_STRING
-                || element->entry.key.type == HASH_KEY_CONST_STRING) {
-            hfree(table, element->entry.key.str);
-        }
-        hfree(table, element);
-        return HASH_SUCCESS;
+        contract = count_add(table, -1UL) / table->bucket_count < table->min_load_factor;
     } else {
-        return HASH_ERROR_KEY_NOT_FOUND;
+        error = HASH_ERROR_KEY_NOT_FOUND;
+    }
+
+    stripe_unlock(stripe);
+    table_unlock(table);
+
+    if (contract) {
+        error = resize_table(table, false);
     }
+    return error;
 }
 
 
@@ -92,6 +92,11 @@ terms of this license.
 #define HASH_DEFAULT_MIN_LOAD_FACTOR 1
 #define HASH_DEFAULT_MAX_LOAD_FACTOR 5
 
+/* Pass as directory_bits to hash_create_ex() to get an open addressing table */
+#define HASH_OPEN_ADDRESSING (~0U)
+#define HASH_OPEN_DEFAULT_MIN_LOAD_FACTOR 25
+#define HASH_OPEN_DEFAULT_MAX_LOAD_FACTOR 87
+
 #define HASH_ERROR_BASE -2000
 #define HASH_ERROR_LIMIT (HASH_ERROR_BASE+20)
 #define IS_HASH_ERROR(error)  (((error) >= HASH_ERROR_BASE) && ((error) < HASH_ERROR_LIMIT))
@@ -187,6 +192,9 @@ struct hash_iter_context_t {
 typedef void *(hash_alloc_func)(size_t size, void *pvt);
 typedef void (hash_free_func)(void *ptr, void *pvt);
 
+/* typedef for hash_set_key_func() */
+typedef unsigned long (hash_key_func)(hash_key_t *key, void *pvt);
+
 /*****************************************************************************/
 /*************************  External Global Variables  ***********************/
 /*****************************************************************************/
@@ -272,6 +280,15 @@ int hash_create(unsigned long count, hash_table_t **tbl,
  *
  * Note directory_bits + segment_bits must be <= number of bits in
  * unsigned long
+ *
+ * If directory_bits is HASH_OPEN_ADDRESSING the table does not chain the
+ * entries off the buckets. The entries are stored directly in an array of
+ * slots and the slots are probed in groups using a byte of the hash kept
+ * for each slot. segment_bits is ignored and the load factors are given in
+ * percent of the occupied slots: the table doubles when it gets fuller than
+ * max_load_factor (less than 100, default 87) and halves when it gets
+ * emptier than min_load_factor (less than half of max_load_factor,
+ * default 25). The table never gets smaller than it was created.
  */
 int hash_create_ex(unsigned long count, hash_table_t **tbl,
                    unsigned int directory_bits,
@@ -284,6 +301,61 @@ int hash_create_ex(unsigned long count, hash_table_t **tbl,
                    hash_delete_callback *delete_callback,
                    void *delete_private_data);
 
+/*
+ * Replace the function which hashes the keys of the table. Keys which are
+ * equal must have the same hash, for string keys the hash must depend on the
+ * characters of the string only. The function can be changed only while the
+ * table is empty, otherwise EINVAL is returned.
+ *
+ * key_func
+ *     Function which returns the hash of the key. If key_func is NULL the
+ *     default hash is restored.
+ * key_private_data
+ *     Data pointer passed to key_func.
+ */
+int hash_set_key_func(hash_table_t *table, hash_key_func *key_func,
+                      void *key_private_data);
+
+/*
+ * Fast hash of the key which processes strings a word at a time. It can be
+ * given to hash_set_key_func(). pvt is NULL or points to an unsigned long
+ * seed which changes the hash of every key.
+ */
+unsigned long hash_fast_key(hash_key_t *key, void *pvt);
+
+/*
+ * Hash the keys of the empty table with hash_fast_key() seeded with a random
+ * seed kept in the table. The hashes of the keys can not be guessed so the
+ * entries can not be forced into the same bucket on purpose.
+ */
+int hash_set_random_seed(hash_table_t *table);
+
+/*
+ * Allocate the entries and the copies of string keys of the empty table from
+ * a pool, otherwise EINVAL is returned. The pool takes memory from the alloc
+ * function of the table in slabs and keeps the entries that are deleted for
+ * the next insertions. The memory is given back only by hash_destroy(), which
+ * frees the slabs at once instead of every entry.
+ */
+int hash_set_pool(hash_table_t *table);
+
+/*
+ * Make the table safe to use from several threads at once. It must be
+ * called before the table is shared. The alloc, free, delete and key
+ * functions of the table must be thread safe then.
+ *
+ * Lookups and changes of entries in different buckets of the linear hashing
+ * table run in parallel, the buckets are locked by stripes. Expanding and
+ * contracting the table locks out all other operations. Lookups of the open
+ * addressing table run in parallel, its changes lock out other operations.
+ *
+ * hash_iterate(), hash_keys(), hash_values() and hash_entries() lock out all
+ * other operations while they run, the callback of hash_iterate() must not
+ * call functions of the table. The iterator object of new_hash_iter_context()
+ * is not protected, the table must not be changed while it is used.
+ */
+int hash_set_thread_safe(hash_table_t *table);
+
 #ifdef HASH_STATISTICS
 /*
  * Return statistics for the table.
@@ -0,0 +1,453 @@
+/*
+    Copyright (C) 2026 ding-libs contributors
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU Lesser General Public License as published by
+    the Free Software Foundation; either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmark of the hash table engines.
+ *
+ * The open addressing table is created with a fixed number of slots and
+ * filled to the load factor. The linear hashing table with its default
+ * parameters gets the same number of entries. Both run with the default
+ * hash of the keys and with hash_fast_key() seeded by hash_set_random_seed(),
+ * the runs marked "+pool" allocate the entries with hash_set_pool().
+ * Every measurement is printed as one line:
+ *
+ *     <engine>/<hash>[+pool] <key type> <operation> <load factor> <entries> <ns per operation>
+ *
+ * The "churn" operation deletes an entry and enters it again.
+ *
+ * The "collisions" operation reports the collisions per lookup of the hits
+ * instead of the time; for the linear table it is the average number of
+ * chain entries walked before the key is found.
+ *
+ * The multi-threaded part runs lookups mixed with 10% of enters and deletes
+ * of unsigned long keys from several threads on a table locked with one
+ * mutex and on the thread safe table. It prints the wall time per operation
+ * with the number of threads in place of the load factor:
+ *
+ *     <engine>/<mutex|striped> ulong threaded <threads> <entries> <ns per operation>
+ *
+ * Lines that start with '#' are comments.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include "dhash.h"
+
+/* Length of the generated string keys */
+#define BENCH_KEY_LEN       24
+#define BENCH_KEY_MAX       4096
+
+/* Load factor that keeps the open table from growing */
+#define BENCH_OPEN_MAX_LOAD 95
+
+/* Entries and operations of every thread of the multi-threaded part */
+#define BENCH_MT_ENTRIES    65536
+#define BENCH_MT_OPS        1000000
+
+enum bench_op {
+    BENCH_INSERT,
+    BENCH_LOOKUP_HIT,
+    BENCH_LOOKUP_MISS,
+    BENCH_ITERATE,
+    BENCH_CHURN,
+    BENCH_DELETE,
+    BENCH_OP_COUNT
+};
+
+static const char *bench_op_names[BENCH_OP_COUNT] = {
+    "insert",
+    "lookup_hit",
+    "lookup_miss",
+    "iterate",
+    "churn",
+    "delete"
+};
+
+int verbose = 0;
+
+/* Size of the buffer of one string key */
+static size_t key_size = BENCH_KEY_LEN;
+
+/* Time in nanoseconds */
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+/* Key number i; keys of the misses follow the keys of the entries */
+static void bench_key(hash_key_t *key, hash_key_enum type,
+                      char *strings, unsigned long i)
+{
+    key->type = type;
+    if (type == HASH_KEY_ULONG) {
+        /* Scatter the keys so they do not come in order */
+        key->ul = i * 2654435761UL;
+    } else {
+        key->str = strings + i * key_size;
+    }
+}
+
+static bool bench_counter(hash_entry_t *item, void *user_data)
+{
+    (*(unsigned long *)user_data)++;
+    return true;
+}
+
+static int bench_table(const char *engine, bool fast, bool pool, hash_key_enum type,
+                       unsigned long slots, unsigned long entries,
+                       double load, char *strings)
+{
+    hash_table_t *table = NULL;
+    hash_key_t key;
+    hash_value_t value;
+    hash_statistics_t before, after;
+    unsigned long visited = 0;
+    unsigned long i;
+    double ns[BENCH_OP_COUNT];
+    double start;
+    int error;
+
+    if (strcmp(engine, "open") == 0) {
+        error = hash_create_ex(slots * BENCH_OPEN_MAX_LOAD / 100, &table,
+                               HASH_OPEN_ADDRESSING, 0,
+                               1, BENCH_OPEN_MAX_LOAD,
+                               NULL, NULL, NULL, NULL, NULL);
+    } else {
+        error = hash_create(slots, &table, NULL, NULL);
+    }
+    if (error == HASH_SUCCESS && fast) {
+        error = hash_set_random_seed(table);
+    }
+    if (error == HASH_SUCCESS && pool) {
+        error = hash_set_pool(table);
+    }
+    if (error != HASH_SUCCESS) {
+        printf("Failed to create table. Error %d\n", error);
+        hash_destroy(table);
+        return error;
+    }
+
+    value.type = HASH_VALUE_ULONG;
+    start = bench_now();
+    for (i = 0; i < entries && error == HASH_SUCCESS; i++) {
+        bench_key(&key, type, strings, i);
+        value.ul = i;
+        error = hash_enter(table, &key, &value);
+    }
+    ns[BENCH_INSERT] = bench_now() - start;
+
+    hash_get_statistics(table, &before);
+    start = bench_now();
+    for (i = 0; i < entries && error == HASH_SUCCESS; i++) {
+        bench_key(&key, type, strings, (i * 7919) % entries);
+        error = hash_lookup(table, &key, &value);
+    }
+    ns[BENCH_LOOKUP_HIT] = bench_now() - start;
+    hash_get_statistics(table, &after);
+
+    start = bench_now();
+    for (i = 0; i < entries && error == HASH_SUCCESS; i++) {
+        bench_key(&key, type, strings, entries + i);
+        if (hash_lookup(table, &key, &value) != HASH_ERROR_KEY_NOT_FOUND) {
+            error = EEXIST;
+        }
+    }
+    ns[BENCH_LOOKUP_MISS] = bench_now() - start;
+
+    start = bench_now();
+    if (error == HASH_SUCCESS) {
+        hash_iterate(table, bench_counter, &visited);
+        if (visited != entries) error = EFAULT;
+    }
+    ns[BENCH_ITERATE] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < entries && error == HASH_SUCCESS; i++) {
+        bench_key(&key, type, strings, (i * 7919) % entries);
+        error = hash_delete(table, &key);
+        if (error == HASH_SUCCESS) {
+            value.ul = i;
+            error = hash_enter(table, &key, &value);
+        }
+    }
+    ns[BENCH_CHURN] = bench_now() - start;
+
+    start = bench_now();
+    for (i = 0; i < entries && error == HASH_SUCCESS; i++) {
+        bench_key(&key, type, strings, i);
+        error = hash_delete(table, &key);
+    }
+    ns[BENCH_DELETE] = bench_now() - start;
+
+    hash_destroy(table);
+    if (error != HASH_SUCCESS) {
+        printf("Operation on %s table failed. Error %d\n", engine, error);
+        return error;
+    }
+
+    for (i = 0; i < BENCH_OP_COUNT; i++) {
+        printf("%s/%s%s %s %s %.2f %lu %.1f\n", engine, fast ? "fast" : "default",
+               pool ? "+pool" : "", type == HASH_KEY_ULONG ? "ulong" : "string",
+               bench_op_names[i], load, entries, ns[i] / (double)entries);
+    }
+    printf("%s/%s%s %s collisions %.2f %lu %.3f\n", engine, fast ? "fast" : "default",
+           pool ? "+pool" : "", type == HASH_KEY_ULONG ? "ulong" : "string", load, entries,
+           (double)(after.hash_collisions - before.hash_collisions) /
+           (double)(after.hash_accesses - before.hash_accesses));
+    fflush(stdout);
+
+    return HASH_SUCCESS;
+}
+
+struct bench_thread {
+    hash_table_t *table;
+    pthread_mutex_t *mutex;
+    unsigned long id;
+    int error;
+};
+
+/* Run the operation on the table, under the mutex if there is one */
+static int bench_mt_op(struct bench_thread *data, int op, hash_key_t *key)
+{
+    hash_value_t value;
+    int error;
+
+    if (data->mutex) pthread_mutex_lock(data->mutex);
+    switch (op) {
+    case BENCH_INSERT:
+        value.type = HASH_VALUE_ULONG;
+        value.ul = key->ul;
+        error = hash_enter(data->table, key, &value);
+        break;
+    case BENCH_DELETE:
+        error = hash_delete(data->table, key);
+        break;
+    default:
+        error = hash_lookup(data->table, key, &value);
+        break;
+    }
+    if (data->mutex) pthread_mutex_unlock(data->mutex);
+
+    return error;
+}
+
+static void *bench_mt_worker(void *arg)
+{
+    struct bench_thread *data = (struct bench_thread *)arg;
+    hash_key_t key;
+    unsigned long i;
+    unsigned long r = data->id * 2654435761UL + 1;
+    int error = HASH_SUCCESS;
+
+    key.type = HASH_KEY_ULONG;
+    for (i = 0; i < BENCH_MT_OPS && error == HASH_SUCCESS; i++) {
+        r = r * 6364136223846793005UL + 1442695040888963407UL;
+        if (i % 10 == 9) {
+            /* Keys of the thread that are not in the table */
+            key.ul = BENCH_MT_ENTRIES * (data->id + 1) + (i & 1023);
+            error = bench_mt_op(data, BENCH_INSERT, &key);
+            if (error == HASH_SUCCESS)
+                error = bench_mt_op(data, BENCH_DELETE, &key);
+        } else {
+            key.ul = (r >> 33) % BENCH_MT_ENTRIES;
+            error = bench_mt_op(data, BENCH_LOOKUP_HIT, &key);
+        }
+    }
+
+    data->error = error;
+    return NULL;
+}
+
+static int bench_threads(const char *engine, bool striped, unsigned long threads)
+{
+    hash_table_t *table = NULL;
+    pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+    struct bench_thread *data;
+    pthread_t *ids;
+    hash_key_t key;
+    hash_value_t value;
+    unsigned long i;
+    double start;
+    int error;
+
+    if (strcmp(engine, "open") == 0) {
+        error = hash_create_ex(BENCH_MT_ENTRIES * 2, &table,
+                               HASH_OPEN_ADDRESSING, 0, 0, 0,
+                               NULL, NULL, NULL, NULL, NULL);
+    } else {
+        error = hash_create(BENCH_MT_ENTRIES, &table, NULL, NULL);
+    }
+    if (error == HASH_SUCCESS && striped) {
+        error = hash_set_thread_safe(table);
+    }
+    key.type = HASH_KEY_ULONG;
+    value.type = HASH_VALUE_ULONG;
+    for (i = 0; i < BENCH_MT_ENTRIES && error == HASH_SUCCESS; i++) {
+        key.ul = value.ul = i;
+        error = hash_enter(table, &key, &value);
+    }
+
+    data = calloc(threads, sizeof(struct bench_thread));
+    ids = calloc(threads, sizeof(pthread_t));
+    if (data == NULL || ids == NULL) error = ENOMEM;
+
+    start = bench_now();
+    for (i = 0; i < threads && error == HASH_SUCCESS; i++) {
+        data[i].table = table;
+        data[i].mutex = striped ? NULL : &mutex;
+        data[i].id = i;
+        error = pthread_create(&ids[i], NULL, bench_mt_worker, &data[i]);
+        if (error) threads = i;
+    }
+    for (i = 0; data && ids && i < threads; i++) {
+        pthread_join(ids[i], NULL);
+        if (data[i].error != HASH_SUCCESS) error = data[i].error;
+    }
+
+    if (error == HASH_SUCCESS) {
+        printf("%s/%s ulong threaded %lu %d %.1f\n", engine,
+               striped ? "striped" : "mutex", threads, BENCH_MT_ENTRIES,
+               (bench_now() - start) / (double)(threads * BENCH_MT_OPS));
+        fflush(stdout);
+    } else {
+        printf("Threaded run on %s table failed. Error %d\n", engine, error);
+    }
+
+    free(data);
+    free(ids);
+    hash_destroy(table);
+    return error;
+}
+
+static void bench_usage(const char *name)
+{
+    printf("Usage: %s [-v] [-n slots] [-k key_length] [-t max_threads]\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long slots = 1UL << 20;
+    unsigned long max_threads = 8;
+    unsigned long threads;
+    unsigned long entries;
+    unsigned long i;
+    unsigned int percent;
+    unsigned int run;
+    size_t len;
+    char *strings;
+    int opt;
+    int error = HASH_SUCCESS;
+    static const struct {
+        const char *engine;
+        bool fast;
+        bool pool;
+        hash_key_enum type;
+    } runs[] = {
+        { "linear", false, false, HASH_KEY_ULONG },
+        { "linear", true, false, HASH_KEY_ULONG },
+        { "linear", false, true, HASH_KEY_ULONG },
+        { "open", false, false, HASH_KEY_ULONG },
+        { "open", true, false, HASH_KEY_ULONG },
+        { "open", false, true, HASH_KEY_ULONG },
+        { "linear", false, false, HASH_KEY_STRING },
+        { "linear", true, false, HASH_KEY_STRING },
+        { "linear", false, true, HASH_KEY_STRING },
+        { "open", false, false, HASH_KEY_STRING },
+        { "open", true, false, HASH_KEY_STRING },
+        { "open", false, true, HASH_KEY_STRING },
+    };
+
+    while ((opt = getopt(argc, argv, "vn:k:t:h")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = 1;
+            break;
+        case 'n':
+            slots = strtoul(optarg, NULL, 0);
+            break;
+        case 't':
+            max_threads = strtoul(optarg, NULL, 0);
+            break;
+        case 'k':
+            key_size = strtoul(optarg, NULL, 0) + 1;
+            if (key_size < BENCH_KEY_LEN || key_size > BENCH_KEY_MAX) {
+                printf("Key length must be between %d and %d\n",
+                       BENCH_KEY_LEN - 1, BENCH_KEY_MAX - 1);
+                return EINVAL;
+            }
+            break;
+        default:
+            bench_usage(argv[0]);
+            return EINVAL;
+        }
+    }
+
+    /* The open table has a power of 2 slots */
+    for (i = 16; i < slots; i <<= 1);
+    slots = i;
+
+    /* Keys of the entries and of the misses.
+     * Long keys share a common prefix like paths or DNs do.
+     */
+    strings = malloc(2 * slots * key_size);
+    if (strings == NULL) {
+        printf("Failed to allocate keys.\n");
+        return ENOMEM;
+    }
+    for (i = 0; i < 2 * slots; i++) {
+        len = key_size - BENCH_KEY_LEN;
+        memset(strings + i * key_size, 'x', len);
+        snprintf(strings + i * key_size + len, BENCH_KEY_LEN, "key%lu", i);
+    }
+
+    printf("# engine key operation load entries ns_per_operation\n");
+
+    for (percent = 50; percent <= 90 && error == HASH_SUCCESS; percent += 10) {
+        entries = slots * percent / 100;
+        if (verbose) printf("# %lu slots, %lu entries\n", slots, entries);
+        for (run = 0; run < sizeof(runs) / sizeof(runs[0]) &&
+                      error == HASH_SUCCESS; run++) {
+            error = bench_table(runs[run].engine, runs[run].fast,
+                                runs[run].pool, runs[run].type, slots, entries,
+                                percent / 100.0, strings);
+        }
+    }
+
+    free(strings);
+
+    for (threads = 1; threads <= max_threads && error == HASH_SUCCESS; threads <<= 1) {
+        for (run = 0; run < 4 && error == HASH_SUCCESS; run++) {
+            error = bench_threads(run < 2 ? "linear" : "open", run & 1, threads);
+        }
+    }
+
+    if (error != HASH_SUCCESS) {
+        printf("Failed!\n");
+        return error;
+    }
+
+    return 0;
+}
@@ -23,6 +23,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <pthread.h>
 #include <check.h>
 
 /* #define TRACE_LEVEL 7 */
@@ -199,6 +200,375 @@ START_TEST(test_key_ulong)
 }
 END_TEST
 
+static void count_deleted(hash_entry_t *item, hash_destroy_enum type,
+                          void *pvt)
+{
+    (*(unsigned long *)pvt)++;
+}
+
+static bool count_entries(hash_entry_t *item, void *user_data)
+{
+    (*(unsigned long *)user_data)++;
+    return true;
+}
+
+START_TEST(test_open_addressing)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i;
+    unsigned long deleted = 0;
+    unsigned long iterated = 0;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    char str[32];
+    struct hash_iter_context_t *iter;
+    hash_statistics_t stats;
+
+    /* Load factors of the open table are percents */
+    ret = hash_create_ex(0, &htable, HASH_OPEN_ADDRESSING, 0, 0, 100,
+                         NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == EINVAL);
+    ret = hash_create_ex(0, &htable, HASH_OPEN_ADDRESSING, 0, 50, 90,
+                         NULL, NULL, NULL, NULL, NULL);
+    fail_unless(ret == EINVAL);
+
+    ret = hash_create_ex(0, &htable, HASH_OPEN_ADDRESSING, 0, 0, 0,
+                         NULL, NULL, NULL, count_deleted, &deleted);
+    fail_unless(ret == 0);
+
+    /* Even numbers are strings, odd numbers are unsigned longs */
+    for (i = 0; i < 2 * HTABLE_SIZE * 10; i++) {
+        if (i & 1) {
+            key.type = HASH_KEY_ULONG;
+            key.ul = i;
+        } else {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "%lu", i);
+            key.str = str;
+        }
+        enter_val.type = HASH_VALUE_ULONG;
+        enter_val.ul = i;
+        ret = hash_enter(htable, &key, &enter_val);
+        fail_unless(ret == 0);
+    }
+    fail_unless(hash_count(htable) == 2 * HTABLE_SIZE * 10);
+
+    /* String "1" and unsigned long 1 are different keys */
+    key.type = HASH_KEY_CONST_STRING;
+    key.c_str = "1";
+    ret = hash_lookup(htable, &key, &ret_val);
+    fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+
+    for (i = 0; i < 2 * HTABLE_SIZE * 10; i++) {
+        key.type = HASH_KEY_ULONG;
+        key.ul = i;
+        if ((i & 1) == 0) {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "%lu", i);
+            key.str = str;
+        }
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        fail_unless(ret_val.ul == i);
+    }
+
+    ret = hash_iterate(htable, count_entries, &iterated);
+    fail_unless(ret == 0);
+    fail_unless(iterated == 2 * HTABLE_SIZE * 10);
+
+    /* Remove all unsigned long keys */
+    for (i = 1; i < 2 * HTABLE_SIZE * 10; i += 2) {
+        key.type = HASH_KEY_ULONG;
+        key.ul = i;
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == 0);
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+    }
+    fail_unless(deleted == HTABLE_SIZE * 10);
+    fail_unless(hash_count(htable) == HTABLE_SIZE * 10);
+
+    iterated = 0;
+    iter = new_hash_iter_context(htable);
+    fail_unless(iter != NULL);
+    while (iter->next(iter) != NULL) iterated++;
+    free(iter);
+    fail_unless(iterated == HTABLE_SIZE * 10);
+
+    ret = hash_get_statistics(htable, &stats);
+    fail_unless(ret == 0);
+    fail_unless(stats.table_expansions > 0);
+
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+    fail_unless(deleted == 2 * HTABLE_SIZE * 10);
+}
+END_TEST
+
+static unsigned long count_hashes(hash_key_t *key, void *pvt)
+{
+    (*(unsigned long *)pvt)++;
+    return hash_fast_key(key, NULL);
+}
+
+START_TEST(test_key_func)
+{
+    hash_table_t *htable;
+    int ret;
+    unsigned long i;
+    unsigned long hashed = 0;
+    unsigned long seed = 1;
+    hash_value_t ret_val;
+    hash_value_t enter_val;
+    hash_key_t key;
+    hash_key_t same;
+    char str[64];
+
+    /* Seed changes the hash, equal strings hash the same */
+    key.type = HASH_KEY_CONST_STRING;
+    key.c_str = "some key that is longer than sixteen bytes";
+    same.type = HASH_KEY_CONST_STRING;
+    snprintf(str, sizeof(str), "%s", "some key that is longer than sixteen bytes");
+    same.c_str = str;
+    fail_unless(hash_fast_key(&key, NULL) == hash_fast_key(&same, NULL));
+    fail_unless(hash_fast_key(&key, NULL) != hash_fast_key(&key, &seed));
+
+    ret = hash_create(HTABLE_SIZE, &htable, NULL, NULL);
+    fail_unless(ret == 0);
+    ret = hash_set_key_func(htable, count_hashes, &hashed);
+    fail_unless(ret == 0);
+
+    enter_val.type = HASH_VALUE_ULONG;
+    enter_val.ul = 1;
+    ret = hash_enter(htable, &key, &enter_val);
+    fail_unless(ret == 0);
+    fail_unless(hashed == 1);
+    ret = hash_lookup(htable, &same, &ret_val);
+    fail_unless(ret == 0);
+    fail_unless(ret_val.ul == 1);
+    fail_unless(hashed == 2);
+
+    /* The hash can not change under the entries */
+    ret = hash_set_key_func(htable, NULL, NULL);
+    fail_unless(ret == EINVAL);
+    ret = hash_set_random_seed(htable);
+    fail_unless(ret == EINVAL);
+
+    ret = hash_destroy(htable);
+    fail_unless(ret == 0);
+
+    /* Random seed on both engines */
+    for (i = 0; i < 2; i++) {
+        ret = hash_create_ex(0, &htable, i ? HASH_OPEN_ADDRESSING : 0, 0, 0, 0,
+                             NULL, NULL, NULL, NULL, NULL);
+        fail_unless(ret == 0);
+        ret = hash_set_random_seed(htable);
+        fail_unless(ret == 0);
+
+        for (enter_val.ul = 0; enter_val.ul < HTABLE_SIZE * 10; enter_val.ul++) {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "key%lu", enter_val.ul);
+            key.str = str;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+            key.type = HASH_KEY_ULONG;
+            key.ul = enter_val.ul;
+            ret = hash_enter(htable, &key, &enter_val);
+            fail_unless(ret == 0);
+        }
+        fail_unless(hash_count(htable) == 2 * HTABLE_SIZE * 10);
+
+        key.type = HASH_KEY_STRING;
+        snprintf(str, sizeof(str), "key77");
+        key.str = str;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        fail_unless(ret_val.ul == 77);
+        key.type = HASH_KEY_ULONG;
+        key.ul = 77;
+        ret = hash_delete(htable, &key);
+        fail_unless(ret == 0);
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == HASH_ERROR_KEY_NOT_FOUND);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+#define THREADS 4
+
+struct thread_data {
+    hash_table_t *htable;
+    unsigned long first;
+    unsigned long errors;
+};
+
+/* Every thread enters its own keys, looks them up and deletes half */
+static void *thread_worker(void *arg)
+{
+    struct thread_data *data = (struct thread_data *)arg;
+    hash_key_t key;
+    hash_value_t value;
+    hash_value_t ret_val;
+    unsigned long i;
+    char str[32];
+
+    for (i = data->first; i < data->first + HTABLE_SIZE * 10; i++) {
+        key.type = HASH_KEY_STRING;
+        snprintf(str, sizeof(str), "key%lu", i);
+        key.str = str;
+        value.type = HASH_VALUE_ULONG;
+        value.ul = i;
+        if (hash_enter(data->htable, &key, &value) != 0) data->errors++;
+    }
+    for (i = data->first; i < data->first + HTABLE_SIZE * 10; i++) {
+        key.type = HASH_KEY_STRING;
+        snprintf(str, sizeof(str), "key%lu", i);
+        key.str = str;
+        if (hash_lookup(data->htable, &key, &ret_val) != 0 ||
+            ret_val.ul != i) {
+            data->errors++;
+        }
+        if ((i & 1) && hash_delete(data->htable, &key) != 0) data->errors++;
+    }
+
+    return NULL;
+}
+
+START_TEST(test_thread_safe)
+{
+    hash_table_t *htable;
+    pthread_t threads[THREADS];
+    struct thread_data data[THREADS];
+    hash_key_t key;
+    hash_value_t ret_val;
+    unsigned long i, t;
+    char str[32];
+    int ret;
+
+    /* Both engines, with and without the pool */
+    for (t = 0; t < 4; t++) {
+        ret = hash_create_ex(0, &htable, (t & 1) ? HASH_OPEN_ADDRESSING : 0, 0, 0, 0,
+                             NULL, NULL, NULL, NULL, NULL);
+        fail_unless(ret == 0);
+        ret = hash_set_thread_safe(htable);
+        fail_unless(ret == 0);
+        if (t & 2) {
+            ret = hash_set_pool(htable);
+            fail_unless(ret == 0);
+        }
+
+        for (i = 0; i < THREADS; i++) {
+            data[i].htable = htable;
+            data[i].first = i * HTABLE_SIZE * 10;
+            data[i].errors = 0;
+            ret = pthread_create(&threads[i], NULL, thread_worker, &data[i]);
+            fail_unless(ret == 0);
+        }
+        for (i = 0; i < THREADS; i++) {
+            pthread_join(threads[i], NULL);
+            fail_unless(data[i].errors == 0);
+        }
+
+        fail_unless(hash_count(htable) == THREADS * HTABLE_SIZE * 5);
+        for (i = 0; i < THREADS * HTABLE_SIZE * 10; i++) {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "key%lu", i);
+            key.str = str;
+            ret = hash_lookup(htable, &key, &ret_val);
+            fail_unless(ret == ((i & 1) ? HASH_ERROR_KEY_NOT_FOUND : 0));
+        }
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+    }
+}
+END_TEST
+
+struct alloc_count {
+    unsigned long allocs;
+    unsigned long frees;
+};
+
+static void *count_alloc(size_t size, void *pvt)
+{
+    ((struct alloc_count *)pvt)->allocs++;
+    return malloc(size);
+}
+
+static void count_free(void *ptr, void *pvt)
+{
+    ((struct alloc_count *)pvt)->frees++;
+    free(ptr);
+}
+
+START_TEST(test_pool)
+{
+    hash_table_t *htable;
+    struct alloc_count count;
+    unsigned long allocs;
+    unsigned long i, t;
+    hash_key_t key;
+    hash_value_t value;
+    hash_value_t ret_val;
+    char str[32];
+    int ret;
+
+    for (t = 0; t < 2; t++) {
+        count.allocs = 0;
+        count.frees = 0;
+        ret = hash_create_ex(HTABLE_SIZE * 10, &htable, t ? HASH_OPEN_ADDRESSING : 0,
+                             0, 0, 0, count_alloc, count_free, &count, NULL, NULL);
+        fail_unless(ret == 0);
+        ret = hash_set_pool(htable);
+        fail_unless(ret == 0);
+
+        value.type = HASH_VALUE_ULONG;
+        for (i = 0; i < HTABLE_SIZE * 10; i++) {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "key%lu", i);
+            key.str = str;
+            value.ul = i;
+            ret = hash_enter(htable, &key, &value);
+            fail_unless(ret == 0);
+        }
+
+        /* Pool can not take over the entries */
+        ret = hash_set_pool(htable);
+        fail_unless(ret == EINVAL);
+
+        /* Deleted entries and keys are reused */
+        allocs = count.allocs;
+        for (i = 0; i < HTABLE_SIZE * 100; i++) {
+            key.type = HASH_KEY_STRING;
+            snprintf(str, sizeof(str), "key%lu", i % (HTABLE_SIZE * 10));
+            key.str = str;
+            ret = hash_delete(htable, &key);
+            fail_unless(ret == 0);
+            value.ul = i;
+            ret = hash_enter(htable, &key, &value);
+            fail_unless(ret == 0);
+        }
+        fail_unless(count.allocs == allocs);
+
+        key.type = HASH_KEY_STRING;
+        snprintf(str, sizeof(str), "key%d", 7);
+        key.str = str;
+        ret = hash_lookup(htable, &key, &ret_val);
+        fail_unless(ret == 0);
+        fail_unless(ret_val.ul % (HTABLE_SIZE * 10) == 7);
+
+        ret = hash_destroy(htable);
+        fail_unless(ret == 0);
+        fail_unless(count.allocs == count.frees);
+    }
+}
+END_TEST
+
 static Suite *dhash_suite(void)
 {
     Suite *s = suite_create("");
@@ -207,6 +577,10 @@ static Suite *dhash_suite(void)
     tcase_add_test(tc_basic, test_key_const_string);
     tcase_add_test(tc_basic, test_key_string);
     tcase_add_test(tc_basic, test_key_ulong);
+    tcase_add_test(tc_basic, test_open_addressing);
+    tcase_add_test(tc_basic, test_key_func);
+    tcase_add_test(tc_basic, test_thread_safe);
+    tcase_add_test(tc_basic, test_pool);
     suite_add_tcase(s, tc_basic);
 
     return s;
@@ -165,6 +165,9 @@ int main(int argc, char **argv)
     unsigned int segment_bits = 0;
     unsigned long min_load_factor = HASH_DEFAULT_MIN_LOAD_FACTOR;
     unsigned long max_load_factor = HASH_DEFAULT_MAX_LOAD_FACTOR;
+    bool fast_hash = false;
+    bool thread_safe = false;
+    bool pool = false;
 
     while (1) {
         int arg;
@@ -179,10 +182,14 @@ int main(int argc, char **argv)
             {"min-load-factor", 1, 0, 'l'},
             {"max-load-factor", 1, 0, 'h'},
             {"seed", 1, 0, 'r'},
+            {"open-addressing", 0, 0, 'o'},
+            {"fast-hash", 0, 0, 'x'},
+            {"thread-safe", 0, 0, 'S'},
+            {"pool", 0, 0, 'P'},
             {0, 0, 0, 0}
         };
 
-        arg = getopt_long(argc, argv, "c:vqt:d:s:l:h:r:",
+        arg = getopt_long(argc, argv, "c:vqt:d:s:l:h:r:oxSP",
                           long_options, &option_index);
         if (arg == -1) break;
 
@@ -214,6 +221,21 @@ int main(int argc, char **argv)
         case 'r':
             seed = strtoul(optarg, NULL, 0);
             break;
+        case 'o':
+            /* Load factors given after this option override the defaults */
+            directory_bits = HASH_OPEN_ADDRESSING;
+            min_load_factor = HASH_OPEN_DEFAULT_MIN_LOAD_FACTOR;
+            max_load_factor = HASH_OPEN_DEFAULT_MAX_LOAD_FACTOR;
+            break;
+        case 'x':
+            fast_hash = true;
+            break;
+        case 'S':
+            thread_safe = true;
+            break;
+        case 'P':
+            pool = true;
+            break;
         }
     }
 
@@ -245,6 +267,19 @@ int main(int argc, char **argv)
         exit(1);
     }
 
+    if (fast_hash && (status = hash_set_random_seed(table)) != HASH_SUCCESS) {
+        fprintf(stderr, "setting the seed failed at line %d (%s)\n", __LINE__, error_string(status));
+        exit(1);
+    }
+    if (thread_safe && (status = hash_set_thread_safe(table)) != HASH_SUCCESS) {
+        fprintf(stderr, "making the table thread safe failed at line %d (%s)\n", __LINE__, error_string(status));
+        exit(1);
+    }
+    if (pool && (status = hash_set_pool(table)) != HASH_SUCCESS) {
+        fprintf(stderr, "setting the pool failed at line %d (%s)\n", __LINE__, error_string(status));
+        exit(1);
+    }
+
     /* Initialize the array of test values */
     for (i = 0; i < max_test; i++) {
         /* Get random value, make sure it's unique */
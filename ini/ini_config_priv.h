@@ -43,6 +43,8 @@ struct ini_cfgobj {
     int section_len;
     int name_len;
     struct collection_iterator *iterator;
+    /* Storage of the iterator of the last search */
+    struct collection_iterator_storage iterator_storage;
     /* Collection of errors detected during parsing */
     struct collection_item *error_list;
     /* Count of error lines */
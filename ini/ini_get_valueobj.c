@@ -164,9 +164,10 @@ int ini_get_config_valueobj(const char *section,
         }
 
         /* Create an iterator */
-        error = col_bind_iterator(&(ini_config->iterator),
-                                  section_handle,
-                                  COL_TRAVERSE_ONELEVEL);
+        error = col_bind_iterator_storage(&(ini_config->iterator),
+                                          &(ini_config->iterator_storage),
+                                          section_handle,
+                                          COL_TRAVERSE_ONELEVEL);
         /* Make sure we free the section we found */
         col_destroy_collection(section_handle);
         /* Check error */
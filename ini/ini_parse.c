@@ -53,7 +53,7 @@ struct parser_obj {
     /* Wrapping boundary */
     uint32_t boundary;
     /* Action queue */
-    struct collection_item *queue;
+    struct col_value_queue *queue;
     /* Last error */
     uint32_t last_error;
     /* Last line number */
@@ -82,8 +82,6 @@ struct parser_obj {
 
 typedef int (*action_fn)(struct parser_obj *);
 
-#define PARSE_ACTION       "action"
-
 /* Actions */
 #define PARSE_READ      0 /* Read from the file */
 #define PARSE_INSPECT   1 /* Process read string */
@@ -167,7 +165,7 @@ static void parser_destroy(struct parser_obj *po)
     TRACE_FLOW_ENTRY();
 
     if(po) {
-        col_destroy_queue(po->queue);
+        col_destroy_value_queue(po->queue);
         col_destroy_collection_with_cb(po->sec, ini_cleanup_cb, NULL);
         ini_comment_destroy(po->ic);
         value_destroy_arrays(po->raw_lines,
@@ -181,6 +179,12 @@ static void parser_destroy(struct parser_obj *po)
     TRACE_FLOW_EXIT();
 }
 
+/* Schedule the next action of the parser */
+static int parser_schedule(struct parser_obj *po, uint32_t action)
+{
+    return col_enqueue_value(po->queue, &action);
+}
+
 /* Create parse object
  *
  * It assumes that the ini collection
@@ -270,16 +274,14 @@ static int parser_create(struct ini_cfgobj *co,
     }
 
     /* Create a queue */
-    error = col_create_queue(&(new_po->queue));
+    error = col_create_value_queue(&(new_po->queue), sizeof(uint32_t));
     if (error) {
         TRACE_ERROR_NUMBER("Failed to create queue", error);
         parser_destroy(new_po);
         return error;
     }
 
-    error = col_enqueue_unsigned_property(new_po->queue,
-                                          PARSE_ACTION,
-                                          PARSE_READ);
+    error = parser_schedule(new_po, PARSE_READ);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to create queue", error);
         parser_destroy(new_po);
@@ -358,9 +360,7 @@ static int parser_read(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1412,9 +1412,7 @@ static int parser_inspect(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1472,9 +1470,7 @@ static int parser_post(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          PARSE_DONE);
+    error = parser_schedule(po, PARSE_DONE);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1598,9 +1594,7 @@ static int parser_error(struct parser_obj *po)
     }
 
     /* Move to the next action */
-    error = col_enqueue_unsigned_property(po->queue,
-                                          PARSE_ACTION,
-                                          action);
+    error = parser_schedule(po, action);
     if (error) {
         TRACE_ERROR_NUMBER("Failed to schedule an action", error);
         return error;
@@ -1615,7 +1609,6 @@ static int parser_error(struct parser_obj *po)
 static int parser_run(struct parser_obj *po)
 {
     int error = EOK;
-    struct collection_item *item = NULL;
     uint32_t action = 0;
     action_fn operations[] = { parser_read,
                                parser_inspect,
@@ -1627,17 +1620,13 @@ static int parser_run(struct parser_obj *po)
 
     while(1) {
         /* Get next action */
-        item = NULL;
-        error = col_dequeue_item(po->queue, &item);
+        error = col_dequeue_value(po->queue, &action);
         if (error) {
             TRACE_ERROR_NUMBER("Failed to get action", error);
             return error;
         }
 
-        /* Get action, run operation */
-        action = *((uint32_t *)(col_get_item_data(item)));
-        col_delete_item(item);
-
+        /* Run operation */
         if (action == PARSE_DONE) {
 
             TRACE_INFO_NUMBER("We are done", error);
@@ -11,8 +11,8 @@ m4_define([VERSION_NUMBER], [0.6.1])
 m4_define([PRERELEASE_VERSION_NUMBER], [])
 
 m4_define([PATH_UTILS_VERSION_NUMBER], [0.2.1])
-m4_define([DHASH_VERSION_NUMBER], [0.5.0])
-m4_define([COLLECTION_VERSION_NUMBER], [0.7.0])
+m4_define([DHASH_VERSION_NUMBER], [0.5.1])
+m4_define([COLLECTION_VERSION_NUMBER], [0.7.1])
 m4_define([REF_ARRAY_VERSION_NUMBER], [0.1.5])
 m4_define([BASICOBJECTS_VERSION_NUMBER], [0.1.1])
 m4_define([INI_CONFIG_VERSION_NUMBER], [1.3.1])